@@ -0,0 +1,488 @@
+/*
+  Copyright 2012-2021 Jyri J. Virkki <jyri@virkki.com>
+
+  This file is part of dupd.
+
+  dupd is free software: you can redistribute it and/or modify it
+  under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  dupd is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with dupd.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+// Portable implementation of the BLAKE3 hash function (default 32 byte
+// output, no key or key derivation modes).
+// See https://github.com/BLAKE3-team/BLAKE3-specs
+
+#include <string.h>
+
+#include "blake3.h"
+#include "hashers.h"
+#include "utils.h"
+
+#define CHUNK_START (1 << 0)
+#define CHUNK_END (1 << 1)
+#define PARENT (1 << 2)
+#define ROOT (1 << 3)
+
+// Don't hand less than this much data to a hasher thread
+#define BLAKE3_THREAD_MIN (256 * 1024)
+
+static const uint32_t IV[8] = {
+  0x6A09E667, 0xBB67AE85, 0x3C6EF372, 0xA54FF53A,
+  0x510E527F, 0x9B05688C, 0x1F83D9AB, 0x5BE0CD19
+};
+
+static const uint8_t MSG_SCHEDULE[7][16] = {
+  { 0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15 },
+  { 2, 6, 3, 10, 7, 0, 4, 13, 1, 11, 12, 5, 9, 14, 15, 8 },
+  { 3, 4, 10, 12, 13, 2, 7, 14, 6, 5, 9, 0, 11, 15, 8, 1 },
+  { 10, 7, 12, 9, 14, 3, 13, 15, 4, 0, 11, 2, 5, 8, 1, 6 },
+  { 12, 13, 9, 11, 15, 10, 14, 8, 7, 2, 5, 3, 0, 1, 6, 4 },
+  { 9, 14, 11, 5, 8, 12, 15, 1, 13, 3, 0, 10, 2, 6, 4, 7 },
+  { 11, 15, 5, 0, 1, 9, 8, 6, 14, 10, 2, 12, 3, 4, 7, 13 },
+};
+
+struct subtree_job {
+  struct hasher_job job;
+  const uint8_t * input;
+  size_t len;
+  uint64_t counter;
+  uint32_t * cv;
+};
+
+static void subtree_cv(const uint8_t * input, size_t len, uint64_t counter,
+                       uint32_t * cv);
+
+
+/** ***************************************************************************
+ * Load a little endian 32 bit word.
+ *
+ */
+static inline uint32_t load32(const uint8_t * p)
+{
+  return (uint32_t)p[0] | ((uint32_t)p[1] << 8) |
+    ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+
+/** ***************************************************************************
+ * Store a little endian 32 bit word.
+ *
+ */
+static inline void store32(uint8_t * p, uint32_t w)
+{
+  p[0] = (uint8_t)w;
+  p[1] = (uint8_t)(w >> 8);
+  p[2] = (uint8_t)(w >> 16);
+  p[3] = (uint8_t)(w >> 24);
+}
+
+
+static inline uint32_t rotr32(uint32_t w, int c)
+{
+  return (w >> c) | (w << (32 - c));
+}
+
+
+/** ***************************************************************************
+ * The quarter-round mixing function.
+ *
+ */
+static inline void g(uint32_t * s, int a, int b, int c, int d,
+                     uint32_t x, uint32_t y)
+{
+  s[a] = s[a] + s[b] + x;
+  s[d] = rotr32(s[d] ^ s[a], 16);
+  s[c] = s[c] + s[d];
+  s[b] = rotr32(s[b] ^ s[c], 12);
+  s[a] = s[a] + s[b] + y;
+  s[d] = rotr32(s[d] ^ s[a], 8);
+  s[c] = s[c] + s[d];
+  s[b] = rotr32(s[b] ^ s[c], 7);
+}
+
+
+/** ***************************************************************************
+ * Compress one block into the chaining value cv.
+ *
+ * Parameters:
+ *    cv        - Input chaining value, replaced by the output one.
+ *    block     - The 64 byte block (zero padded if block_len < 64).
+ *    block_len - Number of input bytes in block.
+ *    counter   - Chunk counter (zero for parent nodes).
+ *    flags     - Domain separation flags.
+ *
+ * Return: none
+ *
+ */
+static void compress(uint32_t * cv, const uint8_t * block, uint8_t block_len,
+                     uint64_t counter, uint8_t flags)
+{
+  uint32_t m[16];
+  uint32_t s[16];
+
+  for (int i = 0; i < 16; i++) {
+    m[i] = load32(block + 4 * i);
+  }
+
+  for (int i = 0; i < 8; i++) {
+    s[i] = cv[i];
+  }
+  s[8] = IV[0];
+  s[9] = IV[1];
+  s[10] = IV[2];
+  s[11] = IV[3];
+  s[12] = (uint32_t)counter;
+  s[13] = (uint32_t)(counter >> 32);
+  s[14] = (uint32_t)block_len;
+  s[15] = (uint32_t)flags;
+
+  for (int r = 0; r < 7; r++) {
+    const uint8_t * sc = MSG_SCHEDULE[r];
+    g(s, 0, 4, 8, 12, m[sc[0]], m[sc[1]]);
+    g(s, 1, 5, 9, 13, m[sc[2]], m[sc[3]]);
+    g(s, 2, 6, 10, 14, m[sc[4]], m[sc[5]]);
+    g(s, 3, 7, 11, 15, m[sc[6]], m[sc[7]]);
+    g(s, 0, 5, 10, 15, m[sc[8]], m[sc[9]]);
+    g(s, 1, 6, 11, 12, m[sc[10]], m[sc[11]]);
+    g(s, 2, 7, 8, 13, m[sc[12]], m[sc[13]]);
+    g(s, 3, 4, 9, 14, m[sc[14]], m[sc[15]]);
+  }
+
+  for (int i = 0; i < 8; i++) {
+    cv[i] = s[i] ^ s[i + 8];
+  }
+}
+
+
+/** ***************************************************************************
+ * Compute the chaining value of a parent node.
+ *
+ * Parameters:
+ *    left  - Chaining value of the left child.
+ *    right - Chaining value of the right child.
+ *    flags - Extra flags (ROOT for the root node).
+ *    cv    - Output chaining value (may be the same as left or right).
+ *
+ * Return: none
+ *
+ */
+static void parent_cv(const uint32_t * left, const uint32_t * right,
+                      uint8_t flags, uint32_t * cv)
+{
+  uint8_t block[BLAKE3_BLOCK_LEN];
+
+  for (int i = 0; i < 8; i++) {
+    store32(block + 4 * i, left[i]);
+    store32(block + 32 + 4 * i, right[i]);
+  }
+
+  memcpy(cv, IV, sizeof(IV));
+  compress(cv, block, BLAKE3_BLOCK_LEN, 0, PARENT | flags);
+}
+
+
+/** ***************************************************************************
+ * Reset a chunk state.
+ *
+ */
+static void chunk_init(struct blake3_chunk * chunk, uint64_t counter)
+{
+  memcpy(chunk->cv, IV, sizeof(IV));
+  chunk->counter = counter;
+  memset(chunk->block, 0, BLAKE3_BLOCK_LEN);
+  chunk->block_len = 0;
+  chunk->blocks_compressed = 0;
+}
+
+
+static inline size_t chunk_len(const struct blake3_chunk * chunk)
+{
+  return BLAKE3_BLOCK_LEN * (size_t)chunk->blocks_compressed +
+    chunk->block_len;
+}
+
+
+static inline uint8_t chunk_start_flag(const struct blake3_chunk * chunk)
+{
+  return chunk->blocks_compressed == 0 ? CHUNK_START : 0;
+}
+
+
+/** ***************************************************************************
+ * Add data to a chunk. The last block is kept buffered since it needs
+ * the CHUNK_END flag, which isn't known until the chunk is finalized.
+ *
+ */
+static void chunk_update(struct blake3_chunk * chunk,
+                         const uint8_t * input, size_t len)
+{
+  while (len > 0) {
+    if (chunk->block_len == BLAKE3_BLOCK_LEN) {
+      compress(chunk->cv, chunk->block, BLAKE3_BLOCK_LEN, chunk->counter,
+               chunk_start_flag(chunk));
+      chunk->blocks_compressed++;
+      chunk->block_len = 0;
+      memset(chunk->block, 0, BLAKE3_BLOCK_LEN);
+    }
+
+    size_t take = BLAKE3_BLOCK_LEN - chunk->block_len;
+    if (take > len) { take = len; }
+    memcpy(chunk->block + chunk->block_len, input, take);
+    chunk->block_len += (uint8_t)take;
+    input += take;
+    len -= take;
+  }
+}
+
+
+/** ***************************************************************************
+ * Compute the chaining value (or root hash if flags has ROOT) of the
+ * data in a chunk.
+ *
+ */
+static void chunk_cv(const struct blake3_chunk * chunk, uint8_t flags,
+                     uint32_t * cv)
+{
+  memcpy(cv, chunk->cv, sizeof(chunk->cv));
+  compress(cv, chunk->block, chunk->block_len,
+           (flags & ROOT) ? 0 : chunk->counter,
+           chunk_start_flag(chunk) | CHUNK_END | flags);
+}
+
+
+/** ***************************************************************************
+ * Compute the chaining value of one full chunk.
+ *
+ */
+static void full_chunk_cv(const uint8_t * input, uint64_t counter,
+                          uint32_t * cv)
+{
+  uint8_t flags = CHUNK_START;
+
+  memcpy(cv, IV, sizeof(IV));
+  for (int b = 0; b < BLAKE3_CHUNK_LEN / BLAKE3_BLOCK_LEN; b++) {
+    if (b == BLAKE3_CHUNK_LEN / BLAKE3_BLOCK_LEN - 1) { flags |= CHUNK_END; }
+    compress(cv, input + b * BLAKE3_BLOCK_LEN, BLAKE3_BLOCK_LEN,
+             counter, flags);
+    flags = 0;
+  }
+}
+
+
+/** ***************************************************************************
+ * Hasher job for computing the chaining value of one subtree.
+ *
+ */
+static void subtree_job_run(void * arg)
+{
+  struct subtree_job * sj = (struct subtree_job *)arg;
+  subtree_cv(sj->input, sj->len, sj->counter, sj->cv);
+}
+
+
+/** ***************************************************************************
+ * Compute the chaining values of two sibling subtrees of 'half' bytes
+ * each. If the halves are big enough, the left one is offered to the
+ * hasher threads while this one does the right. If no hasher is free to
+ * take it, this thread does both.
+ *
+ */
+static void subtree_pair(const uint8_t * input, size_t half, uint64_t counter,
+                         uint32_t * left, uint32_t * right)
+{
+  uint64_t right_counter = counter + half / BLAKE3_CHUNK_LEN;
+
+  if (half >= BLAKE3_THREAD_MIN) {
+    struct subtree_job sj;
+    sj.job.run = subtree_job_run;
+    sj.job.arg = &sj;
+    sj.input = input;
+    sj.len = half;
+    sj.counter = counter;
+    sj.cv = left;
+    submit_hasher_job(&sj.job);
+    subtree_cv(input + half, half, right_counter, right);
+    finish_hasher_job(&sj.job);
+  } else {
+    subtree_cv(input, half, counter, left);
+    subtree_cv(input + half, half, right_counter, right);
+  }
+}
+
+
+/** ***************************************************************************
+ * Compute the chaining value of a complete subtree. The length must be
+ * a power of two number of chunks.
+ *
+ */
+static void subtree_cv(const uint8_t * input, size_t len, uint64_t counter,
+                       uint32_t * cv)
+{
+  if (len == BLAKE3_CHUNK_LEN) {
+    full_chunk_cv(input, counter, cv);
+    return;
+  }
+
+  uint32_t left[8];
+  uint32_t right[8];
+  subtree_pair(input, len / 2, counter, left, right);
+  parent_cv(left, right, 0, cv);
+}
+
+
+/** ***************************************************************************
+ * Merge completed subtrees on the stack. After 'chunks' chunks the stack
+ * holds one subtree for each bit set in 'chunks'.
+ *
+ * The merge is done lazily (before pushing the next chaining value) so
+ * that the last merge can be done with the ROOT flag in blake3_final().
+ *
+ */
+static void merge_cv_stack(struct blake3_state * state, uint64_t chunks)
+{
+  size_t post_merge_len = (size_t)__builtin_popcountll(chunks);
+
+  while (state->cv_stack_len > post_merge_len) {
+    uint32_t * left = state->cv_stack[state->cv_stack_len - 2];
+    uint32_t * right = state->cv_stack[state->cv_stack_len - 1];
+    parent_cv(left, right, 0, left);
+    state->cv_stack_len--;
+  }
+}
+
+
+/** ***************************************************************************
+ * Push the chaining value of a subtree starting at chunk 'counter'.
+ *
+ */
+static void push_cv(struct blake3_state * state, const uint32_t * cv,
+                    uint64_t counter)
+{
+  merge_cv_stack(state, counter);
+  memcpy(state->cv_stack[state->cv_stack_len], cv, 8 * sizeof(uint32_t));
+  state->cv_stack_len++;
+}
+
+
+/** ***************************************************************************
+ * Public function, see header file.
+ *
+ */
+void blake3_init(struct blake3_state * state)
+{
+  chunk_init(&state->chunk, 0);
+  state->cv_stack_len = 0;
+}
+
+
+/** ***************************************************************************
+ * Public function, see header file.
+ *
+ */
+void blake3_update(struct blake3_state * state, const uint8_t * input,
+                   size_t len)
+{
+  uint32_t cv[8];
+
+  if (len == 0) {
+    return;
+  }
+
+  // First fill up a partial chunk left over from earlier. If there is
+  // more input after it, it is complete (and not the root) so push it.
+  if (chunk_len(&state->chunk) > 0) {
+    size_t take = BLAKE3_CHUNK_LEN - chunk_len(&state->chunk);
+    if (take > len) { take = len; }
+    chunk_update(&state->chunk, input, take);
+    input += take;
+    len -= take;
+    if (len == 0) {
+      return;
+    }
+    chunk_cv(&state->chunk, 0, cv);
+    push_cv(state, cv, state->chunk.counter);
+    chunk_init(&state->chunk, state->chunk.counter + 1);
+  }
+
+  // Hash the largest subtrees allowed by the alignment of the current
+  // position, as long as there is more input after the first chunk.
+  // A subtree which consumes all the input might be the root, so its
+  // two halves are pushed separately and only merged later.
+  while (len > BLAKE3_CHUNK_LEN) {
+    size_t subtree_len = BLAKE3_CHUNK_LEN;
+    while (subtree_len * 2 <= len) {
+      subtree_len *= 2;
+    }
+    uint64_t count_so_far = state->chunk.counter * BLAKE3_CHUNK_LEN;
+    while (((uint64_t)(subtree_len - 1) & count_so_far) != 0) {
+      subtree_len /= 2;
+    }
+
+    uint64_t subtree_chunks = subtree_len / BLAKE3_CHUNK_LEN;
+    if (subtree_len == BLAKE3_CHUNK_LEN) {
+      full_chunk_cv(input, state->chunk.counter, cv);
+      push_cv(state, cv, state->chunk.counter);
+    } else {
+      uint32_t right[8];
+      subtree_pair(input, subtree_len / 2, state->chunk.counter, cv, right);
+      push_cv(state, cv, state->chunk.counter);
+      push_cv(state, right, state->chunk.counter + subtree_chunks / 2);
+    }
+
+    state->chunk.counter += subtree_chunks;
+    input += subtree_len;
+    len -= subtree_len;
+  }
+
+  // The rest (at most one chunk) stays buffered. Since it follows all the
+  // subtrees on the stack, they can now be merged.
+  if (len > 0) {
+    chunk_update(&state->chunk, input, len);
+    merge_cv_stack(state, state->chunk.counter);
+  }
+}
+
+
+/** ***************************************************************************
+ * Public function, see header file.
+ *
+ */
+void blake3_final(const struct blake3_state * state, uint8_t * output)
+{
+  uint32_t cv[8];
+  int remaining;
+
+  if (state->cv_stack_len == 0) {
+    chunk_cv(&state->chunk, ROOT, cv);
+
+  } else {
+    // Merge the last chunk (or the last two subtrees) and then everything
+    // on the stack into the root, right to left.
+    if (chunk_len(&state->chunk) > 0) {
+      remaining = state->cv_stack_len;
+      chunk_cv(&state->chunk, 0, cv);
+    } else {
+      remaining = state->cv_stack_len - 1;
+      memcpy(cv, state->cv_stack[remaining], sizeof(cv));
+    }
+
+    while (remaining > 0) {
+      remaining--;
+      parent_cv(state->cv_stack[remaining], cv,
+                remaining == 0 ? ROOT : 0, cv);
+    }
+  }
+
+  for (int i = 0; i < 8; i++) {
+    store32(output + 4 * i, cv[i]);
+  }
+}
@@ -0,0 +1,92 @@
+/*
+  Copyright 2012-2021 Jyri J. Virkki <jyri@virkki.com>
+
+  This file is part of dupd.
+
+  dupd is free software: you can redistribute it and/or modify it
+  under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  dupd is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with dupd.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef _DUPD_BLAKE3_H
+#define _DUPD_BLAKE3_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define BLAKE3_OUT_LEN 32
+#define BLAKE3_BLOCK_LEN 64
+#define BLAKE3_CHUNK_LEN 1024
+#define BLAKE3_MAX_DEPTH 54
+
+struct blake3_chunk {
+  uint32_t cv[8];
+  uint64_t counter;
+  uint8_t block[BLAKE3_BLOCK_LEN];
+  uint8_t block_len;
+  uint8_t blocks_compressed;
+};
+
+struct blake3_state {
+  struct blake3_chunk chunk;
+  uint8_t cv_stack_len;
+  uint32_t cv_stack[BLAKE3_MAX_DEPTH + 1][8];
+};
+
+
+/** ***************************************************************************
+ * Reset a BLAKE3 state to hash a new input.
+ *
+ * Parameters:
+ *    state - State to reset.
+ *
+ * Return: none
+ *
+ */
+void blake3_init(struct blake3_state * state);
+
+
+/** ***************************************************************************
+ * Add data to a BLAKE3 state.
+ *
+ * Whole subtrees of the input (1024 byte chunks combined in a binary
+ * tree) are independent of each other, so parts of large updates (of at
+ * least BLAKE3_THREAD_MIN bytes) are offered to idle hasher threads, see
+ * submit_hasher_job().
+ *
+ * Parameters:
+ *    state - State to update.
+ *    input - Read data from here.
+ *    len   - Size of input.
+ *
+ * Return: none
+ *
+ */
+void blake3_update(struct blake3_state * state, const uint8_t * input,
+                   size_t len);
+
+
+/** ***************************************************************************
+ * Store the hash of the data added to the state so far. The state is not
+ * modified so more data can be added afterwards.
+ *
+ * Parameters:
+ *    state  - State to read.
+ *    output - Buffer where output (BLAKE3_OUT_LEN bytes) will be stored.
+ *
+ * Return: none
+ *
+ */
+void blake3_final(const struct blake3_state * state, uint8_t * output);
+
+
+#endif
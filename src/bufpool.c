@@ -0,0 +1,309 @@
+/*
+  Copyright 2021 Jyri J. Virkki <jyri@virkki.com>
+
+  This file is part of dupd.
+
+  dupd is free software: you can redistribute it and/or modify it
+  under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  dupd is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with dupd.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <inttypes.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "bufpool.h"
+#include "main.h"
+#include "stats.h"
+#include "utils.h"
+
+#define POOL_MIN_SHIFT 9
+#define POOL_MAX_SHIFT 24
+#define POOL_CLASSES (POOL_MAX_SHIFT - POOL_MIN_SHIFT + 1)
+#define THREAD_CACHE_MAX 8
+
+// Free buffers are kept in lists linked through their first bytes
+struct free_buffer {
+  struct free_buffer * next;
+};
+
+struct thread_cache {
+  int count[POOL_CLASSES];
+  struct free_buffer * list[POOL_CLASSES];
+};
+
+static struct free_buffer * pool_list[POOL_CLASSES];
+static pthread_mutex_t pool_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_key_t cache_key;
+static pthread_once_t cache_key_once = PTHREAD_ONCE_INIT;
+static uint64_t idle_bytes = 0;
+static uint64_t pool_hits = 0;
+static uint64_t pool_misses = 0;
+
+
+/** ***************************************************************************
+ * Return the size class for a buffer size, or -1 if it is too large to
+ * be pooled.
+ *
+ */
+static int size_class(uint32_t size)
+{
+  int c = 0;
+
+  while ((UINT32_C(1) << (c + POOL_MIN_SHIFT)) < size) {
+    c++;
+    if (c == POOL_CLASSES) {
+      return -1;
+    }
+  }
+
+  return c;
+}
+
+
+/** ***************************************************************************
+ * Move all the buffers in a thread cache to the shared pool.
+ *
+ */
+static void flush_thread_cache(struct thread_cache * tc)
+{
+  d_mutex_lock(&pool_lock, "flush_thread_cache");
+
+  for (int c = 0; c < POOL_CLASSES; c++) {
+    while (tc->list[c] != NULL) {
+      struct free_buffer * b = tc->list[c];
+      tc->list[c] = b->next;
+      b->next = pool_list[c];
+      pool_list[c] = b;
+    }
+    tc->count[c] = 0;
+  }
+
+  d_mutex_unlock(&pool_lock);
+}
+
+
+/** ***************************************************************************
+ * Called at thread exit, give the thread's cached buffers to the others.
+ *
+ */
+static void thread_cache_done(void * arg)
+{
+  struct thread_cache * tc = (struct thread_cache *)arg;
+  flush_thread_cache(tc);
+  free(tc);
+}
+
+
+/** ***************************************************************************
+ * Create the key for the thread caches.
+ *
+ */
+static void create_cache_key()
+{
+  if (pthread_key_create(&cache_key, thread_cache_done)) {   // LCOV_EXCL_START
+    printf("error: unable to create buffer pool thread key\n");
+    exit(1);
+  }                                                          // LCOV_EXCL_STOP
+}
+
+
+/** ***************************************************************************
+ * Return the buffer cache of the current thread.
+ *
+ */
+static struct thread_cache * get_thread_cache()
+{
+  pthread_once(&cache_key_once, create_cache_key);
+
+  struct thread_cache * tc =
+    (struct thread_cache *)pthread_getspecific(cache_key);
+
+  if (tc == NULL) {
+    tc = (struct thread_cache *)calloc(1, sizeof(struct thread_cache));
+    pthread_setspecific(cache_key, tc);
+  }
+
+  return tc;
+}
+
+
+/** ***************************************************************************
+ * Allocate a new buffer.
+ *
+ */
+static char * new_buffer(uint64_t size)
+{
+  char * buffer;
+
+  if (direct_io) {
+    buffer = alloc_aligned(size);
+  } else {
+    buffer = (char *)malloc(size);
+  }
+
+  if (buffer == NULL) {                                      // LCOV_EXCL_START
+    printf("error: unable to allocate read buffer, sorry!\n");
+    exit(1);
+  }                                                          // LCOV_EXCL_STOP
+
+  return buffer;
+}
+
+
+/** ***************************************************************************
+ * Public function, see header file.
+ *
+ */
+uint32_t read_buffer_alloc_size(uint32_t size)
+{
+  int c = size_class(size);
+
+  if (c < 0) {
+    return size;
+  }
+
+  return UINT32_C(1) << (c + POOL_MIN_SHIFT);
+}
+
+
+/** ***************************************************************************
+ * Public function, see header file.
+ *
+ */
+char * get_read_buffer(uint32_t size)
+{
+  int c = size_class(size);
+  struct free_buffer * b = NULL;
+
+  if (c < 0) {
+    return new_buffer(size);
+  }
+
+  uint64_t class_size = UINT64_C(1) << (c + POOL_MIN_SHIFT);
+  struct thread_cache * tc = get_thread_cache();
+
+  if (tc->list[c] == NULL) {
+    // Refill from the shared pool, up to half the cache size
+    d_mutex_lock(&pool_lock, "get_read_buffer");
+    while (pool_list[c] != NULL && tc->count[c] < THREAD_CACHE_MAX / 2) {
+      b = pool_list[c];
+      pool_list[c] = b->next;
+      b->next = tc->list[c];
+      tc->list[c] = b;
+      tc->count[c]++;
+    }
+    d_mutex_unlock(&pool_lock);
+  }
+
+  b = tc->list[c];
+  if (b == NULL) {
+    __atomic_add_fetch(&pool_misses, 1, __ATOMIC_RELAXED);
+    return new_buffer(class_size);
+  }
+
+  tc->list[c] = b->next;
+  tc->count[c]--;
+  __atomic_sub_fetch(&idle_bytes, class_size, __ATOMIC_RELAXED);
+  __atomic_add_fetch(&pool_hits, 1, __ATOMIC_RELAXED);
+
+  return (char *)b;
+}
+
+
+/** ***************************************************************************
+ * Public function, see header file.
+ *
+ */
+void put_read_buffer(char * buffer, uint32_t size)
+{
+  int c = size_class(size);
+
+  if (c < 0) {
+    free(buffer);
+    return;
+  }
+
+  uint64_t class_size = UINT64_C(1) << (c + POOL_MIN_SHIFT);
+
+  // Don't keep more idle buffers than the buffer limit allows for. The
+  // caller has already taken this buffer out of the allocated total.
+  if (stats_read_buffers_allocated + idle_bytes + class_size > buffer_limit) {
+    free(buffer);
+    return;
+  }
+
+  __atomic_add_fetch(&idle_bytes, class_size, __ATOMIC_RELAXED);
+
+  struct thread_cache * tc = get_thread_cache();
+  struct free_buffer * b = (struct free_buffer *)buffer;
+  b->next = tc->list[c];
+  tc->list[c] = b;
+  tc->count[c]++;
+
+  // If this thread frees more than it allocates (e.g. hashers), pass the
+  // extra buffers on to the threads which need them
+  if (tc->count[c] > THREAD_CACHE_MAX) {
+    d_mutex_lock(&pool_lock, "put_read_buffer");
+    while (tc->count[c] > THREAD_CACHE_MAX / 2) {
+      b = tc->list[c];
+      tc->list[c] = b->next;
+      b->next = pool_list[c];
+      pool_list[c] = b;
+      tc->count[c]--;
+    }
+    d_mutex_unlock(&pool_lock);
+  }
+}
+
+
+/** ***************************************************************************
+ * Public function, see header file.
+ *
+ */
+int same_read_buffer_class(uint32_t size1, uint32_t size2)
+{
+  int c = size_class(size1);
+  return c >= 0 && c == size_class(size2);
+}
+
+
+/** ***************************************************************************
+ * Public function, see header file.
+ *
+ */
+void free_read_buffer_pool()
+{
+  pthread_once(&cache_key_once, create_cache_key);
+
+  struct thread_cache * tc =
+    (struct thread_cache *)pthread_getspecific(cache_key);
+  if (tc != NULL) {
+    flush_thread_cache(tc);
+  }
+
+  LOG(L_RESOURCES, "Read buffer pool: %" PRIu64 " reused, %" PRIu64
+      " allocated, %" PRIu64 " idle bytes\n",
+      pool_hits, pool_misses, idle_bytes);
+
+  d_mutex_lock(&pool_lock, "free_read_buffer_pool");
+  for (int c = 0; c < POOL_CLASSES; c++) {
+    while (pool_list[c] != NULL) {
+      struct free_buffer * b = pool_list[c];
+      pool_list[c] = b->next;
+      free(b);
+    }
+  }
+  idle_bytes = 0;
+  d_mutex_unlock(&pool_lock);
+}
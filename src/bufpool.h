@@ -0,0 +1,102 @@
+/*
+  Copyright 2021 Jyri J. Virkki <jyri@virkki.com>
+
+  This file is part of dupd.
+
+  dupd is free software: you can redistribute it and/or modify it
+  under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  dupd is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with dupd.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef _DUPD_BUFPOOL_H
+#define _DUPD_BUFPOOL_H
+
+#include <stdint.h>
+
+
+/** ***************************************************************************
+ * Pool of file data read buffers.
+ *
+ * Read buffers are allocated in power of two size classes from 512 bytes
+ * to 16MB, which covers all the hash round sizes (K512, MB2, MB16). When
+ * a file is done its buffer goes back to the pool and is reused for the
+ * next file instead of being returned to malloc.
+ *
+ * Each thread keeps a few free buffers of each class to itself so most
+ * allocations don't need the pool lock. Idle buffers (in the pool or the
+ * thread caches) plus the read buffers in use never exceed buffer_limit,
+ * beyond that buffers are freed.
+ *
+ */
+
+
+/** ***************************************************************************
+ * Get a read buffer of at least the given size.
+ *
+ * Parameters:
+ *    size - Size needed.
+ *
+ * Return: the buffer (aligned for O_DIRECT when using --direct-io).
+ *
+ */
+char * get_read_buffer(uint32_t size);
+
+
+/** ***************************************************************************
+ * Return how much memory get_read_buffer() uses for a buffer of the given
+ * size, i.e. the size of its size class. This is what counts towards
+ * stats_read_buffers_allocated (and so buffer_limit).
+ *
+ * Parameters:
+ *    size - Size needed.
+ *
+ * Return: bytes allocated for the buffer.
+ *
+ */
+uint32_t read_buffer_alloc_size(uint32_t size);
+
+
+/** ***************************************************************************
+ * Return a read buffer from get_read_buffer() to the pool. The buffer
+ * must already be removed from stats_read_buffers_allocated.
+ *
+ * Parameters:
+ *    buffer - The buffer.
+ *    size   - The size it was requested with.
+ *
+ * Return: none
+ *
+ */
+void put_read_buffer(char * buffer, uint32_t size);
+
+
+/** ***************************************************************************
+ * Returns true if buffers of both sizes come from the same size class,
+ * so a buffer allocated for one can be used for the other.
+ *
+ */
+int same_read_buffer_class(uint32_t size1, uint32_t size2);
+
+
+/** ***************************************************************************
+ * Free all the buffers held in the pool (and in the caller's thread
+ * cache). The other threads using the pool must have exited.
+ *
+ * Parameters: none
+ *
+ * Return: none
+ *
+ */
+void free_read_buffer_pool();
+
+
+#endif
@@ -0,0 +1,638 @@
+/*
+  Copyright 2021 Jyri J. Virkki <jyri@virkki.com>
+
+  This file is part of dupd.
+
+  dupd is free software: you can redistribute it and/or modify it
+  under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  dupd is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with dupd.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <fcntl.h>
+#include <inttypes.h>
+#include <pthread.h>
+#include <sqlite3.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+#include "checkpoint.h"
+#include "dbops.h"
+#include "dirtree.h"
+#include "main.h"
+#include "paths.h"
+#include "sizelist.h"
+#include "stats.h"
+#include "utils.h"
+
+#define CHECKPOINT_MAGIC "DUPDCKP2"
+
+#define CHECKPOINT_PENDING 0
+#define CHECKPOINT_DONE 1
+
+// The checkpoint file is the header, followed by one checkpoint_size
+// record per size group, followed by the strings: the scan start paths
+// and then the paths of each size group (all null-terminated).
+
+struct checkpoint_header {
+  char magic[8];
+  uint32_t hash_function;
+  uint32_t done;
+  uint32_t files_seen;
+  uint32_t files_too_small;
+  uint32_t files_skip_notfile;
+  uint32_t files_skip_error;
+  uint32_t files_skip_badsep;
+  uint32_t files_hl_skip;
+  uint32_t files_in_sizetree;
+  uint32_t start_paths;
+  uint64_t sizes;
+  uint64_t strings_offset;
+  uint64_t strings_size;
+};
+
+struct checkpoint_size {
+  uint64_t size;
+  uint64_t paths_offset;
+  uint32_t paths;
+  uint32_t state;
+};
+
+struct dir_slot {
+  char * path;
+  struct direntry * dir;
+};
+
+static char * map = NULL;
+static size_t map_size = 0;
+static struct checkpoint_header * header = NULL;
+static struct checkpoint_size * records = NULL;
+static struct size_list * * nodes = NULL;
+static uint32_t * newly_done = NULL;
+
+static sqlite3 * checkpoint_dbh = NULL;
+static pthread_t checkpoint_thread;
+static int checkpoint_running = 0;
+static int checkpoint_stopping = 0;
+static int checkpoint_stopped_scan = 0;
+
+static struct dir_slot * dir_map = NULL;
+static uint32_t dir_map_size = 0;
+static uint32_t dir_map_used = 0;
+
+
+/** ***************************************************************************
+ * Path of the checkpoint file, which lives next to the database.
+ *
+ */
+static void get_checkpoint_path(char * buffer)
+{
+  snprintf(buffer, DUPD_PATH_MAX, "%s.checkpoint", db_path);
+}
+
+
+/** ***************************************************************************
+ * Map the checkpoint file.
+ *
+ * Parameters:
+ *    path - Path of the checkpoint file.
+ *
+ * Return: 0 on success, -1 if the file is missing or not valid.
+ *
+ */
+static int map_checkpoint(const char * path)
+{
+  STRUCT_STAT info;
+
+  int fd = open(path, O_RDWR);
+  if (fd < 0) {
+    return -1;
+  }
+
+  if (fstat(fd, &info) || info.st_size < (off_t)sizeof(struct checkpoint_header)) {
+    close(fd);
+    return -1;
+  }
+
+  map_size = (size_t)info.st_size;
+  map = (char *)mmap(NULL, map_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  close(fd);
+  if (map == MAP_FAILED) {                                   // LCOV_EXCL_START
+    map = NULL;
+    return -1;
+  }                                                          // LCOV_EXCL_STOP
+
+  header = (struct checkpoint_header *)map;
+  records = (struct checkpoint_size *)(map + sizeof(struct checkpoint_header));
+
+  if (memcmp(header->magic, CHECKPOINT_MAGIC, 8) ||
+      header->strings_offset + header->strings_size != map_size) {
+    munmap(map, map_size);
+    map = NULL;
+    return -1;
+  }
+
+  newly_done = (uint32_t *)malloc((header->sizes + 1) * sizeof(uint32_t));
+
+  return 0;
+}
+
+
+/** ***************************************************************************
+ * Public function, see checkpoint.h
+ *
+ */
+void checkpoint_save()
+{
+  char path[DUPD_PATH_MAX];
+  char file[DUPD_PATH_MAX];
+  struct checkpoint_header h;
+  struct checkpoint_size * recs;
+  struct size_list * node;
+  uint64_t sizes = 0;
+  uint64_t pos = 0;
+  uint32_t files = 0;
+
+  if (checkpoint_interval == 0) {
+    return;
+  }
+
+  get_checkpoint_path(path);
+
+  for (node = size_list_head; node != NULL; node = node->next) {
+    sizes++;
+  }
+
+  memset(&h, 0, sizeof(struct checkpoint_header));
+  memcpy(h.magic, CHECKPOINT_MAGIC, 8);
+  h.hash_function = hash_function;
+  h.files_seen = s_total_files_seen;
+  h.files_too_small = s_files_too_small;
+  h.files_skip_notfile = s_files_skip_notfile;
+  h.files_skip_error = s_files_skip_error;
+  h.files_skip_badsep = s_files_skip_badsep;
+  h.files_hl_skip = s_files_hl_skip;
+  h.files_in_sizetree = s_files_in_sizetree;
+  h.sizes = sizes;
+  for (int n = 0; start_path[n] != NULL; n++) {
+    h.start_paths++;
+  }
+  h.strings_offset = sizeof(struct checkpoint_header) +
+    sizes * sizeof(struct checkpoint_size);
+
+  FILE * fp = fopen(path, "w");
+  if (fp == NULL) {                                          // LCOV_EXCL_START
+    printf("error: unable to create checkpoint file [%s]\n", path);
+    exit(1);
+  }                                                          // LCOV_EXCL_STOP
+
+  recs = (struct checkpoint_size *)calloc(sizes + 1,
+                                          sizeof(struct checkpoint_size));
+  fseeko(fp, (off_t)h.strings_offset, SEEK_SET);
+
+  for (int n = 0; start_path[n] != NULL; n++) {
+    int len = strlen(start_path[n]) + 1;
+    fwrite(start_path[n], len, 1, fp);
+    pos += len;
+  }
+
+  int i = 0;
+  for (node = size_list_head; node != NULL; node = node->next) {
+    struct path_list_entry * entry = pb_get_first_entry(node->path_list);
+    recs[i].size = node->size;
+    recs[i].paths_offset = pos;
+    recs[i].state = CHECKPOINT_PENDING;
+
+    while (entry != NULL) {
+      if (entry->state == FS_NEED_DATA) {
+        build_path(entry, file);
+        int len = strlen(file) + 1;
+        fwrite(file, len, 1, fp);
+        pos += len;
+        recs[i].paths++;
+        files++;
+      }
+      entry = entry->next;
+    }
+    i++;
+  }
+
+  h.strings_size = pos;
+  fseeko(fp, 0, SEEK_SET);
+  fwrite(&h, sizeof(struct checkpoint_header), 1, fp);
+  fwrite(recs, sizeof(struct checkpoint_size), sizes, fp);
+  free(recs);
+
+  if (fflush(fp) || fsync(fileno(fp)) || ferror(fp)) {       // LCOV_EXCL_START
+    printf("error: unable to write checkpoint file [%s]\n", path);
+    exit(1);
+  }                                                          // LCOV_EXCL_STOP
+  fclose(fp);
+
+  if (map_checkpoint(path)) {                                // LCOV_EXCL_START
+    printf("error: unable to map checkpoint file [%s]\n", path);
+    exit(1);
+  }                                                          // LCOV_EXCL_STOP
+
+  // This run's size list nodes, in the same order as the records.
+  nodes = (struct size_list * *)calloc(sizes + 1, sizeof(struct size_list *));
+  i = 0;
+  for (node = size_list_head; node != NULL; node = node->next) {
+    nodes[i++] = node;
+  }
+
+  LOG(L_PROGRESS, "Saved checkpoint of %" PRIu64 " sizes (%" PRIu32
+      " files) to %s\n", sizes, files, path);
+}
+
+
+/** ***************************************************************************
+ * Hash a directory path for dir_map.
+ *
+ */
+static uint32_t dir_hash(const char * path)
+{
+  uint32_t hash = 2166136261U;
+  while (*path) {
+    hash = (hash ^ (uint8_t)*path++) * 16777619U;
+  }
+  return hash;
+}
+
+
+/** ***************************************************************************
+ * Find (or create) the dir tree entry for a directory path.
+ *
+ * Parameters:
+ *    path - The directory.
+ *
+ * Return: The dir tree entry.
+ *
+ */
+static struct direntry * get_dir(const char * path)
+{
+  char parent[DUPD_PATH_MAX];
+  struct direntry * dir;
+  uint32_t mask;
+  uint32_t n;
+
+  if (dir_map_used * 4 >= dir_map_size * 3) {
+    struct dir_slot * old = dir_map;
+    uint32_t old_size = dir_map_size;
+    dir_map_size = dir_map_size == 0 ? 1024 : dir_map_size * 2;
+    dir_map = (struct dir_slot *)calloc(dir_map_size, sizeof(struct dir_slot));
+    mask = dir_map_size - 1;
+    for (uint32_t i = 0; i < old_size; i++) {
+      if (old[i].path != NULL) {
+        n = dir_hash(old[i].path) & mask;
+        while (dir_map[n].path != NULL) { n = (n + 1) & mask; }
+        dir_map[n] = old[i];
+      }
+    }
+    if (old != NULL) { free(old); }
+  }
+
+  mask = dir_map_size - 1;
+  n = dir_hash(path) & mask;
+  while (dir_map[n].path != NULL) {
+    if (!strcmp(dir_map[n].path, path)) {
+      return dir_map[n].dir;
+    }
+    n = (n + 1) & mask;
+  }
+
+  char * slash = strrchr(path, '/');
+  if (slash == NULL || (slash == path && path[1] == 0)) {
+    dir = new_child_dir((char *)path, NULL);
+  } else {
+    int len = slash - path;
+    if (len == 0) {
+      strlcpy(parent, "/", DUPD_PATH_MAX);
+    } else {
+      memcpy(parent, path, len);
+      parent[len] = 0;
+    }
+    struct direntry * up = get_dir(parent);
+    dir = new_child_dir(slash + 1, up);
+  }
+
+  // The recursion above may have grown the map, find the slot again.
+  mask = dir_map_size - 1;
+  n = dir_hash(path) & mask;
+  while (dir_map[n].path != NULL) { n = (n + 1) & mask; }
+  dir_map[n].path = strdup(path);
+  dir_map[n].dir = dir;
+  dir_map_used++;
+
+  return dir;
+}
+
+
+/** ***************************************************************************
+ * Verify the checkpoint was saved by a scan of the same paths, using the
+ * same hash function, as this one. If no --path was given, continue with
+ * the paths of the checkpoint.
+ *
+ * Parameters:
+ *    path - Path of the checkpoint file.
+ *
+ * Return: none (exits if the checkpoint doesn't match)
+ *
+ */
+static void check_checkpoint_scan(const char * path)
+{
+  char * p = map + header->strings_offset;
+  uint32_t n;
+  int found;
+
+  if (header->hash_function != (uint32_t)hash_function) {
+    printf("error: checkpoint [%s] was saved by a scan using a different "
+           "hash function\n", path);
+    exit(1);
+  }
+
+  if (start_path_default) {
+    free(start_path[0]);
+    for (n = 0; n < header->start_paths; n++) {
+      start_path[n] = strdup(p);
+      p += strlen(p) + 1;
+    }
+    start_path[n] = NULL;
+    return;
+  }
+
+  for (n = 0; start_path[n] != NULL; n++) { }
+  if (n != header->start_paths) {
+    printf("error: checkpoint [%s] was saved by a scan of different paths\n",
+           path);
+    exit(1);
+  }
+
+  for (n = 0; n < header->start_paths; n++) {
+    found = 0;
+    for (int i = 0; start_path[i] != NULL; i++) {
+      if (!strcmp(start_path[i], p)) { found = 1; }
+    }
+    if (!found) {
+      printf("error: checkpoint [%s] was saved by a scan of different paths "
+             "(%s)\n", path, p);
+      exit(1);
+    }
+    p += strlen(p) + 1;
+  }
+}
+
+
+/** ***************************************************************************
+ * Public function, see checkpoint.h
+ *
+ */
+void checkpoint_load(sqlite3 * dbh)
+{
+  char path[DUPD_PATH_MAX];
+  char dirname[DUPD_PATH_MAX];
+  char filename[DUPD_PATH_MAX];
+  STRUCT_STAT info;
+  uint32_t pending = 0;
+
+  get_checkpoint_path(path);
+
+  if (map_checkpoint(path)) {
+    printf("error: no scan checkpoint to resume from [%s]\n", path);
+    exit(1);
+  }
+
+  check_checkpoint_scan(path);
+
+  s_total_files_seen = header->files_seen;
+  s_files_too_small = header->files_too_small;
+  s_files_skip_notfile = header->files_skip_notfile;
+  s_files_skip_error = header->files_skip_error;
+  s_files_skip_badsep = header->files_skip_badsep;
+  s_files_hl_skip = header->files_hl_skip;
+  s_files_in_sizetree = header->files_in_sizetree;
+
+  nodes = (struct size_list * *)calloc(header->sizes + 1,
+                                       sizeof(struct size_list *));
+
+  for (uint64_t i = 0; i < header->sizes; i++) {
+    if (records[i].state == CHECKPOINT_DONE) {
+      continue;
+    }
+
+    uint64_t size = records[i].size;
+    char * p = map + header->strings_offset + records[i].paths_offset;
+    struct path_list_head * head = NULL;
+
+    // Any duplicates of this size which made it to the db after the
+    // last checkpoint will be found again.
+    delete_duplicates_of_size(dbh, size);
+
+    for (uint32_t j = 0; j < records[i].paths; j++) {
+      char * file = p;
+      p += strlen(file) + 1;
+
+      // Skip files which have gone away or changed size since
+      if (get_file_info(file, &info) || !S_ISREG(info.st_mode) ||
+          (uint64_t)info.st_size != size) {
+        LOG(L_INFO, "Changed since checkpoint, skipping [%s]\n", file);
+        continue;
+      }
+
+      char * slash = strrchr(file, '/');
+      int len = slash - file;
+      if (len == 0) {
+        strlcpy(dirname, "/", DUPD_PATH_MAX);
+      } else {
+        memcpy(dirname, file, len);
+        dirname[len] = 0;
+      }
+      strlcpy(filename, slash + 1, DUPD_PATH_MAX);
+
+      struct direntry * dir = get_dir(dirname);
+      if (head == NULL) {
+        head = insert_first_path(filename, dir, size);
+      } else {
+        insert_end_path(filename, dir, info.st_ino, size, head);
+      }
+    }
+
+    if (head != NULL && head->list_size >= 2) {
+      nodes[i] = head->sizelist;
+      pending++;
+    }
+  }
+
+  for (uint32_t i = 0; i < dir_map_size; i++) {
+    if (dir_map[i].path != NULL) { free(dir_map[i].path); }
+  }
+  free(dir_map);
+  dir_map = NULL;
+  dir_map_size = 0;
+  dir_map_used = 0;
+
+  LOG(L_PROGRESS, "Resuming scan, %" PRIu32 " of %" PRIu64
+      " size groups remain\n", pending, header->sizes);
+}
+
+
+/** ***************************************************************************
+ * Record the size groups completed since the previous checkpoint.
+ *
+ * Everything published to the db up to this point is committed first,
+ * then the groups which were already done before the commit are marked
+ * done in the checkpoint file.
+ *
+ */
+static void checkpoint_update()
+{
+  uint32_t count = 0;
+
+  for (uint64_t i = 0; i < header->sizes; i++) {
+    if (records[i].state == CHECKPOINT_PENDING && nodes[i] != NULL &&
+        __atomic_load_n(&nodes[i]->path_list->state,
+                        __ATOMIC_ACQUIRE) == PLS_DONE) {
+      newly_done[count++] = i;
+    }
+  }
+
+  restart_transaction(checkpoint_dbh);
+
+  for (uint32_t i = 0; i < count; i++) {
+    records[newly_done[i]].state = CHECKPOINT_DONE;
+  }
+  header->done += count;
+  msync(map, map_size, MS_SYNC);
+
+  LOG(L_INFO, "Checkpoint: %" PRIu32 " of %" PRIu64 " size groups done\n",
+      header->done, header->sizes);
+}
+
+
+/** ***************************************************************************
+ * Checkpoint thread, saves progress every checkpoint_interval seconds
+ * or when the scan is interrupted. In the latter case it also stops the
+ * size list processing, the scan then exits once its threads are done.
+ *
+ */
+static void * checkpoint_main(void * arg)
+{
+  (void)arg;
+  uint64_t last = get_current_time_millis();
+
+  pthread_setspecific(thread_name, (char *)"      [checkpoint] ");
+  LOG(L_THREADS, "Thread created\n");
+
+  while (!__atomic_load_n(&checkpoint_stopping, __ATOMIC_ACQUIRE)) {
+    usleep(100000);
+
+    if (scan_interrupted) {
+      checkpoint_update();
+      printf("\nScan interrupted, progress saved. "
+             "Continue with 'dupd scan --resume'.\n");
+      checkpoint_stopped_scan = 1;
+      stop_size_list();
+      break;
+    }
+
+    uint64_t now = get_current_time_millis();
+    if (now - last >= (uint64_t)checkpoint_interval * 1000) {
+      checkpoint_update();
+      last = now;
+    }
+  }
+
+  LOG(L_THREADS, "Thread done\n");
+  return NULL;
+}
+
+
+/** ***************************************************************************
+ * Public function, see checkpoint.h
+ *
+ */
+void checkpoint_start(sqlite3 * dbh)
+{
+  if (map == NULL) {
+    return;
+  }
+
+  checkpoint_dbh = dbh;
+  checkpoint_stopping = 0;
+  checkpoint_stopped_scan = 0;
+  d_create(&checkpoint_thread, checkpoint_main, NULL);
+  checkpoint_running = 1;
+}
+
+
+/** ***************************************************************************
+ * Public function, see checkpoint.h
+ *
+ */
+int checkpoint_stop()
+{
+  if (!checkpoint_running) {
+    return 0;
+  }
+
+  __atomic_store_n(&checkpoint_stopping, 1, __ATOMIC_RELEASE);
+  d_join(checkpoint_thread, NULL);
+  checkpoint_running = 0;
+
+  return checkpoint_stopped_scan;
+}
+
+
+/** ***************************************************************************
+ * Public function, see checkpoint.h
+ *
+ */
+void checkpoint_remove()
+{
+  char path[DUPD_PATH_MAX];
+
+  if (map != NULL) {
+    munmap(map, map_size);
+    map = NULL;
+    header = NULL;
+    records = NULL;
+  }
+
+  if (nodes != NULL) {
+    free(nodes);
+    nodes = NULL;
+  }
+
+  if (newly_done != NULL) {
+    free(newly_done);
+    newly_done = NULL;
+  }
+
+  // Once a scan completes any older checkpoint is stale as well.
+  get_checkpoint_path(path);
+  unlink(path);
+}
+
+
+/** ***************************************************************************
+ * Public function, see checkpoint.h
+ *
+ */
+int checkpoint_active()
+{
+  return map != NULL;
+}
@@ -0,0 +1,122 @@
+/*
+  Copyright 2021 Jyri J. Virkki <jyri@virkki.com>
+
+  This file is part of dupd.
+
+  dupd is free software: you can redistribute it and/or modify it
+  under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  dupd is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with dupd.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef _DUPD_CHECKPOINT_H
+#define _DUPD_CHECKPOINT_H
+
+#include <sqlite3.h>
+
+
+/** ***************************************************************************
+ * A scan checkpoint lets an interrupted scan continue (scan --resume)
+ * without walking the filesystem again and without reprocessing the size
+ * groups which were already completed.
+ *
+ * Once the walk is done, the size list (and the paths of each size) is
+ * saved to a checkpoint file next to the database, along with the scan
+ * paths and hash function. Nothing is saved during the walk itself. The file is then
+ * mapped and, periodically during processing, the database transaction
+ * is committed and the size groups completed so far are marked done in
+ * the mapped file. The file is removed when the scan completes.
+ *
+ */
+
+
+/** ***************************************************************************
+ * Save the size list to the checkpoint file. Call once the walk is complete
+ * (and before processing starts). Does nothing unless checkpointing was
+ * requested.
+ *
+ * Parameters: none
+ *
+ * Return: none
+ *
+ */
+void checkpoint_save();
+
+
+/** ***************************************************************************
+ * Rebuild the size list from the checkpoint file, for scan --resume.
+ * The checkpoint must be from a scan of the same paths with the same hash
+ * function (if no --path was given, those of the checkpoint are used).
+ * Only the size groups not yet done are restored. Any duplicates of those
+ * sizes already in the database are removed since they will be found again.
+ *
+ * Parameters:
+ *    dbh - Database handle.
+ *
+ * Return: none (exits on failure)
+ *
+ */
+void checkpoint_load(sqlite3 * dbh);
+
+
+/** ***************************************************************************
+ * Start the checkpoint thread which periodically records progress while
+ * the size list is processed.
+ *
+ * Parameters:
+ *    dbh - Database handle.
+ *
+ * Return: none
+ *
+ */
+void checkpoint_start(sqlite3 * dbh);
+
+
+/** ***************************************************************************
+ * Stop the checkpoint thread.
+ *
+ * If the scan was interrupted, the thread has already saved progress and
+ * stopped the size list processing (see stop_size_list()). The caller
+ * must then exit without committing the database.
+ *
+ * Parameters: none
+ *
+ * Return: 1 if the scan was interrupted, 0 otherwise
+ *
+ */
+int checkpoint_stop();
+
+
+/** ***************************************************************************
+ * Remove the checkpoint file, once the scan has completed and the
+ * database has been committed.
+ *
+ * Parameters: none
+ *
+ * Return: none
+ *
+ */
+void checkpoint_remove();
+
+
+/** ***************************************************************************
+ * Returns true if a checkpoint exists to which an interrupted scan can
+ * be saved.
+ *
+ * Parameters: none
+ *
+ * Return: 1 if active
+ *
+ */
+int checkpoint_active();
+
+
+#endif
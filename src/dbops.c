@@ -38,6 +38,7 @@ static int known_dup_path_list_first = 1;
 static sqlite3_stmt * stmt_is_known_unique = NULL;
 static sqlite3_stmt * stmt_duplicate_to_db = NULL;
 static sqlite3_stmt * stmt_delete_duplicate = NULL;
+static sqlite3_stmt * stmt_delete_duplicates_of_size = NULL;
 static sqlite3_stmt * stmt_unique_to_db = NULL;
 static sqlite3_stmt * stmt_get_known_duplicates = NULL;
 
@@ -330,22 +331,32 @@ void close_database(sqlite3 * dbh)
   // Need to finalize all prepared statements in order to close db cleanly.
   if (stmt_is_known_unique != NULL) {
     sqlite3_finalize(stmt_is_known_unique);
+    stmt_is_known_unique = NULL;
   }
 
   if (stmt_duplicate_to_db != NULL) {
     sqlite3_finalize(stmt_duplicate_to_db);
+    stmt_duplicate_to_db = NULL;
   }
 
   if (stmt_unique_to_db != NULL) {
     sqlite3_finalize(stmt_unique_to_db);
+    stmt_unique_to_db = NULL;
   }
 
   if (stmt_delete_duplicate != NULL) {
     sqlite3_finalize(stmt_delete_duplicate);
+    stmt_delete_duplicate = NULL;
+  }
+
+  if (stmt_delete_duplicates_of_size != NULL) {
+    sqlite3_finalize(stmt_delete_duplicates_of_size);
+    stmt_delete_duplicates_of_size = NULL;
   }
 
   if (stmt_get_known_duplicates != NULL) {
     sqlite3_finalize(stmt_get_known_duplicates);
+    stmt_get_known_duplicates = NULL;
   }
 
   int rv = sqlite3_close(dbh);
@@ -399,6 +410,19 @@ void commit_transaction(sqlite3 * dbh)
 }
 
 
+/** ***************************************************************************
+ * Public function, see header file.
+ *
+ */
+void restart_transaction(sqlite3 * dbh)
+{
+  pthread_mutex_lock(&dbh_lock);
+  commit_transaction(dbh);
+  begin_transaction(dbh);
+  pthread_mutex_unlock(&dbh_lock);
+}
+
+
 /** ***************************************************************************
  * Public function, see header file.
  *
@@ -476,6 +500,32 @@ void delete_duplicate_entry(sqlite3 * dbh, int id)
 }
 
 
+/** ***************************************************************************
+ * Public function, see header file.
+ *
+ */
+void delete_duplicates_of_size(sqlite3 * dbh, uint64_t size)
+{
+  const char * sql = "DELETE FROM duplicates WHERE each_size=?";
+  int rv;
+
+  if (stmt_delete_duplicates_of_size == NULL) {
+    rv = sqlite3_prepare_v2(dbh, sql, -1,
+                            &stmt_delete_duplicates_of_size, NULL);
+    rvchk(rv, SQLITE_OK, "Can't prepare statement: %s\n", dbh);
+  }
+
+  rv = sqlite3_bind_int64(stmt_delete_duplicates_of_size, 1,
+                          (sqlite3_int64)size);
+  rvchk(rv, SQLITE_OK, "Can't bind file size: %s\n", dbh);
+
+  rv = sqlite3_step(stmt_delete_duplicates_of_size);
+  rvchk(rv, SQLITE_DONE, "tried to delete from duplicates table: %s\n", dbh);
+
+  sqlite3_reset(stmt_delete_duplicates_of_size);
+}
+
+
 /** ***************************************************************************
  * Public function, see header file.
  *
@@ -706,9 +756,10 @@ int cache_db_find_entry_id(char * path, uint64_t * file_id, char * hashbuf)
 
   LOG(L_FILES, "Attempting to find hash from cache for %s\n", path);
 
+  // The file may have been removed since it was found, e.g. by watch
   if (get_file_info(path, &info)) {
-    printf("error: unable to stat %s\n", path);
-    exit(1);
+    LOG(L_FILES, "%s: unable to stat, CACHE_FILE_NOT_PRESENT\n", path);
+    return CACHE_FILE_NOT_PRESENT;
   }
 
   timestamp = (uint32_t)info.st_ctime;
@@ -796,8 +847,8 @@ void cache_db_add_entry(char * path, char * hash, int hash_len)
   LOG(L_FILES, "cache_db_add_entry (hash_alg=%d): %s\n", hash_function, path);
 
   if (get_file_info(path, &info)) {
-    printf("error: unable to stat %s\n", path);
-    exit(1);
+    LOG(L_FILES, "%s: unable to stat, not added to cache\n", path);
+    return;
   }
 
   timestamp = (uint32_t)info.st_ctime;
@@ -105,6 +105,19 @@ void begin_transaction(sqlite3 * dbh);
 void commit_transaction(sqlite3 * dbh);
 
 
+/** ***************************************************************************
+ * Commit the current transaction and begin a new one. Safe to call while
+ * other threads are adding duplicates via duplicate_to_db().
+ *
+ * Parameters:
+ *    dbh - Database handle.
+ *
+ * Return: none
+ *
+ */
+void restart_transaction(sqlite3 * dbh);
+
+
 /** ***************************************************************************
  * Checks the return value of sqlite function calls. If the return value
  * rv does not match the expected return code, close db and exit.
@@ -148,6 +161,19 @@ void duplicate_to_db(sqlite3 * dbh, int count, uint64_t size, char * paths);
 void delete_duplicate_entry(sqlite3 * dbh, int id);
 
 
+/** ***************************************************************************
+ * Remove all the duplicate entries of a given file size from the database.
+ *
+ * Parameters:
+ *    dbh  - Database handle.
+ *    size - Size of the files.
+ *
+ * Return: none.
+ *
+ */
+void delete_duplicates_of_size(sqlite3 * dbh, uint64_t size);
+
+
 /** ***************************************************************************
  * Pre-allocate memory used by get_known_duplicates().
  *
@@ -187,7 +213,8 @@ void free_get_known_duplicates();
 /** ***************************************************************************
  * Find the hash of a given path in the hash cache.
  *
- * If the path is not in the db, just returns CACHE_FILE_NOT_PRESENT.
+ * If the path is not in the db, or the file can't be stat'd (e.g. it was
+ * removed), just returns CACHE_FILE_NOT_PRESENT.
  *
  * If the path is present but either the size or timestamp do not
  * match the values in the db (that is, the file has been modified after
@@ -262,6 +289,8 @@ int cache_db_check_entry(char * path);
  * Otherwise, adds the path to the db if not already there and then adds
  * the given hash/hash_alg pair to the db.
  *
+ * If the file can't be stat'd (e.g. it was removed), nothing is added.
+ *
  * Parameters:
  *    path      - Path of the file to add hash.
  *    hash      - The hash to save is here.
@@ -0,0 +1,320 @@
+/*
+  Copyright 2021 Jyri J. Virkki <jyri@virkki.com>
+
+  This file is part of dupd.
+
+  dupd is free software: you can redistribute it and/or modify it
+  under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  dupd is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with dupd.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <pthread.h>
+#include <sqlite3.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "dbops.h"
+#include "dirindex.h"
+#include "main.h"
+#include "stats.h"
+#include "utils.h"
+
+// Each listing entry: type (1), name length (1), inode (8), name
+#define ENTRY_HEADER 10
+
+static sqlite3_stmt * stmt_lookup = NULL;
+static sqlite3_stmt * stmt_touch = NULL;
+static sqlite3_stmt * stmt_store = NULL;
+static int64_t scan_gen = 0;
+static pthread_mutex_t dir_index_lock = PTHREAD_MUTEX_INITIALIZER;
+
+
+/** ***************************************************************************
+ * Prepare a statement on the cache db, exit on failure.
+ *
+ */
+static sqlite3_stmt * prepare(const char * sql)
+{
+  sqlite3_stmt * statement = NULL;
+
+  int rv = sqlite3_prepare_v2(cache_dbh, sql, -1, &statement, NULL);
+  rvchk(rv, SQLITE_OK, "Can't prepare statement: %s\n", cache_dbh);
+
+  return statement;
+}
+
+
+/** ***************************************************************************
+ * Run a statement with no parameters on the cache db.
+ *
+ */
+static void run(const char * sql)
+{
+  sqlite3_stmt * statement = prepare(sql);
+
+  int rv = sqlite3_step(statement);
+  rvchk(rv, SQLITE_DONE, "Can't step: %s\n", cache_dbh);
+
+  sqlite3_finalize(statement);
+}
+
+
+/** ***************************************************************************
+ * Public function, see dirindex.h
+ *
+ */
+void init_dir_index()
+{
+  if (!incremental_scan) {
+    return;
+  }
+
+  run("CREATE TABLE IF NOT EXISTS dir_listings "
+      "(path TEXT PRIMARY KEY, inode INTEGER, mtime INTEGER, ctime INTEGER, "
+      "hidden INTEGER, gen INTEGER, listing BLOB)");
+
+  stmt_lookup = prepare("SELECT inode, mtime, ctime, hidden, listing "
+                        "FROM dir_listings WHERE path=?");
+  stmt_touch = prepare("UPDATE dir_listings SET gen=? WHERE path=?");
+  stmt_store = prepare("INSERT OR REPLACE INTO dir_listings "
+                       "(path, inode, mtime, ctime, hidden, gen, listing) "
+                       "VALUES (?, ?, ?, ?, ?, ?, ?)");
+
+  scan_gen = (int64_t)time(NULL);
+
+  // All the index updates of this scan go in one transaction. This also
+  // covers any cache updates done during the scan phase.
+  begin_transaction(cache_dbh);
+
+  LOG(L_INFO, "Directory index ready, generation %" PRId64 "\n", scan_gen);
+}
+
+
+/** ***************************************************************************
+ * Public function, see dirindex.h
+ *
+ */
+void close_dir_index(char * paths[])
+{
+  sqlite3_stmt * statement;
+  char prefix[DUPD_PATH_MAX + 1];
+  int rv;
+
+  if (!incremental_scan || stmt_lookup == NULL) {
+    return;
+  }
+
+  sqlite3_finalize(stmt_lookup);
+  sqlite3_finalize(stmt_touch);
+  sqlite3_finalize(stmt_store);
+  stmt_lookup = NULL;
+  stmt_touch = NULL;
+  stmt_store = NULL;
+
+  // Directories under the scanned paths which weren't seen this time
+  // have been removed (or are now excluded), forget them.
+
+  statement = prepare("DELETE FROM dir_listings WHERE gen < ? AND "
+                      "(path = ? OR substr(path, 1, ?) = ?)");
+
+  for (int i = 0; paths[i] != NULL; i++) {
+    int len = strlen(paths[i]);
+    if (len == 1 && paths[i][0] == '/') {
+      strlcpy(prefix, "/", DUPD_PATH_MAX);
+    } else {
+      snprintf(prefix, DUPD_PATH_MAX + 1, "%s/", paths[i]);
+      len++;
+    }
+
+    sqlite3_bind_int64(statement, 1, scan_gen);
+    sqlite3_bind_text(statement, 2, paths[i], -1, SQLITE_STATIC);
+    sqlite3_bind_int(statement, 3, len);
+    sqlite3_bind_text(statement, 4, prefix, -1, SQLITE_STATIC);
+    rv = sqlite3_step(statement);
+    rvchk(rv, SQLITE_DONE, "Can't purge dirs: %s\n", cache_dbh);
+    LOG(L_INFO, "Removed %d stale directories under %s from index\n",
+        sqlite3_changes(cache_dbh), paths[i]);
+    sqlite3_reset(statement);
+  }
+
+  sqlite3_finalize(statement);
+  commit_transaction(cache_dbh);
+}
+
+
+/** ***************************************************************************
+ * Public function, see dirindex.h
+ *
+ */
+int dir_index_lookup(const char * path, STRUCT_STAT * info,
+                     struct dir_listing * listing)
+{
+  int valid = 0;
+  int rv;
+
+  d_mutex_lock(&dir_index_lock, "dir_index_lookup");
+
+  sqlite3_bind_text(stmt_lookup, 1, path, -1, SQLITE_STATIC);
+  rv = sqlite3_step(stmt_lookup);
+
+  if (rv == SQLITE_ROW &&
+      (uint64_t)sqlite3_column_int64(stmt_lookup, 0) == info->st_ino &&
+      sqlite3_column_int64(stmt_lookup, 1) == info->st_mtime &&
+      sqlite3_column_int64(stmt_lookup, 2) == info->st_ctime &&
+      sqlite3_column_int(stmt_lookup, 3) >= scan_hidden) {
+
+    uint32_t bytes = sqlite3_column_bytes(stmt_lookup, 4);
+    if (listing->size < bytes) {
+      listing->size = bytes;
+      listing->buf = (char *)realloc(listing->buf, listing->size);
+    }
+    if (bytes > 0) {
+      memcpy(listing->buf, sqlite3_column_blob(stmt_lookup, 4), bytes);
+    }
+    listing->used = bytes;
+    valid = 1;
+  }
+
+  sqlite3_reset(stmt_lookup);
+
+  if (valid) {
+    sqlite3_bind_int64(stmt_touch, 1, scan_gen);
+    sqlite3_bind_text(stmt_touch, 2, path, -1, SQLITE_STATIC);
+    rv = sqlite3_step(stmt_touch);
+    rvchk(rv, SQLITE_DONE, "Can't update dir: %s\n", cache_dbh);
+    sqlite3_reset(stmt_touch);
+    stats_dirs_reused++;
+  }
+
+  d_mutex_unlock(&dir_index_lock);
+
+  LOG(L_FILES, "dir_index_lookup: %s [%s]\n",
+      valid ? "unchanged" : "needs read", path);
+
+  return valid;
+}
+
+
+/** ***************************************************************************
+ * Public function, see dirindex.h
+ *
+ */
+void dir_index_store(const char * path, STRUCT_STAT * info,
+                     struct dir_listing * listing)
+{
+  int rv;
+
+  // If the directory was modified within the last second of the scan
+  // starting, it could change again without the (one second resolution)
+  // timestamps changing. Don't trust it next time, read it again.
+  if (info->st_mtime >= scan_gen - 1 || info->st_ctime >= scan_gen - 1) {
+    LOG(L_FILES, "dir_index_store: too recent, not saved [%s]\n", path);
+    return;
+  }
+
+  d_mutex_lock(&dir_index_lock, "dir_index_store");
+
+  sqlite3_bind_text(stmt_store, 1, path, -1, SQLITE_STATIC);
+  sqlite3_bind_int64(stmt_store, 2, (int64_t)info->st_ino);
+  sqlite3_bind_int64(stmt_store, 3, (int64_t)info->st_mtime);
+  sqlite3_bind_int64(stmt_store, 4, (int64_t)info->st_ctime);
+  sqlite3_bind_int(stmt_store, 5, scan_hidden);
+  sqlite3_bind_int64(stmt_store, 6, scan_gen);
+  sqlite3_bind_blob(stmt_store, 7, listing->buf, listing->used, SQLITE_STATIC);
+  rv = sqlite3_step(stmt_store);
+  rvchk(rv, SQLITE_DONE, "Can't store dir: %s\n", cache_dbh);
+  sqlite3_reset(stmt_store);
+
+  d_mutex_unlock(&dir_index_lock);
+}
+
+
+/** ***************************************************************************
+ * Public function, see dirindex.h
+ *
+ */
+void dir_listing_reset(struct dir_listing * listing)
+{
+  listing->used = 0;
+}
+
+
+/** ***************************************************************************
+ * Public function, see dirindex.h
+ *
+ */
+void dir_listing_add(struct dir_listing * listing, int type, char * name,
+                     ino_t inode)
+{
+  uint8_t len = (uint8_t)strlen(name);
+  uint64_t ino = (uint64_t)inode;
+  uint32_t needed = ENTRY_HEADER + len + 1;
+
+  if (listing->used + needed > listing->size) {
+    listing->size = listing->size == 0 ? K4 : listing->size * 2;
+    if (listing->size < listing->used + needed) {
+      listing->size = listing->used + needed;
+    }
+    listing->buf = (char *)realloc(listing->buf, listing->size);
+  }
+
+  char * p = listing->buf + listing->used;
+  p[0] = (char)type;
+  p[1] = (char)len;
+  memcpy(p + 2, &ino, 8);
+  memcpy(p + ENTRY_HEADER, name, len + 1);
+  listing->used += needed;
+}
+
+
+/** ***************************************************************************
+ * Public function, see dirindex.h
+ *
+ */
+int dir_listing_next(struct dir_listing * listing, uint32_t * pos,
+                     int * type, char ** name, ino_t * inode)
+{
+  uint64_t ino;
+
+  if (*pos + ENTRY_HEADER >= listing->used) {
+    return 0;
+  }
+
+  char * p = listing->buf + *pos;
+  uint8_t len = (uint8_t)p[1];
+
+  *type = (int)p[0];
+  memcpy(&ino, p + 2, 8);
+  *inode = (ino_t)ino;
+  *name = p + ENTRY_HEADER;
+  *pos += ENTRY_HEADER + len + 1;
+
+  return 1;
+}
+
+
+/** ***************************************************************************
+ * Public function, see dirindex.h
+ *
+ */
+void free_dir_listing(struct dir_listing * listing)
+{
+  if (listing->buf != NULL) {
+    free(listing->buf);
+  }
+  listing->buf = NULL;
+  listing->size = 0;
+  listing->used = 0;
+}
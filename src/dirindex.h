@@ -0,0 +1,167 @@
+/*
+  Copyright 2021 Jyri J. Virkki <jyri@virkki.com>
+
+  This file is part of dupd.
+
+  dupd is free software: you can redistribute it and/or modify it
+  under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  dupd is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with dupd.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef _DUPD_DIRINDEX_H
+#define _DUPD_DIRINDEX_H
+
+#include <stdint.h>
+#include <sys/types.h>
+
+#include "utils.h"
+
+
+/** ***************************************************************************
+ * The directory index (used by scan --incremental) keeps, in the hash
+ * cache database, the listing of every directory seen during a scan
+ * along with the inode, mtime and ctime of the directory. On a later
+ * scan, a directory whose inode, mtime and ctime are unchanged doesn't
+ * need to be read again, the stored listing is used instead.
+ *
+ * Only names and types are kept, not file sizes: a file can be appended
+ * to or truncated without changing its directory, so files from a stored
+ * listing are still stat'd.
+ *
+ * A dir_listing is the in-memory form of one directory listing. Each
+ * entry holds the type and inode of the entry followed by its
+ * (null-terminated) name.
+ *
+ */
+struct dir_listing {
+  char * buf;
+  uint32_t size;
+  uint32_t used;
+};
+
+
+/** ***************************************************************************
+ * Initialize the directory index. Does nothing unless incremental_scan.
+ * Must be called after open_cache_database().
+ *
+ * Parameters: none
+ *
+ * Return: none
+ *
+ */
+void init_dir_index();
+
+
+/** ***************************************************************************
+ * Finish using the directory index. Stored directories under the scanned
+ * paths which were not seen in this scan are removed. Must be called
+ * once the scan phase is complete, before any hashes are added to the
+ * cache.
+ *
+ * Parameters:
+ *    paths - The paths scanned (NULL terminated).
+ *
+ * Return: none
+ *
+ */
+void close_dir_index(char * paths[]);
+
+
+/** ***************************************************************************
+ * Look up the stored listing for a directory.
+ *
+ * Parameters:
+ *    path    - Path of the directory.
+ *    info    - Current stat info of the directory.
+ *    listing - If found and still valid, the listing is copied here.
+ *
+ * Return: 1 if listing contains the (unchanged) directory contents,
+ *         0 if the directory needs to be read.
+ *
+ */
+int dir_index_lookup(const char * path, STRUCT_STAT * info,
+                     struct dir_listing * listing);
+
+
+/** ***************************************************************************
+ * Save the listing of a directory which was just read.
+ *
+ * Parameters:
+ *    path    - Path of the directory.
+ *    info    - Stat info of the directory, taken before reading it.
+ *    listing - The directory contents.
+ *
+ * Return: none
+ *
+ */
+void dir_index_store(const char * path, STRUCT_STAT * info,
+                     struct dir_listing * listing);
+
+
+/** ***************************************************************************
+ * Empty a listing (keeping its buffer).
+ *
+ * Parameters:
+ *    listing - The listing.
+ *
+ * Return: none
+ *
+ */
+void dir_listing_reset(struct dir_listing * listing);
+
+
+/** ***************************************************************************
+ * Append an entry to a listing.
+ *
+ * Parameters:
+ *    listing - The listing.
+ *    type    - Type of the entry (opaque to the index).
+ *    name    - Name of the entry.
+ *    inode   - Inode of the entry.
+ *
+ * Return: none
+ *
+ */
+void dir_listing_add(struct dir_listing * listing, int type, char * name,
+                     ino_t inode);
+
+
+/** ***************************************************************************
+ * Iterate over the entries of a listing.
+ *
+ * Parameters:
+ *    listing - The listing.
+ *    pos     - Iterator position, set to zero before the first call.
+ *    type    - Type of the entry.
+ *    name    - Name of the entry (points into the listing).
+ *    inode   - Inode of the entry.
+ *
+ * Return: 1 if an entry was returned, 0 at the end of the listing.
+ *
+ */
+int dir_listing_next(struct dir_listing * listing, uint32_t * pos,
+                     int * type, char ** name, ino_t * inode);
+
+
+/** ***************************************************************************
+ * Free the buffer of a listing.
+ *
+ * Parameters:
+ *    listing - The listing.
+ *
+ * Return: none
+ *
+ */
+void free_dir_listing(struct dir_listing * listing);
+
+
+#endif
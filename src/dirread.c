@@ -0,0 +1,169 @@
+/*
+  Copyright 2021 Jyri J. Virkki <jyri@virkki.com>
+
+  This file is part of dupd.
+
+  dupd is free software: you can redistribute it and/or modify it
+  under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  dupd is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with dupd.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+#ifdef USE_GETDENTS
+#include <sys/syscall.h>
+#endif
+
+#include "dirread.h"
+#include "main.h"
+#include "utils.h"
+
+#ifdef USE_GETDENTS
+
+// Layout of the records returned by the getdents64 syscall.
+struct linux_dirent64 {
+  uint64_t d_ino;
+  int64_t d_off;
+  unsigned short d_reclen;
+  unsigned char d_type;
+  char d_name[];
+};
+
+#endif
+
+
+/** ***************************************************************************
+ * Public function, see dirread.h
+ *
+ */
+void dir_reader_init(struct dir_reader * r)
+{
+  r->name = NULL;
+  r->type = 0;
+#ifdef USE_GETDENTS
+  // libc readdir uses a 32K buffer, which means many syscalls on very
+  // large directories. Since the buffer is reused across all directories
+  // read by this reader, may as well make it larger.
+  r->bufsize = x_small_buffers ? K4 : K256;
+  r->buf = (char *)malloc(r->bufsize);
+  r->fd = -1;
+  r->pos = 0;
+  r->len = 0;
+#else
+  r->dir = NULL;
+#endif
+}
+
+
+/** ***************************************************************************
+ * Public function, see dirread.h
+ *
+ */
+int dir_reader_open(struct dir_reader * r, const char * path)
+{
+#ifdef USE_GETDENTS
+  r->fd = open(path, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+  r->pos = 0;
+  r->len = 0;
+  if (r->fd < 0) {
+    return -1;
+  }
+#else
+  r->dir = opendir(path);
+  if (r->dir == NULL) {
+    return -1;
+  }
+#endif
+  return 0;
+}
+
+
+/** ***************************************************************************
+ * Public function, see dirread.h
+ *
+ */
+int dir_reader_next(struct dir_reader * r)
+{
+#ifdef USE_GETDENTS
+  struct linux_dirent64 * d;
+
+  if (r->pos >= r->len) {
+    long n = syscall(SYS_getdents64, r->fd, r->buf, r->bufsize);
+    if (n <= 0) {
+      if (n < 0) {                                           // LCOV_EXCL_START
+        LOG_PROGRESS { perror("getdents64"); }
+      }                                                      // LCOV_EXCL_STOP
+      r->len = 0;
+      return 0;
+    }
+    r->len = (int)n;
+    r->pos = 0;
+  }
+
+  d = (struct linux_dirent64 *)(r->buf + r->pos);
+  r->pos += d->d_reclen;
+  r->name = d->d_name;
+  r->type = d->d_type;
+  return 1;
+
+#else
+  struct dirent * entry = readdir(r->dir);
+  if (entry == NULL) {
+    return 0;
+  }
+  r->name = entry->d_name;
+#ifdef DIRENT_HAS_TYPE
+  r->type = entry->d_type;
+#endif
+  return 1;
+#endif
+}
+
+
+/** ***************************************************************************
+ * Public function, see dirread.h
+ *
+ */
+void dir_reader_close(struct dir_reader * r)
+{
+#ifdef USE_GETDENTS
+  if (r->fd >= 0) {
+    close(r->fd);
+    r->fd = -1;
+  }
+#else
+  if (r->dir != NULL) {
+    closedir(r->dir);
+    r->dir = NULL;
+  }
+#endif
+}
+
+
+/** ***************************************************************************
+ * Public function, see dirread.h
+ *
+ */
+void dir_reader_free(struct dir_reader * r)
+{
+  dir_reader_close(r);
+#ifdef USE_GETDENTS
+  free(r->buf);
+  r->buf = NULL;
+#endif
+}
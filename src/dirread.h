@@ -0,0 +1,117 @@
+/*
+  Copyright 2021 Jyri J. Virkki <jyri@virkki.com>
+
+  This file is part of dupd.
+
+  dupd is free software: you can redistribute it and/or modify it
+  under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  dupd is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with dupd.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef _DUPD_DIRREAD_H
+#define _DUPD_DIRREAD_H
+
+#ifndef USE_GETDENTS
+#include <dirent.h>
+#endif
+
+
+/** ***************************************************************************
+ * Directory reader state. On Linux (USE_GETDENTS) the directory entries
+ * are read with getdents64 into a large buffer which is reused for every
+ * directory read through the same reader. Elsewhere this is a thin
+ * wrapper around opendir/readdir.
+ *
+ * After a successful dir_reader_next(), 'name' points to the
+ * (null-terminated) name of the entry and, if DIRENT_HAS_TYPE, 'type'
+ * contains its d_type. Both are only valid until the next call.
+ *
+ */
+struct dir_reader {
+  char * name;
+  unsigned char type;
+#ifdef USE_GETDENTS
+  int fd;
+  char * buf;
+  int bufsize;
+  int pos;
+  int len;
+#else
+  DIR * dir;
+#endif
+};
+
+
+/** ***************************************************************************
+ * Initialize a directory reader. It can then be used to read any number
+ * of directories, one at a time.
+ *
+ * Parameters:
+ *    r - The reader to initialize.
+ *
+ * Return: none
+ *
+ */
+void dir_reader_init(struct dir_reader * r);
+
+
+/** ***************************************************************************
+ * Open a directory for reading.
+ *
+ * Parameters:
+ *    r    - The reader.
+ *    path - Path of the directory.
+ *
+ * Return: 0 on success, -1 on error (errno is set).
+ *
+ */
+int dir_reader_open(struct dir_reader * r, const char * path);
+
+
+/** ***************************************************************************
+ * Advance to the next entry of the directory.
+ *
+ * Parameters:
+ *    r - The reader.
+ *
+ * Return: 1 if r->name (and r->type) contain the next entry, 0 if no
+ *         more entries.
+ *
+ */
+int dir_reader_next(struct dir_reader * r);
+
+
+/** ***************************************************************************
+ * Close the directory currently open in the reader.
+ *
+ * Parameters:
+ *    r - The reader.
+ *
+ * Return: none
+ *
+ */
+void dir_reader_close(struct dir_reader * r);
+
+
+/** ***************************************************************************
+ * Release any memory held by the reader.
+ *
+ * Parameters:
+ *    r - The reader.
+ *
+ * Return: none
+ *
+ */
+void dir_reader_free(struct dir_reader * r);
+
+
+#endif
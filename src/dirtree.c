@@ -150,6 +150,7 @@ struct direntry * new_child_dir(char * name, struct direntry * parent)
   }
 
   entry->parent = parent;
+  entry->device = 0;
 
   if (parent == NULL) {
     entry->total_size = len;
@@ -29,6 +29,7 @@ struct direntry {
   char * name;              // NOT null-terminated directory name
   uint16_t total_size;      // Total length of the path (including self 'name')
   uint8_t name_size;        // Length of the 'name' string
+  uint8_t device;           // Read list device index, 0 if not known yet
 };
 
 
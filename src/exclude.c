@@ -0,0 +1,248 @@
+/*
+  Copyright 2021 Jyri J. Virkki <jyri@virkki.com>
+
+  This file is part of dupd.
+
+  dupd is free software: you can redistribute it and/or modify it
+  under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  dupd is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with dupd.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <fnmatch.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "exclude.h"
+#include "main.h"
+#include "utils.h"
+
+#define NAME_ROOT 0
+#define PATH_ROOT 1
+
+// Trie of the literal patterns, in a flat array. Node 0 is the root of
+// the name patterns, node 1 the root of the path patterns. Since neither
+// root is ever a child or sibling, 0 marks the end of those lists.
+struct trie_node {
+  uint32_t child;
+  uint32_t sibling;
+  uint8_t ch;
+  uint8_t terminal;
+};
+
+static struct trie_node * trie = NULL;
+static uint32_t trie_size = 0;
+static uint32_t trie_used = 0;
+
+static char * * name_globs = NULL;
+static int name_glob_count = 0;
+static char * * path_globs = NULL;
+static int path_glob_count = 0;
+
+static int exclude_count = 0;
+
+
+/** ***************************************************************************
+ * Add a literal string to the trie under the given root.
+ *
+ */
+static void trie_insert(uint32_t root, const char * str)
+{
+  uint32_t node = root;
+
+  for (const char * p = str; *p; p++) {
+    uint32_t child = trie[node].child;
+    while (child != 0 && trie[child].ch != (uint8_t)*p) {
+      child = trie[child].sibling;
+    }
+
+    if (child == 0) {
+      if (trie_used == trie_size) {
+        trie_size *= 2;
+        trie = (struct trie_node *)realloc(trie,
+                                           trie_size * sizeof(struct trie_node));
+      }
+      child = trie_used++;
+      trie[child].ch = (uint8_t)*p;
+      trie[child].terminal = 0;
+      trie[child].child = 0;
+      trie[child].sibling = trie[node].child;
+      trie[node].child = child;
+    }
+
+    node = child;
+  }
+
+  trie[node].terminal = 1;
+}
+
+
+/** ***************************************************************************
+ * Add a glob pattern to a list.
+ *
+ */
+static void glob_insert(char * * * list, int * count, const char * pattern)
+{
+  *list = (char * *)realloc(*list, (*count + 1) * sizeof(char *));
+  (*list)[*count] = strdup(pattern);
+  (*count)++;
+}
+
+
+/** ***************************************************************************
+ * Public function, see exclude.h
+ *
+ */
+void add_exclude(const char * pattern)
+{
+  char buf[DUPD_PATH_MAX];
+  int len;
+
+  strlcpy(buf, pattern, DUPD_PATH_MAX);
+  len = strlen(buf);
+  while (len > 1 && buf[len - 1] == '/') {
+    buf[--len] = 0;
+  }
+
+  if (len == 0) {
+    return;
+  }
+
+  if (trie == NULL) {
+    trie_size = 64;
+    trie = (struct trie_node *)calloc(trie_size, sizeof(struct trie_node));
+    trie_used = 2;
+  }
+
+  int is_path = buf[0] == '/';
+  int is_glob = strpbrk(buf, "*?[") != NULL;
+
+  if (is_glob) {
+    if (is_path) {
+      glob_insert(&path_globs, &path_glob_count, buf);
+    } else {
+      glob_insert(&name_globs, &name_glob_count, buf);
+    }
+  } else {
+    trie_insert(is_path ? PATH_ROOT : NAME_ROOT, buf);
+  }
+
+  exclude_count++;
+  LOG(L_INFO, "Exclude %s %s: %s\n",
+      is_path ? "path" : "name", is_glob ? "glob" : "literal", buf);
+}
+
+
+/** ***************************************************************************
+ * Public function, see exclude.h
+ *
+ */
+int have_excludes()
+{
+  return exclude_count > 0;
+}
+
+
+/** ***************************************************************************
+ * Public function, see exclude.h
+ *
+ */
+int is_excluded(const char * path, const char * name)
+{
+  uint32_t node;
+  uint32_t child;
+  const char * p;
+
+  if (exclude_count == 0) {
+    return 0;
+  }
+
+  // Literal names must match the whole name
+  node = NAME_ROOT;
+  for (p = name; *p; p++) {
+    child = trie[node].child;
+    while (child != 0 && trie[child].ch != (uint8_t)*p) {
+      child = trie[child].sibling;
+    }
+    if (child == 0) {
+      break;
+    }
+    node = child;
+  }
+  if (*p == 0 && trie[node].terminal) {
+    return 1;
+  }
+
+  // Literal paths match the path or any of its parent directories
+  node = PATH_ROOT;
+  for (p = path; *p; p++) {
+    child = trie[node].child;
+    while (child != 0 && trie[child].ch != (uint8_t)*p) {
+      child = trie[child].sibling;
+    }
+    if (child == 0) {
+      break;
+    }
+    node = child;
+    if (trie[node].terminal && (p[1] == '/' || p[1] == 0)) {
+      return 1;
+    }
+  }
+
+  for (int i = 0; i < name_glob_count; i++) {
+    if (!fnmatch(name_globs[i], name, FNM_PERIOD)) {
+      return 1;
+    }
+  }
+
+  for (int i = 0; i < path_glob_count; i++) {
+    if (!fnmatch(path_globs[i], path, FNM_PATHNAME | FNM_PERIOD)) {
+      return 1;
+    }
+  }
+
+  return 0;
+}
+
+
+/** ***************************************************************************
+ * Public function, see exclude.h
+ *
+ */
+void free_excludes()
+{
+  if (trie != NULL) {
+    free(trie);
+    trie = NULL;
+  }
+
+  for (int i = 0; i < name_glob_count; i++) {
+    free(name_globs[i]);
+  }
+  if (name_globs != NULL) {
+    free(name_globs);
+    name_globs = NULL;
+  }
+
+  for (int i = 0; i < path_glob_count; i++) {
+    free(path_globs[i]);
+  }
+  if (path_globs != NULL) {
+    free(path_globs);
+    path_globs = NULL;
+  }
+
+  name_glob_count = 0;
+  path_glob_count = 0;
+  exclude_count = 0;
+}
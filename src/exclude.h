@@ -0,0 +1,83 @@
+/*
+  Copyright 2021 Jyri J. Virkki <jyri@virkki.com>
+
+  This file is part of dupd.
+
+  dupd is free software: you can redistribute it and/or modify it
+  under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  dupd is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with dupd.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef _DUPD_EXCLUDE_H
+#define _DUPD_EXCLUDE_H
+
+
+/** ***************************************************************************
+ * Scan-time exclusions (--exclude). Entries matching any pattern are
+ * skipped during the walk, before they are stat'd or (for directories)
+ * read, so excluded subtrees cost no I/O.
+ *
+ * A pattern starting with '/' is matched against the full path of an
+ * entry and excludes that path and anything under it. Any other pattern
+ * is matched against the name of an entry, at any depth.
+ *
+ * Patterns without glob characters (* ? [) are kept in a trie so all of
+ * them are checked in a single pass over the name (or path). Glob
+ * patterns are matched with fnmatch(3).
+ *
+ */
+
+
+/** ***************************************************************************
+ * Add an exclude pattern.
+ *
+ * Parameters:
+ *    pattern - The pattern.
+ *
+ * Return: none
+ *
+ */
+void add_exclude(const char * pattern);
+
+
+/** ***************************************************************************
+ * Returns true if any exclude patterns have been added.
+ *
+ */
+int have_excludes();
+
+
+/** ***************************************************************************
+ * Check whether an entry is excluded.
+ *
+ * Parameters:
+ *    path - Full path of the entry.
+ *    name - Name of the entry (last component of path).
+ *
+ * Return: 1 if excluded, 0 if not.
+ *
+ */
+int is_excluded(const char * path, const char * name);
+
+
+/** ***************************************************************************
+ * Free all exclude patterns.
+ *
+ * Parameters: none
+ *
+ * Return: none
+ *
+ */
+void free_excludes();
+
+
+#endif
@@ -94,13 +94,26 @@ void compare_two_files(sqlite3 * dbh, char * path1, char * path2,
 {
   LOG(L_TRACE, "compare_two_files: [%s] vs [%s]\n", path1, path2);
 
-  int file1 = open(path1, O_RDONLY);
+  int direct;
+  int file1;
+  int file2;
+
+  // Buffers are aligned but O_DIRECT also needs an aligned read size
+  if (filecmp_block_size % DIRECT_IO_ALIGN == 0) {
+    file1 = open_data_file(path1, &direct);
+  } else {
+    file1 = open(path1, O_RDONLY);
+  }
   if (file1 < 0) {
     LOG(L_PROGRESS, "Error opening [%s]\n", path1);
     return;
   }
 
-  int file2 = open(path2, O_RDONLY);
+  if (filecmp_block_size % DIRECT_IO_ALIGN == 0) {
+    file2 = open_data_file(path2, &direct);
+  } else {
+    file2 = open(path2, O_RDONLY);
+  }
   if (file2 < 0) {
     LOG(L_PROGRESS, "Error opening [%s]\n", path2);
     close(file1);
@@ -117,8 +130,8 @@ void compare_two_files(sqlite3 * dbh, char * path1, char * path2,
  */
 void init_filecompare()
 {
-  buffers[1] = (char *)malloc(filecmp_block_size);
-  buffers[2] = (char *)malloc(filecmp_block_size);
+  buffers[1] = alloc_aligned(filecmp_block_size);
+  buffers[2] = alloc_aligned(filecmp_block_size);
 }
 
 
@@ -26,64 +26,34 @@
 #include <sys/types.h>
 #include <unistd.h>
 
+#include "blake3.h"
 #include "hash.h"
+#include "hash_evp.h"
+#include "hash_lanes.h"
+#include "hash_xxh3.h"
 #include "main.h"
 #include "stats.h"
 #include "utils.h"
 #include "xxhash.h"
 
-#ifndef __APPLE__
-#include <openssl/md5.h>
-#include <openssl/sha.h>
-#endif
-
-#ifdef __APPLE__
-#include <CommonCrypto/CommonDigest.h>
-#define MD5_CTX CC_MD5_CTX
-#define MD5_Init CC_MD5_Init
-#define MD5_Update CC_MD5_Update
-#define MD5_Final CC_MD5_Final
-#define SHA_CTX CC_SHA1_CTX
-#define SHA1_Init CC_SHA1_Init
-#define SHA1_Update CC_SHA1_Update
-#define SHA1_Final CC_SHA1_Final
-#define SHA512_CTX CC_SHA512_CTX
-#define SHA512_Init CC_SHA512_Init
-#define SHA512_Update CC_SHA512_Update
-#define SHA512_Final CC_SHA512_Final
-#endif
-
-#ifdef __linux__
-#define FADVISE 1
-#endif
-
-#ifdef __sun__
-#define FADVISE 1
-#endif
-
-#ifdef __FreeBSD__
-#define FADVISE 1
-#endif
-
 #define MAX_BLOCK (1024 * 1024)
 
 
 /** ***************************************************************************
- * MD5 implementation for hash_fn().
+ * MD5, SHA1 and SHA512 implementation for hash_fn().
  *
  */
-static int md5(char * output, uint64_t blocks, int bsize, int file,
+static int evp(char * output, uint64_t blocks, int bsize, int file,
                char * buffer)
 {
   uint64_t counter = blocks;
   ssize_t bytes;
-  MD5_CTX ctx;
+  void * ctx = evp_ctx_new();
 
-  MD5_Init(&ctx);
   while ((bytes = read(file, buffer, bsize)) > 0) {
     stats_total_bytes_hashed += bytes;
     stats_total_bytes_read += bytes;
-    MD5_Update(&ctx, buffer, bytes);
+    evp_update(ctx, buffer, (size_t)bytes);
     if (blocks) {
       counter--;
       if (counter == 0) { break; }
@@ -91,44 +61,45 @@ static int md5(char * output, uint64_t blocks, int bsize, int file,
   }
 
   close(file);
-  MD5_Final((unsigned char *)output, &ctx);
+  evp_final(ctx, output);
 
   return(0);
 }
 
 
 /** ***************************************************************************
- * MD5 implementation for hash_fn_buf().
+ * MD5, SHA1 and SHA512 implementation for hash_fn_buf().
  *
  */
-static int md5_buf(const char * buffer, int bufsize, char * output)
+static int evp_hash_buf(const char * buffer, int bufsize, char * output)
 {
-  MD5_CTX ctx;
-
-  MD5_Init(&ctx);
-  MD5_Update(&ctx, buffer, bufsize);
-  MD5_Final((unsigned char *)output, &ctx);
+  evp_buf(buffer, (size_t)bufsize, output);
   stats_total_bytes_hashed += bufsize;
   return(0);
 }
 
 
 /** ***************************************************************************
- * SHA1 implementation for hash_fn().
+ * XXHASH implementation for hash_fn().
  *
  */
-static int sha1(char * output, uint64_t blocks, int bsize, int file,
-                char * buffer)
+static int xxhash(char * output, uint64_t blocks, int bsize, int file,
+                  char * buffer)
 {
   uint64_t counter = blocks;
   ssize_t bytes;
-  SHA_CTX ctx;
+  XXH_errorcode rv;
+  XXH64_state_t * state = XXH64_createState();
+  XXH64_reset(state, 1);
 
-  SHA1_Init(&ctx);
   while ((bytes = read(file, buffer, bsize)) > 0) {
     stats_total_bytes_hashed += bytes;
     stats_total_bytes_read += bytes;
-    SHA1_Update(&ctx, buffer, bytes);
+    rv = XXH64_update(state, buffer, bytes);
+    if (rv != XXH_OK) {
+      printf("error: XXH64_update failed\n");
+      exit(1);
+    }
     if (blocks) {
       counter--;
       if (counter == 0) { break; }
@@ -136,44 +107,41 @@ static int sha1(char * output, uint64_t blocks, int bsize, int file,
   }
 
   close(file);
-  SHA1_Final((unsigned char *)output, &ctx);
-
+  XXH64_hash_t result = XXH64_digest(state);
+  memcpy(output, &result, 8);
+  XXH64_freeState(state);
   return(0);
 }
 
 
 /** ***************************************************************************
- * SHA1 implementation for hash_fn_buf().
+ * XXHASH implementation for hash_fn_buf().
  *
  */
-static int sha1_buf(const char * buffer, int bufsize, char * output)
+static int xxhash_buf(const char * buffer, int bufsize, char * output)
 {
-  SHA_CTX ctx;
-
-  SHA1_Init(&ctx);
-  SHA1_Update(&ctx, buffer, bufsize);
-  SHA1_Final((unsigned char *)output, &ctx);
+  XXH64_hash_t result = XXH64(buffer, (size_t)bufsize, 1);
+  memcpy(output, &result, 8);
   stats_total_bytes_hashed += bufsize;
   return(0);
 }
 
 
 /** ***************************************************************************
- * SHA512 implementation for hash_fn().
+ * XXH3 (64 and 128 bit) implementation for hash_fn().
  *
  */
-static int sha512(char * output, uint64_t blocks, int bsize, int file,
-                  char * buffer)
+static int xxh3(char * output, uint64_t blocks, int bsize, int file,
+                char * buffer)
 {
   uint64_t counter = blocks;
   ssize_t bytes;
-  SHA512_CTX ctx;
+  void * state = xxh3_state_new();
 
-  SHA512_Init(&ctx);
   while ((bytes = read(file, buffer, bsize)) > 0) {
     stats_total_bytes_hashed += bytes;
     stats_total_bytes_read += bytes;
-    SHA512_Update(&ctx, buffer, bytes);
+    xxh3_state_update(state, buffer, (size_t)bytes);
     if (blocks) {
       counter--;
       if (counter == 0) { break; }
@@ -181,49 +149,32 @@ static int sha512(char * output, uint64_t blocks, int bsize, int file,
   }
 
   close(file);
-  SHA512_Final((unsigned char *)output, &ctx);
-
-  return(0);
-}
-
-
-/** ***************************************************************************
- * SHA512 implementation for hash_fn_buf().
- *
- */
-static int sha512_buf(const char * buffer, int bufsize, char * output)
-{
-  SHA512_CTX ctx;
-
-  SHA512_Init(&ctx);
-  SHA512_Update(&ctx, buffer, bufsize);
-  SHA512_Final((unsigned char *)output, &ctx);
-  stats_total_bytes_hashed += bufsize;
+  if (hash_function == HASH_FN_XXH3_128) {
+    xxh3_state_digest128(state, output);
+  } else {
+    xxh3_state_digest64(state, output);
+  }
+  xxh3_state_free(state);
   return(0);
 }
 
 
 /** ***************************************************************************
- * XXHASH implementation for hash_fn().
+ * BLAKE3 implementation for hash_fn().
  *
  */
-static int xxhash(char * output, uint64_t blocks, int bsize, int file,
+static int blake3(char * output, uint64_t blocks, int bsize, int file,
                   char * buffer)
 {
   uint64_t counter = blocks;
   ssize_t bytes;
-  XXH_errorcode rv;
-  XXH64_state_t * state = XXH64_createState();
-  XXH64_reset(state, 1);
+  struct blake3_state state;
 
+  blake3_init(&state);
   while ((bytes = read(file, buffer, bsize)) > 0) {
     stats_total_bytes_hashed += bytes;
     stats_total_bytes_read += bytes;
-    rv = XXH64_update(state, buffer, bytes);
-    if (rv != XXH_OK) {
-      printf("error: XXH64_update failed\n");
-      exit(1);
-    }
+    blake3_update(&state, (uint8_t *)buffer, (size_t)bytes);
     if (blocks) {
       counter--;
       if (counter == 0) { break; }
@@ -231,21 +182,22 @@ static int xxhash(char * output, uint64_t blocks, int bsize, int file,
   }
 
   close(file);
-  XXH64_hash_t result = XXH64_digest(state);
-  memcpy(output, &result, 8);
-  XXH64_freeState(state);
+  blake3_final(&state, (uint8_t *)output);
   return(0);
 }
 
 
 /** ***************************************************************************
- * XXHASH implementation for hash_fn_buf().
+ * BLAKE3 implementation for hash_fn_buf().
  *
  */
-static int xxhash_buf(const char * buffer, int bufsize, char * output)
+static int blake3_buf(const char * buffer, int bufsize, char * output)
 {
-  XXH64_hash_t result = XXH64(buffer, (size_t)bufsize, 1);
-  memcpy(output, &result, 8);
+  struct blake3_state state;
+
+  blake3_init(&state);
+  blake3_update(&state, (const uint8_t *)buffer, (size_t)bufsize);
+  blake3_final(&state, (uint8_t *)output);
   stats_total_bytes_hashed += bufsize;
   return(0);
 }
@@ -260,8 +212,15 @@ int hash_get_bufsize(int hash_function)
   switch(hash_function) {
 
   case HASH_FN_XXHASH:
+  case HASH_FN_XXH3_64:
     return 8;
 
+  case HASH_FN_XXH3_128:
+    return 16;
+
+  case HASH_FN_BLAKE3:
+    return BLAKE3_OUT_LEN;
+
   case HASH_FN_MD5:
     return 16;
 
@@ -300,7 +259,16 @@ int hash_fn(const char * path, char * output, uint64_t blocks,
   LOG(L_TRACE, "hash_fn: blocks(%d)=%" PRIu64 " skip=%" PRIu64 " path=%s\n",
       block_size, blocks, skip, path);
 
-  int file = open(path, O_RDONLY);
+  // O_DIRECT reads need the buffer, the block size and the starting
+  // offset to be aligned.
+  int direct = 0;
+  int file;
+  if (direct_io && block_size % DIRECT_IO_ALIGN == 0 &&
+      (skip * bsize) % DIRECT_IO_ALIGN == 0) {
+    file = open_data_file(path, &direct);
+  } else {
+    file = open(path, O_RDONLY);
+  }
   if (file < 0) {
     LOG(L_PROGRESS, "HASH: Error opening [%s]\n", path);
     return(-1);
@@ -308,7 +276,7 @@ int hash_fn(const char * path, char * output, uint64_t blocks,
 
   // When reading the entire file, say so
 #ifdef FADVISE
-  if (blocks == 0) {
+  if (blocks == 0 && !direct) {
     posix_fadvise(file, 0, 0, POSIX_FADV_WILLNEED);
   }
 #endif
@@ -323,33 +291,45 @@ int hash_fn(const char * path, char * output, uint64_t blocks,
     }                                                        // LCOV_EXCL_STOP
   }
 
-  char * buffer = (char *)malloc(block_size);
+  char * buffer;
+  if (direct) {
+    buffer = get_aligned_buffer();
+  } else {
+    buffer = (char *)malloc(block_size);
+  }
   int rv = -1;
 
   switch(hash_function) {
 
   case HASH_FN_MD5:
-    rv = md5(output, blocks, block_size, file, buffer);
-    break;
-
   case HASH_FN_SHA1:
-    rv = sha1(output, blocks, block_size, file, buffer);
-    break;
-
   case HASH_FN_SHA512:
-    rv = sha512(output, blocks, block_size, file, buffer);
+    rv = evp(output, blocks, block_size, file, buffer);
     break;
 
   case HASH_FN_XXHASH:
     rv = xxhash(output, blocks, block_size, file, buffer);
     break;
 
+  case HASH_FN_XXH3_64:
+  case HASH_FN_XXH3_128:
+    rv = xxh3(output, blocks, block_size, file, buffer);
+    break;
+
+  case HASH_FN_BLAKE3:
+    rv = blake3(output, blocks, block_size, file, buffer);
+    break;
+
   default:                                                   // LCOV_EXCL_START
     printf("error: invalid hash_function value %d\n", hash_function);
     exit(1);                                                 // LCOV_EXCL_STOP
   }
 
-  free(buffer);
+  if (direct) {
+    put_aligned_buffer(buffer);
+  } else {
+    free(buffer);
+  }
   return rv;
 }
 
@@ -363,17 +343,26 @@ int hash_fn_buf(const char * buffer, int bufsize, char * output)
   switch(hash_function) {
 
   case HASH_FN_MD5:
-    return md5_buf(buffer, bufsize, output);
-
   case HASH_FN_SHA1:
-    return sha1_buf(buffer, bufsize, output);
-
   case HASH_FN_SHA512:
-    return sha512_buf(buffer, bufsize, output);
+    return evp_hash_buf(buffer, bufsize, output);
 
   case HASH_FN_XXHASH:
     return xxhash_buf(buffer, bufsize, output);
 
+  case HASH_FN_XXH3_64:
+    xxh3_64_buf(buffer, (size_t)bufsize, output);
+    stats_total_bytes_hashed += bufsize;
+    return 0;
+
+  case HASH_FN_XXH3_128:
+    xxh3_128_buf(buffer, (size_t)bufsize, output);
+    stats_total_bytes_hashed += bufsize;
+    return 0;
+
+  case HASH_FN_BLAKE3:
+    return blake3_buf(buffer, bufsize, output);
+
   default:                                                   // LCOV_EXCL_START
     printf("error: invalid hash_function value %d\n", hash_function);
     exit(1);                                                 // LCOV_EXCL_STOP
@@ -385,27 +374,53 @@ int hash_fn_buf(const char * buffer, int bufsize, char * output)
  * Public function, see hash.h
  *
  */
-void * hash_fn_buf_init()
+int hash_get_lanes()
 {
   switch(hash_function) {
 
-  case HASH_FN_MD5: {
-    MD5_CTX * ctx = (MD5_CTX *)malloc(sizeof(MD5_CTX));
-    MD5_Init(ctx);
-    return (void *)ctx;
-  }
+  case HASH_FN_MD5:
+    return MD5_LANES;
 
-  case HASH_FN_SHA1: {
-    SHA_CTX * ctx = (SHA_CTX *)malloc(sizeof(SHA_CTX));
-    SHA1_Init(ctx);
-    return (void *)ctx;
+  default:
+    return 1;
   }
+}
+
 
-  case HASH_FN_SHA512: {
-    SHA512_CTX * ctx = (SHA512_CTX *)malloc(sizeof(SHA512_CTX));
-    SHA512_Init(ctx);
-    return (void *)ctx;
+/** ***************************************************************************
+ * Public function, see hash.h
+ *
+ */
+void hash_fn_buf_lanes(const char ** buffers, int count, int bufsize,
+                       char ** outputs)
+{
+  switch(hash_function) {
+
+  case HASH_FN_MD5:
+    md5_lanes(buffers, count, (size_t)bufsize, outputs);
+    stats_total_bytes_hashed += (uint64_t)count * bufsize;
+    break;
+
+  default:
+    for (int n = 0; n < count; n++) {
+      hash_fn_buf(buffers[n], bufsize, outputs[n]);
+    }
   }
+}
+
+
+/** ***************************************************************************
+ * Public function, see hash.h
+ *
+ */
+void * hash_fn_buf_init()
+{
+  switch(hash_function) {
+
+  case HASH_FN_MD5:
+  case HASH_FN_SHA1:
+  case HASH_FN_SHA512:
+    return evp_ctx_new();
 
   case HASH_FN_XXHASH: {
     XXH64_state_t * state = XXH64_createState();
@@ -413,6 +428,17 @@ void * hash_fn_buf_init()
     return (void *)state;
   }
 
+  case HASH_FN_XXH3_64:
+  case HASH_FN_XXH3_128:
+    return xxh3_state_new();
+
+  case HASH_FN_BLAKE3: {
+    struct blake3_state * state =
+      (struct blake3_state *)malloc(sizeof(struct blake3_state));
+    blake3_init(state);
+    return (void *)state;
+  }
+
   default:                                                   // LCOV_EXCL_START
     printf("error: invalid hash_function value %d\n", hash_function);
     exit(1);                                                 // LCOV_EXCL_STOP
@@ -431,21 +457,25 @@ int hash_fn_buf_update(void * ctx, const char * buffer, int bufsize)
   switch(hash_function) {
 
   case HASH_FN_MD5:
-    MD5_Update((MD5_CTX *)ctx, buffer, bufsize);
-    break;
-
   case HASH_FN_SHA1:
-    SHA1_Update((SHA_CTX *)ctx, buffer, bufsize);
-    break;
-
   case HASH_FN_SHA512:
-    SHA512_Update((SHA512_CTX *)ctx, buffer, bufsize);
+    evp_update(ctx, buffer, (size_t)bufsize);
     break;
 
   case HASH_FN_XXHASH:
     XXH64_update((XXH64_state_t *)ctx, buffer, bufsize);
     break;
 
+  case HASH_FN_XXH3_64:
+  case HASH_FN_XXH3_128:
+    xxh3_state_update(ctx, buffer, (size_t)bufsize);
+    break;
+
+  case HASH_FN_BLAKE3:
+    blake3_update((struct blake3_state *)ctx, (const uint8_t *)buffer,
+                  (size_t)bufsize);
+    break;
+
   default:                                                   // LCOV_EXCL_START
     printf("error: invalid hash_function value %d\n", hash_function);
     exit(1);
@@ -463,26 +493,11 @@ int hash_fn_get_partial(void * ctx, char * output)
 {
   switch(hash_function) {
 
-  case HASH_FN_MD5: {
-    MD5_CTX tmp;
-    memcpy(&tmp, (MD5_CTX *)ctx, sizeof(MD5_CTX));
-    MD5_Final((unsigned char *)output, &tmp);
-    break;
-  }
-
-  case HASH_FN_SHA1: {
-    SHA_CTX tmp;
-    memcpy(&tmp, (SHA_CTX *)ctx, sizeof(SHA_CTX));
-    SHA1_Final((unsigned char *)output, &tmp);
-    break;
-  }
-
-  case HASH_FN_SHA512: {
-    SHA512_CTX tmp;
-    memcpy(&tmp, (SHA512_CTX *)ctx, sizeof(SHA512_CTX));
-    SHA512_Final((unsigned char *)output, &tmp);
+  case HASH_FN_MD5:
+  case HASH_FN_SHA1:
+  case HASH_FN_SHA512:
+    evp_partial(ctx, output);
     break;
-  }
 
   case HASH_FN_XXHASH: {
     XXH64_state_t * tmp_state = XXH64_createState();
@@ -492,6 +507,18 @@ int hash_fn_get_partial(void * ctx, char * output)
     XXH64_freeState(tmp_state);
     break;
   }
+
+  case HASH_FN_XXH3_64:
+    xxh3_state_digest64(ctx, output);
+    break;
+
+  case HASH_FN_XXH3_128:
+    xxh3_state_digest128(ctx, output);
+    break;
+
+  case HASH_FN_BLAKE3:
+    blake3_final((struct blake3_state *)ctx, (uint8_t *)output);
+    break;
   }
 
   return 0;
@@ -508,21 +535,10 @@ int hash_fn_buf_final(void * ctx, const char * buffer, int bufsize,
   switch(hash_function) {
 
   case HASH_FN_MD5:
-    MD5_Update((MD5_CTX *)ctx, buffer, bufsize);
-    MD5_Final((unsigned char *)output, (MD5_CTX *)ctx);
-    free(ctx);
-    break;
-
   case HASH_FN_SHA1:
-    SHA1_Update((SHA_CTX *)ctx, buffer, bufsize);
-    SHA1_Final((unsigned char *)output, (SHA_CTX *)ctx);
-    free(ctx);
-    break;
-
   case HASH_FN_SHA512:
-    SHA512_Update((SHA512_CTX *)ctx, buffer, bufsize);
-    SHA512_Final((unsigned char *)output, (SHA512_CTX *)ctx);
-    free(ctx);
+    evp_update(ctx, buffer, (size_t)bufsize);
+    evp_final(ctx, output);
     break;
 
   case HASH_FN_XXHASH:
@@ -532,6 +548,25 @@ int hash_fn_buf_final(void * ctx, const char * buffer, int bufsize,
     XXH64_freeState((XXH64_state_t *)ctx);
     break;
 
+  case HASH_FN_XXH3_64:
+    xxh3_state_update(ctx, buffer, (size_t)bufsize);
+    xxh3_state_digest64(ctx, output);
+    xxh3_state_free(ctx);
+    break;
+
+  case HASH_FN_XXH3_128:
+    xxh3_state_update(ctx, buffer, (size_t)bufsize);
+    xxh3_state_digest128(ctx, output);
+    xxh3_state_free(ctx);
+    break;
+
+  case HASH_FN_BLAKE3:
+    blake3_update((struct blake3_state *)ctx, (const uint8_t *)buffer,
+                  (size_t)bufsize);
+    blake3_final((struct blake3_state *)ctx, (uint8_t *)output);
+    free(ctx);
+    break;
+
   default:                                                   // LCOV_EXCL_START
     printf("error: invalid hash_function value %d\n", hash_function);
     exit(1);
@@ -550,19 +585,22 @@ void hash_fn_buf_free(void * ctx)
   switch(hash_function) {
 
   case HASH_FN_MD5:
-    free(ctx);
-    break;
-
   case HASH_FN_SHA1:
-    free(ctx);
-    break;
-
   case HASH_FN_SHA512:
-    free(ctx);
+    evp_ctx_free(ctx);
     break;
 
   case HASH_FN_XXHASH:
     XXH64_freeState((XXH64_state_t *)ctx);
     break;
+
+  case HASH_FN_XXH3_64:
+  case HASH_FN_XXH3_128:
+    xxh3_state_free(ctx);
+    break;
+
+  case HASH_FN_BLAKE3:
+    free(ctx);
+    break;
   }
 }
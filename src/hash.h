@@ -26,8 +26,12 @@
 #define HASH_FN_SHA1 2
 #define HASH_FN_SHA512 3
 #define HASH_FN_XXHASH 4
+#define HASH_FN_XXH3_64 5
+#define HASH_FN_XXH3_128 6
+#define HASH_FN_BLAKE3 7
 
 #define HASH_MAX_BUFSIZE 64
+#define HASH_MAX_LANES 8
 
 
 /** ***************************************************************************
@@ -82,6 +86,34 @@ int hash_fn(const char * path, char * output, uint64_t blocks,
 int hash_fn_buf(const char * buffer, int bufsize, char * output);
 
 
+/** ***************************************************************************
+ * Return how many buffers of the same size hash_fn_buf_lanes() can hash
+ * at once with the selected hash function.
+ *
+ * Parameters: none
+ *
+ * Return: Number of lanes (1 if there is no multi-lane implementation).
+ *
+ */
+int hash_get_lanes();
+
+
+/** ***************************************************************************
+ * Compute hash on several buffers of the same size in memory.
+ *
+ * Parameters:
+ *    buffers - Read data from these.
+ *    count   - Number of buffers, at most hash_get_lanes().
+ *    bufsize - Size of each buffer.
+ *    outputs - Store the hash of buffers[n] in outputs[n].
+ *
+ * Return: none
+ *
+ */
+void hash_fn_buf_lanes(const char ** buffers, int count, int bufsize,
+                       char ** outputs);
+
+
 /** ***************************************************************************
  * Initialize appropriate hash context depending on algorithm selected.
  *
@@ -0,0 +1,467 @@
+/*
+  Copyright 2012-2021 Jyri J. Virkki <jyri@virkki.com>
+
+  This file is part of dupd.
+
+  dupd is free software: you can redistribute it and/or modify it
+  under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  dupd is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with dupd.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "hash.h"
+#include "hash_evp.h"
+#include "main.h"
+#include "utils.h"
+
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+#include <cpuid.h>
+#define EVP_CPU_X86
+#endif
+
+#define THREAD_CACHE_MAX 16
+#define BENCH_SIZE (1024 * 1024)
+#define BENCH_ROUNDS 8
+
+#ifdef __APPLE__
+
+#include <CommonCrypto/CommonDigest.h>
+
+typedef union {
+  CC_MD5_CTX md5;
+  CC_SHA1_CTX sha1;
+  CC_SHA512_CTX sha512;
+} digest_ctx;
+
+#else
+
+#include <openssl/crypto.h>
+#include <openssl/evp.h>
+#if OPENSSL_VERSION_NUMBER >= 0x30000000L
+#include <openssl/provider.h>
+#endif
+
+typedef EVP_MD_CTX digest_ctx;
+
+static EVP_MD * md = NULL;
+
+#endif
+
+struct thread_cache {
+  int count;
+  digest_ctx * free[THREAD_CACHE_MAX];
+  digest_ctx * scratch;
+};
+
+static pthread_key_t cache_key;
+static pthread_once_t cache_key_once = PTHREAD_ONCE_INIT;
+static char impl_name[64];
+static char cpu_features[64];
+
+
+#ifdef __APPLE__
+
+static digest_ctx * dg_alloc()
+{
+  return (digest_ctx *)malloc(sizeof(digest_ctx));
+}
+
+
+static void dg_free(digest_ctx * ctx)
+{
+  free(ctx);
+}
+
+
+static void dg_init(digest_ctx * ctx)
+{
+  switch(hash_function) {
+  case HASH_FN_MD5: CC_MD5_Init(&ctx->md5); break;
+  case HASH_FN_SHA1: CC_SHA1_Init(&ctx->sha1); break;
+  case HASH_FN_SHA512: CC_SHA512_Init(&ctx->sha512); break;
+  }
+}
+
+
+static void dg_update(digest_ctx * ctx, const char * buffer, size_t len)
+{
+  switch(hash_function) {
+  case HASH_FN_MD5: CC_MD5_Update(&ctx->md5, buffer, len); break;
+  case HASH_FN_SHA1: CC_SHA1_Update(&ctx->sha1, buffer, len); break;
+  case HASH_FN_SHA512: CC_SHA512_Update(&ctx->sha512, buffer, len); break;
+  }
+}
+
+
+static void dg_final(digest_ctx * ctx, char * output)
+{
+  unsigned char * out = (unsigned char *)output;
+
+  switch(hash_function) {
+  case HASH_FN_MD5: CC_MD5_Final(out, &ctx->md5); break;
+  case HASH_FN_SHA1: CC_SHA1_Final(out, &ctx->sha1); break;
+  case HASH_FN_SHA512: CC_SHA512_Final(out, &ctx->sha512); break;
+  }
+}
+
+
+static void dg_copy(digest_ctx * dst, digest_ctx * src)
+{
+  memcpy(dst, src, sizeof(digest_ctx));
+}
+
+#else
+
+static digest_ctx * dg_alloc()
+{
+  EVP_MD_CTX * ctx = EVP_MD_CTX_new();
+  if (ctx == NULL) {                                         // LCOV_EXCL_START
+    printf("error: unable to allocate digest context\n");
+    exit(1);
+  }                                                          // LCOV_EXCL_STOP
+  return ctx;
+}
+
+
+static void dg_free(digest_ctx * ctx)
+{
+  EVP_MD_CTX_free(ctx);
+}
+
+
+static void dg_init(digest_ctx * ctx)
+{
+  // Initializing a context again with the same digest reuses its state
+  // instead of allocating it again
+  if (!EVP_DigestInit_ex(ctx, md, NULL)) {                   // LCOV_EXCL_START
+    printf("error: EVP_DigestInit_ex failed\n");
+    exit(1);
+  }                                                          // LCOV_EXCL_STOP
+}
+
+
+static void dg_update(digest_ctx * ctx, const char * buffer, size_t len)
+{
+  EVP_DigestUpdate(ctx, buffer, len);
+}
+
+
+static void dg_final(digest_ctx * ctx, char * output)
+{
+  EVP_DigestFinal_ex(ctx, (unsigned char *)output, NULL);
+}
+
+
+static void dg_copy(digest_ctx * dst, digest_ctx * src)
+{
+  if (!EVP_MD_CTX_copy_ex(dst, src)) {                       // LCOV_EXCL_START
+    printf("error: EVP_MD_CTX_copy_ex failed\n");
+    exit(1);
+  }                                                          // LCOV_EXCL_STOP
+}
+
+#endif
+
+
+/** ***************************************************************************
+ * Called at thread exit, free the contexts kept by the thread.
+ *
+ */
+static void thread_cache_done(void * arg)
+{
+  struct thread_cache * tc = (struct thread_cache *)arg;
+
+  for (int n = 0; n < tc->count; n++) {
+    dg_free(tc->free[n]);
+  }
+  if (tc->scratch != NULL) {
+    dg_free(tc->scratch);
+  }
+  free(tc);
+}
+
+
+/** ***************************************************************************
+ * Create the key for the thread caches.
+ *
+ */
+static void create_cache_key()
+{
+  if (pthread_key_create(&cache_key, thread_cache_done)) {   // LCOV_EXCL_START
+    printf("error: unable to create digest context thread key\n");
+    exit(1);
+  }                                                          // LCOV_EXCL_STOP
+}
+
+
+/** ***************************************************************************
+ * Return the context cache of the current thread.
+ *
+ */
+static struct thread_cache * get_thread_cache()
+{
+  pthread_once(&cache_key_once, create_cache_key);
+
+  struct thread_cache * tc =
+    (struct thread_cache *)pthread_getspecific(cache_key);
+
+  if (tc == NULL) {
+    tc = (struct thread_cache *)calloc(1, sizeof(struct thread_cache));
+    pthread_setspecific(cache_key, tc);
+  }
+
+  return tc;
+}
+
+
+/** ***************************************************************************
+ * Return the scratch context of the current thread, used for one-shot
+ * and partial digests.
+ *
+ */
+static digest_ctx * get_scratch()
+{
+  struct thread_cache * tc = get_thread_cache();
+
+  if (tc->scratch == NULL) {
+    tc->scratch = dg_alloc();
+  }
+
+  return tc->scratch;
+}
+
+
+/** ***************************************************************************
+ * Fill in cpu_features with the CPU features which the library has
+ * assembly code paths for, for the selected digest. Which one it actually
+ * uses isn't exposed, so this is only informational.
+ *
+ */
+static void find_cpu_features()
+{
+  strlcpy(cpu_features, "none", sizeof(cpu_features));
+
+#ifdef EVP_CPU_X86
+  unsigned int a, b, c, d;
+  int sha = 0;
+
+  if (hash_function != HASH_FN_SHA1 && hash_function != HASH_FN_SHA512) {
+    return;
+  }
+
+  __builtin_cpu_init();
+  if (__get_cpuid_count(7, 0, &a, &b, &c, &d)) {
+    sha = (b >> 29) & 1;
+  }
+  int avx2 = __builtin_cpu_supports("avx2") && __builtin_cpu_supports("bmi2");
+  int avx = __builtin_cpu_supports("avx");
+  int ssse3 = __builtin_cpu_supports("ssse3");
+
+  snprintf(cpu_features, sizeof(cpu_features), "%s%s%s%s",
+           hash_function == HASH_FN_SHA1 && sha ? "sha-ni " : "",
+           avx2 ? "avx2 " : "", avx ? "avx " : "",
+           hash_function == HASH_FN_SHA1 && ssse3 ? "ssse3 " : "");
+
+  int len = strlen(cpu_features);
+  if (len == 0) {
+    strlcpy(cpu_features, "none", sizeof(cpu_features));
+  } else {
+    cpu_features[len - 1] = 0;
+  }
+#endif
+}
+
+
+/** ***************************************************************************
+ * Public function, see header file.
+ *
+ */
+void evp_init()
+{
+  find_cpu_features();
+
+#ifdef __APPLE__
+  strlcpy(impl_name, "CommonCrypto", sizeof(impl_name));
+#else
+  const char * name = "MD5";
+  if (hash_function == HASH_FN_SHA1) {
+    name = "SHA1";
+  } else if (hash_function == HASH_FN_SHA512) {
+    name = "SHA512";
+  }
+
+  // Fetching the digest once avoids the implicit lookup OpenSSL 3 does
+  // on every EVP_DigestInit_ex() given one of the EVP_md5() style digests
+#if OPENSSL_VERSION_NUMBER >= 0x30000000L
+  md = EVP_MD_fetch(NULL, name, NULL);
+#else
+  md = (EVP_MD *)EVP_get_digestbyname(name);
+#endif
+  if (md == NULL) {                                          // LCOV_EXCL_START
+    printf("error: %s digest not available from OpenSSL\n", name);
+    exit(1);
+  }                                                          // LCOV_EXCL_STOP
+
+  // Name the library version and (OpenSSL 3) the provider the digest
+  // was fetched from
+#if OPENSSL_VERSION_NUMBER >= 0x30000000L
+  snprintf(impl_name, sizeof(impl_name), "OpenSSL %s %s provider",
+           OpenSSL_version(OPENSSL_VERSION_STRING),
+           OSSL_PROVIDER_get0_name(EVP_MD_get0_provider(md)));
+#else
+  strlcpy(impl_name, OPENSSL_VERSION_TEXT, sizeof(impl_name));
+#endif
+#endif
+}
+
+
+/** ***************************************************************************
+ * Public function, see header file.
+ *
+ */
+const char * evp_impl_name()
+{
+  return impl_name;
+}
+
+
+/** ***************************************************************************
+ * Public function, see header file.
+ *
+ */
+const char * evp_cpu_features()
+{
+  return cpu_features;
+}
+
+
+/** ***************************************************************************
+ * Public function, see header file.
+ *
+ */
+int evp_benchmark()
+{
+  char output[HASH_MAX_BUFSIZE];
+  struct timespec start, end;
+  char * buffer = (char *)malloc(BENCH_SIZE);
+
+  for (int n = 0; n < BENCH_SIZE; n++) {
+    buffer[n] = (char)(n * 31 + (n >> 8));
+  }
+
+  // One untimed round first so the timing doesn't include page faults
+  evp_buf(buffer, BENCH_SIZE, output);
+
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  for (int n = 0; n < BENCH_ROUNDS; n++) {
+    evp_buf(buffer, BENCH_SIZE, output);
+  }
+  clock_gettime(CLOCK_MONOTONIC, &end);
+  free(buffer);
+
+  int64_t usec = (int64_t)(end.tv_sec - start.tv_sec) * 1000000 +
+    (end.tv_nsec - start.tv_nsec) / 1000;
+  if (usec <= 0) {
+    usec = 1;
+  }
+
+  return (int)((int64_t)BENCH_ROUNDS * BENCH_SIZE / usec);
+}
+
+
+/** ***************************************************************************
+ * Public function, see header file.
+ *
+ */
+void * evp_ctx_new()
+{
+  struct thread_cache * tc = get_thread_cache();
+  digest_ctx * ctx;
+
+  if (tc->count > 0) {
+    ctx = tc->free[--tc->count];
+  } else {
+    ctx = dg_alloc();
+  }
+
+  dg_init(ctx);
+  return (void *)ctx;
+}
+
+
+/** ***************************************************************************
+ * Public function, see header file.
+ *
+ */
+void evp_update(void * ctx, const char * buffer, size_t len)
+{
+  dg_update((digest_ctx *)ctx, buffer, len);
+}
+
+
+/** ***************************************************************************
+ * Public function, see header file.
+ *
+ */
+void evp_final(void * ctx, char * output)
+{
+  dg_final((digest_ctx *)ctx, output);
+  evp_ctx_free(ctx);
+}
+
+
+/** ***************************************************************************
+ * Public function, see header file.
+ *
+ */
+void evp_partial(void * ctx, char * output)
+{
+  digest_ctx * tmp = get_scratch();
+
+  dg_copy(tmp, (digest_ctx *)ctx);
+  dg_final(tmp, output);
+}
+
+
+/** ***************************************************************************
+ * Public function, see header file.
+ *
+ */
+void evp_ctx_free(void * ctx)
+{
+  struct thread_cache * tc = get_thread_cache();
+
+  if (tc->count < THREAD_CACHE_MAX) {
+    tc->free[tc->count++] = (digest_ctx *)ctx;
+  } else {
+    dg_free((digest_ctx *)ctx);
+  }
+}
+
+
+/** ***************************************************************************
+ * Public function, see header file.
+ *
+ */
+void evp_buf(const char * buffer, size_t len, char * output)
+{
+  digest_ctx * ctx = get_scratch();
+
+  dg_init(ctx);
+  dg_update(ctx, buffer, len);
+  dg_final(ctx, output);
+}
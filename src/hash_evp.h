@@ -0,0 +1,161 @@
+/*
+  Copyright 2012-2021 Jyri J. Virkki <jyri@virkki.com>
+
+  This file is part of dupd.
+
+  dupd is free software: you can redistribute it and/or modify it
+  under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  dupd is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with dupd.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#ifndef _DUPD_HASH_EVP_H
+#define _DUPD_HASH_EVP_H
+
+#include <stddef.h>
+
+// MD5, SHA1 and SHA512 go through the OpenSSL EVP interface (CommonCrypto
+// on macOS). Digest contexts are costly to create so each thread keeps the
+// contexts it is done with and hands them out again.
+
+
+/** ***************************************************************************
+ * Look up the digest for the current hash_function. Must be called once
+ * before any threads use the other functions here, and only when
+ * hash_function is one of MD5, SHA1 or SHA512.
+ *
+ * Parameters: none
+ *
+ * Return: none
+ *
+ */
+void evp_init();
+
+
+/** ***************************************************************************
+ * Return the name of the library providing the digest, as reported by the
+ * library itself.
+ *
+ * Parameters: none
+ *
+ * Return: Name of the implementation (e.g. "OpenSSL 3.0.2 default provider").
+ *
+ */
+const char * evp_impl_name();
+
+
+/** ***************************************************************************
+ * Return the CPU features this CPU supports which the library has
+ * optimized code for, for the selected digest. Whether the library
+ * actually uses them can't be told.
+ *
+ * Parameters: none
+ *
+ * Return: Space separated feature names (e.g. "sha-ni avx2"), or "none".
+ *
+ */
+const char * evp_cpu_features();
+
+
+/** ***************************************************************************
+ * Measure how fast the digest selected by evp_init() hashes in-memory
+ * data. Takes a few milliseconds.
+ *
+ * Parameters: none
+ *
+ * Return: Throughput in MB/s.
+ *
+ */
+int evp_benchmark();
+
+
+/** ***************************************************************************
+ * Get a digest context ready to hash a new input. Contexts released by
+ * this thread earlier are reused.
+ *
+ * Parameters: none
+ *
+ * Return: The context.
+ *
+ */
+void * evp_ctx_new();
+
+
+/** ***************************************************************************
+ * Add data to a digest context.
+ *
+ * Parameters:
+ *    ctx    - Context from evp_ctx_new().
+ *    buffer - Data to add.
+ *    len    - Size of buffer.
+ *
+ * Return: none
+ *
+ */
+void evp_update(void * ctx, const char * buffer, size_t len);
+
+
+/** ***************************************************************************
+ * Store the digest of the data added to the context and release it.
+ *
+ * Parameters:
+ *    ctx    - Context from evp_ctx_new(), not usable after this call.
+ *    output - Buffer where output will be stored.
+ *
+ * Return: none
+ *
+ */
+void evp_final(void * ctx, char * output);
+
+
+/** ***************************************************************************
+ * Store the digest of the data added to the context so far. The context
+ * is not modified so more data can be added afterwards.
+ *
+ * Parameters:
+ *    ctx    - Context from evp_ctx_new().
+ *    output - Buffer where output will be stored.
+ *
+ * Return: none
+ *
+ */
+void evp_partial(void * ctx, char * output);
+
+
+/** ***************************************************************************
+ * Release a digest context without computing its digest. It is kept for
+ * reuse by the current thread.
+ *
+ * Parameters:
+ *    ctx - Context from evp_ctx_new(), not usable after this call.
+ *
+ * Return: none
+ *
+ */
+void evp_ctx_free(void * ctx);
+
+
+/** ***************************************************************************
+ * Compute the digest of one buffer.
+ *
+ * Parameters:
+ *    buffer - Data to hash.
+ *    len    - Size of buffer.
+ *    output - Buffer where output will be stored.
+ *
+ * Return: none
+ *
+ */
+void evp_buf(const char * buffer, size_t len, char * output);
+
+
+#endif
@@ -0,0 +1,260 @@
+/*
+  Copyright 2012-2021 Jyri J. Virkki <jyri@virkki.com>
+
+  This file is part of dupd.
+
+  dupd is free software: you can redistribute it and/or modify it
+  under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  dupd is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with dupd.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+// Multi-buffer hashing: MD5 can't be vectorized within one stream since
+// every step depends on the previous one, but independent buffers can
+// be hashed side by side, one per 32 bit SIMD lane. The lanes use the
+// compiler vector extensions so the same code builds for any target.
+
+#include <stdint.h>
+#include <string.h>
+
+#include "hash_lanes.h"
+
+typedef uint32_t lane_t __attribute__((vector_size(4 * MD5_LANES)));
+
+typedef void (*md5_lanes_fn)(const uint8_t **, size_t, uint8_t **);
+
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+#define LANES_DISPATCH
+#endif
+
+static const uint32_t MD5_K[64] = {
+  0xd76aa478, 0xe8c7b756, 0x242070db, 0xc1bdceee,
+  0xf57c0faf, 0x4787c62a, 0xa8304613, 0xfd469501,
+  0x698098d8, 0x8b44f7af, 0xffff5bb1, 0x895cd7be,
+  0x6b901122, 0xfd987193, 0xa679438e, 0x49b40821,
+  0xf61e2562, 0xc040b340, 0x265e5a51, 0xe9b6c7aa,
+  0xd62f105d, 0x02441453, 0xd8a1e681, 0xe7d3fbc8,
+  0x21e1cde6, 0xc33707d6, 0xf4d50d87, 0x455a14ed,
+  0xa9e3e905, 0xfcefa3f8, 0x676f02d9, 0x8d2a4c8a,
+  0xfffa3942, 0x8771f681, 0x6d9d6122, 0xfde5380c,
+  0xa4beea44, 0x4bdecfa9, 0xf6bb4b60, 0xbebfbc70,
+  0x289b7ec6, 0xeaa127fa, 0xd4ef3085, 0x04881d05,
+  0xd9d4d039, 0xe6db99e5, 0x1fa27cf8, 0xc4ac5665,
+  0xf4292244, 0x432aff97, 0xab9423a7, 0xfc93a039,
+  0x655b59c3, 0x8f0ccc92, 0xffeff47d, 0x85845dd1,
+  0x6fa87e4f, 0xfe2ce6e0, 0xa3014314, 0x4e0811a1,
+  0xf7537e82, 0xbd3af235, 0x2ad7d2bb, 0xeb86d391
+};
+
+static const int MD5_S[4][4] = {
+  { 7, 12, 17, 22 }, { 5, 9, 14, 20 }, { 4, 11, 16, 23 }, { 6, 10, 15, 21 }
+};
+
+static const uint32_t MD5_INIT[4] = {
+  0x67452301, 0xefcdab89, 0x98badcfe, 0x10325476
+};
+
+
+static inline __attribute__((always_inline)) uint32_t load32(const uint8_t * p)
+{
+  return (uint32_t)p[0] | ((uint32_t)p[1] << 8) |
+    ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+
+static inline __attribute__((always_inline)) void store32(uint8_t * p,
+                                                         uint32_t w)
+{
+  p[0] = (uint8_t)w;
+  p[1] = (uint8_t)(w >> 8);
+  p[2] = (uint8_t)(w >> 16);
+  p[3] = (uint8_t)(w >> 24);
+}
+
+
+/** ***************************************************************************
+ * One MD5 step on all lanes.
+ *
+ */
+#define MD5_STEP(f, i, g)                                                   \
+  {                                                                         \
+    lane_t t = a + (f) + MD5_K[i] + m[g];                                   \
+    int s = MD5_S[(i) / 16][(i) % 4];                                       \
+    a = d;                                                                  \
+    d = c;                                                                  \
+    c = b;                                                                  \
+    b = b + ((t << s) | (t >> (32 - s)));                                   \
+  }
+
+
+/** ***************************************************************************
+ * Compress one 64 byte block of each lane into the lane states.
+ *
+ * Parameters:
+ *    h      - The four state words, one lane per buffer.
+ *    blocks - Pointer to the block of each lane.
+ *
+ * Return: none
+ *
+ */
+static inline __attribute__((always_inline)) void
+md5_lanes_block(lane_t * h, const uint8_t ** blocks)
+{
+  lane_t m[16];
+  lane_t a = h[0];
+  lane_t b = h[1];
+  lane_t c = h[2];
+  lane_t d = h[3];
+
+  for (int i = 0; i < 16; i++) {
+    for (int l = 0; l < MD5_LANES; l++) {
+      m[i][l] = load32(blocks[l] + 4 * i);
+    }
+  }
+
+  for (int i = 0; i < 16; i++) {
+    MD5_STEP((b & c) | (~b & d), i, i);
+  }
+  for (int i = 16; i < 32; i++) {
+    MD5_STEP((d & b) | (~d & c), i, (5 * i + 1) % 16);
+  }
+  for (int i = 32; i < 48; i++) {
+    MD5_STEP(b ^ c ^ d, i, (3 * i + 5) % 16);
+  }
+  for (int i = 48; i < 64; i++) {
+    MD5_STEP(c ^ (b | ~d), i, (7 * i) % 16);
+  }
+
+  h[0] += a;
+  h[1] += b;
+  h[2] += c;
+  h[3] += d;
+}
+
+
+/** ***************************************************************************
+ * MD5 of MD5_LANES buffers of len bytes each.
+ *
+ */
+static inline __attribute__((always_inline)) void
+md5_lanes_all(const uint8_t ** buffers, size_t len, uint8_t ** outputs)
+{
+  uint8_t tail[MD5_LANES][128];
+  const uint8_t * blocks[MD5_LANES];
+  lane_t h[4];
+  size_t full = len / 64;
+  size_t rem = len % 64;
+  size_t tail_len = rem < 56 ? 64 : 128;
+  uint64_t bits = (uint64_t)len * 8;
+
+  for (int i = 0; i < 4; i++) {
+    h[i] = (lane_t){ 0 } + MD5_INIT[i];
+  }
+
+  for (size_t n = 0; n < full; n++) {
+    for (int l = 0; l < MD5_LANES; l++) {
+      blocks[l] = buffers[l] + 64 * n;
+    }
+    md5_lanes_block(h, blocks);
+  }
+
+  // All buffers have the same length so they all get the same padding
+  for (int l = 0; l < MD5_LANES; l++) {
+    memcpy(tail[l], buffers[l] + 64 * full, rem);
+    tail[l][rem] = 0x80;
+    memset(tail[l] + rem + 1, 0, tail_len - rem - 1);
+    store32(tail[l] + tail_len - 8, (uint32_t)bits);
+    store32(tail[l] + tail_len - 4, (uint32_t)(bits >> 32));
+  }
+
+  for (size_t off = 0; off < tail_len; off += 64) {
+    for (int l = 0; l < MD5_LANES; l++) {
+      blocks[l] = tail[l] + off;
+    }
+    md5_lanes_block(h, blocks);
+  }
+
+  for (int l = 0; l < MD5_LANES; l++) {
+    for (int i = 0; i < 4; i++) {
+      store32(outputs[l] + 4 * i, h[i][l]);
+    }
+  }
+}
+
+
+#ifdef LANES_DISPATCH
+__attribute__((__target__("avx2")))
+static void md5_lanes_avx2(const uint8_t ** buffers, size_t len,
+                           uint8_t ** outputs)
+{
+  md5_lanes_all(buffers, len, outputs);
+}
+#endif
+
+static void md5_lanes_default(const uint8_t ** buffers, size_t len,
+                              uint8_t ** outputs)
+{
+  md5_lanes_all(buffers, len, outputs);
+}
+
+static md5_lanes_fn md5_lanes_impl = md5_lanes_default;
+static const char * impl_name = "default";
+
+
+/** ***************************************************************************
+ * Public function, see header file.
+ *
+ */
+void hash_lanes_init()
+{
+#ifdef LANES_DISPATCH
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx2")) {
+    md5_lanes_impl = md5_lanes_avx2;
+    impl_name = "avx2";
+  }
+#endif
+}
+
+
+/** ***************************************************************************
+ * Public function, see header file.
+ *
+ */
+const char * hash_lanes_impl_name()
+{
+  return impl_name;
+}
+
+
+/** ***************************************************************************
+ * Public function, see header file.
+ *
+ */
+void md5_lanes(const char ** buffers, int count, size_t len, char ** outputs)
+{
+  const uint8_t * in[MD5_LANES];
+  uint8_t * out[MD5_LANES];
+  uint8_t unused[MD5_LANES][16];
+
+  // Unused lanes hash the first buffer again, the result is discarded
+  for (int l = 0; l < MD5_LANES; l++) {
+    if (l < count) {
+      in[l] = (const uint8_t *)buffers[l];
+      out[l] = (uint8_t *)outputs[l];
+    } else {
+      in[l] = (const uint8_t *)buffers[0];
+      out[l] = unused[l];
+    }
+  }
+
+  md5_lanes_impl(in, len, out);
+}
@@ -0,0 +1,68 @@
+/*
+  Copyright 2012-2021 Jyri J. Virkki <jyri@virkki.com>
+
+  This file is part of dupd.
+
+  dupd is free software: you can redistribute it and/or modify it
+  under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  dupd is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with dupd.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef _DUPD_HASH_LANES_H
+#define _DUPD_HASH_LANES_H
+
+#include <stddef.h>
+
+#define MD5_LANES 8
+
+
+/** ***************************************************************************
+ * Select the multi-lane implementation to use based on the features of
+ * the CPU we are running on. Must be called once before any threads use
+ * the other functions here.
+ *
+ * Parameters: none
+ *
+ * Return: none
+ *
+ */
+void hash_lanes_init();
+
+
+/** ***************************************************************************
+ * Return the name of the implementation selected by hash_lanes_init().
+ *
+ * Parameters: none
+ *
+ * Return: Name of the implementation (e.g. "avx2").
+ *
+ */
+const char * hash_lanes_impl_name();
+
+
+/** ***************************************************************************
+ * Compute the MD5 hash of up to MD5_LANES buffers of the same size at
+ * once, each buffer in its own SIMD lane.
+ *
+ * Parameters:
+ *    buffers - The buffers to hash.
+ *    count   - Number of buffers (1 to MD5_LANES).
+ *    len     - Size of each buffer.
+ *    outputs - Store the 16 byte hash of buffers[n] in outputs[n].
+ *
+ * Return: none
+ *
+ */
+void md5_lanes(const char ** buffers, int count, size_t len, char ** outputs);
+
+
+#endif
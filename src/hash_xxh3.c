@@ -0,0 +1,223 @@
+/*
+  Copyright 2012-2021 Jyri J. Virkki <jyri@virkki.com>
+
+  This file is part of dupd.
+
+  dupd is free software: you can redistribute it and/or modify it
+  under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  dupd is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with dupd.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "hash_xxh3.h"
+
+// On x86_64 all the SIMD variants are compiled in (each function with
+// its own target attribute) and the best one is picked at runtime, so
+// the binary does not depend on the CPU it was built on. Elsewhere the
+// compile time choice of xxh3.h (e.g. NEON on aarch64) is used.
+
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+#define XXH3_DISPATCH
+#define XXH_X86DISPATCH
+#define XXH_DISPATCH_AVX2 1
+#define XXH_DISPATCH_AVX512 1
+#define XXH_TARGET_SSE2 __attribute__((__target__("sse2")))
+#define XXH_TARGET_AVX2 __attribute__((__target__("avx2")))
+#define XXH_TARGET_AVX512 __attribute__((__target__("avx512f")))
+#include <immintrin.h>
+#endif
+
+#define XXH_INLINE_ALL
+#include "xxh3.h"
+
+
+struct xxh3_impl {
+  const char * name;
+  XXH64_hash_t (*long64)(const void *, size_t);
+  XXH128_hash_t (*long128)(const void *, size_t);
+  void (*update)(XXH3_state_t *, const xxh_u8 *, size_t);
+};
+
+// Generates the functions which differ by SIMD variant: the hashing of
+// long (> XXH3_MIDSIZE_MAX) buffers and the streaming update. Short
+// buffers and the final digest take the same path for all variants.
+#define XXH3_VARIANT(name, target, f_acc, f_scramble)                       \
+  XXH_NO_INLINE target XXH64_hash_t                                         \
+  long64_##name(const void * input, size_t len)                             \
+  {                                                                         \
+    return XXH3_hashLong_64b_internal(input, len, XXH3_kSecret,             \
+                                      sizeof(XXH3_kSecret),                 \
+                                      f_acc, f_scramble);                   \
+  }                                                                         \
+  XXH_NO_INLINE target XXH128_hash_t                                        \
+  long128_##name(const void * input, size_t len)                            \
+  {                                                                         \
+    return XXH3_hashLong_128b_internal(input, len, XXH3_kSecret,            \
+                                       sizeof(XXH3_kSecret),                \
+                                       f_acc, f_scramble);                  \
+  }                                                                         \
+  XXH_NO_INLINE target void                                                 \
+  update_##name(XXH3_state_t * state, const xxh_u8 * input, size_t len)     \
+  {                                                                         \
+    XXH3_update(state, input, len, f_acc, f_scramble);                      \
+  }                                                                         \
+  static const struct xxh3_impl impl_##name =                               \
+    { #name, long64_##name, long128_##name, update_##name };
+
+#ifdef XXH3_DISPATCH
+XXH3_VARIANT(avx512, XXH_TARGET_AVX512,
+             XXH3_accumulate_avx512, XXH3_scrambleAcc_avx512)
+XXH3_VARIANT(avx2, XXH_TARGET_AVX2,
+             XXH3_accumulate_avx2, XXH3_scrambleAcc_avx2)
+XXH3_VARIANT(sse2, XXH_TARGET_SSE2,
+             XXH3_accumulate_sse2, XXH3_scrambleAcc_sse2)
+#else
+#if XXH_VECTOR == XXH_NEON
+XXH3_VARIANT(neon, , XXH3_accumulate, XXH3_scrambleAcc)
+#define impl_native impl_neon
+#elif XXH_VECTOR == XXH_SCALAR
+XXH3_VARIANT(scalar, , XXH3_accumulate, XXH3_scrambleAcc)
+#define impl_native impl_scalar
+#else
+XXH3_VARIANT(native, , XXH3_accumulate, XXH3_scrambleAcc)
+#endif
+#endif
+
+static const struct xxh3_impl * impl = NULL;
+
+
+/** ***************************************************************************
+ * Public function, see header file.
+ *
+ */
+void xxh3_init()
+{
+#ifdef XXH3_DISPATCH
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx512f")) {
+    impl = &impl_avx512;
+  } else if (__builtin_cpu_supports("avx2")) {
+    impl = &impl_avx2;
+  } else {
+    impl = &impl_sse2;
+  }
+#else
+  impl = &impl_native;
+#endif
+}
+
+
+/** ***************************************************************************
+ * Public function, see header file.
+ *
+ */
+const char * xxh3_impl_name()
+{
+  return impl->name;
+}
+
+
+/** ***************************************************************************
+ * Public function, see header file.
+ *
+ */
+void xxh3_64_buf(const char * buffer, size_t bufsize, char * output)
+{
+  XXH64_hash_t result;
+
+  if (bufsize <= XXH3_MIDSIZE_MAX) {
+    result = XXH3_64bits(buffer, bufsize);
+  } else {
+    result = impl->long64(buffer, bufsize);
+  }
+  memcpy(output, &result, 8);
+}
+
+
+/** ***************************************************************************
+ * Public function, see header file.
+ *
+ */
+void xxh3_128_buf(const char * buffer, size_t bufsize, char * output)
+{
+  XXH128_hash_t result;
+
+  if (bufsize <= XXH3_MIDSIZE_MAX) {
+    result = XXH3_128bits(buffer, bufsize);
+  } else {
+    result = impl->long128(buffer, bufsize);
+  }
+  memcpy(output, &result.low64, 8);
+  memcpy(output + 8, &result.high64, 8);
+}
+
+
+/** ***************************************************************************
+ * Public function, see header file.
+ *
+ */
+void * xxh3_state_new()
+{
+  XXH3_state_t * state = XXH3_createState();
+  if (state == NULL) {                                       // LCOV_EXCL_START
+    printf("error: unable to allocate XXH3 state\n");
+    exit(1);
+  }                                                          // LCOV_EXCL_STOP
+  XXH3_64bits_reset(state);
+  return (void *)state;
+}
+
+
+/** ***************************************************************************
+ * Public function, see header file.
+ *
+ */
+void xxh3_state_update(void * state, const char * buffer, size_t bufsize)
+{
+  impl->update((XXH3_state_t *)state, (const xxh_u8 *)buffer, bufsize);
+}
+
+
+/** ***************************************************************************
+ * Public function, see header file.
+ *
+ */
+void xxh3_state_digest64(void * state, char * output)
+{
+  XXH64_hash_t result = XXH3_64bits_digest((XXH3_state_t *)state);
+  memcpy(output, &result, 8);
+}
+
+
+/** ***************************************************************************
+ * Public function, see header file.
+ *
+ */
+void xxh3_state_digest128(void * state, char * output)
+{
+  XXH128_hash_t result = XXH3_128bits_digest((XXH3_state_t *)state);
+  memcpy(output, &result.low64, 8);
+  memcpy(output + 8, &result.high64, 8);
+}
+
+
+/** ***************************************************************************
+ * Public function, see header file.
+ *
+ */
+void xxh3_state_free(void * state)
+{
+  XXH3_freeState((XXH3_state_t *)state);
+}
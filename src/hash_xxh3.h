@@ -0,0 +1,146 @@
+/*
+  Copyright 2012-2021 Jyri J. Virkki <jyri@virkki.com>
+
+  This file is part of dupd.
+
+  dupd is free software: you can redistribute it and/or modify it
+  under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  dupd is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with dupd.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef _DUPD_HASH_XXH3_H
+#define _DUPD_HASH_XXH3_H
+
+#include <stddef.h>
+
+
+/** ***************************************************************************
+ * Select the XXH3 implementation to use based on the features of the
+ * CPU we are running on. Must be called once before any threads use
+ * the other functions here.
+ *
+ * Parameters: none
+ *
+ * Return: none
+ *
+ */
+void xxh3_init();
+
+
+/** ***************************************************************************
+ * Return the name of the XXH3 implementation selected by xxh3_init().
+ *
+ * Parameters: none
+ *
+ * Return: Name of the implementation (e.g. "avx2").
+ *
+ */
+const char * xxh3_impl_name();
+
+
+/** ***************************************************************************
+ * Compute the XXH3 64 bit hash of a buffer. The 8 byte hash is stored
+ * in 'output'.
+ *
+ * Parameters:
+ *    buffer  - Read data from here.
+ *    bufsize - Size of buffer.
+ *    output  - Buffer where output will be stored.
+ *
+ * Return: none
+ *
+ */
+void xxh3_64_buf(const char * buffer, size_t bufsize, char * output);
+
+
+/** ***************************************************************************
+ * Compute the XXH3 128 bit hash of a buffer. The 16 byte hash is stored
+ * in 'output'.
+ *
+ * Parameters:
+ *    buffer  - Read data from here.
+ *    bufsize - Size of buffer.
+ *    output  - Buffer where output will be stored.
+ *
+ * Return: none
+ *
+ */
+void xxh3_128_buf(const char * buffer, size_t bufsize, char * output);
+
+
+/** ***************************************************************************
+ * Allocate and reset a streaming XXH3 state. The same state is used for
+ * both the 64 and 128 bit variants.
+ *
+ * Parameters: none
+ *
+ * Return: pointer to the state
+ *
+ */
+void * xxh3_state_new();
+
+
+/** ***************************************************************************
+ * Add data to a streaming XXH3 state.
+ *
+ * Parameters:
+ *    state   - State from xxh3_state_new().
+ *    buffer  - Read data from here.
+ *    bufsize - Size of buffer.
+ *
+ * Return: none
+ *
+ */
+void xxh3_state_update(void * state, const char * buffer, size_t bufsize);
+
+
+/** ***************************************************************************
+ * Store the 64 bit hash of the data added to the state so far. The
+ * state is not modified so more data can be added afterwards.
+ *
+ * Parameters:
+ *    state   - State from xxh3_state_new().
+ *    output  - Buffer where output (8 bytes) will be stored.
+ *
+ * Return: none
+ *
+ */
+void xxh3_state_digest64(void * state, char * output);
+
+
+/** ***************************************************************************
+ * Store the 128 bit hash of the data added to the state so far. The
+ * state is not modified so more data can be added afterwards.
+ *
+ * Parameters:
+ *    state   - State from xxh3_state_new().
+ *    output  - Buffer where output (16 bytes) will be stored.
+ *
+ * Return: none
+ *
+ */
+void xxh3_state_digest128(void * state, char * output);
+
+
+/** ***************************************************************************
+ * Free a streaming XXH3 state.
+ *
+ * Parameters:
+ *    state   - State from xxh3_state_new().
+ *
+ * Return: none
+ *
+ */
+void xxh3_state_free(void * state);
+
+
+#endif
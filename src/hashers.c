@@ -17,6 +17,8 @@
   along with dupd.  If not, see <http://www.gnu.org/licenses/>.
 */
 
+#include <string.h>
+
 #include "dbops.h"
 #include "dtrace.h"
 #include "dirtree.h"
@@ -29,6 +31,35 @@
 #include "stats.h"
 #include "utils.h"
 
+struct hasher_param {
+  int thread_num;
+  sqlite3 * dbh;
+  pthread_t thread;
+  pthread_mutex_t lock;
+  struct path_list_head ** list;
+  int capacity;
+  int bottom;
+  int top;
+  long steals;
+};
+
+// Sets with at most this many files left are compared instead of hashed
+#define DIRECT_COMPARE_MAX 3
+
+static struct hasher_param * hashers = NULL;
+static int hasher_count = 0;
+static int hash_queued = 0;
+static int hash_done = 0;
+static pthread_mutex_t hash_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t hash_cond = PTHREAD_COND_INITIALIZER;
+
+// Jobs offered by submit_hasher_job(), also under hash_lock
+#define JOB_LOCAL 0
+#define JOB_QUEUED 1
+#define JOB_RUNNING 2
+#define JOB_DONE 3
+static struct hasher_job * job_list = NULL;
+static pthread_cond_t job_done_cond = PTHREAD_COND_INITIALIZER;
 
 /** ***************************************************************************
  * Update hash with new data in buffer.
@@ -42,13 +73,182 @@
  */
 static void update_node_hash(struct path_list_entry * node, char * hash_out)
 {
+  struct path_read_state * rs = node->rs;
+
   // If this is the first block of data being hashed, need to initialize
-  if (node->hash_ctx == NULL) {
-    node->hash_ctx =  hash_fn_buf_init();
+  if (rs->hash_ctx == NULL) {
+    rs->hash_ctx =  hash_fn_buf_init();
+  }
+
+  hash_fn_buf_update(rs->hash_ctx, rs->buffer, rs->data_in_buffer);
+  hash_fn_get_partial(rs->hash_ctx, hash_out);
+}
+
+
+/** ***************************************************************************
+ * Drop the file data just hashed from the page cache (--drop-cache).
+ *
+ * Parameters:
+ *    node - The entry whose buffer was hashed.
+ *    path - Path of the entry.
+ *    size - Size of the file.
+ *
+ * Return: none
+ *
+ */
+static void drop_hashed_data(struct path_list_entry * node, char * path,
+                             uint64_t size)
+{
+  struct path_read_state * rs = node->rs;
+  uint64_t len = rs->data_in_buffer;
+
+  if (rs->direct || len > rs->next_read_byte) {
+    return;
+  }
+
+  uint64_t pos = rs->next_read_byte - len;
+  int fd = open_entry_fd(node, path);
+  if (fd >= 0) {
+    drop_cached_range(fd, pos, len);
+    release_entry_fd(node, fd, size, len, pos, 0);
+  }
+}
+
+
+/** ***************************************************************************
+ * Compare the buffers of a small set directly instead of hashing them.
+ * Each file gets the group number of the first file with identical data,
+ * which is then used in place of its hash. Sets whose hashes may be saved
+ * in the hash cache are not compared, they need the real hashes.
+ *
+ * Parameters:
+ *    size_node - The set, all remaining files in FS_BUFFER_READY.
+ *    groups    - Group of each FS_BUFFER_READY file, in path list order.
+ *
+ * Return: 1 if the set was compared, 0 if it needs to be hashed.
+ *
+ */
+static int compare_ready_buffers(struct size_list * size_node,
+                                 uint8_t * groups)
+{
+  struct path_list_entry * ready[DIRECT_COMPARE_MAX];
+  struct path_list_entry * node;
+  int count = 0;
+
+  if (use_hash_cache && size_node->size > cache_min_size) {
+    return 0;
+  }
+
+  node = pb_get_first_entry(size_node->path_list);
+  while (node != NULL) {
+    if (node->state == FS_BUFFER_READY) {
+      if (count == DIRECT_COMPARE_MAX) {
+        return 0;
+      }
+      ready[count++] = node;
+    }
+    node = node->next;
+  }
+
+  if (count < 2) {
+    return 0;
+  }
+
+  for (int i = 0; i < count; i++) {
+    groups[i] = i;
+    for (int j = 0; j < i; j++) {
+      if (groups[j] == j &&
+          ready[i]->rs->data_in_buffer == ready[j]->rs->data_in_buffer &&
+          !memcmp(ready[i]->rs->buffer, ready[j]->rs->buffer,
+                  ready[i]->rs->data_in_buffer)) {
+        groups[i] = j;
+        break;
+      }
+    }
+  }
+
+  if (count == 2) {
+    __atomic_fetch_add(&stats_two_file_compare, 1, __ATOMIC_RELAXED);
+  } else {
+    __atomic_fetch_add(&stats_three_file_compare, 1, __ATOMIC_RELAXED);
+  }
+
+  LOG(L_TRACE, "Compared %d buffers of size %" PRIu64 " directly\n",
+      count, size_node->size);
+
+  return 1;
+}
+
+
+/** ***************************************************************************
+ * Decide whether the ready buffers of a set can be hashed several at a
+ * time by hash_fn_buf_lanes(). This is possible when each buffer holds
+ * the entire file, so no hash context needs to be kept for later rounds.
+ *
+ * Parameters:
+ *    size_node - The set about to be hashed.
+ *
+ * Return: Number of lanes to use, 1 to hash one buffer at a time.
+ *
+ */
+static int set_hash_lanes(struct size_list * size_node)
+{
+  struct path_list_entry * node;
+  int count = 0;
+  int lanes = hash_get_lanes();
+
+  if (lanes < 2 || !size_node->fully_read) {
+    return 1;
+  }
+
+  node = pb_get_first_entry(size_node->path_list);
+  while (node != NULL) {
+    if (node->state == FS_BUFFER_READY) {
+      if (node->rs->hash_ctx != NULL) {
+        return 1;
+      }
+      count++;
+    }
+    node = node->next;
+  }
+
+  return count < 2 ? 1 : lanes;
+}
+
+
+/** ***************************************************************************
+ * Hash the buffers of the next (up to) 'lanes' ready entries, starting
+ * from node, all at once.
+ *
+ * Parameters:
+ *    node   - First entry to hash, must be FS_BUFFER_READY.
+ *    lanes  - Max number of entries to hash.
+ *    hashes - Store the hash of each entry here, in path list order.
+ *
+ * Return: Number of entries hashed.
+ *
+ */
+static int hash_ready_lanes(struct path_list_entry * node, int lanes,
+                            char hashes[][HASH_MAX_BUFSIZE])
+{
+  const char * buffers[HASH_MAX_LANES];
+  char * outputs[HASH_MAX_LANES];
+  uint32_t len = node->rs->data_in_buffer;
+  int count = 0;
+
+  while (node != NULL && count < lanes) {
+    if (node->state == FS_BUFFER_READY) {
+      buffers[count] = node->rs->buffer;
+      outputs[count] = hashes[count];
+      count++;
+    }
+    node = node->next;
   }
 
-  hash_fn_buf_update(node->hash_ctx, node->buffer, node->data_in_buffer);
-  hash_fn_get_partial(node->hash_ctx, hash_out);
+  hash_fn_buf_lanes(buffers, count, (int)len, outputs);
+  __atomic_fetch_add(&stats_lane_hashed, count, __ATOMIC_RELAXED);
+
+  return count;
 }
 
 
@@ -74,6 +274,16 @@ static int build_hash_list_round(sqlite3 * dbh,
   struct path_list_entry * node;
   int completed = 0;
   uint32_t prev_buffer = 0;
+  uint8_t groups[DIRECT_COMPARE_MAX];
+  int ready = 0;
+
+  char lane_hashes[HASH_MAX_LANES][HASH_MAX_BUFSIZE];
+  int lane = 0;
+  int lane_count = 0;
+
+  // Compare before any (mmap) buffers are released below
+  int compared = compare_ready_buffers(size_node, groups);
+  int lanes = compared ? 1 : set_hash_lanes(size_node);
 
   node = pb_get_first_entry(size_node->path_list);
 
@@ -85,9 +295,26 @@ static int build_hash_list_round(sqlite3 * dbh,
   do {
 
     if (node->state == FS_BUFFER_READY) {
-      update_node_hash(node, hash_out);
+      if (compared) {
+        memset(hash_out, 0, hash_bufsize);
+        hash_out[hash_bufsize - 1] = groups[ready++];
+      } else if (lanes > 1) {
+        // Hash the next few buffers together (their windows are only
+        // unmapped as each entry is processed here)
+        if (lane == lane_count) {
+          lane_count = hash_ready_lanes(node, lanes, lane_hashes);
+          lane = 0;
+        }
+        memcpy(hash_out, lane_hashes[lane++], hash_bufsize);
+      } else {
+        update_node_hash(node, hash_out);
+      }
       add_to_hash_table(hl, node, hash_out);
       build_path(node, file);
+      unmap_read_window(file, size_node->size, node->rs);
+      if (drop_cache) {
+        drop_hashed_data(node, file, size_node->size);
+      }
       node->state = FS_NEED_DATA;
       dtrace_set_state(file, size_node->size, FS_BUFFER_READY, FS_NEED_DATA);
 
@@ -95,20 +322,20 @@ static int build_hash_list_round(sqlite3 * dbh,
       // If applicable, save in hash cache. Note if the large file differed
       // only in the final block we may have unique files but since we
       // went to the trouble of hashing them fully, cache it now.
-      if (size_node->fully_read && use_hash_cache &&
+      if (!compared && size_node->fully_read && use_hash_cache &&
           size_node->size > cache_min_size) {
         cache_db_add_entry(file, hash_out, hash_bufsize);
       }
 
-      if (prev_buffer > 0 && node->data_in_buffer != prev_buffer) {
+      if (prev_buffer > 0 && node->rs->data_in_buffer != prev_buffer) {
         printf("error: inconsistent amount of data in buffers\n");
         dump_path_list("bad state", size_node->size, size_node->path_list, 1);
         exit(1);
       }
 
-      prev_buffer = node->data_in_buffer;
-      node->data_in_buffer = 0;
-      node->next_buffer_pos = 0;
+      prev_buffer = node->rs->data_in_buffer;
+      node->rs->data_in_buffer = 0;
+      node->rs->next_buffer_pos = 0;
     }
 
     node = node->next;
@@ -175,10 +402,148 @@ static int build_hash_list_round(sqlite3 * dbh,
 
 
 /** ***************************************************************************
- * Public function, see header file.
+ * Take one path list off a hasher queue.
+ *
+ * The owner takes the most recently queued set, other hashers steal the
+ * oldest one.
+ *
+ * Parameters:
+ *    h     - The hasher which owns the queue.
+ *    steal - If true, take from the bottom instead of the top.
+ *
+ * Return: The path list, or NULL if the queue was empty.
+ *
+ */
+static struct path_list_head * hasher_take(struct hasher_param * h, int steal)
+{
+  struct path_list_head * entry = NULL;
+
+  d_mutex_lock(&h->lock, "hasher_take");
+  if (h->top > h->bottom) {
+    if (steal) {
+      entry = h->list[h->bottom];
+      h->bottom++;
+    } else {
+      h->top--;
+      entry = h->list[h->top];
+    }
+    if (h->top == h->bottom) {
+      h->top = 0;
+      h->bottom = 0;
+    }
+    stats_hasher_queue_len[h->thread_num] = h->top - h->bottom;
+  }
+  d_mutex_unlock(&h->lock);
+
+  if (entry != NULL) {
+    d_mutex_lock(&hash_lock, "hasher_take queued");
+    hash_queued--;
+    d_mutex_unlock(&hash_lock);
+  }
+
+  return entry;
+}
+
+
+/** ***************************************************************************
+ * Run a job offered with submit_hasher_job(), if there is one.
+ *
+ * Return: 1 if a job was run.
+ *
+ */
+static int run_hasher_job()
+{
+  struct hasher_job * job;
+
+  if (__atomic_load_n(&job_list, __ATOMIC_RELAXED) == NULL) {
+    return 0;
+  }
+
+  d_mutex_lock(&hash_lock, "run_hasher_job");
+  job = job_list;
+  if (job != NULL) {
+    __atomic_store_n(&job_list, job->next, __ATOMIC_RELAXED);
+    job->state = JOB_RUNNING;
+  }
+  d_mutex_unlock(&hash_lock);
+
+  if (job == NULL) {
+    return 0;
+  }
+
+  job->run(job->arg);
+
+  d_mutex_lock(&hash_lock, "run_hasher_job done");
+  job->state = JOB_DONE;
+  d_cond_broadcast(&job_done_cond);
+  d_mutex_unlock(&hash_lock);
+
+  return 1;
+}
+
+
+/** ***************************************************************************
+ * Get the next path list for this hasher. Looks in its own queue first,
+ * then tries to steal from the other hashers. Jobs offered with
+ * submit_hasher_job() are run in between. If there is nothing to do,
+ * waits until either more sets or jobs are queued or the readers are done.
+ *
+ * Parameters:
+ *    h - The hasher looking for work.
+ *
+ * Return: The path list, or NULL if all work is done.
+ *
+ */
+static struct path_list_head * hasher_next(struct hasher_param * h)
+{
+  struct path_list_head * entry;
+
+  while (1) {
+
+    // Jobs come first, their submitter is waiting for them
+    if (run_hasher_job()) {
+      continue;
+    }
+
+    entry = hasher_take(h, 0);
+    if (entry != NULL) {
+      return entry;
+    }
+
+    for (int i = 1; i < hasher_count; i++) {
+      struct hasher_param * victim = &hashers[(h->thread_num + i) %
+                                              hasher_count];
+      entry = hasher_take(victim, 1);
+      if (entry != NULL) {
+        h->steals++;
+        LOG(L_MORE_THREADS, "Stole set of size %" PRIu64 " from hasher %d\n",
+            entry->sizelist->size, victim->thread_num);
+        return entry;
+      }
+    }
+
+    d_mutex_lock(&hash_lock, "hasher_next");
+    if (hash_queued == 0 && job_list == NULL) {
+      if (hash_done) {
+        d_mutex_unlock(&hash_lock);
+        return NULL;
+      }
+      d_cond_wait(&hash_cond, &hash_lock);
+    }
+    d_mutex_unlock(&hash_lock);
+  }
+}
+
+
+/** ***************************************************************************
+ * Hashes incoming file data during initial round.
+ *
+ * Parameters: arg points to a struct hasher_param.
+ *
+ * Return: none
  *
  */
-void * round1_hasher(void * arg)
+static void * round1_hasher(void * arg)
 {
   struct hasher_param * info = (struct hasher_param *)arg;
   struct path_list_head * entry = NULL;
@@ -186,7 +551,6 @@ void * round1_hasher(void * arg)
   sqlite3 * dbh = info->dbh;
   int set_completed;
   int path_count;
-  int done = 0;
   char self[80];
   struct hash_table * ht = init_hash_table();
 
@@ -194,64 +558,186 @@ void * round1_hasher(void * arg)
   pthread_setspecific(thread_name, self);
   LOG(L_THREADS, "Thread created\n");
 
-  do {
+  while ((entry = hasher_next(info)) != NULL) {
 
-    entry = NULL;
+    size_node = entry->sizelist;
+    d_mutex_lock(&size_node->lock, "hasher");
 
-    // Get an entry from my queue or wait for it.
-    // The reader thread adds path list entries to my work queue.
+    LOG_THREADS {
+      LOG(L_THREADS, "Set (%d files of size %" PRIu64 ") pass %d\n",
+          size_node->path_list->list_size, size_node->size,
+          1 + size_node->path_list->hash_passes);
+    }
 
-    d_mutex_lock(&info->queue_lock, "R1-hasher-get");
+    reset_hash_table(ht);
+    set_completed = build_hash_list_round(dbh, size_node, ht);
 
-    while (info->done == 0 && info->queue_pos < 0) {
-      d_cond_wait(&info->queue_cond, &info->queue_lock);
+    if (set_completed) {
+      path_count = size_node->path_list->list_size;
+      show_processed(s_stats_size_list_count, path_count, size_node->size);
     }
 
-    if (info->queue_pos >= 0) {
-      entry = info->queue[info->queue_pos];
-      info->queue[info->queue_pos] = NULL;
-      LOG(L_THREADS, "Grabbed path list from queue(%d) position %d\n",
-          info->thread_num, info->queue_pos);
-      info->queue_pos--;
-      stats_hasher_queue_len[info->thread_num] = info->queue_pos;
-    }
+    // The set either needs more data or is done, readers can continue
+    release_parked_reads(size_node);
+
+    d_mutex_unlock(&size_node->lock);
+  }
+
+  free_hash_table(ht);
+  free_path_buffer();
 
-    if (info->done == 1 && info->queue_pos == -1) {
-      LOG(L_THREADS, "My queue is empty (pos=%d) and done=%d.\n",
-          info->queue_pos, info->done);
-      done = 1;
+  LOG(L_THREADS, "DONE, stole %ld sets\n", info->steals);
+
+  return NULL;
+}
+
+
+/** ***************************************************************************
+ * Public function, see header file.
+ *
+ */
+void start_hashers(sqlite3 * dbh, int count)
+{
+  int initial_size = 50;
+
+  if (x_small_buffers) { initial_size = 2; }
+
+  hasher_count = count;
+  hash_queued = 0;
+  hash_done = 0;
+  hashers = (struct hasher_param *)calloc(count, sizeof(struct hasher_param));
+
+  for (int n = 0; n < count; n++) {
+    hashers[n].thread_num = n;
+    hashers[n].dbh = dbh;
+    pthread_mutex_init(&hashers[n].lock, NULL);
+    hashers[n].capacity = initial_size;
+    hashers[n].list = (struct path_list_head **)
+      malloc(initial_size * sizeof(struct path_list_head *));
+  }
+
+  LOG(L_THREADS, "Starting %d hasher threads...\n", count);
+  for (int n = 0; n < count; n++) {
+    d_create(&hashers[n].thread, round1_hasher, &hashers[n]);
+  }
+}
+
+
+/** ***************************************************************************
+ * Public function, see header file.
+ *
+ */
+void submit_path_list(int thread, struct path_list_head * pathlist_head)
+{
+  struct hasher_param * h = &hashers[thread % hasher_count];
+
+  LOG(L_THREADS, "Inserting set (%d files of size %" PRIu64
+      ") pass %d in state %s into hasher queue %d\n",
+      pathlist_head->list_size, pathlist_head->sizelist->size,
+      pathlist_head->hash_passes, pls_state(pathlist_head->state),
+      h->thread_num);
+
+  d_mutex_lock(&h->lock, "submit_path_list");
+
+  if (h->top == h->capacity) {
+    if (h->bottom > 0) {
+      // Entries below bottom were stolen, reclaim that space first
+      memmove(h->list, h->list + h->bottom,
+              (h->top - h->bottom) * sizeof(struct path_list_head *));
+      h->top -= h->bottom;
+      h->bottom = 0;
+    } else {
+      h->capacity *= 2;
+      h->list = (struct path_list_head **)
+        realloc(h->list, h->capacity * sizeof(struct path_list_head *));
+      LOG(L_RESOURCES, "Increased hasher queue(%d) to %d entries\n",
+          h->thread_num, h->capacity);
     }
+  }
 
-    d_mutex_unlock(&info->queue_lock);
+  h->list[h->top] = pathlist_head;
+  h->top++;
+  stats_hasher_queue_len[h->thread_num] = h->top - h->bottom;
 
-    if (entry != NULL) {
+  d_mutex_unlock(&h->lock);
 
-      size_node = entry->sizelist;
-      d_mutex_lock(&size_node->lock, "hasher");
+  // Wake up one idle hasher, whichever one it is can steal the set
+  d_mutex_lock(&hash_lock, "submit_path_list queued");
+  hash_queued++;
+  d_cond_signal(&hash_cond);
+  d_mutex_unlock(&hash_lock);
+}
+
+
+/** ***************************************************************************
+ * Public function, see header file.
+ *
+ */
+void submit_hasher_job(struct hasher_job * job)
+{
+  if (hasher_count == 0) {
+    job->state = JOB_LOCAL;
+    return;
+  }
+
+  d_mutex_lock(&hash_lock, "submit_hasher_job");
+  job->state = JOB_QUEUED;
+  job->next = job_list;
+  __atomic_store_n(&job_list, job, __ATOMIC_RELAXED);
+  d_cond_signal(&hash_cond);
+  d_mutex_unlock(&hash_lock);
+}
 
-      LOG_THREADS {
-        LOG(L_THREADS, "Set (%d files of size %" PRIu64 ") pass %d\n",
-            size_node->path_list->list_size, size_node->size,
-            1 + size_node->path_list->hash_passes);
-      }
 
-      reset_hash_table(ht);
-      set_completed = build_hash_list_round(dbh, size_node, ht);
+/** ***************************************************************************
+ * Public function, see header file.
+ *
+ */
+void finish_hasher_job(struct hasher_job * job)
+{
+  if (job->state != JOB_LOCAL) {
+    d_mutex_lock(&hash_lock, "finish_hasher_job");
 
-      if (set_completed) {
-        path_count = size_node->path_list->list_size;
-        show_processed(s_stats_size_list_count, path_count, size_node->size);
+    if (job->state != JOB_QUEUED) {
+      // A hasher took it, wait for it to be done
+      while (job->state != JOB_DONE) {
+        d_cond_wait(&job_done_cond, &hash_lock);
       }
+      d_mutex_unlock(&hash_lock);
+      return;
+    }
 
-      d_mutex_unlock(&size_node->lock);
+    // Nobody took it, take it back
+    struct hasher_job * * prev = &job_list;
+    while (*prev != job) {
+      prev = &(*prev)->next;
+    }
+    __atomic_store_n(prev, job->next, __ATOMIC_RELAXED);
+    d_mutex_unlock(&hash_lock);
+  }
 
-    } // if entry != NULL
-  } while (!done);
+  job->run(job->arg);
+}
 
-  free_hash_table(ht);
-  free_path_buffer();
 
-  LOG(L_THREADS, "DONE\n");
+/** ***************************************************************************
+ * Public function, see header file.
+ *
+ */
+void stop_hashers()
+{
+  d_mutex_lock(&hash_lock, "stop_hashers");
+  hash_done = 1;
+  d_cond_broadcast(&hash_cond);
+  d_mutex_unlock(&hash_lock);
+
+  for (int n = 0; n < hasher_count; n++) {
+    d_join(hashers[n].thread, NULL);
+    LOG(L_THREADS, "Joined hasher thread %d\n", n);
+    free(hashers[n].list);
+  }
 
-  return NULL;
+  free(hashers);
+  hashers = NULL;
+  hasher_count = 0;
 }
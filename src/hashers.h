@@ -23,28 +23,84 @@
 #include <pthread.h>
 #include <sqlite3.h>
 
-struct hasher_param {
-  int thread_num;
-  int done;
-  sqlite3 * dbh;
-  pthread_t thread;
-  pthread_mutex_t queue_lock;
-  pthread_cond_t queue_cond;
-  int queue_pos;
-  int size;
-  struct path_list_head ** queue;
+#include "paths.h"
+
+// A piece of work (e.g. half of a BLAKE3 subtree) a hasher thread can do
+// on behalf of another thread, see submit_hasher_job().
+struct hasher_job {
+  void (*run)(void * arg);
+  void * arg;
+  struct hasher_job * next;
+  int state;
 };
 
+/** ***************************************************************************
+ * Start the hasher threads. Each hasher has its own queue of sets ready to
+ * be hashed and, when it runs out, takes sets from the queues of the other
+ * hashers.
+ *
+ * Parameters:
+ *    dbh   - Database pointer.
+ *    count - Number of hasher threads.
+ *
+ * Return: none
+ *
+ */
+void start_hashers(sqlite3 * dbh, int count);
+
+
+/** ***************************************************************************
+ * Add a path list to the queue of a hasher thread.
+ *
+ * Parameters:
+ *    thread        - Add it to this thread's queue (modulo hasher count).
+ *    pathlist_head - Add this pathlist to the queue.
+ *
+ * Return: none
+ *
+ */
+void submit_path_list(int thread, struct path_list_head * pathlist_head);
+
+
+/** ***************************************************************************
+ * Offer a piece of work to the hasher threads, so an idle hasher can do
+ * it while the caller does something else. The caller must then call
+ * finish_hasher_job(). If the hashers are not running, the job is left
+ * for finish_hasher_job() to run.
+ *
+ * Parameters:
+ *    job - The job, with run and arg set. Must stay valid until
+ *          finish_hasher_job() returns.
+ *
+ * Return: none
+ *
+ */
+void submit_hasher_job(struct hasher_job * job);
+
+
+/** ***************************************************************************
+ * Complete a job from submit_hasher_job(). If no hasher has taken it yet,
+ * it is run by the caller, otherwise wait for the hasher to finish it.
+ *
+ * Parameters:
+ *    job - The job.
+ *
+ * Return: none
+ *
+ */
+void finish_hasher_job(struct hasher_job * job);
+
 
 /** ***************************************************************************
- * Hashes incoming file data during initial round.
+ * Tell the hasher threads no more sets will be submitted and wait for
+ * them to finish the ones queued.
  *
- * Parameters: arg points to a struct hasher_param.
+ * Parameters: none
  *
  * Return: none
  *
  */
-void * round1_hasher(void * arg);
+void stop_hashers();
 
 
 #endif
@@ -25,9 +25,14 @@
 #include <unistd.h>
 
 #include "cache.h"
+#include "checkpoint.h"
 #include "copying.h"
+#include "exclude.h"
 #include "filecompare.h"
 #include "hash.h"
+#include "hash_evp.h"
+#include "hash_lanes.h"
+#include "hash_xxh3.h"
 #include "hashlist.h"
 #include "info.h"
 #include "main.h"
@@ -43,6 +48,7 @@
 #include "stats.h"
 #include "testing.h"
 #include "utils.h"
+#include "watch.h"
 
 #define MAX_START_PATH 10
 #define START_PATH_NULL 0
@@ -57,6 +63,7 @@ static int free_cache_db_path = 0;
 static int free_file_path = 0;
 int log_level = 1;
 char * start_path[MAX_START_PATH];
+int start_path_default = 0;
 char * file_path = NULL;
 char * db_path = NULL;
 char * cache_db_path = NULL;
@@ -82,6 +89,15 @@ char * path_sep_string = NULL;
 int x_small_buffers = 0;
 int only_testing = 0;
 int threaded_sizetree = 1;
+int scan_threads = 0;
+int stat_threads = 0;
+int hash_threads = 0;
+int use_uring = 1;
+int use_mmap = 0;
+int direct_io = 0;
+int prefetch_window = 32;
+int drop_cache = 0;
+int device_type = DEVICE_TYPE_AUTO;
 int hardlink_is_unique = 0;
 int hash_function = -1;
 int hash_bufsize = -1;
@@ -93,6 +109,12 @@ pthread_mutex_t logger_lock = PTHREAD_MUTEX_INITIALIZER;
 int sort_bypass = 0;
 uint64_t buffer_limit = 0;
 int one_file_system = 0;
+int incremental_scan = 0;
+int checkpoint_interval = 0;
+int resume_scan = 0;
+int sample_round = 0;
+int scan_interrupted = 0;
+int x_checkpoint_exit = 0;
 int using_fiemap = 0;
 int max_open_files = 0;
 uint64_t cache_min_size = 0;
@@ -163,6 +185,17 @@ static void show_usage()
 }
 
 
+/** ***************************************************************************
+ * Callback called by optgen whenever an 'exclude' arg is seen.
+ */
+int opt_add_exclude(char * arg, int command)
+{
+  (void)command;
+  add_exclude(arg);
+  return OPTGEN_CALLBACK_OK;
+}
+
+
 /** ***************************************************************************
  * Callback called by optgen whenever a 'path' arg is seen.
  */
@@ -279,6 +312,7 @@ static int process_args(int argc, char * argv[])
       return 2;
     }
     start_path_count = 1;
+    start_path_default = 1;
     LOG(L_INFO, "Defaulting --path to [%s]\n", start_path[0]);
   }
 
@@ -315,8 +349,16 @@ static int process_args(int argc, char * argv[])
   if (options[OPT_hardlink]) { rmsh_link = RMSH_LINK_HARD; }
   if (options[OPT_hidden]) { scan_hidden = 1; }
   if (options[OPT_no_thread_scan]) { threaded_sizetree = 0; }
+  if (options[OPT_no_uring]) { use_uring = 0; }
+  if (options[OPT_mmap]) { use_mmap = 1; }
+  if (options[OPT_direct_io]) { direct_io = 1; }
+  if (options[OPT_drop_cache]) { drop_cache = 1; }
   if (options[OPT_hardlink_is_unique]) { hardlink_is_unique = 1; }
   if (options[OPT_one_file_system]) { one_file_system = 1; }
+  if (options[OPT_incremental]) { incremental_scan = 1; }
+  if (options[OPT_resume]) { resume_scan = 1; }
+  if (options[OPT_sample]) { sample_round = 1; }
+  if (options[OPT_x_checkpoint_exit]) { x_checkpoint_exit = 1; }
   if (options[OPT_x_no_cache]) { use_hash_cache = 0; }
   if (options[OPT_delete]) { cache_delete = 1; }
   if (options[OPT_ls]) { cache_ls = 1; }
@@ -335,6 +377,38 @@ static int process_args(int argc, char * argv[])
 
   debug_size = opt_int(options[OPT_debug_size], debug_size);
 
+  // Directory reads are mostly waiting on the filesystem so a few walker
+  // threads help even on small machines, but past a handful they mostly
+  // contend on the feed lock.
+  scan_threads = opt_int(options[OPT_scan_threads], scan_threads);
+  if (scan_threads == 0) {
+    scan_threads = cpu_cores();
+    if (scan_threads > 8) { scan_threads = 8; }
+  }
+  if (scan_threads < 1) { scan_threads = 1; }
+  LOG(L_INFO, "Directory walker threads: %d\n", scan_threads);
+
+  stat_threads = opt_int(options[OPT_stat_threads], stat_threads);
+  if (stat_threads == 0) {
+    stat_threads = cpu_cores();
+    if (stat_threads > 8) { stat_threads = 8; }
+  }
+  if (stat_threads < 1) { stat_threads = 1; }
+  LOG(L_INFO, "Sizetree worker threads: %d\n", stat_threads);
+
+  prefetch_window = opt_int(options[OPT_prefetch], prefetch_window);
+  if (prefetch_window < 0) { prefetch_window = 0; }
+
+  hash_threads = opt_int(options[OPT_hash_threads], hash_threads);
+  if (hash_threads == 0) { hash_threads = cpu_cores(); }
+  if (hash_threads > MAX_HASHER_THREADS) { hash_threads = MAX_HASHER_THREADS; }
+  if (hash_threads < 1) { hash_threads = 1; }
+  LOG(L_INFO, "Hasher threads: %d\n", hash_threads);
+
+  checkpoint_interval = opt_int(options[OPT_checkpoint], checkpoint_interval);
+  if (checkpoint_interval < 0) { checkpoint_interval = 0; }
+  if (resume_scan && checkpoint_interval == 0) { checkpoint_interval = 60; }
+
   cut_path = options[OPT_cut];
 
   exclude_path = options[OPT_exclude_path];
@@ -343,6 +417,11 @@ static int process_args(int argc, char * argv[])
     return 2;
   }
 
+  if (use_mmap && direct_io) {
+    printf("error: --mmap and --direct-io can't be used together\n");
+    return 2;
+  }
+
   stats_file = options[OPT_stats_file];
   trace_file = options[OPT_trace_mem];
   info_extents_path = options[OPT_x_extents];
@@ -354,7 +433,7 @@ static int process_args(int argc, char * argv[])
   path_sep_string[0] = (char)path_separator;
   path_sep_string[1] = 0;
 
-  char * hash_name = opt_string(options[OPT_hash], "xxhash");
+  char * hash_name = opt_string(options[OPT_hash], "xxh3");
   if (!strcmp("md5", hash_name)) {
     hash_function = HASH_FN_MD5;
   } else if (!strcmp("sha1", hash_name)) {
@@ -363,12 +442,37 @@ static int process_args(int argc, char * argv[])
     hash_function = HASH_FN_SHA512;
   } else if (!strcmp("xxhash", hash_name)) {
     hash_function = HASH_FN_XXHASH;
+  } else if (!strcmp("xxh3", hash_name)) {
+    hash_function = HASH_FN_XXH3_64;
+  } else if (!strcmp("xxh128", hash_name)) {
+    hash_function = HASH_FN_XXH3_128;
+  } else if (!strcmp("blake3", hash_name)) {
+    hash_function = HASH_FN_BLAKE3;
   } else {
     printf("error: unknown hash %s\n", hash_name);
     return 2;
   }
   hash_bufsize = hash_get_bufsize(hash_function);
 
+  xxh3_init();
+  if (hash_function == HASH_FN_XXH3_64 || hash_function == HASH_FN_XXH3_128) {
+    LOG(L_INFO, "Using %s XXH3 implementation\n", xxh3_impl_name());
+  }
+  if (hash_function == HASH_FN_MD5 || hash_function == HASH_FN_SHA1 ||
+      hash_function == HASH_FN_SHA512) {
+    evp_init();
+    LOG_INFO {
+      int speed = evp_benchmark();
+      LOG(L_INFO, "Using %s digest implementation (%d MB/s), "
+          "CPU supports: %s\n", evp_impl_name(), speed, evp_cpu_features());
+    }
+  }
+  hash_lanes_init();
+  if (hash_get_lanes() > 1) {
+    LOG(L_INFO, "Using %s multi-lane implementation (%d lanes)\n",
+        hash_lanes_impl_name(), hash_get_lanes());
+  }
+
   char * report_format_name = opt_string(options[OPT_format], "text");
   if (!strcmp("text", report_format_name)) {
     report_format = REPORT_FORMAT_TEXT;
@@ -420,6 +524,16 @@ static int process_args(int argc, char * argv[])
     }
   }
 
+  char * devtype = opt_string(options[OPT_device_type], "auto");
+  if (!strcmp("hdd", devtype)) {
+    device_type = DEVICE_TYPE_HDD;
+  } else if (!strcmp("ssd", devtype)) {
+    device_type = DEVICE_TYPE_SSD;
+  } else if (strcmp("auto", devtype)) {
+    printf("error: unknown device type %s\n", devtype);
+    return 2;
+  }
+
   char * sortby = opt_string(options[OPT_sort_by], "def");
   if (!strcmp("inode", sortby)) {
     sort_bypass = SORT_BY_INODE;
@@ -500,6 +614,16 @@ void handle_signal(int sig)
 
   } else if (sig == SIGUSR2) {
     dump_state = 1;
+
+  } else if (sig == SIGINT || sig == SIGTERM) {
+    // Once a checkpoint exists, let the checkpoint thread save progress
+    // before exiting. Otherwise there is nothing to save, just exit.
+    if (checkpoint_active()) {
+      scan_interrupted = 1;
+    } else {
+      signal(sig, SIG_DFL);
+      raise(sig);
+    }
   }
 }
 
@@ -545,6 +669,10 @@ int main(int argc, char * argv[])
 
   signal(SIGUSR1, &handle_signal);
   signal(SIGUSR2, &handle_signal);
+  if (operation == COMMAND_scan && checkpoint_interval > 0) {
+    signal(SIGINT, &handle_signal);
+    signal(SIGTERM, &handle_signal);
+  }
 
   if (trace_file != NULL) {
     trace_file_fd = open(trace_file, O_CREAT | O_TRUNC | O_APPEND | O_WRONLY,
@@ -558,6 +686,7 @@ int main(int argc, char * argv[])
   switch (operation) {
 
     case COMMAND_scan:      scan();                      break;
+    case COMMAND_watch:     rv = operation_watch();      break;
     case COMMAND_refresh:   operation_refresh();         break;
     case COMMAND_report:    operation_report();          break;
     case COMMAND_uniques:   operation_uniques();         break;
@@ -593,6 +722,7 @@ int main(int argc, char * argv[])
   free_filecompare();
   free_scanlist();
   free_start_paths();
+  free_excludes();
   free_read_list();
   free_dirtree();
   free_path_buffer();
@@ -109,6 +109,13 @@ extern pthread_mutex_t logger_lock;
 extern char * start_path[];
 
 
+/** ***************************************************************************
+ * True if no --path was given and start_path is the current directory.
+ *
+ */
+extern int start_path_default;
+
+
 /** ***************************************************************************
  * A file specified by the user.
  *
@@ -249,6 +256,78 @@ extern int only_testing;
 extern int threaded_sizetree;
 
 
+/** ***************************************************************************
+ * Number of threads reading directories during scan. If 1, the
+ * directory tree is walked by the main thread.
+ *
+ */
+extern int scan_threads;
+
+
+/** ***************************************************************************
+ * Number of threads which stat files and add them to the size index
+ * during a threaded scan.
+ *
+ */
+extern int stat_threads;
+
+
+/** ***************************************************************************
+ * Number of threads hashing file data while sets are being processed.
+ *
+ */
+extern int hash_threads;
+
+
+/** ***************************************************************************
+ * If true, use io_uring (where available) to batch system calls.
+ *
+ */
+extern int use_uring;
+
+
+/** ***************************************************************************
+ * If true, hash file data from memory mapped windows of the files instead
+ * of reading it into buffers.
+ *
+ */
+extern int use_mmap;
+
+
+/** ***************************************************************************
+ * If true, read file data with O_DIRECT (where supported) so the scan
+ * doesn't fill the page cache.
+ *
+ */
+extern int direct_io;
+
+
+/** ***************************************************************************
+ * How many read list entries ahead of the current one the reader tells
+ * the kernel about (0 to disable).
+ *
+ */
+extern int prefetch_window;
+
+
+/** ***************************************************************************
+ * If true, drop file data from the page cache once it has been hashed.
+ *
+ */
+extern int drop_cache;
+
+
+/** ***************************************************************************
+ * How to read each device. By default this is detected per device, see
+ * read_device_index(). Can be forced for all devices with --device-type.
+ *
+ */
+extern int device_type;
+#define DEVICE_TYPE_AUTO 0
+#define DEVICE_TYPE_HDD 1
+#define DEVICE_TYPE_SSD 2
+
+
 /** ***************************************************************************
  * If database is older than this, show a warning.
  *
@@ -341,6 +420,51 @@ extern uint64_t buffer_limit;
 extern int one_file_system;
 
 
+/** ***************************************************************************
+ * If true, reuse the listings of directories unchanged since the previous
+ * scan (see dirindex.h).
+ *
+ */
+extern int incremental_scan;
+
+
+/** ***************************************************************************
+ * If non-zero, save the scan state every this many seconds so an
+ * interrupted scan can be resumed (see checkpoint.h).
+ *
+ */
+extern int checkpoint_interval;
+
+
+/** ***************************************************************************
+ * If true, continue the previous scan from its checkpoint.
+ *
+ */
+extern int resume_scan;
+
+
+/** ***************************************************************************
+ * If true, large size sets are first narrowed down by sampling a few
+ * small blocks from each file (see process_sampled_sets()).
+ *
+ */
+extern int sample_round;
+
+
+/** ***************************************************************************
+ * Set (via SIGINT or SIGTERM) when a checkpointed scan should stop.
+ *
+ */
+extern int scan_interrupted;
+
+
+/** ***************************************************************************
+ * If true, exit right after saving the scan checkpoint. For testing only.
+ *
+ */
+extern int x_checkpoint_exit;
+
+
 /** ***************************************************************************
  * Limit of open files.
  *
@@ -28,4 +28,11 @@
 int opt_add_path(char * arg, int command);
 
 
+/** ***************************************************************************
+ * Callback called by optgen whenever an exclude argument is processed.
+ *
+ */
+int opt_add_exclude(char * arg, int command);
+
+
 #endif
@@ -48,15 +48,30 @@
 char * numstring[] = { "1","2","3","4","5","6","7","8","9","10","11","12","13","14","15","16","17","18","19","20","21","22","23","24","25","26","27","28","29","30","31","32","33","34","35","36","37","38","39","40","41","42","43","44","45","46","47","48","49","50", "X" };
 
 // For each option, list the commands which accept it
-int option_path[] = { 1, 5, 6, 7 };
+int option_path[] = { 1, 2, 6, 7, 8 };
 int option_stats_file[] = { 1 };
-int option_minsize[] = { 1, 3 };
-int option_hidden[] = { 1 };
+int option_minsize[] = { 1, 2, 4 };
+int option_hidden[] = { 1, 2 };
+int option_exclude[] = { 1, 2 };
 int option_buflimit[] = { 1 };
+int option_mmap[] = { 1 };
+int option_direct_io[] = { 1 };
+int option_prefetch[] = { 1 };
+int option_drop_cache[] = { 1 };
+int option_device_type[] = { 1 };
 int option_one_file_system[] = { 1 };
 int option_trace_mem[] = { 1 };
-int option_hardlink_is_unique[] = { 1, 4, 5, 6, 7 };
+int option_hardlink_is_unique[] = { 1, 5, 6, 7, 8 };
+int option_scan_threads[] = { 1 };
+int option_stat_threads[] = { 1 };
+int option_hash_threads[] = { 1 };
+int option_incremental[] = { 1 };
+int option_checkpoint[] = { 1 };
+int option_resume[] = { 1 };
+int option_sample[] = { 1 };
+int option_x_checkpoint_exit[] = { 1 };
 int option_no_thread_scan[] = { 1 };
+int option_no_uring[] = { 1 };
 int option_firstblocks[] = { 1 };
 int option_firstblocksize[] = { 1 };
 int option_blocksize[] = { 1 };
@@ -65,27 +80,27 @@ int option_cmp_two[] = { 1 };
 int option_sort_by[] = { 1 };
 int option_x_nofie[] = { 1 };
 int option_debug_size[] = { 1 };
-int option_cut[] = { 3, 4, 5, 6, 7 };
-int option_format[] = { 3 };
-int option_file[] = { 4, 8 };
-int option_exclude_path[] = { 4, 5, 6, 7 };
-int option_delete[] = { 9 };
-int option_ls[] = { 9 };
-int option_link[] = { 10 };
-int option_hardlink[] = { 10 };
-int option_x_extents[] = { 18 };
-int option_hash[] = { 19 };
-int option_verbose[] = { 19 };
-int option_verbose_level[] = { 19 };
-int option_quiet[] = { 19 };
-int option_db[] = { 19 };
-int option_cache[] = { 19 };
-int option_help[] = { 19 };
-int option_x_small_buffers[] = { 19 };
-int option_x_testing[] = { 19 };
-int option_x_no_cache[] = { 19 };
-int option_x_cache_min_size[] = { 19 };
-int option_x_wait[] = { 19 };
+int option_cut[] = { 4, 5, 6, 7, 8 };
+int option_format[] = { 4 };
+int option_file[] = { 5, 9 };
+int option_exclude_path[] = { 5, 6, 7, 8 };
+int option_delete[] = { 10 };
+int option_ls[] = { 10 };
+int option_link[] = { 11 };
+int option_hardlink[] = { 11 };
+int option_x_extents[] = { 19 };
+int option_hash[] = { 20 };
+int option_verbose[] = { 20 };
+int option_verbose_level[] = { 20 };
+int option_quiet[] = { 20 };
+int option_db[] = { 20 };
+int option_cache[] = { 20 };
+int option_help[] = { 20 };
+int option_x_small_buffers[] = { 20 };
+int option_x_testing[] = { 20 };
+int option_x_no_cache[] = { 20 };
+int option_x_cache_min_size[] = { 20 };
+int option_x_wait[] = { 20 };
 
 int optgen_parse(int argc, char * argv[], int * command, char * options[])
 {
@@ -109,74 +124,78 @@ int optgen_parse(int argc, char * argv[], int * command, char * options[])
     *command = 1;
     goto OPTS;
   }
-  if (l == 7 && !strncmp("refresh", argv[1], 7)) {
+  if (l == 5 && !strncmp("watch", argv[1], 5)) {
     *command = 2;
     goto OPTS;
   }
-  if (l == 6 && !strncmp("report", argv[1], 6)) {
+  if (l == 7 && !strncmp("refresh", argv[1], 7)) {
     *command = 3;
     goto OPTS;
   }
-  if (l == 4 && !strncmp("file", argv[1], 4)) {
+  if (l == 6 && !strncmp("report", argv[1], 6)) {
     *command = 4;
     goto OPTS;
   }
-  if (l == 7 && !strncmp("uniques", argv[1], 7)) {
+  if (l == 4 && !strncmp("file", argv[1], 4)) {
     *command = 5;
     goto OPTS;
   }
-  if (l == 4 && !strncmp("dups", argv[1], 4)) {
+  if (l == 7 && !strncmp("uniques", argv[1], 7)) {
     *command = 6;
     goto OPTS;
   }
-  if (l == 2 && !strncmp("ls", argv[1], 2)) {
+  if (l == 4 && !strncmp("dups", argv[1], 4)) {
     *command = 7;
     goto OPTS;
   }
-  if (l == 4 && !strncmp("hash", argv[1], 4)) {
+  if (l == 2 && !strncmp("ls", argv[1], 2)) {
     *command = 8;
     goto OPTS;
   }
-  if (l == 5 && !strncmp("cache", argv[1], 5)) {
+  if (l == 4 && !strncmp("hash", argv[1], 4)) {
     *command = 9;
     goto OPTS;
   }
-  if (l == 4 && !strncmp("rmsh", argv[1], 4)) {
+  if (l == 5 && !strncmp("cache", argv[1], 5)) {
     *command = 10;
     goto OPTS;
   }
-  if (l == 8 && !strncmp("validate", argv[1], 8)) {
+  if (l == 4 && !strncmp("rmsh", argv[1], 4)) {
     *command = 11;
     goto OPTS;
   }
-  if (l == 4 && !strncmp("help", argv[1], 4)) {
+  if (l == 8 && !strncmp("validate", argv[1], 8)) {
     *command = 12;
     goto OPTS;
   }
-  if (l == 5 && !strncmp("usage", argv[1], 5)) {
+  if (l == 4 && !strncmp("help", argv[1], 4)) {
     *command = 13;
     goto OPTS;
   }
-  if (l == 3 && !strncmp("man", argv[1], 3)) {
+  if (l == 5 && !strncmp("usage", argv[1], 5)) {
     *command = 14;
     goto OPTS;
   }
-  if (l == 7 && !strncmp("license", argv[1], 7)) {
+  if (l == 3 && !strncmp("man", argv[1], 3)) {
     *command = 15;
     goto OPTS;
   }
-  if (l == 7 && !strncmp("version", argv[1], 7)) {
+  if (l == 7 && !strncmp("license", argv[1], 7)) {
     *command = 16;
     goto OPTS;
   }
-  if (l == 7 && !strncmp("testing", argv[1], 7)) {
+  if (l == 7 && !strncmp("version", argv[1], 7)) {
     *command = 17;
     goto OPTS;
   }
-  if (l == 4 && !strncmp("info", argv[1], 4)) {
+  if (l == 7 && !strncmp("testing", argv[1], 7)) {
     *command = 18;
     goto OPTS;
   }
+  if (l == 4 && !strncmp("info", argv[1], 4)) {
+    *command = 19;
+    goto OPTS;
+  }
 
  OPTS:
 
@@ -282,12 +301,40 @@ int optgen_parse(int argc, char * argv[], int * command, char * options[])
       }
       continue;
     }
+    if ((l == 9 && !strncmp("--exclude", argv[pos], 9))) {
+      if (argv[pos+1] == NULL) {
+        printf("error: no value for arg --exclude\n");
+        exit(1);
+      }
+      options[4] = argv[pos+1];
+      pos += 2;
+      // strict_options: is exclude allowed?
+      int ok = 0;
+      unsigned int cc;
+      unsigned int len = sizeof(option_exclude) / sizeof(option_exclude)[0];
+      for (cc = 0; cc < len; cc++) {
+        if (option_exclude[cc] == *command) { ok = 1; }
+        if (option_exclude[cc] == COMMAND_GLOBAL) { ok = 1; }
+      }
+      if (!ok) {
+        printf("error: option 'exclude' not compatible with given command\n");
+        exit(1);
+      }
+      // callback configured for this option
+      int rv = opt_add_exclude(options[4], *command);
+      if (rv != OPTGEN_CALLBACK_OK) {
+        printf("error: problem handling option 'exclude'\n");
+        exit(1);
+      }
+
+      continue;
+    }
     if ((l == 10 && !strncmp("--buflimit", argv[pos], 10))) {
       if (argv[pos+1] == NULL) {
         printf("error: no value for arg --buflimit\n");
         exit(1);
       }
-      options[4] = argv[pos+1];
+      options[5] = argv[pos+1];
       pos += 2;
       // strict_options: is buflimit allowed?
       int ok = 0;
@@ -303,13 +350,130 @@ int optgen_parse(int argc, char * argv[], int * command, char * options[])
       }
       continue;
     }
+    if ((l == 6 && !strncmp("--mmap", argv[pos], 6))) {
+      if (options[6] == NULL) {
+        options[6] = numstring[0];
+      } else {
+        options[6] = numstring[atoi(options[6])];
+        if (!strcmp(options[6], "X")) {
+          printf("error: option %s repeated too many times!\n", argv[pos]);
+          exit(1);
+        }
+      }
+      pos++;
+      // strict_options: is mmap allowed?
+      int ok = 0;
+      unsigned int cc;
+      unsigned int len = sizeof(option_mmap) / sizeof(option_mmap)[0];
+      for (cc = 0; cc < len; cc++) {
+        if (option_mmap[cc] == *command) { ok = 1; }
+        if (option_mmap[cc] == COMMAND_GLOBAL) { ok = 1; }
+      }
+      if (!ok) {
+        printf("error: option 'mmap' not compatible with given command\n");
+        exit(1);
+      }
+      continue;
+    }
+    if ((l == 11 && !strncmp("--direct-io", argv[pos], 11))) {
+      if (options[7] == NULL) {
+        options[7] = numstring[0];
+      } else {
+        options[7] = numstring[atoi(options[7])];
+        if (!strcmp(options[7], "X")) {
+          printf("error: option %s repeated too many times!\n", argv[pos]);
+          exit(1);
+        }
+      }
+      pos++;
+      // strict_options: is direct_io allowed?
+      int ok = 0;
+      unsigned int cc;
+      unsigned int len = sizeof(option_direct_io) / sizeof(option_direct_io)[0];
+      for (cc = 0; cc < len; cc++) {
+        if (option_direct_io[cc] == *command) { ok = 1; }
+        if (option_direct_io[cc] == COMMAND_GLOBAL) { ok = 1; }
+      }
+      if (!ok) {
+        printf("error: option 'direct_io' not compatible with given command\n");
+        exit(1);
+      }
+      continue;
+    }
+    if ((l == 10 && !strncmp("--prefetch", argv[pos], 10))) {
+      if (argv[pos+1] == NULL) {
+        printf("error: no value for arg --prefetch\n");
+        exit(1);
+      }
+      options[8] = argv[pos+1];
+      pos += 2;
+      // strict_options: is prefetch allowed?
+      int ok = 0;
+      unsigned int cc;
+      unsigned int len = sizeof(option_prefetch) / sizeof(option_prefetch)[0];
+      for (cc = 0; cc < len; cc++) {
+        if (option_prefetch[cc] == *command) { ok = 1; }
+        if (option_prefetch[cc] == COMMAND_GLOBAL) { ok = 1; }
+      }
+      if (!ok) {
+        printf("error: option 'prefetch' not compatible with given command\n");
+        exit(1);
+      }
+      continue;
+    }
+    if ((l == 12 && !strncmp("--drop-cache", argv[pos], 12))) {
+      if (options[9] == NULL) {
+        options[9] = numstring[0];
+      } else {
+        options[9] = numstring[atoi(options[9])];
+        if (!strcmp(options[9], "X")) {
+          printf("error: option %s repeated too many times!\n", argv[pos]);
+          exit(1);
+        }
+      }
+      pos++;
+      // strict_options: is drop_cache allowed?
+      int ok = 0;
+      unsigned int cc;
+      unsigned int len = sizeof(option_drop_cache) / sizeof(option_drop_cache)[0];
+      for (cc = 0; cc < len; cc++) {
+        if (option_drop_cache[cc] == *command) { ok = 1; }
+        if (option_drop_cache[cc] == COMMAND_GLOBAL) { ok = 1; }
+      }
+      if (!ok) {
+        printf("error: option 'drop_cache' not compatible with given command\n");
+        exit(1);
+      }
+      continue;
+    }
+    if ((l == 13 && !strncmp("--device-type", argv[pos], 13))) {
+      if (argv[pos+1] == NULL) {
+        printf("error: no value for arg --device-type\n");
+        exit(1);
+      }
+      options[10] = argv[pos+1];
+      pos += 2;
+      // strict_options: is device_type allowed?
+      int ok = 0;
+      unsigned int cc;
+      unsigned int len = sizeof(option_device_type) / sizeof(option_device_type)[0];
+      for (cc = 0; cc < len; cc++) {
+        if (option_device_type[cc] == *command) { ok = 1; }
+        if (option_device_type[cc] == COMMAND_GLOBAL) { ok = 1; }
+      }
+      if (!ok) {
+        printf("error: option 'device_type' not compatible with given command\n");
+        exit(1);
+      }
+      continue;
+    }
     if ((l == 17 && !strncmp("--one-file-system", argv[pos], 17))||
         (l == 2 && !strncmp("-X", argv[pos], 2))) {
-      if (options[5] == NULL) {
-        options[5] = numstring[0];
+      if (options[11] == NULL) {
+        options[11] = numstring[0];
       } else {
-        options[5] = numstring[atoi(options[5])];
-        if (!strcmp(options[5], "X")) {
+        options[11] = numstring[atoi(options[11])];
+        if (!strcmp(options[11], "X")) {
           printf("error: option %s repeated too many times!\n", argv[pos]);
           exit(1);
         }
@@ -335,7 +499,7 @@ int optgen_parse(int argc, char * argv[], int * command, char * options[])
         printf("error: no value for arg --trace-mem\n");
         exit(1);
       }
-      options[6] = argv[pos+1];
+      options[12] = argv[pos+1];
       pos += 2;
       // strict_options: is trace_mem allowed?
       int ok = 0;
@@ -353,11 +517,11 @@ int optgen_parse(int argc, char * argv[], int * command, char * options[])
     }
     if ((l == 20 && !strncmp("--hardlink-is-unique", argv[pos], 20))||
         (l == 2 && !strncmp("-I", argv[pos], 2))) {
-      if (options[7] == NULL) {
-        options[7] = numstring[0];
+      if (options[13] == NULL) {
+        options[13] = numstring[0];
       } else {
-        options[7] = numstring[atoi(options[7])];
-        if (!strcmp(options[7], "X")) {
+        options[13] = numstring[atoi(options[13])];
+        if (!strcmp(options[13], "X")) {
           printf("error: option %s repeated too many times!\n", argv[pos]);
           exit(1);
         }
@@ -377,12 +541,196 @@ int optgen_parse(int argc, char * argv[], int * command, char * options[])
       }
       continue;
     }
+    if ((l == 14 && !strncmp("--scan-threads", argv[pos], 14))) {
+      if (argv[pos+1] == NULL) {
+        printf("error: no value for arg --scan-threads\n");
+        exit(1);
+      }
+      options[14] = argv[pos+1];
+      pos += 2;
+      // strict_options: is scan_threads allowed?
+      int ok = 0;
+      unsigned int cc;
+      unsigned int len = sizeof(option_scan_threads) / sizeof(option_scan_threads)[0];
+      for (cc = 0; cc < len; cc++) {
+        if (option_scan_threads[cc] == *command) { ok = 1; }
+        if (option_scan_threads[cc] == COMMAND_GLOBAL) { ok = 1; }
+      }
+      if (!ok) {
+        printf("error: option 'scan_threads' not compatible with given command\n");
+        exit(1);
+      }
+      continue;
+    }
+    if ((l == 14 && !strncmp("--stat-threads", argv[pos], 14))) {
+      if (argv[pos+1] == NULL) {
+        printf("error: no value for arg --stat-threads\n");
+        exit(1);
+      }
+      options[15] = argv[pos+1];
+      pos += 2;
+      // strict_options: is stat_threads allowed?
+      int ok = 0;
+      unsigned int cc;
+      unsigned int len = sizeof(option_stat_threads) / sizeof(option_stat_threads)[0];
+      for (cc = 0; cc < len; cc++) {
+        if (option_stat_threads[cc] == *command) { ok = 1; }
+        if (option_stat_threads[cc] == COMMAND_GLOBAL) { ok = 1; }
+      }
+      if (!ok) {
+        printf("error: option 'stat_threads' not compatible with given command\n");
+        exit(1);
+      }
+      continue;
+    }
+    if ((l == 14 && !strncmp("--hash-threads", argv[pos], 14))) {
+      if (argv[pos+1] == NULL) {
+        printf("error: no value for arg --hash-threads\n");
+        exit(1);
+      }
+      options[16] = argv[pos+1];
+      pos += 2;
+      // strict_options: is hash_threads allowed?
+      int ok = 0;
+      unsigned int cc;
+      unsigned int len = sizeof(option_hash_threads) / sizeof(option_hash_threads)[0];
+      for (cc = 0; cc < len; cc++) {
+        if (option_hash_threads[cc] == *command) { ok = 1; }
+        if (option_hash_threads[cc] == COMMAND_GLOBAL) { ok = 1; }
+      }
+      if (!ok) {
+        printf("error: option 'hash_threads' not compatible with given command\n");
+        exit(1);
+      }
+      continue;
+    }
+    if ((l == 13 && !strncmp("--incremental", argv[pos], 13))) {
+      if (options[17] == NULL) {
+        options[17] = numstring[0];
+      } else {
+        options[17] = numstring[atoi(options[17])];
+        if (!strcmp(options[17], "X")) {
+          printf("error: option %s repeated too many times!\n", argv[pos]);
+          exit(1);
+        }
+      }
+      pos++;
+      // strict_options: is incremental allowed?
+      int ok = 0;
+      unsigned int cc;
+      unsigned int len = sizeof(option_incremental) / sizeof(option_incremental)[0];
+      for (cc = 0; cc < len; cc++) {
+        if (option_incremental[cc] == *command) { ok = 1; }
+        if (option_incremental[cc] == COMMAND_GLOBAL) { ok = 1; }
+      }
+      if (!ok) {
+        printf("error: option 'incremental' not compatible with given command\n");
+        exit(1);
+      }
+      continue;
+    }
+    if ((l == 12 && !strncmp("--checkpoint", argv[pos], 12))) {
+      if (argv[pos+1] == NULL) {
+        printf("error: no value for arg --checkpoint\n");
+        exit(1);
+      }
+      options[18] = argv[pos+1];
+      pos += 2;
+      // strict_options: is checkpoint allowed?
+      int ok = 0;
+      unsigned int cc;
+      unsigned int len = sizeof(option_checkpoint) / sizeof(option_checkpoint)[0];
+      for (cc = 0; cc < len; cc++) {
+        if (option_checkpoint[cc] == *command) { ok = 1; }
+        if (option_checkpoint[cc] == COMMAND_GLOBAL) { ok = 1; }
+      }
+      if (!ok) {
+        printf("error: option 'checkpoint' not compatible with given command\n");
+        exit(1);
+      }
+      continue;
+    }
+    if ((l == 8 && !strncmp("--resume", argv[pos], 8))) {
+      if (options[19] == NULL) {
+        options[19] = numstring[0];
+      } else {
+        options[19] = numstring[atoi(options[19])];
+        if (!strcmp(options[19], "X")) {
+          printf("error: option %s repeated too many times!\n", argv[pos]);
+          exit(1);
+        }
+      }
+      pos++;
+      // strict_options: is resume allowed?
+      int ok = 0;
+      unsigned int cc;
+      unsigned int len = sizeof(option_resume) / sizeof(option_resume)[0];
+      for (cc = 0; cc < len; cc++) {
+        if (option_resume[cc] == *command) { ok = 1; }
+        if (option_resume[cc] == COMMAND_GLOBAL) { ok = 1; }
+      }
+      if (!ok) {
+        printf("error: option 'resume' not compatible with given command\n");
+        exit(1);
+      }
+      continue;
+    }
+    if ((l == 8 && !strncmp("--sample", argv[pos], 8))) {
+      if (options[20] == NULL) {
+        options[20] = numstring[0];
+      } else {
+        options[20] = numstring[atoi(options[20])];
+        if (!strcmp(options[20], "X")) {
+          printf("error: option %s repeated too many times!\n", argv[pos]);
+          exit(1);
+        }
+      }
+      pos++;
+      // strict_options: is sample allowed?
+      int ok = 0;
+      unsigned int cc;
+      unsigned int len = sizeof(option_sample) / sizeof(option_sample)[0];
+      for (cc = 0; cc < len; cc++) {
+        if (option_sample[cc] == *command) { ok = 1; }
+        if (option_sample[cc] == COMMAND_GLOBAL) { ok = 1; }
+      }
+      if (!ok) {
+        printf("error: option 'sample' not compatible with given command\n");
+        exit(1);
+      }
+      continue;
+    }
+    if ((l == 19 && !strncmp("--x-checkpoint-exit", argv[pos], 19))) {
+      if (options[21] == NULL) {
+        options[21] = numstring[0];
+      } else {
+        options[21] = numstring[atoi(options[21])];
+        if (!strcmp(options[21], "X")) {
+          printf("error: option %s repeated too many times!\n", argv[pos]);
+          exit(1);
+        }
+      }
+      pos++;
+      // strict_options: is x_checkpoint_exit allowed?
+      int ok = 0;
+      unsigned int cc;
+      unsigned int len = sizeof(option_x_checkpoint_exit) / sizeof(option_x_checkpoint_exit)[0];
+      for (cc = 0; cc < len; cc++) {
+        if (option_x_checkpoint_exit[cc] == *command) { ok = 1; }
+        if (option_x_checkpoint_exit[cc] == COMMAND_GLOBAL) { ok = 1; }
+      }
+      if (!ok) {
+        printf("error: option 'x_checkpoint_exit' not compatible with given command\n");
+        exit(1);
+      }
+      continue;
+    }
     if ((l == 16 && !strncmp("--no-thread-scan", argv[pos], 16))) {
-      if (options[8] == NULL) {
-        options[8] = numstring[0];
+      if (options[22] == NULL) {
+        options[22] = numstring[0];
       } else {
-        options[8] = numstring[atoi(options[8])];
-        if (!strcmp(options[8], "X")) {
+        options[22] = numstring[atoi(options[22])];
+        if (!strcmp(options[22], "X")) {
           printf("error: option %s repeated too many times!\n", argv[pos]);
           exit(1);
         }
@@ -402,12 +750,37 @@ int optgen_parse(int argc, char * argv[], int * command, char * options[])
       }
       continue;
     }
+    if ((l == 10 && !strncmp("--no-uring", argv[pos], 10))) {
+      if (options[23] == NULL) {
+        options[23] = numstring[0];
+      } else {
+        options[23] = numstring[atoi(options[23])];
+        if (!strcmp(options[23], "X")) {
+          printf("error: option %s repeated too many times!\n", argv[pos]);
+          exit(1);
+        }
+      }
+      pos++;
+      // strict_options: is no_uring allowed?
+      int ok = 0;
+      unsigned int cc;
+      unsigned int len = sizeof(option_no_uring) / sizeof(option_no_uring)[0];
+      for (cc = 0; cc < len; cc++) {
+        if (option_no_uring[cc] == *command) { ok = 1; }
+        if (option_no_uring[cc] == COMMAND_GLOBAL) { ok = 1; }
+      }
+      if (!ok) {
+        printf("error: option 'no_uring' not compatible with given command\n");
+        exit(1);
+      }
+      continue;
+    }
     if ((l == 13 && !strncmp("--firstblocks", argv[pos], 13))) {
       if (argv[pos+1] == NULL) {
         printf("error: no value for arg --firstblocks\n");
         exit(1);
       }
-      options[9] = argv[pos+1];
+      options[24] = argv[pos+1];
       pos += 2;
       // strict_options: is firstblocks allowed?
       int ok = 0;
@@ -428,7 +801,7 @@ int optgen_parse(int argc, char * argv[], int * command, char * options[])
         printf("error: no value for arg --firstblocksize\n");
         exit(1);
       }
-      options[10] = argv[pos+1];
+      options[25] = argv[pos+1];
       pos += 2;
       // strict_options: is firstblocksize allowed?
       int ok = 0;
@@ -449,7 +822,7 @@ int optgen_parse(int argc, char * argv[], int * command, char * options[])
         printf("error: no value for arg --blocksize\n");
         exit(1);
       }
-      options[11] = argv[pos+1];
+      options[26] = argv[pos+1];
       pos += 2;
       // strict_options: is blocksize allowed?
       int ok = 0;
@@ -470,7 +843,7 @@ int optgen_parse(int argc, char * argv[], int * command, char * options[])
         printf("error: no value for arg --fileblocksize\n");
         exit(1);
       }
-      options[12] = argv[pos+1];
+      options[27] = argv[pos+1];
       pos += 2;
       // strict_options: is fileblocksize allowed?
       int ok = 0;
@@ -487,11 +860,11 @@ int optgen_parse(int argc, char * argv[], int * command, char * options[])
       continue;
     }
     if ((l == 9 && !strncmp("--cmp-two", argv[pos], 9))) {
-      if (options[13] == NULL) {
-        options[13] = numstring[0];
+      if (options[28] == NULL) {
+        options[28] = numstring[0];
       } else {
-        options[13] = numstring[atoi(options[13])];
-        if (!strcmp(options[13], "X")) {
+        options[28] = numstring[atoi(options[28])];
+        if (!strcmp(options[28], "X")) {
           printf("error: option %s repeated too many times!\n", argv[pos]);
           exit(1);
         }
@@ -516,7 +889,7 @@ int optgen_parse(int argc, char * argv[], int * command, char * options[])
         printf("error: no value for arg --sort-by\n");
         exit(1);
       }
-      options[14] = argv[pos+1];
+      options[29] = argv[pos+1];
       pos += 2;
       // strict_options: is sort_by allowed?
       int ok = 0;
@@ -533,11 +906,11 @@ int optgen_parse(int argc, char * argv[], int * command, char * options[])
       continue;
     }
     if ((l == 9 && !strncmp("--x-nofie", argv[pos], 9))) {
-      if (options[15] == NULL) {
-        options[15] = numstring[0];
+      if (options[30] == NULL) {
+        options[30] = numstring[0];
       } else {
-        options[15] = numstring[atoi(options[15])];
-        if (!strcmp(options[15], "X")) {
+        options[30] = numstring[atoi(options[30])];
+        if (!strcmp(options[30], "X")) {
           printf("error: option %s repeated too many times!\n", argv[pos]);
           exit(1);
         }
@@ -562,7 +935,7 @@ int optgen_parse(int argc, char * argv[], int * command, char * options[])
         printf("error: no value for arg --debug-size\n");
         exit(1);
       }
-      options[16] = argv[pos+1];
+      options[31] = argv[pos+1];
       pos += 2;
       // strict_options: is debug_size allowed?
       int ok = 0;
@@ -584,7 +957,7 @@ int optgen_parse(int argc, char * argv[], int * command, char * options[])
         printf("error: no value for arg --cut\n");
         exit(1);
       }
-      options[17] = argv[pos+1];
+      options[32] = argv[pos+1];
       pos += 2;
       // strict_options: is cut allowed?
       int ok = 0;
@@ -605,7 +978,7 @@ int optgen_parse(int argc, char * argv[], int * command, char * options[])
         printf("error: no value for arg --format\n");
         exit(1);
       }
-      options[18] = argv[pos+1];
+      options[33] = argv[pos+1];
       pos += 2;
       // strict_options: is format allowed?
       int ok = 0;
@@ -627,7 +1000,7 @@ int optgen_parse(int argc, char * argv[], int * command, char * options[])
         printf("error: no value for arg --file\n");
         exit(1);
       }
-      options[19] = argv[pos+1];
+      options[34] = argv[pos+1];
       pos += 2;
       // strict_options: is file allowed?
       int ok = 0;
@@ -649,7 +1022,7 @@ int optgen_parse(int argc, char * argv[], int * command, char * options[])
         printf("error: no value for arg --exclude-path\n");
         exit(1);
       }
-      options[20] = argv[pos+1];
+      options[35] = argv[pos+1];
       pos += 2;
       // strict_options: is exclude_path allowed?
       int ok = 0;
@@ -667,11 +1040,11 @@ int optgen_parse(int argc, char * argv[], int * command, char * options[])
     }
     if ((l == 8 && !strncmp("--delete", argv[pos], 8))||
         (l == 2 && !strncmp("-D", argv[pos], 2))) {
-      if (options[21] == NULL) {
-        options[21] = numstring[0];
+      if (options[36] == NULL) {
+        options[36] = numstring[0];
       } else {
-        options[21] = numstring[atoi(options[21])];
-        if (!strcmp(options[21], "X")) {
+        options[36] = numstring[atoi(options[36])];
+        if (!strcmp(options[36], "X")) {
           printf("error: option %s repeated too many times!\n", argv[pos]);
           exit(1);
         }
@@ -693,11 +1066,11 @@ int optgen_parse(int argc, char * argv[], int * command, char * options[])
     }
     if ((l == 4 && !strncmp("--ls", argv[pos], 4))||
         (l == 2 && !strncmp("-l", argv[pos], 2))) {
-      if (options[22] == NULL) {
-        options[22] = numstring[0];
+      if (options[37] == NULL) {
+        options[37] = numstring[0];
       } else {
-        options[22] = numstring[atoi(options[22])];
-        if (!strcmp(options[22], "X")) {
+        options[37] = numstring[atoi(options[37])];
+        if (!strcmp(options[37], "X")) {
           printf("error: option %s repeated too many times!\n", argv[pos]);
           exit(1);
         }
@@ -719,11 +1092,11 @@ int optgen_parse(int argc, char * argv[], int * command, char * options[])
     }
     if ((l == 6 && !strncmp("--link", argv[pos], 6))||
         (l == 2 && !strncmp("-L", argv[pos], 2))) {
-      if (options[23] == NULL) {
-        options[23] = numstring[0];
+      if (options[38] == NULL) {
+        options[38] = numstring[0];
       } else {
-        options[23] = numstring[atoi(options[23])];
-        if (!strcmp(options[23], "X")) {
+        options[38] = numstring[atoi(options[38])];
+        if (!strcmp(options[38], "X")) {
           printf("error: option %s repeated too many times!\n", argv[pos]);
           exit(1);
         }
@@ -745,11 +1118,11 @@ int optgen_parse(int argc, char * argv[], int * command, char * options[])
     }
     if ((l == 10 && !strncmp("--hardlink", argv[pos], 10))||
         (l == 2 && !strncmp("-H", argv[pos], 2))) {
-      if (options[24] == NULL) {
-        options[24] = numstring[0];
+      if (options[39] == NULL) {
+        options[39] = numstring[0];
       } else {
-        options[24] = numstring[atoi(options[24])];
-        if (!strcmp(options[24], "X")) {
+        options[39] = numstring[atoi(options[39])];
+        if (!strcmp(options[39], "X")) {
           printf("error: option %s repeated too many times!\n", argv[pos]);
           exit(1);
         }
@@ -774,7 +1147,7 @@ int optgen_parse(int argc, char * argv[], int * command, char * options[])
         printf("error: no value for arg --x-extents\n");
         exit(1);
       }
-      options[25] = argv[pos+1];
+      options[40] = argv[pos+1];
       pos += 2;
       // strict_options: is x_extents allowed?
       int ok = 0;
@@ -796,7 +1169,7 @@ int optgen_parse(int argc, char * argv[], int * command, char * options[])
         printf("error: no value for arg --hash\n");
         exit(1);
       }
-      options[26] = argv[pos+1];
+      options[41] = argv[pos+1];
       pos += 2;
       // strict_options: is hash allowed?
       int ok = 0;
@@ -814,11 +1187,11 @@ int optgen_parse(int argc, char * argv[], int * command, char * options[])
     }
     if ((l == 9 && !strncmp("--verbose", argv[pos], 9))||
         (l == 2 && !strncmp("-v", argv[pos], 2))) {
-      if (options[27] == NULL) {
-        options[27] = numstring[0];
+      if (options[42] == NULL) {
+        options[42] = numstring[0];
       } else {
-        options[27] = numstring[atoi(options[27])];
-        if (!strcmp(options[27], "X")) {
+        options[42] = numstring[atoi(options[42])];
+        if (!strcmp(options[42], "X")) {
           printf("error: option %s repeated too many times!\n", argv[pos]);
           exit(1);
         }
@@ -844,7 +1217,7 @@ int optgen_parse(int argc, char * argv[], int * command, char * options[])
         printf("error: no value for arg --verbose-level\n");
         exit(1);
       }
-      options[28] = argv[pos+1];
+      options[43] = argv[pos+1];
       pos += 2;
       // strict_options: is verbose_level allowed?
       int ok = 0;
@@ -862,11 +1235,11 @@ int optgen_parse(int argc, char * argv[], int * command, char * options[])
     }
     if ((l == 7 && !strncmp("--quiet", argv[pos], 7))||
         (l == 2 && !strncmp("-q", argv[pos], 2))) {
-      if (options[29] == NULL) {
-        options[29] = numstring[0];
+      if (options[44] == NULL) {
+        options[44] = numstring[0];
       } else {
-        options[29] = numstring[atoi(options[29])];
-        if (!strcmp(options[29], "X")) {
+        options[44] = numstring[atoi(options[44])];
+        if (!strcmp(options[44], "X")) {
           printf("error: option %s repeated too many times!\n", argv[pos]);
           exit(1);
         }
@@ -892,7 +1265,7 @@ int optgen_parse(int argc, char * argv[], int * command, char * options[])
         printf("error: no value for arg --db\n");
         exit(1);
       }
-      options[30] = argv[pos+1];
+      options[45] = argv[pos+1];
       pos += 2;
       // strict_options: is db allowed?
       int ok = 0;
@@ -914,7 +1287,7 @@ int optgen_parse(int argc, char * argv[], int * command, char * options[])
         printf("error: no value for arg --cache\n");
         exit(1);
       }
-      options[31] = argv[pos+1];
+      options[46] = argv[pos+1];
       pos += 2;
       // strict_options: is cache allowed?
       int ok = 0;
@@ -932,11 +1305,11 @@ int optgen_parse(int argc, char * argv[], int * command, char * options[])
     }
     if ((l == 6 && !strncmp("--help", argv[pos], 6))||
         (l == 2 && !strncmp("-h", argv[pos], 2))) {
-      if (options[32] == NULL) {
-        options[32] = numstring[0];
+      if (options[47] == NULL) {
+        options[47] = numstring[0];
       } else {
-        options[32] = numstring[atoi(options[32])];
-        if (!strcmp(options[32], "X")) {
+        options[47] = numstring[atoi(options[47])];
+        if (!strcmp(options[47], "X")) {
           printf("error: option %s repeated too many times!\n", argv[pos]);
           exit(1);
         }
@@ -957,11 +1330,11 @@ int optgen_parse(int argc, char * argv[], int * command, char * options[])
       continue;
     }
     if ((l == 17 && !strncmp("--x-small-buffers", argv[pos], 17))) {
-      if (options[33] == NULL) {
-        options[33] = numstring[0];
+      if (options[48] == NULL) {
+        options[48] = numstring[0];
       } else {
-        options[33] = numstring[atoi(options[33])];
-        if (!strcmp(options[33], "X")) {
+        options[48] = numstring[atoi(options[48])];
+        if (!strcmp(options[48], "X")) {
           printf("error: option %s repeated too many times!\n", argv[pos]);
           exit(1);
         }
@@ -982,11 +1355,11 @@ int optgen_parse(int argc, char * argv[], int * command, char * options[])
       continue;
     }
     if ((l == 11 && !strncmp("--x-testing", argv[pos], 11))) {
-      if (options[34] == NULL) {
-        options[34] = numstring[0];
+      if (options[49] == NULL) {
+        options[49] = numstring[0];
       } else {
-        options[34] = numstring[atoi(options[34])];
-        if (!strcmp(options[34], "X")) {
+        options[49] = numstring[atoi(options[49])];
+        if (!strcmp(options[49], "X")) {
           printf("error: option %s repeated too many times!\n", argv[pos]);
           exit(1);
         }
@@ -1007,11 +1380,11 @@ int optgen_parse(int argc, char * argv[], int * command, char * options[])
       continue;
     }
     if ((l == 12 && !strncmp("--x-no-cache", argv[pos], 12))) {
-      if (options[35] == NULL) {
-        options[35] = numstring[0];
+      if (options[50] == NULL) {
+        options[50] = numstring[0];
       } else {
-        options[35] = numstring[atoi(options[35])];
-        if (!strcmp(options[35], "X")) {
+        options[50] = numstring[atoi(options[50])];
+        if (!strcmp(options[50], "X")) {
           printf("error: option %s repeated too many times!\n", argv[pos]);
           exit(1);
         }
@@ -1036,7 +1409,7 @@ int optgen_parse(int argc, char * argv[], int * command, char * options[])
         printf("error: no value for arg --x-cache-min-size\n");
         exit(1);
       }
-      options[36] = argv[pos+1];
+      options[51] = argv[pos+1];
       pos += 2;
       // strict_options: is x_cache_min_size allowed?
       int ok = 0;
@@ -1053,11 +1426,11 @@ int optgen_parse(int argc, char * argv[], int * command, char * options[])
       continue;
     }
     if ((l == 8 && !strncmp("--x-wait", argv[pos], 8))) {
-      if (options[37] == NULL) {
-        options[37] = numstring[0];
+      if (options[52] == NULL) {
+        options[52] = numstring[0];
       } else {
-        options[37] = numstring[atoi(options[37])];
-        if (!strcmp(options[37], "X")) {
+        options[52] = numstring[atoi(options[52])];
+        if (!strcmp(options[52], "X")) {
           printf("error: option %s repeated too many times!\n", argv[pos]);
           exit(1);
         }
@@ -1128,10 +1501,29 @@ void opt_show_help()
   printf("     --stats-file FILE        save stats to this file\n");
   printf("  -m --minsize SIZE           min size of files to scan\n");
   printf("     --hidden                 include hidden files and dirs in scan\n");
+  printf("     --exclude PATTERN        skip files and dirs matching PATTERN\n");
   printf("     --buflimit NAME          read buffer size cap\n");
+  printf("     --mmap                   hash file data from memory mappings instead of reading it\n");
+  printf("     --direct-io              read file data bypassing the page cache\n");
+  printf("     --prefetch N             prefetch the next N reads (default 32, 0 to disable)\n");
+  printf("     --drop-cache             drop file data from the page cache once hashed\n");
+  printf("     --device-type NAME       read as hdd or ssd instead of detecting per device\n");
   printf("  -X --one-file-system        for each path, stay in that filesystem\n");
   printf("  -T --trace-mem FILE         save memory trace data to this file\n");
   printf("  -I --hardlink-is-unique     ignore hard links as duplicates\n");
+  printf("     --scan-threads N         number of threads reading directories\n");
+  printf("     --stat-threads N         number of threads adding files to the size index\n");
+  printf("     --hash-threads N         number of threads hashing file data\n");
+  printf("     --incremental            reuse listings of unchanged dirs from previous scan\n");
+  printf("     --checkpoint SECONDS     save scan state every SECONDS for --resume\n");
+  printf("     --resume                 continue an interrupted scan from its checkpoint\n");
+  printf("     --sample                 sample large files before reading them in full\n");
+  printf("\n");
+  printf("watch     scan, then keep duplicates current as files change\n");
+  printf("  -p --path PATH        path where scanning will start\n");
+  printf("  -m --minsize SIZE     min size of files to scan\n");
+  printf("     --hidden           include hidden files and dirs in scan\n");
+  printf("     --exclude PATTERN  skip files and dirs matching PATTERN\n");
   printf("\n");
   printf("refresh   remove deleted files from the database\n");
   printf("\n");
@@ -44,7 +44,7 @@
 // ab..e.g.ijk..no..rstu.w.yzAB..E.G..JK.MNOPQRS.U.W.YZ0123456789
 //
 
-#define COUNT_OPTIONS 38
+#define COUNT_OPTIONS 53
 
 // path (-p,--path) PATH : path where scanning will start
 #define OPT_path 0
@@ -58,164 +58,212 @@
 // hidden (--hidden) : include hidden files and dirs in scan
 #define OPT_hidden 3
 
+// exclude (--exclude) PATTERN : skip files and dirs matching PATTERN
+#define OPT_exclude 4
+
 // buflimit (--buflimit) NAME : read buffer size cap
-#define OPT_buflimit 4
+#define OPT_buflimit 5
+
+// mmap (--mmap) : hash file data from memory mappings instead of reading it
+#define OPT_mmap 6
+
+// direct_io (--direct-io) : read file data bypassing the page cache
+#define OPT_direct_io 7
+
+// prefetch (--prefetch) N : prefetch the next N reads (default 32, 0 to disable)
+#define OPT_prefetch 8
+
+// drop_cache (--drop-cache) : drop file data from the page cache once hashed
+#define OPT_drop_cache 9
+
+// device_type (--device-type) NAME : read as hdd or ssd instead of detecting per device
+#define OPT_device_type 10
 
 // one_file_system (-X,--one-file-system) : for each path, stay in that filesystem
-#define OPT_one_file_system 5
+#define OPT_one_file_system 11
 
 // trace_mem (-T,--trace-mem) FILE : save memory trace data to this file
-#define OPT_trace_mem 6
+#define OPT_trace_mem 12
 
 // hardlink_is_unique (-I,--hardlink-is-unique) : ignore hard links as duplicates
-#define OPT_hardlink_is_unique 7
+#define OPT_hardlink_is_unique 13
+
+// scan_threads (--scan-threads) N : number of threads reading directories
+#define OPT_scan_threads 14
+
+// stat_threads (--stat-threads) N : number of threads adding files to the size index
+#define OPT_stat_threads 15
+
+// hash_threads (--hash-threads) N : number of threads hashing file data
+#define OPT_hash_threads 16
+
+// incremental (--incremental) : reuse listings of unchanged dirs from previous scan
+#define OPT_incremental 17
+
+// checkpoint (--checkpoint) SECONDS : save scan state every SECONDS for --resume
+#define OPT_checkpoint 18
+
+// resume (--resume) : continue an interrupted scan from its checkpoint
+#define OPT_resume 19
+
+// sample (--sample) : sample large files before reading them in full
+#define OPT_sample 20
+
+// x_checkpoint_exit (--x-checkpoint-exit) : for testing only, not useful otherwise
+#define OPT_x_checkpoint_exit 21
 
 // no_thread_scan (--no-thread-scan) : do scan phase in a single thread
-#define OPT_no_thread_scan 8
+#define OPT_no_thread_scan 22
+
+// no_uring (--no-uring) : do not use io_uring
+#define OPT_no_uring 23
 
 // firstblocks (--firstblocks) N : max blocks to read in first hash pass
-#define OPT_firstblocks 9
+#define OPT_firstblocks 24
 
 // firstblocksize (--firstblocksize) N : size of firstblocks to read
-#define OPT_firstblocksize 10
+#define OPT_firstblocksize 25
 
 // blocksize (--blocksize) N : size of regular blocks to read
-#define OPT_blocksize 11
+#define OPT_blocksize 26
 
 // fileblocksize (--fileblocksize) N : size of blocks to read in file compare
-#define OPT_fileblocksize 12
+#define OPT_fileblocksize 27
 
 // cmp_two (--cmp-two) : force direct comparison of two files
-#define OPT_cmp_two 13
+#define OPT_cmp_two 28
 
 // sort_by (--sort-by) NAME : testing
-#define OPT_sort_by 14
+#define OPT_sort_by 29
 
 // x_nofie (--x-nofie) : testing
-#define OPT_x_nofie 15
+#define OPT_x_nofie 30
 
 // debug_size (--debug-size) N : increase logging for this size
-#define OPT_debug_size 16
+#define OPT_debug_size 31
 
 // cut (-c,--cut) PATHSEG : remove 'PATHSEG' from report paths
-#define OPT_cut 17
+#define OPT_cut 32
 
 // format (--format) NAME : report output format (text, csv, json)
-#define OPT_format 18
+#define OPT_format 33
 
 // file (-f,--file) PATH : check this file
-#define OPT_file 19
+#define OPT_file 34
 
 // exclude_path (-x,--exclude-path) PATH : ignore duplicates under this path
-#define OPT_exclude_path 20
+#define OPT_exclude_path 35
 
 // delete (-D,--delete) : delete the cache
-#define OPT_delete 21
+#define OPT_delete 36
 
 // ls (-l,--ls) : list cache contents
-#define OPT_ls 22
+#define OPT_ls 37
 
 // link (-L,--link) : create symlinks for deleted files
-#define OPT_link 23
+#define OPT_link 38
 
 // hardlink (-H,--hardlink) : create hard links for deleted files
-#define OPT_hardlink 24
+#define OPT_hardlink 39
 
 // x_extents (--x-extents) PATH : show extents
-#define OPT_x_extents 25
+#define OPT_x_extents 40
 
 // hash (-F,--hash) NAME : specify alternate hash function
-#define OPT_hash 26
+#define OPT_hash 41
 
 // verbose (-v,--verbose) : increase verbosity (may be repeated for more)
-#define OPT_verbose 27
+#define OPT_verbose 42
 
 // verbose_level (-V,--verbose-level) N : set verbosity level to N
-#define OPT_verbose_level 28
+#define OPT_verbose_level 43
 
 // quiet (-q,--quiet) : quiet, suppress all output except fatal errors
-#define OPT_quiet 29
+#define OPT_quiet 44
 
 // db (-d,--db) PATH : path to dupd database file
-#define OPT_db 30
+#define OPT_db 45
 
 // cache (-C,--cache) PATH : path to dupd hash cache file
-#define OPT_cache 31
+#define OPT_cache 46
 
 // help (-h,--help) : show brief usage info
-#define OPT_help 32
+#define OPT_help 47
 
 // x_small_buffers (--x-small-buffers) : for testing only, not useful otherwise
-#define OPT_x_small_buffers 33
+#define OPT_x_small_buffers 48
 
 // x_testing (--x-testing) : for testing only, not useful otherwise
-#define OPT_x_testing 34
+#define OPT_x_testing 49
 
 // x_no_cache (--x-no-cache) : for testing only, not useful otherwise
-#define OPT_x_no_cache 35
+#define OPT_x_no_cache 50
 
 // x_cache_min_size (--x-cache-min-size) N : for testing only, not useful otherwise
-#define OPT_x_cache_min_size 36
+#define OPT_x_cache_min_size 51
 
 // x_wait (--x-wait) : wait for newline before starting
-#define OPT_x_wait 37
+#define OPT_x_wait 52
 
 // scan: scan starting from the given path
 #define COMMAND_scan 1
 
+// watch: scan, then keep duplicates current as files change
+#define COMMAND_watch 2
+
 // refresh: remove deleted files from the database
-#define COMMAND_refresh 2
+#define COMMAND_refresh 3
 
 // report: show duplicate report from last scan
-#define COMMAND_report 3
+#define COMMAND_report 4
 
 // file: based on report, check for duplicates of one file
-#define COMMAND_file 4
+#define COMMAND_file 5
 
 // uniques: based on report, look for unique files
-#define COMMAND_uniques 5
+#define COMMAND_uniques 6
 
 // dups: based on report, look for duplicate files
-#define COMMAND_dups 6
+#define COMMAND_dups 7
 
 // ls: based on report, list info about every file seen
-#define COMMAND_ls 7
+#define COMMAND_ls 8
 
 // hash: just hash one file, no duplicate detection
-#define COMMAND_hash 8
+#define COMMAND_hash 9
 
 // cache: operate on the hash cache
-#define COMMAND_cache 9
+#define COMMAND_cache 10
 
 // rmsh: create shell script to delete all duplicates
-#define COMMAND_rmsh 10
+#define COMMAND_rmsh 11
 
 // validate: revalidate all duplicates in db
-#define COMMAND_validate 11
+#define COMMAND_validate 12
 
 // help: show brief usage info
-#define COMMAND_help 12
+#define COMMAND_help 13
 
 // usage: show more extensive documentation
-#define COMMAND_usage 13
+#define COMMAND_usage 14
 
 // man: show more extensive documentation
-#define COMMAND_man 14
+#define COMMAND_man 15
 
 // license: show license info
-#define COMMAND_license 15
+#define COMMAND_license 16
 
 // version: show version and exit
-#define COMMAND_version 16
+#define COMMAND_version 17
 
 // testing: testing only, ignore
-#define COMMAND_testing 17
+#define COMMAND_testing 18
 
 // info: developer info, ignore
-#define COMMAND_info 18
+#define COMMAND_info 19
 
 // GLOBAL: 
-#define COMMAND_GLOBAL 19
+#define COMMAND_GLOBAL 20
 
 /**
  * Function to parse the arguments.
@@ -17,12 +17,15 @@
   along with dupd.  If not, see <http://www.gnu.org/licenses/>.
 */
 
+#include <stddef.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <strings.h>
+#include <sys/mman.h>
 #include <unistd.h>
 
+#include "bufpool.h"
 #include "dbops.h"
 #include "dirtree.h"
 #include "dtrace.h"
@@ -49,6 +52,8 @@ static char * next_entry;
 static char * path_block_end;
 static long space_used;
 static long space_allocated;
+static uint32_t read_states_in_use = 0;
+static uint32_t read_states_peak = 0;
 void * fiemap = NULL;
 
 
@@ -95,18 +100,22 @@ void dump_path_list(const char * line, uint64_t size,
       printf("   file state: %s\n", file_state(entry->state));
       printf("   filename_size: %d\n", entry->filename_size);
       printf("   dir: %p\n", entry->dir);
-      printf("   fd: %d\n", entry->fd);
       printf("   next: %p\n", entry->next);
-      printf("   buffer: %p\n", entry->buffer);
-      printf("   bufsize: %" PRIu32 "\n", entry->bufsize);
-      printf("   data_in_buffer: %" PRIu32 "\n", entry->data_in_buffer);
-      printf("   file_pos: %" PRIu64 "\n", entry->file_pos);
-      printf("   next_read_byte: %" PRIu64 "\n", entry->next_read_byte);
-      printf("   next_buffer_pos: %" PRIu32 "\n", entry->next_buffer_pos);
-      printf("   next_read_block: %d\n", entry->next_read_block);
       printf("   blocks: %p\n", entry->blocks);
-      printf("   hash_ctx: %p\n", entry->hash_ctx);
       dump_block_list("      ", entry->blocks);
+      printf("   read state: %p\n", entry->rs);
+      if (entry->rs != NULL) {
+        struct path_read_state * rs = entry->rs;
+        printf("   fd: %d\n", rs->fd);
+        printf("   buffer: %p\n", rs->buffer);
+        printf("   bufsize: %" PRIu32 "\n", rs->bufsize);
+        printf("   data_in_buffer: %" PRIu32 "\n", rs->data_in_buffer);
+        printf("   file_pos: %" PRIu64 "\n", rs->file_pos);
+        printf("   next_read_byte: %" PRIu64 "\n", rs->next_read_byte);
+        printf("   next_buffer_pos: %" PRIu32 "\n", rs->next_buffer_pos);
+        printf("   next_read_block: %d\n", rs->next_read_block);
+        printf("   hash_ctx: %p\n", rs->hash_ctx);
+      }
 
       filename = pb_get_filename(entry);
       bzero(buffer, DUPD_PATH_MAX);
@@ -349,32 +358,101 @@ void free_path_block()
  * Public function, see paths.h
  *
  */
-void free_path_entry(char * path, uint64_t size,
-                     struct path_list_entry * entry)
+void unmap_read_window(char * path, uint64_t size,
+                       struct path_read_state * rs)
 {
-  if (entry->buffer != NULL) {
-    free(entry->buffer);
-    entry->buffer = NULL;
-    dec_stats_read_buffers_allocated(path, size, entry->bufsize);
-    entry->bufsize = 0;
-    entry->data_in_buffer = 0;
+  if (rs->map == NULL) {
+    return;
   }
 
-  if (entry->hash_ctx != NULL) {
-    hash_fn_buf_free(entry->hash_ctx);
-    entry->hash_ctx = NULL;
-  }
+  munmap(rs->map, rs->map_len);
+  dec_stats_read_buffers_allocated(path, size, rs->map_len);
+  rs->map = NULL;
+  rs->map_len = 0;
+  rs->buffer = NULL;
+}
+
+
+/** ***************************************************************************
+ * Public function, see paths.h
+ *
+ */
+void free_path_entry(char * path, uint64_t size,
+                     struct path_list_entry * entry)
+{
+  struct path_read_state * rs = entry->rs;
 
   if (entry->blocks != NULL) {
     free(entry->blocks);
     entry->blocks = NULL;
   }
 
-  if (entry->fd != 0) {
-    close(entry->fd);
-    entry->fd = 0;
+  // If an io_uring read into the buffer is still pending, the reader
+  // will call here again once it completes.
+  if (rs == NULL || rs->in_flight) {
+    return;
+  }
+
+  if (rs->map != NULL) {
+    unmap_read_window(path, size, rs);
+  } else if (rs->buffer != NULL) {
+    dec_stats_read_buffers_allocated(path, size,
+                                     read_buffer_alloc_size(rs->bufsize));
+    put_read_buffer(rs->buffer, rs->bufsize);
+  }
+
+  if (rs->hash_ctx != NULL) {
+    hash_fn_buf_free(rs->hash_ctx);
+  }
+
+  if (rs->fd != 0) {
+    close(rs->fd);
     update_open_files(-1);
   }
+
+  free(rs);
+  entry->rs = NULL;
+  __atomic_sub_fetch(&read_states_in_use, 1, __ATOMIC_RELAXED);
+}
+
+
+/** ***************************************************************************
+ * Public function, see paths.h
+ *
+ */
+struct path_read_state * alloc_read_state(struct path_list_entry * entry)
+{
+  struct path_read_state * rs;
+
+  rs = (struct path_read_state *)calloc(1, sizeof(struct path_read_state));
+  if (rs == NULL) {                                          // LCOV_EXCL_START
+    printf("error: unable to allocate read state\n");
+    exit(1);
+  }                                                          // LCOV_EXCL_STOP
+
+  entry->rs = rs;
+
+  // Peak is only reported for information, a lost update is harmless
+  uint32_t n = __atomic_add_fetch(&read_states_in_use, 1, __ATOMIC_RELAXED);
+  if (n > read_states_peak) {
+    read_states_peak = n;
+  }
+
+  return rs;
+}
+
+
+/** ***************************************************************************
+ * Return the fiemap to use for files in the given directory. Files on SSDs
+ * are not read in block order so there is no need to look up their blocks.
+ *
+ */
+static void * device_fiemap(struct direntry * dir_entry)
+{
+  if (read_device_is_ssd(dir_entry->device)) {
+    return NULL;
+  }
+  return fiemap;
 }
 
 
@@ -388,8 +466,8 @@ struct path_list_head * insert_first_path(char * filename,
 {
   int filename_len = strlen(filename);
 
-  int space_needed = filename_len +
-    sizeof(struct path_list_head) + sizeof(struct path_list_entry);
+  int space_needed = filename_len + sizeof(struct path_list_head) +
+    offsetof(struct path_list_entry, filename);
 
   check_space(space_needed);
   space_used += space_needed;
@@ -428,18 +506,10 @@ struct path_list_head * insert_first_path(char * filename,
   // Initialize the first entry
   s_files_processed++;
   first_entry->filename_size = (uint8_t)filename_len;
-  first_entry->fd = 0;
   first_entry->dir = dir_entry;
   first_entry->blocks = NULL;
-  first_entry->hash_ctx = NULL;
-  first_entry->file_pos = 0;
-  first_entry->next_read_byte = 0;
-  first_entry->next_buffer_pos = 0;
-  first_entry->next_read_block = 0;
+  first_entry->rs = NULL;
   first_entry->next = NULL;
-  first_entry->buffer = NULL;
-  first_entry->bufsize = 0;
-  first_entry->data_in_buffer = 0;
   memcpy(filebuf, filename, filename_len);
   dtrace_set_state(filename, size, 0, FS_NEED_DATA);
   first_entry->state = FS_NEED_DATA;
@@ -467,9 +537,11 @@ void insert_end_path(char * filename, struct direntry * dir_entry,
 {
   char pathbuf[DUPD_PATH_MAX];
   struct block_list * block_list = NULL;
+  STRUCT_STAT info;
 
   int filename_len = strlen(filename);
-  int space_needed = sizeof(struct path_list_entry) + filename_len;
+  int space_needed =
+    offsetof(struct path_list_entry, filename) + filename_len;
   check_space(space_needed);
   space_used += space_needed;
 
@@ -491,18 +563,10 @@ void insert_end_path(char * filename, struct direntry * dir_entry,
   // Initialize this new entry
   s_files_processed++;
   entry->filename_size = (uint8_t)filename_len;
-  entry->fd = 0;
   entry->dir = dir_entry;
   entry->next = NULL;
-  entry->buffer = NULL;
-  entry->hash_ctx = NULL;
-  entry->bufsize = 0;
-  entry->data_in_buffer = 0;
   entry->blocks = NULL;
-  entry->file_pos = 0;
-  entry->next_read_byte = 0;
-  entry->next_buffer_pos = 0;
-  entry->next_read_block = 0;
+  entry->rs = NULL;
   memcpy(filebuf, filename, filename_len);
   dtrace_set_state(filename, size, 0, FS_NEED_DATA);
   entry->state = FS_NEED_DATA;
@@ -521,8 +585,6 @@ void insert_end_path(char * filename, struct direntry * dir_entry,
       head->wanted_bufsize = hash_one_block_size;
     }
 
-    STRUCT_STAT info;
-
     // Add the first entry to the read list. It wasn't added earlier
     // because we didn't know it needed to be there but now we do.
     // We'll need to re-stat() it to get info. This should be fast
@@ -535,7 +597,12 @@ void insert_end_path(char * filename, struct direntry * dir_entry,
       exit(1);
     }                                                      // LCOV_EXCL_STOP
 
-    block_list = get_block_info_from_path(pathbuf, info.st_ino, size,fiemap);
+    if (prior->dir->device == 0) {
+      prior->dir->device = read_device_index(info.st_dev);
+    }
+
+    block_list = get_block_info_from_path(pathbuf, info.st_ino, size,
+                                          device_fiemap(prior->dir));
     prior->blocks = block_list;
     add_to_read_list(head, prior, info.st_ino);
 
@@ -549,7 +616,15 @@ void insert_end_path(char * filename, struct direntry * dir_entry,
   }
 
   build_path_from_string(filename, dir_entry, pathbuf);
-  block_list = get_block_info_from_path(pathbuf, inode, size, fiemap);
+
+  // The read list is split by device. All files in a directory are on the
+  // same device so only need to stat() one file per directory to find out.
+  if (dir_entry->device == 0 && get_file_info(pathbuf, &info) == 0) {
+    dir_entry->device = read_device_index(info.st_dev);
+  }
+
+  block_list = get_block_info_from_path(pathbuf, inode, size,
+                                        device_fiemap(dir_entry));
   entry->blocks = block_list;
   add_to_read_list(head, entry, inode);
 
@@ -586,6 +661,8 @@ void report_path_block_usage()
   printf("Total path block size: %ld\n", space_allocated);
   printf("Bytes used in this run: %ld (%d%%)\n", space_used, pct);
   printf("Total files in path list: %" PRIu32 "\n", stats_path_list_entries);
+  printf("Peak read states allocated: %" PRIu32 " (%" PRIu32 " bytes each)\n",
+         read_states_peak, (uint32_t)sizeof(struct path_read_state));
 }
 
 
@@ -36,12 +36,17 @@
  * a path_list_head struct. Immediately following (in memory) there will
  * be the first path_list_entry.
  *
+ * Most files scanned never need to be read (their size is unique) so the
+ * path_list_entry only holds what is needed to identify the file. The state
+ * needed while reading it lives in a separate path_read_state which is only
+ * allocated once reading starts (see pb_read_state()) and released as soon
+ * as the file is done (free_path_entry()).
+ *
  */
-struct path_list_entry {
-  struct path_list_entry * next;
-  struct block_list * blocks;
-  struct direntry * dir;
-  char * buffer;
+struct path_read_state {
+  char * buffer;            // points into map when using --mmap
+  char * map;               // mapped window of the file, or NULL
+  size_t map_len;
   void * hash_ctx;
   uint64_t file_pos;
   uint64_t next_read_byte;
@@ -49,10 +54,19 @@ struct path_list_entry {
   uint32_t bufsize;
   uint32_t data_in_buffer;
   int fd;
+  uint8_t next_read_block;
+  uint8_t in_flight;        // an io_uring read into buffer is pending
+  uint8_t direct;           // fd was opened with O_DIRECT
+};
+
+struct path_list_entry {
+  struct path_list_entry * next;
+  struct block_list * blocks;
+  struct direntry * dir;
+  struct path_read_state * rs;
   uint8_t state;
   uint8_t filename_size;
-  uint8_t next_read_block;
-  // filename follows, file_size bytes
+  char filename[];          // NOT null-terminated, filename_size bytes
 };
 
 struct path_list_head {
@@ -130,7 +144,7 @@ void free_path_block();
 
 
 /** ***************************************************************************
- * Free buffers related to one path entry.
+ * Free buffers and read state related to one path entry.
  *
  * Parameters:
  *     path  - File path of entry
@@ -144,6 +158,22 @@ void free_path_entry(char * path, uint64_t size,
                      struct path_list_entry * entry);
 
 
+/** ***************************************************************************
+ * Unmap the window of file data mapped for this entry (with --mmap), if
+ * any, and stop counting it against the buffer limit.
+ *
+ * Parameters:
+ *     path - File path of entry
+ *     size - Size of file in path
+ *     rs   - Read state of the entry
+ *
+ * Return: none
+ *
+ */
+void unmap_read_window(char * path, uint64_t size,
+                       struct path_read_state * rs);
+
+
 /** ***************************************************************************
  * Inserts the first file in a path list into the next available slot.
  * Subsequent files of the same size are added with insert_end_path().
@@ -222,7 +252,38 @@ pb_get_first_entry(struct path_list_head * head)
 static inline char * pb_get_filename(struct path_list_entry * entry)
 {
   if (entry == NULL) { return NULL; }
-  return (char *)((char *)entry + sizeof(struct path_list_entry));
+  return entry->filename;
+}
+
+
+/** ***************************************************************************
+ * Allocate the read state of a path list entry. Internal, use
+ * pb_read_state() instead.
+ *
+ * Parameters:
+ *     entry - The path list entry.
+ *
+ * Return: The (zeroed) read state now attached to entry.
+ *
+ */
+struct path_read_state * alloc_read_state(struct path_list_entry * entry);
+
+
+/** ***************************************************************************
+ * Given a path list entry, return its read state, allocating it if this
+ * is the first time the entry is being read.
+ *
+ * Parameters:
+ *     entry - The path list entry.
+ *
+ * Return: The read state of entry.
+ *
+ */
+static inline struct path_read_state *
+pb_read_state(struct path_list_entry * entry)
+{
+  if (entry->rs != NULL) { return entry->rs; }
+  return alloc_read_state(entry);
 }
 
 
@@ -42,6 +42,13 @@ static uint64_t read_block_counter = 0;
 
 struct read_list_entry * read_list = NULL;
 uint64_t read_list_end;
+struct read_list_part * read_list_parts = NULL;
+int read_list_part_count = 0;
+
+static dev_t read_devices[MAX_READ_DEVICES + 1];
+static uint8_t read_device_ssd[MAX_READ_DEVICES + 1];
+static int read_device_count = 0;
+static int read_ssd_count = 0;
 
 struct read_list_entry * inode_read_list = NULL;
 static uint64_t inode_read_list_end;
@@ -102,6 +109,111 @@ static int rl_compare_b(const void * a, const void * b)
 }
 
 
+/** ***************************************************************************
+ * Split the sorted read list into one part per device.
+ *
+ * The entries of each device are moved (stably, so the read order within
+ * each device is preserved) into a contiguous range of 'out'.
+ *
+ * Parameters:
+ *    in  - The sorted read list.
+ *    out - Space for the same number of entries.
+ *    len - Number of entries.
+ *
+ * Return: none
+ *
+ */
+static void partition_read_list(struct read_list_entry * in,
+                                struct read_list_entry * out, uint64_t len)
+{
+  uint64_t count[MAX_READ_DEVICES + 1];
+  uint64_t next[MAX_READ_DEVICES + 1];
+  uint64_t pos = 0;
+  int parts = 0;
+
+  memset(count, 0, sizeof(count));
+  for (uint64_t i = 0; i < len; i++) {
+    count[in[i].device]++;
+  }
+
+  for (int d = 0; d <= MAX_READ_DEVICES; d++) {
+    if (count[d] > 0) { parts++; }
+  }
+
+  read_list_parts =
+    (struct read_list_part *)calloc(parts, sizeof(struct read_list_part));
+  read_list_part_count = parts;
+
+  parts = 0;
+  for (int d = 0; d <= MAX_READ_DEVICES; d++) {
+    next[d] = pos;
+    if (count[d] > 0) {
+      read_list_parts[parts].start = pos;
+      read_list_parts[parts].end = pos + count[d];
+      read_list_parts[parts].device = d;
+      read_list_parts[parts].ssd = read_device_ssd[d];
+      LOG(L_INFO, "read_list: device %d: BLOCKS %" PRIu64 "\n", d, count[d]);
+      parts++;
+      pos += count[d];
+    }
+  }
+
+  for (uint64_t i = 0; i < len; i++) {
+    out[next[in[i].device]++] = in[i];
+  }
+}
+
+
+/** ***************************************************************************
+ * Public function, see readlist.h
+ *
+ */
+uint8_t read_device_index(dev_t dev)
+{
+  for (int i = 1; i <= read_device_count; i++) {
+    if (read_devices[i] == dev) {
+      return i;
+    }
+  }
+
+  if (read_device_count == MAX_READ_DEVICES) {
+    return MAX_READ_DEVICES;
+  }
+
+  read_device_count++;
+  read_devices[read_device_count] = dev;
+
+  // Devices not known to be either are read like hard drives, which is
+  // never terribly slow on an SSD. The reverse is not true.
+  switch (device_type) {
+  case DEVICE_TYPE_HDD:
+    read_device_ssd[read_device_count] = 0;
+    break;
+  case DEVICE_TYPE_SSD:
+    read_device_ssd[read_device_count] = 1;
+    break;
+  default:
+    read_device_ssd[read_device_count] = device_is_rotational(dev) == 0;
+  }
+  read_ssd_count += read_device_ssd[read_device_count];
+
+  LOG(L_INFO, "Device %d is %ld (%s)\n", read_device_count, (long)dev,
+      read_device_ssd[read_device_count] ? "ssd" : "hdd");
+
+  return read_device_count;
+}
+
+
+/** ***************************************************************************
+ * Public function, see readlist.h
+ *
+ */
+int read_device_is_ssd(uint8_t device)
+{
+  return read_device_ssd[device];
+}
+
+
 /** ***************************************************************************
  * Public function, see readlist.h
  *
@@ -132,6 +244,12 @@ void free_read_list()
     read_list = NULL;
     read_list_end = 0;
   }
+
+  if (read_list_parts != NULL) {
+    free(read_list_parts);
+    read_list_parts = NULL;
+    read_list_part_count = 0;
+  }
 }
 
 
@@ -211,25 +329,28 @@ void add_to_read_list(struct path_list_head * head,
 
 /** ***************************************************************************
  * Add all blocks of all files (in FS_NEED_DATA state) in a given path list
- * to the tmp_read_list provided.
+ * to the tmp_read_list provided. Only files on SSDs are added if 'ssd',
+ * otherwise only files on other devices.
  *
  */
 static uint64_t
 add_all_blocks_from_group(struct path_list_head * plhead,
                           struct read_list_entry * tmp_read_list,
-                          uint64_t * tmp_index)
+                          uint64_t * tmp_index, int ssd)
 {
   uint64_t n = 0;
   struct path_list_entry * entry = pb_get_first_entry(plhead);
 
   while (entry != NULL) {
-    if (entry->state == FS_NEED_DATA) {
+    if (entry->state == FS_NEED_DATA &&
+        read_device_is_ssd(entry->dir->device) == ssd) {
       for (uint8_t i = 0; i < entry->blocks->count; i++) {
         tmp_read_list[*tmp_index].pathlist_head = plhead;
         tmp_read_list[*tmp_index].pathlist_self = entry;
         tmp_read_list[*tmp_index].block = entry->blocks->entry[i].block;
         tmp_read_list[*tmp_index].inode = 0;
         tmp_read_list[*tmp_index].done = 0;
+        tmp_read_list[*tmp_index].device = entry->dir->device;
         (*tmp_index)++;
         n++;
       }
@@ -329,6 +450,27 @@ void sort_read_list()
   // need some tuning, but ultimately there isn't any one optimal order
   // as it will depend on the file set being scanned.
 
+  // 0: None of this matters for files on SSDs where there is no seek
+  // penalty. Those are read in size list order, so each set can be
+  // completed (and its buffers released) as soon as possible.
+
+  if (read_ssd_count > 0) {
+    block_counter = 0;
+    set_counter = 0;
+    szl = size_list_head;
+    while (szl != NULL) {
+      uint64_t n = add_all_blocks_from_group(szl->path_list, the_read_list,
+                                             &read_list_index, 1);
+      if (n > 0) {
+        block_counter += n;
+        set_counter++;
+      }
+      szl = szl->next;
+    }
+    LOG(L_INFO, "read_list: (#0 ssd files): "
+        "SETS %" PRIu64 ", BLOCKS %" PRIu64 "\n", set_counter, block_counter);
+  }
+
   // 1: Handle all groups of files smaller than a single read block.
   // All these files will be read in a single read() so for each file there
   // can't be any further pending reads.
@@ -339,14 +481,14 @@ void sort_read_list()
   szl = size_list_head;
   while (szl != NULL) {
     if (szl->size <= hash_one_block_size) {
-      block_counter +=
-        add_all_blocks_from_group(szl->path_list, tmp_read_list, &tmp_index);
+      block_counter += add_all_blocks_from_group(szl->path_list, tmp_read_list,
+                                                &tmp_index, 0);
       set_counter++;
     }
     szl = szl->next;
   }
   sort_and_transfer(tmp_read_list, &tmp_index,the_read_list, &read_list_index);
-  if (set_counter > 0) {
+  if (block_counter > 0) {
     LOG(L_INFO, "read_list: (#1 small files): "
         "SETS %" PRIu64 ", BLOCKS %" PRIu64 "\n", set_counter, block_counter);
   }
@@ -365,14 +507,14 @@ void sort_read_list()
   while (szl != NULL) {
     if (szl->path_list->list_size <= SMALL_GROUP_SMALL_FILES_LIMIT &&
         szl->size > hash_one_block_size && szl->size <= round1_max_bytes) {
-      block_counter +=
-        add_all_blocks_from_group(szl->path_list, tmp_read_list, &tmp_index);
+      block_counter += add_all_blocks_from_group(szl->path_list, tmp_read_list,
+                                                &tmp_index, 0);
       set_counter++;
     }
     szl = szl->next;
   }
   sort_and_transfer(tmp_read_list, &tmp_index,the_read_list, &read_list_index);
-  if (set_counter > 0) {
+  if (block_counter > 0) {
     LOG(L_INFO, "read_list: (#2 medium files): "
         "SETS %" PRIu64 ", BLOCKS %" PRIu64 "\n", set_counter, block_counter);
   }
@@ -388,8 +530,8 @@ void sort_read_list()
     if (szl->path_list->list_size > SMALL_GROUP_SMALL_FILES_LIMIT &&
         szl->size > hash_one_block_size && szl->size <= round1_max_bytes) {
       tmp_index = 0;
-      block_counter =
-        add_all_blocks_from_group(szl->path_list, tmp_read_list, &tmp_index);
+      block_counter = add_all_blocks_from_group(szl->path_list, tmp_read_list,
+                                               &tmp_index, 0);
       sort_and_transfer(tmp_read_list, &tmp_index,
                         the_read_list, &read_list_index);
       LOG(L_INFO, "read_list: (#3 large set, size: %" PRIu64 "): "
@@ -407,14 +549,14 @@ void sort_read_list()
   while (szl != NULL) {
     if (szl->path_list->list_size <= SMALL_GROUP_LARGE_FILES_LIMIT &&
         szl->size > round1_max_bytes) {
-      block_counter +=
-        add_all_blocks_from_group(szl->path_list, tmp_read_list, &tmp_index);
+      block_counter += add_all_blocks_from_group(szl->path_list, tmp_read_list,
+                                                &tmp_index, 0);
       set_counter++;
     }
     szl = szl->next;
   }
   sort_and_transfer(tmp_read_list, &tmp_index,the_read_list, &read_list_index);
-  if (set_counter > 0) {
+  if (block_counter > 0) {
     LOG(L_INFO, "read_list: (#4 large files): "
         "SETS %" PRIu64 ", BLOCKS %" PRIu64 "\n", set_counter, block_counter);
   }
@@ -428,8 +570,8 @@ void sort_read_list()
     if (szl->path_list->list_size > SMALL_GROUP_LARGE_FILES_LIMIT &&
         szl->size > round1_max_bytes) {
       tmp_index = 0;
-      block_counter =
-        add_all_blocks_from_group(szl->path_list, tmp_read_list, &tmp_index);
+      block_counter = add_all_blocks_from_group(szl->path_list, tmp_read_list,
+                                               &tmp_index, 0);
       sort_and_transfer(tmp_read_list, &tmp_index,
                         the_read_list, &read_list_index);
       LOG(L_INFO, "read_list: (#5 large set, size: %" PRIu64 "): "
@@ -438,7 +580,23 @@ void sort_read_list()
     szl = szl->next;
   }
 
-  // Done! All blocks should be accounted for.
+  // Done! All blocks should be accounted for. Group them by device,
+  // reusing the tmp_read_list space.
+
+  if (read_device_count > 1) {
+    partition_read_list(the_read_list, tmp_read_list, read_list_index);
+    struct read_list_entry * swap = the_read_list;
+    the_read_list = tmp_read_list;
+    tmp_read_list = swap;
+  } else {
+    read_list_parts =
+      (struct read_list_part *)calloc(1, sizeof(struct read_list_part));
+    read_list_parts[0].start = 0;
+    read_list_parts[0].end = read_list_index;
+    read_list_parts[0].device = read_device_count;
+    read_list_parts[0].ssd = read_device_ssd[read_device_count];
+    read_list_part_count = 1;
+  }
 
   free(tmp_read_list);
   tmp_read_list = NULL;
@@ -452,7 +610,7 @@ void sort_read_list()
   // were reported as zero, give up on using fiemap ordering. Shouldn't
   // happen but if it does, revert to inodes.
 
-  if (using_fiemap) {
+  if (using_fiemap && stats_fiemap_total_blocks > 0) {
     int zeropct = (100 * stats_fiemap_zero_blocks) / stats_fiemap_total_blocks;
     if (zeropct > 5 && s_total_files_seen > 100) {
       using_fiemap = 0;
@@ -30,11 +30,27 @@ struct read_list_entry {
   struct path_list_entry * pathlist_self;
   uint64_t block;
   ino_t inode;
+  uint64_t next_parked;     // see park_read() in sizelist.c
   uint8_t done;
+  uint8_t device;
 };
 
+// After sort_read_list() the read list is split in one contiguous part
+// per device so each part can be read concurrently by its own reader.
+struct read_list_part {
+  uint64_t start;
+  uint64_t end;
+  uint8_t device;
+  uint8_t ssd;
+};
+
+// Files on devices beyond this many share the last device index
+#define MAX_READ_DEVICES 32
+
 extern struct read_list_entry * read_list;
 extern uint64_t read_list_end;
+extern struct read_list_part * read_list_parts;
+extern int read_list_part_count;
 
 
 /** ***************************************************************************
@@ -59,6 +75,36 @@ void init_read_list();
 void free_read_list();
 
 
+/** ***************************************************************************
+ * Return the index (1..MAX_READ_DEVICES) used in the read list for the
+ * given device. Zero is reserved to mean the device is not known.
+ *
+ * Not thread safe, callers must serialize (insert_end_path() is only
+ * called while holding the path list lock).
+ *
+ * Parameters:
+ *    dev - The device (st_dev).
+ *
+ * Return: device index
+ *
+ */
+uint8_t read_device_index(dev_t dev);
+
+
+/** ***************************************************************************
+ * Check whether the given device is read as an SSD. Files on SSDs are read
+ * in size list order with many reads in flight, files on hard drives
+ * (and on devices of unknown type) in disk order with only a few.
+ *
+ * Parameters:
+ *    device - Device index from read_device_index().
+ *
+ * Return: true if device is read as an SSD.
+ *
+ */
+int read_device_is_ssd(uint8_t device);
+
+
 /** ***************************************************************************
  * Add a file to the read list.
  *
@@ -79,6 +125,8 @@ void add_to_read_list(struct path_list_head * head,
  *
  * If hardlink_is_unique, also removes duplicate inodes from the list.
  *
+ * The sorted list is then grouped by device, see read_list_parts.
+ *
  * Parameters: none
  *
  * Return: none
@@ -29,8 +29,12 @@
 #include <time.h>
 #include <unistd.h>
 
+#include "checkpoint.h"
 #include "dbops.h"
+#include "dirindex.h"
+#include "dirread.h"
 #include "dirtree.h"
+#include "exclude.h"
 #include "filecompare.h"
 #include "main.h"
 #include "readlist.h"
@@ -44,12 +48,51 @@
 #define D_FILE 2
 #define D_OTHER 3
 #define D_ERROR 4
+#define D_BADSEP 5
+
+#define WALK_BATCH 64
 
 struct scan_list_entry {
   struct direntry * dir_entry;
   char path[DUPD_PATH_MAX];
 };
 
+struct walk_batch_entry {
+  int type;
+  ino_t inode;
+  uint64_t size;
+  char name[DUPD_FILENAME_MAX];
+};
+
+struct walker {
+  int thread_num;
+  pthread_t thread;
+  pthread_mutex_t lock;
+  struct scan_list_entry * list;
+  int capacity;
+  int bottom;
+  int top;
+  int usage_max;
+  int resizes;
+  long steals;
+  struct dir_reader reader;
+  struct dir_listing listing;
+  struct walk_batch_entry batch[WALK_BATCH];
+};
+
+static struct walker * walkers = NULL;
+static int walker_count = 0;
+static int walk_queued = 0;
+static int walk_outstanding = 0;
+static int walk_idle = 0;
+static sqlite3 * walk_dbh = NULL;
+static dev_t walk_device = 0;
+static int (*walk_process_file)(sqlite3 *, ino_t, uint64_t, char *,
+                                char *, struct direntry *) = NULL;
+static pthread_mutex_t walk_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t walk_cond = PTHREAD_COND_INITIALIZER;
+static pthread_mutex_t feed_lock = PTHREAD_MUTEX_INITIALIZER;
+
 static struct scan_list_entry * scan_list = NULL;
 static int scan_list_capacity = 0;
 static int scan_list_pos = -1;
@@ -145,7 +188,7 @@ static void * scan_status(void * arg)
     kread = stats_total_bytes_read / 1024;
     ksec = delta == 0 ? 0 : kread / delta;
     queued = 0;
-    for (int q = 0; q < MAX_HASHER_THREADS; q++) {
+    for (int q = 0; q < hash_threads; q++) {
       queued += stats_hasher_queue_len[q];
     }
     if (queued < 0) { queued = 0; }
@@ -195,6 +238,89 @@ void free_scanlist()
 }
 
 
+/** ***************************************************************************
+ * Build the full path of a directory entry into newpath.
+ *
+ * Parameters:
+ *    newpath - Output buffer, must be DUPD_PATH_MAX * 2 bytes.
+ *    current - Path of the directory containing the entry.
+ *    curlen  - Length of current.
+ *    name    - Name of the entry.
+ *
+ * Return: none
+ *
+ */
+static inline void build_entry_path(char * newpath, char * current,
+                                    int curlen, char * name)
+{
+  if (curlen == 1 && current[0] == '/') {
+    snprintf(newpath, DUPD_PATH_MAX, "/%s", name);
+  } else {
+    snprintf(newpath, DUPD_PATH_MAX * 2, "%s/%s", current, name);
+  }
+}
+
+
+/** ***************************************************************************
+ * Determine the type of a directory entry.
+ *
+ * If DIRENT_HAS_TYPE, we can get the type of the file from d_type
+ * which means we can skip doing stat() on it here and instead let
+ * the worker thread do it. That means we won't know the size of the file
+ * yet but that's ok. If so, set it to SCAN_SIZE_UNKNOWN to let the
+ * worker thread know it'll have to get the size.
+ * This doesn't work on some filesystems such as XFS. In that case, fall
+ * back on calling stat() as usual.
+ *
+ * Parameters:
+ *    d_type  - Type of the entry as returned by the dir_reader.
+ *    newpath - Full path of the entry.
+ *    inode   - Set to the inode of the entry (or SCAN_INODE_UNKNOWN).
+ *    size    - Set to the size of the entry (or SCAN_SIZE_UNKNOWN).
+ *
+ * Return: D_DIR, D_FILE, D_OTHER or D_ERROR
+ *
+ */
+static int entry_type(unsigned char d_type, char * newpath,
+                      ino_t * inode, uint64_t * size)
+{
+  STRUCT_STAT new_stat_info;
+  int type = D_OTHER;
+
+#ifdef DIRENT_HAS_TYPE
+  *size = SCAN_SIZE_UNKNOWN;
+  *inode = SCAN_INODE_UNKNOWN;
+  if (d_type == DT_REG) {
+    type = D_FILE;
+  } else if (d_type == DT_DIR) {
+    type = D_DIR;
+  }
+#else
+  (void)d_type;
+#endif
+  if (type == D_OTHER) {
+    int rv = get_file_info(newpath, &new_stat_info);
+    *size = (uint64_t)new_stat_info.st_size;
+
+    if (debug_size == *size) {
+      LOG(L_PROGRESS, "walk_dir found file is size %" PRIu64 " [%s]\n",
+          *size, newpath);
+    }
+
+    *inode = new_stat_info.st_ino;
+    if (rv != 0) {
+      type = D_ERROR;
+    } else if (S_ISDIR(new_stat_info.st_mode)) {
+      type = D_DIR;
+    } else if (S_ISREG(new_stat_info.st_mode)) {
+      type = D_FILE;
+    }
+  }
+
+  return type;
+}
+
+
 /** ***************************************************************************
  * Public function, see scan.h
  *
@@ -205,15 +331,14 @@ void walk_dir(sqlite3 * dbh, const char * path, struct direntry * dir_entry,
                                   char *, struct direntry *))
 {
   STRUCT_STAT new_stat_info;
-  int rv;
   int curlen;
-  struct dirent * entry;
+  struct dir_reader reader;
   char newpath[DUPD_PATH_MAX * 2];
   struct direntry * current_dir_entry;
   char current[DUPD_PATH_MAX];
   ino_t inode;
   uint64_t size;
-  long type;
+  int type;
 
   if (path == NULL || path[0] == 0) {                        // LCOV_EXCL_START
     printf("walk_dir called on null or empty path!\n");
@@ -225,6 +350,8 @@ void walk_dir(sqlite3 * dbh, const char * path, struct direntry * dir_entry,
   scan_list[scan_list_pos].dir_entry = dir_entry;
   strlcpy(scan_list[scan_list_pos].path, path, DUPD_PATH_MAX);
 
+  dir_reader_init(&reader);
+
   // Process directories off the scan_list until none left
   while (scan_list_pos >= 0) {
 
@@ -235,22 +362,30 @@ void walk_dir(sqlite3 * dbh, const char * path, struct direntry * dir_entry,
     LOG(L_FILES, "\nDIR: (%d)[%s]\n", scan_list_pos, current);
     scan_list_pos--;
 
-    DIR * dir = opendir(current);
-    if (dir == NULL) {                                       // LCOV_EXCL_START
+    if (dir_reader_open(&reader, current)) {                 // LCOV_EXCL_START
       LOG_PROGRESS { perror(current); }
       continue;
     }                                                        // LCOV_EXCL_STOP
 
-    while ((entry = readdir(dir))) {
+    while (dir_reader_next(&reader)) {
 
-      char first = entry->d_name[0];
+      char first = reader.name[0];
       if (!scan_hidden && first == '.') {
         continue;
       }
 
       if (first == '.') {
-        if (entry->d_name[1] == 0) { continue; }
-        if (entry->d_name[1] == '.' && entry->d_name[2] == 0) { continue; }
+        if (reader.name[1] == 0) { continue; }
+        if (reader.name[1] == '.' && reader.name[2] == 0) { continue; }
+      }
+
+      // Excluded entries are dropped before any stat() or opendir()
+      if (have_excludes()) {
+        build_entry_path(newpath, current, curlen, reader.name);
+        if (is_excluded(newpath, reader.name)) {
+          LOG(L_SKIPPED, "SKIP (excluded) [%s]\n", newpath);
+          continue;
+        }
       }
 
       s_total_files_seen++;
@@ -264,56 +399,15 @@ void walk_dir(sqlite3 * dbh, const char * path, struct direntry * dir_entry,
       // Skip files with 'path_separator' in them because dupd uses this
       // character as a separator in the sqlite duplicates table.
 
-      if (strchr(entry->d_name, path_separator)) {
+      if (strchr(reader.name, path_separator)) {
         LOG(L_PROGRESS, "SKIP (due to %c) [%s/%s]\n",
-            path_separator, current, entry->d_name);
+            path_separator, current, reader.name);
         s_files_skip_badsep++;
         continue;
       }
 
-      if (curlen == 1 && current[0] == '/') {
-        snprintf(newpath, DUPD_PATH_MAX, "/%s", entry->d_name);
-      } else {
-        snprintf(newpath, DUPD_PATH_MAX * 2, "%s/%s", current, entry->d_name);
-      }
-
-      // If DIRENT_HAS_TYPE, we can get the type of the file from entry->d_type
-      // which means we can skip doing stat() on it here and instead let
-      // the worker thread do it. That means we won't know the size of the file
-      // yet but that's ok. If so, set it to SCAN_SIZE_UNKNOWN to let the
-      // worker thread know it'll have to get the size.
-      // This doesn't work on some filesystems such as XFS. In that case, fall
-      // back on calling stat() as usual.
-
-      type = D_OTHER;
-
-#ifdef DIRENT_HAS_TYPE
-      size = SCAN_SIZE_UNKNOWN;
-      inode = SCAN_INODE_UNKNOWN;
-      if (entry->d_type == DT_REG) {
-        type = D_FILE;
-      } else if (entry->d_type == DT_DIR) {
-        type = D_DIR;
-      }
-#endif
-      if (type == D_OTHER) {
-        rv = get_file_info(newpath, &new_stat_info);
-        size = (uint64_t)new_stat_info.st_size;
-
-        if (debug_size == size) {
-          LOG(L_PROGRESS, "walk_dir found file is size %" PRIu64 " [%s]\n",
-              size, newpath);
-        }
-
-        inode = new_stat_info.st_ino;
-        if (rv != 0) {
-          type = D_ERROR;
-        } else if (S_ISDIR(new_stat_info.st_mode)) {
-          type = D_DIR;
-        } else if (S_ISREG(new_stat_info.st_mode)) {
-          type = D_FILE;
-        }
-      }
+      build_entry_path(newpath, current, curlen, reader.name);
+      type = entry_type(reader.type, newpath, &inode, &size);
 
       switch(type) {
 
@@ -348,7 +442,7 @@ void walk_dir(sqlite3 * dbh, const char * path, struct direntry * dir_entry,
 
         strlcpy(scan_list[scan_list_pos].path, newpath, DUPD_PATH_MAX);
         struct direntry * new_dir_entry =
-          new_child_dir(entry->d_name, current_dir_entry);
+          new_child_dir(reader.name, current_dir_entry);
         scan_list[scan_list_pos].dir_entry = new_dir_entry;
 
         LOG(L_TRACE, "queued dir at %d: %s\n", scan_list_pos, newpath);
@@ -357,7 +451,7 @@ void walk_dir(sqlite3 * dbh, const char * path, struct direntry * dir_entry,
       case D_FILE:
         // If it is a file, just process it now
         (*process_file)(dbh, inode, size, newpath,
-                        entry->d_name, current_dir_entry);
+                        reader.name, current_dir_entry);
         break;
 
       case D_OTHER:
@@ -373,11 +467,521 @@ void walk_dir(sqlite3 * dbh, const char * path, struct direntry * dir_entry,
         break;
       }
     }
-    closedir(dir);
+    dir_reader_close(&reader);
+  }
+
+  dir_reader_free(&reader);
+}
+
+
+/** ***************************************************************************
+ * Push a directory on top of the given walker's stack.
+ * Caller must hold the walker lock.
+ *
+ * Parameters:
+ *    w         - The walker which owns the stack.
+ *    path      - Path of the directory.
+ *    dir_entry - The dir tree entry for this directory.
+ *
+ * Return: none
+ *
+ */
+static void walker_push(struct walker * w, char * path,
+                        struct direntry * dir_entry)
+{
+  if (w->top == w->capacity) {
+    if (w->bottom > 0) {
+      // Entries below bottom were stolen, reclaim that space first
+      memmove(w->list, w->list + w->bottom,
+              (w->top - w->bottom) * sizeof(struct scan_list_entry));
+      w->top -= w->bottom;
+      w->bottom = 0;
+    } else {
+      w->resizes++;
+      w->capacity *= 2;
+      w->list = (struct scan_list_entry *)
+        realloc(w->list, sizeof(struct scan_list_entry) * w->capacity);
+      LOG(L_RESOURCES, "Had to increase walker %d capacity to %d\n",
+          w->thread_num, w->capacity);
+    }
+  }
+
+  strlcpy(w->list[w->top].path, path, DUPD_PATH_MAX);
+  w->list[w->top].dir_entry = dir_entry;
+  w->top++;
+
+  if (w->top - w->bottom > w->usage_max) {
+    w->usage_max = w->top - w->bottom;
+  }
+}
+
+
+/** ***************************************************************************
+ * Take one directory off a walker stack.
+ *
+ * The owner takes the most recently pushed directory (depth first, which
+ * keeps its stack small and the directories it reads close together).
+ * Other walkers steal the oldest entry, which is the one most likely to
+ * have a large subtree below it.
+ *
+ * Parameters:
+ *    w     - The walker which owns the stack.
+ *    job   - Copy the directory here.
+ *    steal - If true, take from the bottom instead of the top.
+ *
+ * Return: 1 if a directory was taken, 0 if the stack was empty.
+ *
+ */
+static int walker_take(struct walker * w, struct scan_list_entry * job,
+                       int steal)
+{
+  int got = 0;
+
+  d_mutex_lock(&w->lock, "walker_take");
+  if (w->top > w->bottom) {
+    if (steal) {
+      *job = w->list[w->bottom];
+      w->bottom++;
+    } else {
+      w->top--;
+      *job = w->list[w->top];
+    }
+    if (w->top == w->bottom) {
+      w->top = 0;
+      w->bottom = 0;
+    }
+    got = 1;
+  }
+  d_mutex_unlock(&w->lock);
+
+  if (got) {
+    d_mutex_lock(&walk_lock, "walker_take queued");
+    walk_queued--;
+    d_mutex_unlock(&walk_lock);
+  }
+
+  return got;
+}
+
+
+/** ***************************************************************************
+ * Get the next directory for this walker to read. Looks in its own
+ * stack first, then tries to steal from the other walkers. If there is
+ * nothing to do, waits until either more directories are queued or all
+ * walkers are done.
+ *
+ * Parameters:
+ *    w   - The walker looking for work.
+ *    job - Copy the directory here.
+ *
+ * Return: 1 if job was filled, 0 if the walk is complete.
+ *
+ */
+static int walker_next_dir(struct walker * w, struct scan_list_entry * job)
+{
+  while (1) {
+
+    if (walker_take(w, job, 0)) {
+      return 1;
+    }
+
+    for (int i = 1; i < walker_count; i++) {
+      struct walker * victim = &walkers[(w->thread_num + i) % walker_count];
+      if (walker_take(victim, job, 1)) {
+        w->steals++;
+        LOG(L_MORE_THREADS, "Stole [%s] from walker %d\n",
+            job->path, victim->thread_num);
+        return 1;
+      }
+    }
+
+    d_mutex_lock(&walk_lock, "walker_next_dir");
+    if (walk_outstanding == 0) {
+      d_mutex_unlock(&walk_lock);
+      return 0;
+    }
+    if (walk_queued == 0) {
+      walk_idle++;
+      d_cond_wait(&walk_cond, &walk_lock);
+      walk_idle--;
+    }
+    d_mutex_unlock(&walk_lock);
   }
 }
 
 
+/** ***************************************************************************
+ * Feed a batch of entries read from one directory to the scan.
+ *
+ * The directory reads and any stat() calls are done by the walkers in
+ * parallel but the dirtree, the process_file callback and the scan
+ * counters are not thread safe so all the entries in the batch are handed
+ * over while holding the feed lock.
+ *
+ * Parameters:
+ *    w         - The walker which read the batch.
+ *    current   - Path of the directory.
+ *    curlen    - Length of current.
+ *    dir_entry - The dir tree entry for this directory.
+ *    count     - Number of entries in the batch.
+ *
+ * Return: none
+ *
+ */
+static void walker_flush(struct walker * w, char * current, int curlen,
+                         struct direntry * dir_entry, int count)
+{
+  char newpath[DUPD_PATH_MAX * 2];
+  struct walk_batch_entry * b;
+  int dirs = 0;
+
+  d_mutex_lock(&feed_lock, "walker_flush");
+
+  for (int i = 0; i < count; i++) {
+    b = &w->batch[i];
+
+    if (b->type != D_DIR) {
+      s_total_files_seen++;
+      LOG_PROGRESS {
+        if ((s_total_files_seen % 5000) == 0) {
+          LOG(L_PROGRESS, "Files scanned: %" PRIu32 "\n", s_total_files_seen);
+        }
+      }
+    }
+
+    build_entry_path(newpath, current, curlen, b->name);
+
+    switch(b->type) {
+
+    case D_DIR:
+      {
+        struct direntry * new_dir_entry = new_child_dir(b->name, dir_entry);
+        d_mutex_lock(&w->lock, "walker_flush push");
+        walker_push(w, newpath, new_dir_entry);
+        d_mutex_unlock(&w->lock);
+        dirs++;
+        LOG(L_TRACE, "walker %d queued dir: %s\n", w->thread_num, newpath);
+      }
+      break;
+
+    case D_FILE:
+      (*walk_process_file)(walk_dbh, b->inode, b->size, newpath,
+                           b->name, dir_entry);
+      break;
+
+    case D_OTHER:
+      LOG(L_SKIPPED, "SKIP (not file) [%s]\n", newpath);
+      stats_files_ignored++;
+      s_files_skip_notfile++;
+      break;
+
+    case D_ERROR:
+      LOG(L_PROGRESS, "SKIP (error) [%s]\n", newpath);
+      stats_files_error++;
+      s_files_skip_error++;
+      break;
+
+    case D_BADSEP:
+      LOG(L_PROGRESS, "SKIP (due to %c) [%s]\n", path_separator, newpath);
+      s_files_skip_badsep++;
+      break;
+    }
+  }
+
+  d_mutex_unlock(&feed_lock);
+
+  if (dirs) {
+    d_mutex_lock(&walk_lock, "walker_flush queued");
+    walk_queued += dirs;
+    walk_outstanding += dirs;
+    if (walk_idle > 0) {
+      pthread_cond_broadcast(&walk_cond);
+    }
+    d_mutex_unlock(&walk_lock);
+  }
+}
+
+
+/** ***************************************************************************
+ * Feed the listing of an unchanged directory (from the directory index)
+ * to the walk, as if it had just been read.
+ *
+ * Parameters:
+ *    w   - The walker.
+ *    job - The directory, its listing is in w->listing.
+ *
+ * Return: none
+ *
+ */
+static void walker_replay_dir(struct walker * w, struct scan_list_entry * job)
+{
+  STRUCT_STAT new_stat_info;
+  char newpath[DUPD_PATH_MAX * 2];
+  struct walk_batch_entry * b;
+  int curlen = strlen(job->path);
+  int count = 0;
+  uint32_t pos = 0;
+  int type;
+  char * name;
+  ino_t inode;
+
+  while (dir_listing_next(&w->listing, &pos, &type, &name, &inode)) {
+
+    // The listing may include hidden entries from a --hidden scan.
+    if (!scan_hidden && name[0] == '.') {
+      continue;
+    }
+
+    if (have_excludes()) {
+      build_entry_path(newpath, job->path, curlen, name);
+      if (is_excluded(newpath, name)) {
+        LOG(L_SKIPPED, "SKIP (excluded) [%s]\n", newpath);
+        continue;
+      }
+    }
+
+    // The file may have changed size since the listing was stored
+    // (without changing the directory), so the sizetree workers stat it.
+    b = &w->batch[count];
+    b->type = type;
+    b->size = SCAN_SIZE_UNKNOWN;
+    b->inode = inode;
+    strlcpy(b->name, name, DUPD_FILENAME_MAX);
+
+    if (type == D_DIR && one_file_system) {
+      build_entry_path(newpath, job->path, curlen, name);
+      get_file_info(newpath, &new_stat_info);
+      if (walk_device > 0 && new_stat_info.st_dev != walk_device) {
+        LOG(L_SKIPPED, "SKIP (--one-file-system) [%s]\n", newpath);
+        continue;
+      }
+    }
+
+    count++;
+    if (count == WALK_BATCH) {
+      walker_flush(w, job->path, curlen, job->dir_entry, count);
+      count = 0;
+    }
+  }
+
+  if (count > 0) {
+    walker_flush(w, job->path, curlen, job->dir_entry, count);
+  }
+}
+
+
+/** ***************************************************************************
+ * Read one directory, handing its entries over to walker_flush() in
+ * batches of up to WALK_BATCH entries.
+ *
+ * Parameters:
+ *    w   - The walker reading this directory.
+ *    job - The directory to read.
+ *
+ * Return: none
+ *
+ */
+static void walker_read_dir(struct walker * w, struct scan_list_entry * job)
+{
+  STRUCT_STAT new_stat_info;
+  STRUCT_STAT dir_info;
+  char newpath[DUPD_PATH_MAX * 2];
+  struct walk_batch_entry * b;
+  int curlen = strlen(job->path);
+  int count = 0;
+  int indexing = 0;
+
+  LOG(L_FILES, "\nDIR: (walker %d)[%s]\n", w->thread_num, job->path);
+
+  if (incremental_scan && get_file_info(job->path, &dir_info) == 0) {
+    if (dir_index_lookup(job->path, &dir_info, &w->listing)) {
+      walker_replay_dir(w, job);
+      return;
+    }
+    dir_listing_reset(&w->listing);
+    indexing = 1;
+  }
+
+  if (dir_reader_open(&w->reader, job->path)) {              // LCOV_EXCL_START
+    LOG_PROGRESS { perror(job->path); }
+    return;
+  }                                                          // LCOV_EXCL_STOP
+
+  while (dir_reader_next(&w->reader)) {
+
+    char first = w->reader.name[0];
+    if (!scan_hidden && first == '.') {
+      continue;
+    }
+
+    if (first == '.') {
+      if (w->reader.name[1] == 0) { continue; }
+      if (w->reader.name[1] == '.' && w->reader.name[2] == 0) { continue; }
+    }
+
+    // Excluded entries are dropped before any stat() or opendir(). Since
+    // they are then missing from the listing, don't save it in the index.
+    if (have_excludes()) {
+      build_entry_path(newpath, job->path, curlen, w->reader.name);
+      if (is_excluded(newpath, w->reader.name)) {
+        LOG(L_SKIPPED, "SKIP (excluded) [%s]\n", newpath);
+        indexing = 0;
+        continue;
+      }
+    }
+
+    b = &w->batch[count];
+    strlcpy(b->name, w->reader.name, DUPD_FILENAME_MAX);
+
+    // Skip files with 'path_separator' in them because dupd uses this
+    // character as a separator in the sqlite duplicates table.
+    if (strchr(w->reader.name, path_separator)) {
+      b->type = D_BADSEP;
+      b->size = 0;
+      b->inode = 0;
+
+    } else {
+      build_entry_path(newpath, job->path, curlen, w->reader.name);
+      b->type = entry_type(w->reader.type, newpath, &b->inode, &b->size);
+    }
+
+    if (indexing) {
+      if (b->type == D_ERROR) {
+        indexing = 0;
+      } else {
+        dir_listing_add(&w->listing, b->type, b->name,
+                        b->type == D_FILE ? SCAN_INODE_UNKNOWN : b->inode);
+      }
+    }
+
+    if (b->type == D_DIR && one_file_system) {
+      get_file_info(newpath, &new_stat_info);
+      if (walk_device > 0 && new_stat_info.st_dev != walk_device) {
+        LOG(L_SKIPPED, "SKIP (--one-file-system) [%s]\n", newpath);
+        continue;
+      }
+    }
+
+    count++;
+    if (count == WALK_BATCH) {
+      walker_flush(w, job->path, curlen, job->dir_entry, count);
+      count = 0;
+    }
+  }
+
+  dir_reader_close(&w->reader);
+
+  if (count > 0) {
+    walker_flush(w, job->path, curlen, job->dir_entry, count);
+  }
+
+  if (indexing) {
+    dir_index_store(job->path, &dir_info, &w->listing);
+  }
+}
+
+
+/** ***************************************************************************
+ * Walker thread main loop, reads directories until the walk is done.
+ *
+ * Parameters:
+ *    arg - The walker struct for this thread.
+ *
+ * Return: none
+ *
+ */
+static void * walker_main(void * arg)
+{
+  struct walker * w = (struct walker *)arg;
+  struct scan_list_entry * job;
+  char self[80];
+
+  snprintf(self, 80,  "      [walker-%d] ", w->thread_num);
+  pthread_setspecific(thread_name, self);
+  LOG(L_THREADS, "Thread created\n");
+
+  job = (struct scan_list_entry *)malloc(sizeof(struct scan_list_entry));
+
+  while (walker_next_dir(w, job)) {
+    walker_read_dir(w, job);
+
+    d_mutex_lock(&walk_lock, "walker_main done");
+    walk_outstanding--;
+    if (walk_outstanding == 0) {
+      pthread_cond_broadcast(&walk_cond);
+    }
+    d_mutex_unlock(&walk_lock);
+  }
+
+  free(job);
+  LOG(L_THREADS, "Thread finished, stole %ld dirs\n", w->steals);
+
+  return NULL;
+}
+
+
+/** ***************************************************************************
+ * Public function, see scan.h
+ *
+ */
+void walk_dir_threaded(sqlite3 * dbh, const char * path,
+                       struct direntry * dir_entry, dev_t device,
+                       int (*process_file)(sqlite3 *, ino_t, uint64_t,
+                                           char *, char *, struct direntry *))
+{
+  if (path == NULL || path[0] == 0) {                        // LCOV_EXCL_START
+    printf("walk_dir_threaded called on null or empty path!\n");
+    exit(1);
+  }                                                          // LCOV_EXCL_STOP
+
+  walk_dbh = dbh;
+  walk_device = device;
+  walk_process_file = process_file;
+  walker_count = scan_threads;
+  walkers = (struct walker *)calloc(walker_count, sizeof(struct walker));
+
+  for (int i = 0; i < walker_count; i++) {
+    walkers[i].thread_num = i;
+    walkers[i].capacity = x_small_buffers ? 1 : 16;
+    walkers[i].list = (struct scan_list_entry *)
+      malloc(walkers[i].capacity * sizeof(struct scan_list_entry));
+    pthread_mutex_init(&walkers[i].lock, NULL);
+    dir_reader_init(&walkers[i].reader);
+    memset(&walkers[i].listing, 0, sizeof(struct dir_listing));
+  }
+
+  // Seed the first walker with the top level starting dir, the others
+  // will steal from it as it finds subdirectories.
+  walker_push(&walkers[0], (char *)path, dir_entry);
+  walk_queued = 1;
+  walk_outstanding = 1;
+  walk_idle = 0;
+
+  for (int i = 0; i < walker_count; i++) {
+    d_create(&walkers[i].thread, walker_main, &walkers[i]);
+  }
+
+  for (int i = 0; i < walker_count; i++) {
+    d_join(walkers[i].thread, NULL);
+  }
+
+  for (int i = 0; i < walker_count; i++) {
+    if (walkers[i].usage_max > scan_list_usage_max) {
+      scan_list_usage_max = walkers[i].usage_max;
+    }
+    scan_list_resizes += walkers[i].resizes;
+    free(walkers[i].list);
+    pthread_mutex_destroy(&walkers[i].lock);
+    dir_reader_free(&walkers[i].reader);
+    free_dir_listing(&walkers[i].listing);
+  }
+
+  free(walkers);
+  walkers = NULL;
+  walker_count = 0;
+}
+
+
 /** ***************************************************************************
  * Public function, see scan.h
  *
@@ -396,8 +1000,10 @@ void scan()
   init_read_list();
 
   open_cache_database(cache_db_path);
+  init_dir_index();
 
-  dbh = open_database(db_path, 1);
+  // When resuming, keep the duplicates saved before the interruption.
+  dbh = open_database(db_path, !resume_scan);
   begin_transaction(dbh);
 
   pthread_t status_thread;
@@ -437,16 +1043,23 @@ void scan()
   // Scan phase - stat all files and build size tree, size list and path list
 
   scan_phase_started = get_current_time_millis();
-  for (int i=0; start_path[i] != NULL; i++) {
-    int rv = get_file_info(start_path[i], &stat_info);
-    if (rv != 0) {
-      printf("error: skipping requested path [%s]\n", start_path[i]);
-    } else {
-      struct direntry * top = new_child_dir(start_path[i], NULL);
-      if (threaded_sizetree) {
-        walk_dir(dbh, start_path[i], top, stat_info.st_dev, add_queue);
+  if (resume_scan) {
+    checkpoint_load(dbh);
+  } else {
+    for (int i=0; start_path[i] != NULL; i++) {
+      int rv = get_file_info(start_path[i], &stat_info);
+      if (rv != 0) {
+        printf("error: skipping requested path [%s]\n", start_path[i]);
       } else {
-        walk_dir(dbh, start_path[i], top, stat_info.st_dev, add_file);
+        struct direntry * top = new_child_dir(start_path[i], NULL);
+        if (scan_threads > 1 || incremental_scan) {
+          walk_dir_threaded(dbh, start_path[i], top, stat_info.st_dev,
+                            threaded_sizetree ? add_queue : add_file);
+        } else if (threaded_sizetree) {
+          walk_dir(dbh, start_path[i], top, stat_info.st_dev, add_queue);
+        } else {
+          walk_dir(dbh, start_path[i], top, stat_info.st_dev, add_file);
+        }
       }
     }
   }
@@ -455,6 +1068,8 @@ void scan()
     scan_done();
   }
 
+  close_dir_index(start_path);
+
   d_mutex_lock(&status_lock, "scan end");
   stats_time_scan = get_current_time_millis() - scan_phase_started;
   pthread_cond_signal(&status_cond);
@@ -467,10 +1082,20 @@ void scan()
     commit_transaction(dbh);
     close_database(dbh);
     close_cache_database(dbh);
+    checkpoint_remove();
     stats_process_duration = 0;
     return;
   }
 
+  if (!resume_scan) {
+    checkpoint_save();
+    if (x_checkpoint_exit) {
+      close_database(dbh);
+      close_cache_database(dbh);
+      exit(1);
+    }
+  }
+
   long t1 = get_current_time_millis();
   sort_read_list(fiemap_ok);
   LOG_PROGRESS {
@@ -481,7 +1106,14 @@ void scan()
   // Processing phase - walk through size list whittling down the potentials
 
   read_phase_started = get_current_time_millis();
+  checkpoint_start(dbh);
   process_size_list(dbh);
+  if (checkpoint_stop()) {
+    // Interrupted, anything published since the checkpoint is rolled back
+    close_database(dbh);
+    close_cache_database(dbh);
+    exit(1);
+  }
 
   stats_time_process = get_current_time_millis() - read_phase_started;;
 
@@ -493,6 +1125,7 @@ void scan()
   commit_transaction(dbh);
   close_database(dbh);
   close_cache_database(dbh);
+  checkpoint_remove();
 
   LOG_RESOURCES {
     report_path_block_usage();
@@ -72,6 +72,31 @@ void walk_dir(sqlite3 * dbh, const char * path, struct direntry * dir_entry,
                                   char *, struct direntry *));
 
 
+/** ***************************************************************************
+ * Same as walk_dir() but reads the directories in scan_threads threads.
+ * Each walker thread keeps its own stack of directories to read and when
+ * it runs out it steals from the others.
+ *
+ * Only the directory reading (and stat() if needed) runs in parallel,
+ * calls to process_file are serialized so it need not be thread safe.
+ * The order in which files are passed to process_file is not defined.
+ *
+ * Parameters:
+ *    dbh          - sqlite3 database handle.
+ *    path         - The path to process. Must not be null or empty.
+ *    dir_entry    - The dir tree entry for this directory.
+ *    device       - device of the initial path root. Used when the
+ *                   --one-file-system option is set to stay on that device.
+ *    process_file - Function to call on each file as it is found.
+ * Return: none
+ *
+ */
+void walk_dir_threaded(sqlite3 * dbh, const char * path,
+                       struct direntry * dir_entry, dev_t device,
+                       int (*process_file)(sqlite3 *, ino_t, uint64_t,
+                                           char *, char *, struct direntry *));
+
+
 /** ***************************************************************************
  * This is the public entry point for scanning files.
  *
@@ -0,0 +1,253 @@
+/*
+  Copyright 2021 Jyri J. Virkki <jyri@virkki.com>
+
+  This file is part of dupd.
+
+  dupd is free software: you can redistribute it and/or modify it
+  under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  dupd is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with dupd.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "main.h"
+#include "paths.h"
+#include "sizeindex.h"
+#include "stats.h"
+#include "utils.h"
+
+// A size is never zero in the index (minimum_file_size is at least 1)
+// so a zero size marks an empty slot.
+#define EMPTY_SLOT 0
+
+struct size_node {
+  uint64_t size;
+  struct path_list_head * paths;
+  char * filename;
+  struct direntry * dir_entry;
+};
+
+struct size_shard {
+  pthread_mutex_t lock;
+  struct size_node * slots;
+  uint32_t capacity;
+  uint32_t count;
+};
+
+static struct size_shard shards[SIZE_INDEX_SHARDS];
+static int size_index_ready = 0;
+
+// The path lists are not thread safe, serialize access to them.
+static pthread_mutex_t paths_lock = PTHREAD_MUTEX_INITIALIZER;
+
+
+/** ***************************************************************************
+ * Mix the bits of a size value (splitmix64 finalizer). File sizes tend to
+ * be clustered and often multiples of some block size so can't use them
+ * as-is to pick the shard and slot.
+ *
+ * Parameters:
+ *    size - File size.
+ *
+ * Return: hash of size
+ *
+ */
+static inline uint64_t size_hash(uint64_t size)
+{
+  uint64_t h = size;
+  h ^= h >> 30;
+  h *= UINT64_C(0xbf58476d1ce4e5b9);
+  h ^= h >> 27;
+  h *= UINT64_C(0x94d049bb133111eb);
+  h ^= h >> 31;
+  return h;
+}
+
+
+/** ***************************************************************************
+ * Find the slot for this size in the shard. Linear probing, so this
+ * returns either the slot holding the size or the empty slot where it
+ * would go.
+ *
+ * Parameters:
+ *    shard - The shard.
+ *    size  - File size.
+ *    hash  - size_hash(size).
+ *
+ * Return: slot
+ *
+ */
+static inline struct size_node * find_slot(struct size_shard * shard,
+                                           uint64_t size, uint64_t hash)
+{
+  uint32_t mask = shard->capacity - 1;
+  uint32_t i = (uint32_t)hash & mask;
+
+  while (shard->slots[i].size != EMPTY_SLOT && shard->slots[i].size != size) {
+    i = (i + 1) & mask;
+  }
+
+  return &shard->slots[i];
+}
+
+
+/** ***************************************************************************
+ * Double the capacity of a shard.
+ *
+ * Parameters:
+ *    shard - The shard.
+ *
+ * Return: none
+ *
+ */
+static void grow_shard(struct size_shard * shard)
+{
+  struct size_node * old = shard->slots;
+  uint32_t old_capacity = shard->capacity;
+
+  shard->capacity *= 2;
+  shard->slots = (struct size_node *)calloc(shard->capacity,
+                                            sizeof(struct size_node));
+
+  for (uint32_t i = 0; i < old_capacity; i++) {
+    if (old[i].size != EMPTY_SLOT) {
+      *find_slot(shard, old[i].size, size_hash(old[i].size)) = old[i];
+    }
+  }
+
+  free(old);
+  LOG(L_RESOURCES, "Increased size index shard capacity to %u\n",
+      shard->capacity);
+}
+
+
+/** ***************************************************************************
+ * Public function, see sizeindex.h
+ *
+ */
+int size_index_shard(uint64_t size)
+{
+  return (int)(size_hash(size) >> 58) & (SIZE_INDEX_SHARDS - 1);
+}
+
+
+/** ***************************************************************************
+ * Public function, see sizeindex.h
+ *
+ */
+void init_size_index()
+{
+  uint32_t capacity = x_small_buffers ? 2 : 1024;
+
+  for (int i = 0; i < SIZE_INDEX_SHARDS; i++) {
+    pthread_mutex_init(&shards[i].lock, NULL);
+    shards[i].capacity = capacity;
+    shards[i].count = 0;
+    shards[i].slots = (struct size_node *)calloc(capacity,
+                                                 sizeof(struct size_node));
+  }
+
+  size_index_ready = 1;
+}
+
+
+/** ***************************************************************************
+ * Public function, see sizeindex.h
+ *
+ */
+void size_index_add(ino_t inode, uint64_t size, char * filename,
+                    struct direntry * dir_entry)
+{
+  uint64_t hash = size_hash(size);
+  struct size_shard * shard = &shards[size_index_shard(size)];
+
+  d_mutex_lock(&shard->lock, "size_index_add");
+
+  // Keep load factor under 3/4
+  if ((shard->count + 1) * 4 > shard->capacity * 3) {
+    grow_shard(shard);
+  }
+
+  struct size_node * node = find_slot(shard, size, hash);
+
+  if (node->size == EMPTY_SLOT) {
+    // The first file of this size is kept in the size_node itself,
+    // waiting to see if another file of the same size is found.
+    node->size = size;
+    node->paths = NULL;
+    node->dir_entry = dir_entry;
+    int l = strlen(filename);
+    node->filename = (char *)malloc(l + 1);
+    strlcpy(node->filename, filename, l + 1);
+    shard->count++;
+
+    if (debug_size == size) {
+      LOG(L_PROGRESS, "size_index_add: size node created for size %" PRIu64
+          " by file [%s]\n", size, filename);
+    }
+
+  } else {
+    // If we reached a size_node which exists but paths is NULL that
+    // means we just found the second file of this size. So it's time
+    // to add both the previous and current to the path list.
+
+    d_mutex_lock(&paths_lock, "size_index_add paths");
+
+    if (node->paths == NULL) {
+      node->paths = insert_first_path(node->filename, node->dir_entry, size);
+      node->dir_entry = NULL;
+      free(node->filename);
+      node->filename = NULL;
+    }
+
+    insert_end_path(filename, dir_entry, inode, size, node->paths);
+
+    d_mutex_unlock(&paths_lock);
+  }
+
+  __atomic_fetch_add(&s_files_in_sizetree, 1, __ATOMIC_RELAXED);
+
+  d_mutex_unlock(&shard->lock);
+}
+
+
+/** ***************************************************************************
+ * Public function, see sizeindex.h
+ *
+ */
+void free_size_index()
+{
+  // Note: Not tracking size index allocations in --trace-memory because
+  // all of them get freed after scan stage so these don't contribute to
+  // memory usage during read/hash stage.
+
+  if (!size_index_ready) {
+    return;
+  }
+
+  for (int i = 0; i < SIZE_INDEX_SHARDS; i++) {
+    for (uint32_t n = 0; n < shards[i].capacity; n++) {
+      if (shards[i].slots[n].filename != NULL) {
+        free(shards[i].slots[n].filename);
+      }
+    }
+    free(shards[i].slots);
+    shards[i].slots = NULL;
+    pthread_mutex_destroy(&shards[i].lock);
+  }
+
+  size_index_ready = 0;
+}
@@ -0,0 +1,90 @@
+/*
+  Copyright 2021 Jyri J. Virkki <jyri@virkki.com>
+
+  This file is part of dupd.
+
+  dupd is free software: you can redistribute it and/or modify it
+  under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  dupd is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with dupd.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef _DUPD_SIZEINDEX_H
+#define _DUPD_SIZEINDEX_H
+
+#include <stdint.h>
+#include <sys/types.h>
+
+#include "dirtree.h"
+
+// Number of independently locked shards in the size index.
+#define SIZE_INDEX_SHARDS 64
+
+
+/** ***************************************************************************
+ * Initialize the size index.
+ *
+ * Parameters: none
+ *
+ * Return: none
+ *
+ */
+void init_size_index();
+
+
+/** ***************************************************************************
+ * Add a file to the size index.
+ *
+ * The first file of any given size is only held in the index. When a
+ * second file of the same size shows up, both are moved to a new path
+ * list (insert_first_path() and insert_end_path()) and all subsequent
+ * files of that size are appended to it.
+ *
+ * Files of different shards can be added concurrently from different
+ * threads.
+ *
+ * Parameters:
+ *    inode     - The inode of this file (or SCAN_INODE_UNKNOWN).
+ *    size      - Size of this file (must be > 0).
+ *    filename  - Name of this file, relative to dir_entry.
+ *    dir_entry - Directory entry of the dir containing this file.
+ *
+ * Return: none
+ *
+ */
+void size_index_add(ino_t inode, uint64_t size, char * filename,
+                    struct direntry * dir_entry);
+
+
+/** ***************************************************************************
+ * Return the shard (0 .. SIZE_INDEX_SHARDS-1) which holds this size.
+ *
+ * Parameters:
+ *    size - File size.
+ *
+ * Return: shard number
+ *
+ */
+int size_index_shard(uint64_t size);
+
+
+/** ***************************************************************************
+ * Free the size index. The path lists created from it are not affected.
+ *
+ * Parameters: none
+ *
+ * Return: none
+ *
+ */
+void free_size_index();
+
+
+#endif
@@ -27,10 +27,12 @@
 #include <stdlib.h>
 #include <string.h>
 #include <strings.h>
+#include <sys/mman.h>
 #include <sys/stat.h>
 #include <sys/types.h>
 #include <unistd.h>
 
+#include "bufpool.h"
 #include "dbops.h"
 #include "dirtree.h"
 #include "dtrace.h"
@@ -44,16 +46,81 @@
 #include "sizelist.h"
 #include "sizetree.h"
 #include "stats.h"
+#include "uring.h"
 #include "utils.h"
 
 struct size_list * size_list_head;
 static struct size_list * size_list_tail;
-static int avg_read_time = 0;
-static int read_count = 0;
 
 static pthread_mutex_t show_processed_lock = PTHREAD_MUTEX_INITIALIZER;
-
-#define HASHER_THREADS 2
+static pthread_mutex_t flusher_lock = PTHREAD_MUTEX_INITIALIZER;
+
+// End of a parked or ready read list entry chain
+#define NO_PARKED_READ UINT64_MAX
+
+// Max reads a reader keeps in flight with io_uring, and how many are
+// queued before submitting them. Hard drives get only a few reads at a
+// time so they are done close to read list (disk) order.
+#define READ_QUEUE_DEPTH 64
+#define HDD_READ_QUEUE_DEPTH 4
+#define READ_SUBMIT_BATCH 8
+
+// The sampling round (--sample) reads this many blocks of this size from
+// each file of the large size sets.
+#define SAMPLE_BLOCKS 3
+#define SAMPLE_BLOCK_SIZE 4096
+
+// One read of (part of) a block into the buffer of an entry
+struct block_read {
+  uint64_t rlpos;
+  struct path_list_head * head;
+  struct path_list_entry * entry;
+  uint64_t file_pos;
+  uint64_t started;
+  uint32_t want_bytes;
+  int filling_buffer;
+  int consumed_block;
+  int fd;
+};
+
+// One reader thread per device, reading its own part of the read list
+struct reader_param {
+  pthread_t thread;
+  sqlite3 * dbh;
+  uint64_t start;
+  uint64_t end;
+  int device;
+  int ssd;
+  int next_queue;
+  int read_count;
+  int avg_read_time;
+#ifdef USE_IO_URING
+  int ring_ok;
+  int queue_depth;
+  struct uring ring;
+  struct block_read reads[READ_QUEUE_DEPTH];
+  int free_slots[READ_QUEUE_DEPTH];
+  int free_count;
+  int unsubmitted;
+#endif
+  // Entries parked by this reader which sets have handed back (ready_head
+  // to ready_tail, linked through next_parked), see release_parked_reads()
+  pthread_mutex_t ready_lock;
+  pthread_cond_t ready_cond;
+  uint64_t ready_head;
+  uint64_t ready_tail;
+  // Entries parked (or handed back) and not yet taken, only used by the
+  // reader itself
+  uint64_t parked;
+};
+
+static struct reader_param * readers;
+static int reader_count;
+
+// Set by stop_size_list() to make the readers give up. The readers list
+// is only changed or used by stop_size_list() while holding stop_lock.
+static int size_list_stopping = 0;
+static pthread_mutex_t stop_lock = PTHREAD_MUTEX_INITIALIZER;
 
 
 /** ***************************************************************************
@@ -120,6 +187,8 @@ static struct size_list * new_size_list_entry(uint64_t size,
   e->size = size;
   e->path_list = path_list;
   e->fully_read = 0;
+  e->reads_in_flight = 0;
+  e->parked = NO_PARKED_READ;
   if (pthread_mutex_init(&e->lock, NULL)) {
                                                              // LCOV_EXCL_START
     printf("error: new_size_list_entry mutex init failed!\n");
@@ -134,84 +203,111 @@ static struct size_list * new_size_list_entry(uint64_t size,
 
 
 /** ***************************************************************************
- * Tell hasher threads that reader is done.
+ * Return the reader which owns the given read list entry.
+ *
+ */
+static struct reader_param * read_list_owner(uint64_t rlpos)
+{
+  for (int n = 0; n < reader_count; n++) {
+    if (rlpos >= readers[n].start && rlpos < readers[n].end) {
+      return &readers[n];
+    }
+  }
+                                                             // LCOV_EXCL_START
+  printf("error: no reader owns read list entry %" PRIu64 "\n", rlpos);
+  exit(1);
+}                                                            // LCOV_EXCL_STOP
+
+
+/** ***************************************************************************
+ * Park a read list entry on its set until the set changes state (see
+ * release_parked_reads()). Used for entries whose file buffer is waiting
+ * for a hasher, so the reader doesn't need to look at them meanwhile.
+ *
+ * The caller must hold sizelist->lock.
  *
  * Parameters:
- *    hasher_info - Array of hasher thread params.
+ *    reader   - The reader owning the entry.
+ *    sizelist - The set of the entry.
+ *    rlpos    - The read list entry.
  *
  * Return: none
  *
  */
-static void signal_hashers(struct hasher_param * hasher_info)
+static void park_read(struct reader_param * reader,
+                      struct size_list * sizelist, uint64_t rlpos)
 {
-  struct hasher_param * queue_info = NULL;
+  read_list[rlpos].next_parked = sizelist->parked;
+  sizelist->parked = rlpos;
+  reader->parked++;
+}
+
 
-  // Let hashers know I'm done
-  for (int n = 0; n < HASHER_THREADS; n++) {
-    queue_info = &hasher_info[n];
-    d_mutex_lock(&queue_info->queue_lock, "reader saying bye");
-    queue_info->done = 1;
-    LOG(L_MORE_THREADS, "Marking hasher thread %d done\n", n);
-    d_cond_signal(&queue_info->queue_cond);
-    d_mutex_unlock(&queue_info->queue_lock);
+/** ***************************************************************************
+ * Public function, see header file.
+ *
+ */
+void release_parked_reads(struct size_list * sizelist)
+{
+  uint64_t rlpos = sizelist->parked;
+  uint64_t next;
+  struct reader_param * owner;
+
+  sizelist->parked = NO_PARKED_READ;
+
+  while (rlpos != NO_PARKED_READ) {
+    next = read_list[rlpos].next_parked;
+    owner = read_list_owner(rlpos);
+
+    d_mutex_lock(&owner->ready_lock, "release_parked_reads");
+    read_list[rlpos].next_parked = NO_PARKED_READ;
+    if (owner->ready_head == NO_PARKED_READ) {
+      owner->ready_head = rlpos;
+    } else {
+      read_list[owner->ready_tail].next_parked = rlpos;
+    }
+    owner->ready_tail = rlpos;
+    d_cond_signal(&owner->ready_cond);
+    d_mutex_unlock(&owner->ready_lock);
+
+    rlpos = next;
   }
 }
 
 
 /** ***************************************************************************
- * Add a path list to the work queue of a hasher thread.
+ * Move the entries handed back to this reader into its pending list.
  *
  * Parameters:
- *    thread        - Add it to this thread's queue.
- *    pathlist_head - Add this pathlist to the queue.
- *    hasher_info   - Array of hasher thread params.
+ *    reader  - The reader.
+ *    wait    - If true, wait until at least one entry is handed back.
+ *    pending - Pending list (offsets from reader->start).
+ *    count   - Number of entries in pending list, updated.
  *
  * Return: none
  *
  */
-static void submit_path_list(int thread,
-                             struct path_list_head * pathlist_head,
-                             struct hasher_param * hasher_info)
+static void take_ready_reads(struct reader_param * reader, int wait,
+                             uint32_t * pending, uint32_t * count)
 {
-  struct size_list * sizelist = pathlist_head->sizelist;
-  uint64_t size = sizelist->size;
-  struct hasher_param * queue_info = NULL;
-
-  LOG(L_THREADS, "Inserting set (%d files of size %" PRIu64
-      ") pass %d in state %s into hasher queue %d\n",
-      pathlist_head->list_size, size, pathlist_head->hash_passes,
-      pls_state(pathlist_head->state), thread);
-
-  queue_info = &hasher_info[thread];
-
-  d_mutex_lock(&queue_info->queue_lock, "adding to queue");
-
-  if (queue_info->queue_pos == queue_info->size - 1) {
-    LOG(L_THREADS, "Hasher queue %d is full (pos=%d), increasing...\n",
-        thread, queue_info->queue_pos);
-
-    int oldend = queue_info->size;
-    int newend = queue_info->size * 2;
-    int newsize = sizeof(struct path_list_head *) * newend;
-    queue_info->queue =
-      (struct path_list_head **)realloc(queue_info->queue, newsize);
-    queue_info->size = newend;
-    for (int i = oldend; i < newend; i++) {
-      queue_info->queue[i] = NULL;
-    }
-    LOG(L_RESOURCES, "Increased hasher queue(%d) to %d entries\n",
-        thread, queue_info->size);
+  uint64_t rlpos;
+
+  d_mutex_lock(&reader->ready_lock, "take_ready_reads");
+
+  while (wait && reader->ready_head == NO_PARKED_READ &&
+         !__atomic_load_n(&size_list_stopping, __ATOMIC_ACQUIRE)) {
+    d_cond_wait(&reader->ready_cond, &reader->ready_lock);
   }
 
-  queue_info->queue_pos++;
-  queue_info->queue[queue_info->queue_pos] = pathlist_head;
-  LOG(L_MORE_THREADS, "Set (%d files of size %" PRIu64
-      ") now in queue %d pos %d\n",
-      pathlist_head->list_size, size, thread, queue_info->queue_pos);
+  rlpos = reader->ready_head;
+  while (rlpos != NO_PARKED_READ) {
+    pending[(*count)++] = (uint32_t)(rlpos - reader->start);
+    reader->parked--;
+    rlpos = read_list[rlpos].next_parked;
+  }
+  reader->ready_head = NO_PARKED_READ;
 
-  // Signal the corresponding hasher thread so it'll pick up the pathlist
-  d_cond_signal(&queue_info->queue_cond);
-  d_mutex_unlock(&queue_info->queue_lock);
+  d_mutex_unlock(&reader->ready_lock);
 }
 
 
@@ -223,7 +319,7 @@ static void submit_path_list(int thread,
  * free'ing buffers much sooner (but can be far slower on HDDs).
  *
  * Parameters:
- *    arg - Contains hasher_info array.
+ *    arg - Database pointer.
  *
  * Return: none
  *
@@ -237,7 +333,7 @@ static void * size_list_flusher(void * arg)
   int sets;
   int bfpct;
   int path_count;
-  struct hasher_param * hasher_info = (struct hasher_param *)arg;
+  sqlite3 * dbh = (sqlite3 *)arg;
   struct hash_table * ht = init_hash_table();
 
   size_node = size_list_head;
@@ -250,7 +346,9 @@ static void * size_list_flusher(void * arg)
     LOG(L_THREADS, "FL.SET %d size:%" PRIu64 " state:%s\n", ++sets,
         size_node->size, pls_state(size_node->path_list->state));
 
-    if (size_node->path_list->state == PLS_NEED_DATA) {
+    // Skip sets which have io_uring reads pending into their buffers
+    if (size_node->path_list->state == PLS_NEED_DATA &&
+        size_node->reads_in_flight == 0) {
 
       reset_hash_table(ht);
       entry = pb_get_first_entry(size_node->path_list);
@@ -286,11 +384,12 @@ static void * size_list_flusher(void * arg)
 
       skim_uniques(size_node->path_list, ht);
       if (hash_table_has_dups(ht)) {
-        publish_duplicate_hash_table(hasher_info->dbh, ht, size_node->size);
+        publish_duplicate_hash_table(dbh, ht, size_node->size);
         increase_dup_counter(size_node->path_list->list_size);
       }
 
       size_node->path_list->state = PLS_DONE;
+      release_parked_reads(size_node);
       path_count = size_node->path_list->list_size;
       show_processed(s_stats_size_list_count, path_count, size_node->size);
 
@@ -315,68 +414,72 @@ static void * size_list_flusher(void * arg)
 
 
 /** ***************************************************************************
- * Fill one block (of hash block size being used) for 'entry' if possible.
- * Reads from the current block (next_read_block) until either the desired
- * amount of data has been read or the block is fully read.
+ * Work out the next read needed to fill one block (of hash block size being
+ * used) for 'entry'. The read is from the current block (next_read_block)
+ * until either the desired amount of data has been read or the block is
+ * fully read.
  *
- * Also needs to handle if file has gaps on disk.
+ * Also needs to handle if file has gaps on disk. If a gap before the
+ * current block fills the buffer no read is needed now.
  *
  * Incoming state: entry is in FS_NEED_DATA.
  *
- * Outgoing state:
- *     If disk block didn't fill the hash block:
- *       - still in FS_NEED_DATA
- *       - next_read_block updated, next_read_byte updated
- *     If hash block filled or file fully read:
- *       - becomes FS_BUFFER_READY (head possibly PLS_ALL_BUFFERS_READY)
- *       - next_read_block updated, next_read_byte updated
- *     If unable to read expected bytes:
- *       - entry marked invalid (which might make head PLS_DONE)
+ * Parameters:
+ *    head  - Head of the path list containing entry.
+ *    entry - The entry.
+ *    path  - Path of entry.
+ *    br    - Filled in with the details of the read to do.
  *
- * Return: true if current disk block was fully consumed.
+ * Return: 1 if the read in br needs to be done, 0 if not.
  *
  */
-static int fill_data_block(struct path_list_head * head,
+static int plan_block_read(struct path_list_head * head,
                            struct path_list_entry * entry,
-                           char * path)
+                           char * path, struct block_read * br)
 {
-  int rv = 0;
   uint64_t filesize = head->sizelist->size;
+  struct path_read_state * rs = pb_read_state(entry);
 
   // If we haven't been here before for this entry (or if we had to
   // free it), we'll need a buffer.
 
-  if (entry->buffer == NULL) {
-    entry->bufsize = head->wanted_bufsize;
-    entry->buffer = (char *)malloc(entry->bufsize);
-    entry->next_buffer_pos = 0;
-    inc_stats_read_buffers_allocated(path, head->sizelist->size, entry->bufsize);
-  }
-
-  // Or if the desired bufsize has increased since we allocated, realloc.
+  // Buffers are accounted by the size actually allocated for them (their
+  // size class), not the size requested.
 
-  if (entry->bufsize != head->wanted_bufsize) {
-    uint32_t inc = head->wanted_bufsize - entry->bufsize;
-    entry->bufsize = head->wanted_bufsize;
-    entry->buffer = (char *)realloc(entry->buffer, entry->bufsize);
-    entry->next_buffer_pos = 0;
-    inc_stats_read_buffers_allocated(path, head->sizelist->size, inc);
+  if (rs->buffer == NULL) {
+    rs->bufsize = head->wanted_bufsize;
+    rs->buffer = get_read_buffer(rs->bufsize);
+    rs->next_buffer_pos = 0;
+    inc_stats_read_buffers_allocated(path, head->sizelist->size,
+                                     read_buffer_alloc_size(rs->bufsize));
   }
 
-  if (entry->buffer == NULL) {                               // LCOV_EXCL_START
-    printf("error: unable to allocate read buffer, sorry!\n");
-    exit(1);
-  }                                                          // LCOV_EXCL_STOP
+  // Or if the desired bufsize has increased since we allocated, switch to
+  // a larger buffer (unless the current one is big enough already).
+  // Nothing in the buffer needs to be kept.
+
+  if (rs->bufsize != head->wanted_bufsize) {
+    if (!same_read_buffer_class(rs->bufsize, head->wanted_bufsize)) {
+      dec_stats_read_buffers_allocated(path, head->sizelist->size,
+                                       read_buffer_alloc_size(rs->bufsize));
+      put_read_buffer(rs->buffer, rs->bufsize);
+      rs->buffer = get_read_buffer(head->wanted_bufsize);
+      inc_stats_read_buffers_allocated(path, head->sizelist->size,
+                                  read_buffer_alloc_size(head->wanted_bufsize));
+    }
+    rs->bufsize = head->wanted_bufsize;
+    rs->next_buffer_pos = 0;
+  }
 
-  struct block_list_entry * bl = &entry->blocks->entry[entry->next_read_block];
-  uint64_t current_file_pos = entry->next_read_byte;
+  struct block_list_entry * bl = &entry->blocks->entry[rs->next_read_block];
+  uint64_t current_file_pos = rs->next_read_byte;
   uint64_t current_disk_block_start = bl->start_pos;
   uint64_t current_disk_block_end = bl->start_pos + bl->len;
 
   // If there is a gap until next available bytes, fill with zeroes as needed
   if (current_file_pos < current_disk_block_start) {
     uint32_t gap_size = current_disk_block_start - current_file_pos;
-    uint32_t buf_space = entry->bufsize - entry->next_buffer_pos;
+    uint32_t buf_space = rs->bufsize - rs->next_buffer_pos;
     uint32_t zeroes = gap_size;
     int filling_buffer = 0;
     if (buf_space <= zeroes) {
@@ -385,15 +488,15 @@ static int fill_data_block(struct path_list_head * head,
     }
     LOG(L_TRACE, "Gap before in [%s]: gap_size: %" PRIu32 ", buf_space: %"
         PRIu32 ", zeroes: %" PRIu32 "\n", path, gap_size, buf_space, zeroes);
-    memset(entry->buffer + entry->next_buffer_pos, 0, zeroes);
-    entry->next_buffer_pos += zeroes;
-    entry->next_read_byte += zeroes;
+    memset(rs->buffer + rs->next_buffer_pos, 0, zeroes);
+    rs->next_buffer_pos += zeroes;
+    rs->next_read_byte += zeroes;
     if (filling_buffer) {
       mark_path_entry_ready(head, entry);
-      entry->data_in_buffer = entry->bufsize;
-      return rv;
+      rs->data_in_buffer = rs->bufsize;
+      return 0;
     }
-    current_file_pos = entry->next_read_byte;
+    current_file_pos = rs->next_read_byte;
   }
 
                                                              // LCOV_EXCL_START
@@ -411,16 +514,19 @@ static int fill_data_block(struct path_list_head * head,
 
   uint64_t current_disk_block_available =
     current_disk_block_end - current_file_pos;
-  uint32_t buffer_available = entry->bufsize - entry->next_buffer_pos;
-  uint32_t want_bytes = buffer_available;
-  int filling_buffer = 1;
-  int consumed_block = 0;
-  if (want_bytes >= current_disk_block_available) {
-    want_bytes = current_disk_block_available;
-    consumed_block = 1;
+  uint32_t buffer_available = rs->bufsize - rs->next_buffer_pos;
+  br->head = head;
+  br->entry = entry;
+  br->file_pos = current_file_pos;
+  br->want_bytes = buffer_available;
+  br->filling_buffer = 1;
+  br->consumed_block = 0;
+  if (br->want_bytes >= current_disk_block_available) {
+    br->want_bytes = current_disk_block_available;
+    br->consumed_block = 1;
   }
-  if (want_bytes < buffer_available) {
-    filling_buffer = 0;
+  if (br->want_bytes < buffer_available) {
+    br->filling_buffer = 0;
   }
 
   LOG(L_TRACE, "fill_data_block: [%s] current_file_pos: %" PRIu64
@@ -430,49 +536,98 @@ static int fill_data_block(struct path_list_head * head,
       ", buffer_available: %" PRIu32 ", want_bytes: %" PRIu32
       ", filling_buffer: %d\n",
       path, current_file_pos, current_disk_block_start, current_disk_block_end,
-      current_disk_block_available, buffer_available, want_bytes,
-      filling_buffer);
+      current_disk_block_available, buffer_available, br->want_bytes,
+      br->filling_buffer);
 
-  uint64_t bytes_read = 0;
-  uint64_t t1 = get_current_time_millis();
-  read_entry_bytes(entry, filesize, path,
-                   entry->buffer + entry->next_buffer_pos,
-                   want_bytes, current_file_pos, &bytes_read);
-  uint64_t took = get_current_time_millis() - t1;
+  return 1;
+}
 
-  if (bytes_read != want_bytes) {
+
+/** ***************************************************************************
+ * Stop considering an entry which could not be read. If that leaves no
+ * possible duplicates in its set, the remaining files are unique.
+ *
+ * Parameters:
+ *    head  - Head of the path list containing entry.
+ *    entry - The entry.
+ *
+ * Return: none
+ *
+ */
+static void ignore_unreadable_entry(struct path_list_head * head,
+                                    struct path_list_entry * entry)
+{
+  int before = head->list_size;
+  int after = mark_path_entry_ignore(head, entry);
+  int additional = before - 1 - after;
+  if (additional > 0) {
+    LOG(L_SKIPPED, "Defaulting %d additional files as unique\n", additional);
+    increase_unique_counter(additional);
+  }
+}
+
+
+/** ***************************************************************************
+ * Update entry after the read planned by plan_block_read() has completed.
+ *
+ * Outgoing state:
+ *     If disk block didn't fill the hash block:
+ *       - still in FS_NEED_DATA
+ *       - next_read_block updated, next_read_byte updated
+ *     If hash block filled or file fully read:
+ *       - becomes FS_BUFFER_READY (head possibly PLS_ALL_BUFFERS_READY)
+ *       - next_read_block updated, next_read_byte updated
+ *     If unable to read expected bytes:
+ *       - entry marked invalid (which might make head PLS_DONE)
+ *
+ * Parameters:
+ *    reader     - The reader thread.
+ *    br         - The read.
+ *    path       - Path of the entry.
+ *    bytes_read - How many bytes were read.
+ *
+ * Return: true if current disk block was fully consumed.
+ *
+ */
+static int complete_block_read(struct reader_param * reader,
+                               struct block_read * br, char * path,
+                               uint64_t bytes_read)
+{
+  int rv = 0;
+  struct path_list_head * head = br->head;
+  struct path_list_entry * entry = br->entry;
+  uint64_t filesize = head->sizelist->size;
+  uint64_t took = get_current_time_millis() - br->started;
+  int filling_buffer = br->filling_buffer;
+
+  if (bytes_read != br->want_bytes) {
     // File may be unreadable or changed size, either way, ignore it.
     LOG(L_PROGRESS, "error: read %" PRIu64 " bytes from [%s] but wanted %"
-        PRIu32 " (%s)\n", bytes_read, path, want_bytes, strerror(errno));
-    int before = head->list_size;
-    int after = mark_path_entry_ignore(head, entry);
-    int additional = before - 1 - after;
-    if (additional > 0) {
-      LOG(L_SKIPPED, "Defaulting %d additional files as unique\n", additional);
-      increase_unique_counter(additional);
-    }
+        PRIu32 " (%s)\n", bytes_read, path, br->want_bytes, strerror(errno));
+    ignore_unreadable_entry(head, entry);
 
   } else {
 
-    entry->next_read_byte += bytes_read;
-    entry->next_buffer_pos += bytes_read;
+    struct path_read_state * rs = entry->rs;
+    rs->next_read_byte += bytes_read;
+    rs->next_buffer_pos += bytes_read;
 
-    if (consumed_block) {
+    if (br->consumed_block) {
       rv = 1;
-      entry->next_read_block++;
+      rs->next_read_block++;
 
-      if (entry->next_read_block < entry->blocks->count) {
+      if (rs->next_read_block < entry->blocks->count) {
 
         uint64_t next_available_byte =
-          entry->blocks->entry[entry->next_read_block].start_pos;
+          entry->blocks->entry[rs->next_read_block].start_pos;
 
         // If file has a gap after current position, fill with zeroes as needed
-        if (next_available_byte > entry->next_read_byte) {
+        if (next_available_byte > rs->next_read_byte) {
           LOG(L_TRACE, "GAP next_available_byte: %" PRIu64
-              ", entry->next_read_byte: %" PRIu64 "\n",
-              next_available_byte, entry->next_read_byte);
-          uint32_t gap_size = next_available_byte - entry->next_read_byte;
-          uint32_t buf_space = entry->bufsize - entry->next_buffer_pos;
+              ", rs->next_read_byte: %" PRIu64 "\n",
+              next_available_byte, rs->next_read_byte);
+          uint32_t gap_size = next_available_byte - rs->next_read_byte;
+          uint32_t buf_space = rs->bufsize - rs->next_buffer_pos;
           uint32_t zeroes = gap_size;
           if (buf_space < zeroes) {
             zeroes = buf_space;
@@ -481,44 +636,419 @@ static int fill_data_block(struct path_list_head * head,
           LOG(L_TRACE, "Gap after in [%s]: gap_size: %" PRIu32 ", buf_space: %"
               PRIu32 ", zeroes: %" PRIu32 "\n",
               path, gap_size, buf_space, zeroes);
-          memset(entry->buffer + entry->next_buffer_pos, 0, zeroes);
-          entry->next_buffer_pos += zeroes;
-          entry->next_read_byte += zeroes;
+          memset(rs->buffer + rs->next_buffer_pos, 0, zeroes);
+          rs->next_buffer_pos += zeroes;
+          rs->next_read_byte += zeroes;
         }
       } else {
         LOG(L_TRACE, "File completed [%s]\n", path);
       }
     }
 
-    if (entry->next_read_byte >= filesize) {
+    if (rs->next_read_byte >= filesize) {
       mark_path_entry_ready(head, entry);
-      entry->data_in_buffer = entry->next_buffer_pos;
+      rs->data_in_buffer = rs->next_buffer_pos;
       head->sizelist->fully_read = 1;
 
     } else if (filling_buffer) {
       mark_path_entry_ready(head, entry);
-      entry->data_in_buffer = entry->bufsize;
+      rs->data_in_buffer = rs->bufsize;
     }
 
-    read_count++;
-    int new_avg = avg_read_time + (took - avg_read_time) / read_count;
-    avg_read_time = new_avg;
+    reader->read_count++;
+    reader->avg_read_time = reader->avg_read_time +
+      (took - reader->avg_read_time) / reader->read_count;
 
     LOG(L_TRACE, " read took %" PRIu64 "ms (count=%d avg=%d)\n",
-        took, read_count, avg_read_time);
+        took, reader->read_count, reader->avg_read_time);
   }
 
   return rv;
 }
 
 
+/** ***************************************************************************
+ * Fill one block (of hash block size being used) for 'entry' if possible,
+ * using a regular read().
+ *
+ * See plan_block_read() and complete_block_read() for the state changes.
+ *
+ * Return: true if current disk block was fully consumed.
+ *
+ */
+static int fill_data_block(struct reader_param * reader,
+                           struct path_list_head * head,
+                           struct path_list_entry * entry,
+                           char * path)
+{
+  struct block_read br;
+  uint64_t bytes_read = 0;
+
+  if (!plan_block_read(head, entry, path, &br)) {
+    return 0;
+  }
+
+  struct path_read_state * rs = entry->rs;
+  br.started = get_current_time_millis();
+  read_entry_bytes(entry, head->sizelist->size, path,
+                   rs->buffer + rs->next_buffer_pos,
+                   br.want_bytes, br.file_pos, &bytes_read);
+
+  return complete_block_read(reader, &br, path, bytes_read);
+}
+
+
+/** ***************************************************************************
+ * Map the next block (of hash block size being used) of 'entry' instead of
+ * reading it (--mmap). The hasher hashes directly from the mapping and
+ * unmaps it, so there is no buffer to allocate and nothing is copied.
+ *
+ * Unlike fill_data_block() the whole hash block is mapped at once even if
+ * it spans several disk blocks (gaps read as zeroes from the mapping).
+ * Read list entries of the disk blocks skipped over are not matched again,
+ * they drop out of the reader once the file is done.
+ *
+ * Incoming state: entry is in FS_NEED_DATA.
+ *
+ * Outgoing state: FS_BUFFER_READY, or ignored if it couldn't be mapped.
+ *
+ * Return: true if current disk block was fully consumed.
+ *
+ */
+static int map_data_block(struct reader_param * reader,
+                          struct path_list_head * head,
+                          struct path_list_entry * entry,
+                          char * path)
+{
+  uint64_t filesize = head->sizelist->size;
+  struct path_read_state * rs = pb_read_state(entry);
+  uint8_t block = rs->next_read_block;
+  uint64_t pos = rs->next_read_byte;
+  uint64_t len = head->wanted_bufsize;
+  uint64_t delta = pos % (uint64_t)sysconf(_SC_PAGESIZE);
+  uint64_t started = get_current_time_millis();
+  char * map = MAP_FAILED;
+  struct stat info;
+
+  if (len > filesize - pos) {
+    len = filesize - pos;
+  }
+
+  // The hasher normally unmaps the previous window after hashing it
+  unmap_read_window(path, filesize, rs);
+
+  int fd = open_entry_fd(entry, path);
+  if (fd < 0) {
+    ignore_unreadable_entry(head, entry);
+    return 0;
+  }
+
+  // Touching a mapping beyond the end of the file is fatal (SIGBUS) so
+  // don't map files which have been truncated since the scan.
+  if (fstat(fd, &info) == 0 && (uint64_t)info.st_size >= filesize) {
+    map = (char *)mmap(NULL, len + delta, PROT_READ, MAP_SHARED,
+                       fd, pos - delta);
+  }
+  release_entry_fd(entry, fd, filesize, len, pos, map == MAP_FAILED);
+
+  if (map == MAP_FAILED) {
+    LOG(L_PROGRESS, "error: unable to map %" PRIu64 " bytes at %" PRIu64
+        " of [%s] (%s)\n", len, pos, path, strerror(errno));
+    ignore_unreadable_entry(head, entry);
+    return 0;
+  }
+
+  // Start the I/O now, in readlist order, instead of when the hasher
+  // faults on it.
+  madvise(map, len + delta, MADV_WILLNEED);
+
+  rs->map = map;
+  rs->map_len = len + delta;
+  rs->buffer = map + delta;
+  rs->data_in_buffer = len;
+  rs->next_read_byte += len;
+  inc_stats_read_buffers_allocated(path, filesize, rs->map_len);
+  __atomic_fetch_add(&stats_total_bytes_read, len, __ATOMIC_RELAXED);
+
+  while (rs->next_read_block < entry->blocks->count) {
+    struct block_list_entry * bl = &entry->blocks->entry[rs->next_read_block];
+    if (bl->start_pos + bl->len > rs->next_read_byte) {
+      break;
+    }
+    rs->next_read_block++;
+  }
+
+  if (rs->next_read_byte >= filesize) {
+    head->sizelist->fully_read = 1;
+  }
+  mark_path_entry_ready(head, entry);
+
+  uint64_t took = get_current_time_millis() - started;
+  reader->read_count++;
+  reader->avg_read_time = reader->avg_read_time +
+    (took - reader->avg_read_time) / reader->read_count;
+
+  return rs->next_read_block > block;
+}
+
+
+#ifdef USE_IO_URING
+/** ***************************************************************************
+ * Process the completion of one read queued by queue_block_read().
+ *
+ * Parameters:
+ *    reader - The reader thread.
+ *    cqe    - The completion.
+ *
+ * Return: none
+ *
+ */
+static void finish_queued_read(struct reader_param * reader,
+                               struct io_uring_cqe * cqe)
+{
+  char path[DUPD_PATH_MAX];
+  int slot = (int)cqe->user_data;
+  struct block_read * br = &reader->reads[slot];
+  struct path_list_head * head = br->head;
+  struct size_list * sizelist = head->sizelist;
+  uint64_t bytes_read = cqe->res > 0 ? (uint64_t)cqe->res : 0;
+  int submit_this_one = 0;
+
+  if (cqe->res < 0) {
+    errno = -cqe->res;
+    __atomic_fetch_add(&s_files_cant_read, 1, __ATOMIC_RELAXED);
+  }
+
+  d_mutex_lock(&sizelist->lock, "finish_queued_read");
+
+  build_path(br->entry, path);
+  br->entry->rs->in_flight = 0;
+  sizelist->reads_in_flight--;
+
+  __atomic_fetch_add(&stats_total_bytes_read, bytes_read, __ATOMIC_RELAXED);
+
+  if (br->entry->state != FS_NEED_DATA) {
+    // While the read was pending this file was resolved (e.g. became the
+    // only remaining one in its set), so the data is no longer needed.
+    release_entry_fd(br->entry, br->fd, sizelist->size, br->want_bytes,
+                     br->file_pos, 1);
+    free_path_entry(path, sizelist->size, br->entry);
+
+  } else {
+    release_entry_fd(br->entry, br->fd, sizelist->size, br->want_bytes,
+                     br->file_pos, bytes_read != br->want_bytes);
+
+    if (complete_block_read(reader, br, path, bytes_read)) {
+      read_list[br->rlpos].done = 1;
+    }
+  }
+
+  if (head->state == PLS_ALL_BUFFERS_READY) {
+    submit_this_one = 1;
+  } else if (head->state == PLS_DONE) {
+    release_parked_reads(sizelist);
+  }
+
+  d_mutex_unlock(&sizelist->lock);
+
+  reader->free_slots[reader->free_count++] = slot;
+
+  if (submit_this_one) {
+    submit_path_list(reader->next_queue, head);
+    reader->next_queue = (reader->next_queue + 1) % hash_threads;
+  }
+}
+
+
+/** ***************************************************************************
+ * Submit any queued reads.
+ *
+ * Parameters:
+ *    reader  - The reader thread.
+ *    wait_nr - Wait until at least this many reads have completed.
+ *
+ * Return: none
+ *
+ */
+static void submit_queued_reads(struct reader_param * reader,
+                                unsigned wait_nr)
+{
+  if (reader->unsubmitted == 0 && wait_nr == 0) {
+    return;
+  }
+
+  if (uring_submit(&reader->ring, wait_nr) < 0) {            // LCOV_EXCL_START
+    printf("error: unable to submit read requests (%u not submitted)\n",
+           uring_sq_pending(&reader->ring));
+    exit(1);
+  }                                                          // LCOV_EXCL_STOP
+
+  // Only what the kernel took is no longer unsubmitted
+  reader->unsubmitted = uring_sq_pending(&reader->ring);
+}
+
+
+/** ***************************************************************************
+ * Submit any queued reads and process completed ones.
+ *
+ * Parameters:
+ *    reader  - The reader thread.
+ *    wait_nr - Wait until at least this many reads have completed.
+ *
+ * Return: none
+ *
+ */
+static void reap_queued_reads(struct reader_param * reader, unsigned wait_nr)
+{
+  struct io_uring_cqe * cqe;
+
+  submit_queued_reads(reader, wait_nr);
+
+  while ((cqe = uring_peek_cqe(&reader->ring)) != NULL) {
+    finish_queued_read(reader, cqe);
+    uring_cqe_seen(&reader->ring);
+  }
+}
+
+
+/** ***************************************************************************
+ * Queue the read needed to fill one block for 'entry'. Same as
+ * fill_data_block() except that the read completes later, in
+ * finish_queued_read(). Until then the entry stays in FS_NEED_DATA with
+ * in_flight set so it isn't touched.
+ *
+ * Caller must hold the size list lock and make sure there is a free slot.
+ *
+ * Parameters:
+ *    reader - The reader thread.
+ *    rlpos  - Position of this block in the read list.
+ *    head   - Head of the path list containing entry.
+ *    entry  - The entry.
+ *    path   - Path of entry.
+ *
+ * Return: none
+ *
+ */
+static void queue_block_read(struct reader_param * reader, uint64_t rlpos,
+                             struct path_list_head * head,
+                             struct path_list_entry * entry, char * path)
+{
+  int slot = reader->free_slots[reader->free_count - 1];
+  struct block_read * br = &reader->reads[slot];
+
+  if (!plan_block_read(head, entry, path, br)) {
+    return;
+  }
+
+  struct path_read_state * rs = entry->rs;
+  br->rlpos = rlpos;
+  br->started = get_current_time_millis();
+  br->fd = open_entry_fd(entry, path);
+
+  if (br->fd < 0) {
+    if (complete_block_read(reader, br, path, 0)) {
+      read_list[rlpos].done = 1;
+    }
+    return;
+  }
+
+  struct io_uring_sqe * sqe = uring_get_sqe(&reader->ring);
+  sqe->opcode = IORING_OP_READ;
+  sqe->fd = br->fd;
+  sqe->addr = (uint64_t)(uintptr_t)(rs->buffer + rs->next_buffer_pos);
+  sqe->len = br->want_bytes;
+  sqe->off = br->file_pos;
+  sqe->user_data = slot;
+
+  rs->in_flight = 1;
+  head->sizelist->reads_in_flight++;
+  reader->free_count--;
+  reader->unsubmitted++;
+
+  // Can't process completions here (caller holds a size list lock) but
+  // can get the queued reads started.
+  if (reader->unsubmitted >= READ_SUBMIT_BATCH) {
+    submit_queued_reads(reader, 0);
+  }
+}
+#endif
+
+
+/** ***************************************************************************
+ * Tell the kernel about the data the given read list entry will read, if
+ * it is the next read for its file. Reads are done in read list order so
+ * this lets the device work ahead of the reader (--prefetch).
+ *
+ * Parameters:
+ *    rlpos - Position of the entry in the read list.
+ *
+ * Return: none
+ *
+ */
+static void prefetch_entry(uint64_t rlpos)
+{
+  char path[DUPD_PATH_MAX];
+  struct read_list_entry * rlentry = &read_list[rlpos];
+  struct path_list_head * head = rlentry->pathlist_head;
+  struct path_list_entry * entry = rlentry->pathlist_self;
+  struct size_list * sizelist = head->sizelist;
+
+  if (rlentry->done) {
+    return;
+  }
+
+  d_mutex_lock(&sizelist->lock, "prefetch_entry");
+
+  if (entry->state == FS_NEED_DATA &&
+      (entry->rs == NULL || !entry->rs->in_flight)) {
+
+    struct path_read_state * rs = pb_read_state(entry);
+    struct block_list_entry * bl = &entry->blocks->entry[rs->next_read_block];
+
+    if (bl->block == rlentry->block) {
+      uint64_t pos = rs->next_read_byte;
+      if (pos < bl->start_pos) {
+        pos = bl->start_pos;
+      }
+      uint64_t len = bl->start_pos + bl->len - pos;
+      if (len > head->wanted_bufsize) {
+        len = head->wanted_bufsize;
+      }
+
+      build_path(entry, path);
+      int fd = open_entry_fd(entry, path);
+      if (fd >= 0) {
+        prefetch_range(fd, pos, len);
+        release_entry_fd(entry, fd, sizelist->size, len, pos, 0);
+      }
+    }
+  }
+
+  d_mutex_unlock(&sizelist->lock);
+}
+
+
 /** ***************************************************************************
  * Reader thread.
  *
  * This thread reads bytes from disk in readlist order (not by sizelist group)
  * and stores the data in the pathlist buffer for each file.
  *
- * Parameters: none
+ * There is one reader per device, each one handling the part of the read
+ * list for its device. Files in the same size group may be on different
+ * devices so the path lists are shared, under the size list lock. Readers
+ * of SSDs keep more reads in flight than readers of hard drives.
+ *
+ * The first pass goes through the whole read list part. Entries whose file
+ * buffer is waiting on a hasher are parked on their set (see park_read())
+ * and handed back to the reader once the set changes state. Other entries
+ * which can't be completed yet (waiting on an earlier block of the same
+ * file) are kept in a pending list. Later passes only look at the pending
+ * list plus whatever was handed back. When a pass makes no progress the
+ * reader waits for parked entries to come back instead of polling.
+ *
+ * Parameters:
+ *    arg - The reader_param for this thread.
  *
  * Return: none
  *
@@ -542,22 +1072,49 @@ static void * read_list_reader(void * arg)
   struct path_list_entry * pathlist_entry;
   struct path_list_head * pathlist_head;
   char path[DUPD_PATH_MAX];
-  struct hasher_param * hasher_info = (struct hasher_param *)arg;
-  int next_queue = 0;
+  struct reader_param * reader = (struct reader_param *)arg;
   uint8_t block;
   int bfpct;
-  useconds_t sleepy_time = 1;
+  int keep;
+  uint32_t * pending;
+  uint32_t pending_count;
+  uint32_t kept;
+  uint32_t p;
+  uint32_t prefetched;
 
   pthread_setspecific(thread_name, self);
-  LOG(L_THREADS, "Thread created\n");
+  LOG(L_THREADS, "Thread created for device %d (%s)\n", reader->device,
+      reader->ssd ? "ssd" : "hdd");
 
-  if (read_list_end == 0) {                                  // LCOV_EXCL_START
+  if (reader->start == reader->end) {                        // LCOV_EXCL_START
     LOG(L_INFO, "readlist is empty, nothing to read\n");
     return NULL;
   }                                                          // LCOV_EXCL_STOP
 
+#ifdef USE_IO_URING
+  reader->ring_ok = 0;
+  reader->queue_depth = reader->ssd ? READ_QUEUE_DEPTH : HDD_READ_QUEUE_DEPTH;
+  if (use_uring && !use_mmap && !direct_io &&
+      uring_init(&reader->ring, reader->queue_depth) == 0) {
+    reader->ring_ok = 1;
+    reader->free_count = reader->queue_depth;
+    reader->unsubmitted = 0;
+    for (int i = 0; i < reader->queue_depth; i++) {
+      reader->free_slots[i] = i;
+    }
+  }
+#endif
+
+  // Offsets (from reader->start) of the read list entries not done yet
+  pending_count = reader->end - reader->start;
+  pending = (uint32_t *)malloc(pending_count * sizeof(uint32_t));
+  for (p = 0; p < pending_count; p++) {
+    pending[p] = p;
+  }
+
   do {
-    rlpos = 0;
+    kept = 0;
+    prefetched = 0;
     needy = 0;
     done_files = 0;
     waiting_hash = 0;
@@ -568,19 +1125,40 @@ static void * read_list_reader(void * arg)
     loop++;
     LOG(L_THREADS, "Starting read list loop %d\n", loop);
 
-    do {
+    for (p = 0; p < pending_count; p++) {
 
+      if (__atomic_load_n(&size_list_stopping, __ATOMIC_ACQUIRE)) {
+        break;
+      }
+
+      // Keep the prefetch window ahead of this entry
+      if (prefetch_window > 0 && !direct_io) {
+        while (prefetched < pending_count && prefetched < p + prefetch_window) {
+          prefetch_entry(reader->start + pending[prefetched]);
+          prefetched++;
+        }
+      }
+
+      rlpos = reader->start + pending[p];
       rlentry = &read_list[rlpos];
       if (rlentry->done) {
-        rlpos++;
         done_files++;
         continue;
       }
 
+#ifdef USE_IO_URING
+      // Handle any reads which have completed, waiting for one if all
+      // read slots are in use.
+      if (reader->ring_ok) {
+        reap_queued_reads(reader, reader->free_count == 0 ? 1 : 0);
+      }
+#endif
+
       pathlist_head = rlentry->pathlist_head;
       pathlist_entry = rlentry->pathlist_self;
       sizelist = pathlist_head->sizelist;
       submit_this_one = 0;
+      keep = 1;
 
       d_mutex_lock(&sizelist->lock, "process_readlist");
 
@@ -589,8 +1167,13 @@ static void * read_list_reader(void * arg)
       case FS_NEED_DATA:
         needy++;
 
+        // If a read for this path is still pending, wait for it.
+        if (pathlist_entry->rs != NULL && pathlist_entry->rs->in_flight) {
+          break;
+        }
+
         // Is this read list entry the block this path wants to read?
-        block = pathlist_entry->next_read_block;
+        block = pb_read_state(pathlist_entry)->next_read_block;
         if (pathlist_entry->blocks->entry[block].block == rlentry->block) {
 
           build_path(pathlist_entry, path);
@@ -600,9 +1183,20 @@ static void * read_list_reader(void * arg)
               PRIu64 " in state %s): (reading pos %" PRIu64 " block %d) %s\n",
               loop, rlpos, pathlist_head->list_size, size,
               file_state(pathlist_entry->state),
-              pathlist_entry->next_read_byte, block, path);
-
-          if (fill_data_block(pathlist_head, pathlist_entry, path)) {
+              pathlist_entry->rs->next_read_byte, block, path);
+
+          if (use_mmap) {
+            if (map_data_block(reader, pathlist_head, pathlist_entry, path)) {
+              rlentry->done = 1;
+            }
+          } else
+#ifdef USE_IO_URING
+          if (reader->ring_ok) {
+            queue_block_read(reader, rlpos,
+                             pathlist_head, pathlist_entry, path);
+          } else
+#endif
+          if (fill_data_block(reader, pathlist_head, pathlist_entry, path)) {
             rlentry->done = 1;
           }
           did_something++;
@@ -615,20 +1209,25 @@ static void * read_list_reader(void * arg)
 
       case FS_DONE:
         done_files++;
+        keep = 0;
         break;
 
       case FS_BUFFER_READY:
         waiting_hash++;
+        park_read(reader, sizelist, rlpos);
+        keep = 0;
         break;
 
       case FS_IGNORE:
         done_files++;
         ignore++;
+        keep = 0;
         break;
 
       case FS_UNIQUE:
         done_files++;
         unique++;
+        keep = 0;
         break;
 
       default:                                               // LCOV_EXCL_START
@@ -637,44 +1236,85 @@ static void * read_list_reader(void * arg)
         exit(1);
       }                                                      // LCOV_EXCL_STOP
 
+      // If this resolved the set, nothing parked on it is waiting any longer
+      if (pathlist_head->state == PLS_DONE) {
+        release_parked_reads(sizelist);
+      }
+
       d_mutex_unlock(&sizelist->lock);
 
       if (submit_this_one) {
-        submit_path_list(next_queue, pathlist_head, hasher_info);
-        next_queue = (next_queue + 1) % HASHER_THREADS;
+        submit_path_list(reader->next_queue, pathlist_head);
+        reader->next_queue = (reader->next_queue + 1) % hash_threads;
       }
 
-      rlpos++;
+      if (keep && !rlentry->done) {
+        pending[kept++] = pending[p];
+      }
 
+      // Only one reader needs to flush, the others keep reading.
       bfpct = (int)(100 * stats_read_buffers_allocated / buffer_limit);
-      if (bfpct > 99) {
+      if (bfpct > 99 && pthread_mutex_trylock(&flusher_lock) == 0) {
         LOG(L_THREADS, "Buffer usage %d, flushing...\n", bfpct);
-        size_list_flusher(hasher_info);
+        size_list_flusher(reader->dbh);
+        pthread_mutex_unlock(&flusher_lock);
       }
+    }
 
-    } while (rlpos < read_list_end);
+#ifdef USE_IO_URING
+    // Finish all pending reads before deciding whether another pass is needed
+    if (reader->ring_ok) {
+      while (reader->free_count < reader->queue_depth) {
+        reap_queued_reads(reader, 1);
+      }
+    }
+#endif
 
-    LOG(L_THREADS, "Completed loop %d: list size: %" PRIu64 " worked: %d "
+    LOG(L_THREADS, "Completed loop %d: list size: %" PRIu32 " worked: %d "
         "(NEED_DATA %d, NEED_HASH %d, IGNORE %d, UNIQUE %d, DONE %"PRIu64")\n",
-        loop, rlpos, did_something, needy, waiting_hash, ignore, unique,
-        done_files);
+        loop, pending_count, did_something, needy, waiting_hash,
+        ignore, unique, done_files);
+
+    // Queued reads may have completed entries after they were kept
+    pending_count = 0;
+    for (p = 0; p < kept; p++) {
+      if (!read_list[reader->start + pending[p]].done) {
+        pending[pending_count++] = pending[p];
+      }
+    }
+
+    // Pick up the entries handed back by sets which moved on. If this pass
+    // made no progress, nothing else can happen until one comes back.
+    if (!did_something && reader->parked > 0) {
+      LOG(L_MORE_TRACE, "Waiting for parked reads (%" PRIu32 " pending, %"
+          PRIu64 " parked)\n", pending_count, reader->parked);
+      take_ready_reads(reader, 1, pending, &pending_count);
+    } else {
+      take_ready_reads(reader, 0, pending, &pending_count);
+    }
 
-    done = done_files >= rlpos;
+    done = pending_count == 0 && reader->parked == 0;
 
-    if (!done) {
-      if (!did_something) {
-        sleepy_time *= 2;
-        usleep(sleepy_time);
-        LOG(L_MORE_TRACE, "Sleeping before next loop %d\n", sleepy_time);
-      } else {
-        sleepy_time = 1;
-      }
+    // Entries still parked may be handed back after this reader is gone,
+    // so the readers are kept around until the hashers are stopped.
+    if (__atomic_load_n(&size_list_stopping, __ATOMIC_ACQUIRE)) {
+      LOG(L_THREADS, "Stopping, %" PRIu32 " entries not read\n",
+          pending_count);
+      done = 1;
     }
 
   } while (!done);
 
+  free(pending);
+
   LOG(L_MORE_INFO, "DONE read list reader (%d loops)\n", loop);
 
+#ifdef USE_IO_URING
+  if (reader->ring_ok) {
+    uring_free(&reader->ring);
+  }
+#endif
+
   return NULL;
 }
 
@@ -750,6 +1390,148 @@ void process_cached_hashes(sqlite3 * dbh)
 }
 
 
+/** ***************************************************************************
+ * Pick the sample offsets for files of the given size: one block in the
+ * middle, the last block and one more from a pseudo-random offset. The
+ * random offset is derived from the size alone so that all the files in
+ * a size set are sampled at the same offsets.
+ *
+ * Parameters:
+ *    size    - Size of the files.
+ *    offsets - Store the SAMPLE_BLOCKS offsets here.
+ *
+ * Return: none
+ *
+ */
+static void sample_offsets(uint64_t size, uint64_t * offsets)
+{
+  uint64_t last = size - SAMPLE_BLOCK_SIZE;
+  uint64_t x = size + 0x9E3779B97F4A7C15ULL;
+
+  x = (x ^ (x >> 30)) * 0xBF58476D1CE4E5B9ULL;
+  x = (x ^ (x >> 27)) * 0x94D049BB133111EBULL;
+  x = x ^ (x >> 31);
+
+  offsets[0] = (size / 2) & ~(uint64_t)(SAMPLE_BLOCK_SIZE - 1);
+  offsets[1] = last;
+  offsets[2] = (x % last) & ~(uint64_t)(SAMPLE_BLOCK_SIZE - 1);
+}
+
+
+/** ***************************************************************************
+ * Read the sample blocks of one file and hash them.
+ *
+ * Parameters:
+ *    path    - Path of the file.
+ *    offsets - Read SAMPLE_BLOCKS blocks from these offsets.
+ *    buffer  - Scratch buffer of SAMPLE_BLOCKS * SAMPLE_BLOCK_SIZE bytes.
+ *    hash    - Store the hash of the samples here.
+ *
+ * Return: 0 on success, -1 if the file could not be read.
+ *
+ */
+static int sample_file(const char * path, uint64_t * offsets,
+                       char * buffer, char * hash)
+{
+  int fd = open(path, O_RDONLY);
+  if (fd < 0) {
+    return -1;
+  }
+
+  for (int n = 0; n < SAMPLE_BLOCKS; n++) {
+    ssize_t got = pread(fd, buffer + n * SAMPLE_BLOCK_SIZE,
+                        SAMPLE_BLOCK_SIZE, offsets[n]);
+    if (got != SAMPLE_BLOCK_SIZE) {
+      close(fd);
+      return -1;
+    }
+  }
+
+  close(fd);
+  stats_total_bytes_read += SAMPLE_BLOCKS * SAMPLE_BLOCK_SIZE;
+  hash_fn_buf(buffer, SAMPLE_BLOCKS * SAMPLE_BLOCK_SIZE, hash);
+  return 0;
+}
+
+
+/** ***************************************************************************
+ * Sampling round (--sample): before any file data is read sequentially,
+ * read a few small blocks from every file in size sets of large files.
+ * Files whose samples differ from all others in the set are unique, so
+ * they are eliminated at the cost of a few reads instead of reading
+ * round1_max_bytes of each. The files remaining in the set are then
+ * processed normally from the start.
+ *
+ * Only sets of files larger than round1_max_bytes are sampled, smaller
+ * files are read in full by the first round anyway. If any file in a set
+ * can't be sampled, the set is left alone.
+ *
+ * This is called before regular size list processing begins and we're
+ * single-threaded at this point. Hasher/reader threads not started yet.
+ *
+ * Parameters: none
+ *
+ * Return: none
+ *
+ */
+static void process_sampled_sets()
+{
+  char pathbuf[DUPD_PATH_MAX];
+  char hashbuf[HASH_MAX_BUFSIZE];
+  char buffer[SAMPLE_BLOCKS * SAMPLE_BLOCK_SIZE];
+  uint64_t offsets[SAMPLE_BLOCKS];
+  struct path_list_entry * entry;
+  struct size_list * size_node = size_list_head;
+  struct hash_table * hl = init_hash_table();
+  int path_count;
+  int failed;
+
+  while (size_node != NULL) {
+
+    if (size_node->size > round1_max_bytes &&
+        size_node->size > SAMPLE_BLOCKS * SAMPLE_BLOCK_SIZE &&
+        size_node->path_list->state == PLS_NEED_DATA &&
+        size_node->path_list->list_size > 1) {
+
+      path_count = size_node->path_list->list_size;
+      sample_offsets(size_node->size, offsets);
+      failed = 0;
+
+      entry = pb_get_first_entry(size_node->path_list);
+      while (entry != NULL && !failed) {
+        if (entry->state == FS_NEED_DATA) {
+          build_path(entry, pathbuf);
+          if (sample_file(pathbuf, offsets, buffer, hashbuf)) {
+            LOG(L_MORE_INFO, "Unable to sample [%s]\n", pathbuf);
+            failed = 1;
+          } else {
+            add_to_hash_table(hl, entry, hashbuf);
+          }
+        }
+        entry = entry->next;
+      }
+
+      if (!failed) {
+        stats_sample_sets++;
+        stats_sample_unique += skim_uniques(size_node->path_list, hl);
+        LOG(L_MORE_INFO, "Sampled %d files of size %" PRIu64 ", %d remain\n",
+            path_count, size_node->size, size_node->path_list->list_size);
+
+        if (size_node->path_list->state == PLS_DONE) {
+          show_processed(s_stats_size_list_count, path_count, size_node->size);
+        }
+      }
+
+      reset_hash_table(hl);
+    }
+
+    size_node = size_node->next;
+  }
+
+  free_hash_table(hl);
+}
+
+
 /** ***************************************************************************
  * Public function, see header file.
  *
@@ -815,10 +1597,6 @@ void free_size_list()
  */
 void process_size_list(sqlite3 * dbh)
 {
-  pthread_t reader_thread;
-  struct hasher_param hasher_info[HASHER_THREADS];
-  int initial_size = 50;
-
   if (size_list_head == NULL) {
     return;
   }
@@ -827,57 +1605,69 @@ void process_size_list(sqlite3 * dbh)
     process_cached_hashes(dbh);
   }
 
-  if (x_small_buffers) { initial_size = 2; }
-
-  for (int n = 0; n < HASHER_THREADS; n++) {
-    hasher_info[n].thread_num = n;
-    hasher_info[n].done = 0;
-    hasher_info[n].dbh = dbh;
-    pthread_mutex_init(&hasher_info[n].queue_lock, NULL);
-    pthread_cond_init(&hasher_info[n].queue_cond, NULL);
-    hasher_info[n].queue_pos = -1;
-    hasher_info[n].size = initial_size;
-    hasher_info[n].queue =
-      (struct path_list_head **)malloc(initial_size *
-                                      sizeof(struct path_list_head *));
-    for (int i = 0; i < initial_size; i++) {
-      hasher_info[n].queue[i] = NULL;
-    }
+  if (sample_round) {
+    process_sampled_sets();
   }
 
   stats_process_start = get_current_time_millis();
 
-  // Start file reader thread
-  LOG(L_THREADS, "Starting file reader thread...\n");
-  d_create(&reader_thread, read_list_reader, &hasher_info);
+  start_hashers(dbh, hash_threads);
+
+  // Start file reader threads, one per device
+  LOG(L_THREADS, "Starting %d file reader threads...\n", read_list_part_count);
+  d_mutex_lock(&stop_lock, "process_size_list");
+  reader_count = read_list_part_count;
+  readers = (struct reader_param *)calloc(reader_count,
+                                          sizeof(struct reader_param));
+  for (int n = 0; n < reader_count; n++) {
+    readers[n].dbh = dbh;
+    readers[n].start = read_list_parts[n].start;
+    readers[n].end = read_list_parts[n].end;
+    readers[n].device = read_list_parts[n].device;
+    readers[n].ssd = read_list_parts[n].ssd;
+    readers[n].ready_head = NO_PARKED_READ;
+    pthread_mutex_init(&readers[n].ready_lock, NULL);
+    pthread_cond_init(&readers[n].ready_cond, NULL);
+  }
+  d_mutex_unlock(&stop_lock);
+  // All readers must be set up before any of them can hand entries back
+  for (int n = 0; n < reader_count; n++) {
+    d_create(&readers[n].thread, read_list_reader, &readers[n]);
+  }
 
   // Meanwhile, the size tree is no longer needed, so free it. Might
   // as well do it while this thread has nothing else to do but wait.
   free_size_tree();
 
-  usleep(10000);
-
-  // Start hasher threads and then wait for them to finish...
+  LOG(L_THREADS, "process_size_list: waiting for workers to finish\n");
 
-  LOG(L_THREADS, "Starting %d threads...\n", HASHER_THREADS);
-  for (int n = 0; n < HASHER_THREADS; n++) {
-    d_create(&hasher_info[n].thread, round1_hasher, &hasher_info[n]);
+  for (int n = 0; n < reader_count; n++) {
+    d_join(readers[n].thread, NULL);
+    LOG(L_THREADS, "process_size_list: joined reader thread %d\n", n);
   }
 
-  LOG(L_THREADS, "process_size_list: waiting for workers to finish\n");
+  stop_hashers();
 
-  d_join(reader_thread, NULL);
-  LOG(L_THREADS, "process_size_list: joined reader thread\n");
-  signal_hashers(hasher_info);
-
-  for (int n = 0; n < HASHER_THREADS; n++) {
-    d_join(hasher_info[n].thread, NULL);
-    LOG(L_THREADS, "process_size_list: joined hasher thread %d\n", n);
+  d_mutex_lock(&stop_lock, "process_size_list");
+  for (int n = 0; n < reader_count; n++) {
+    pthread_mutex_destroy(&readers[n].ready_lock);
+    pthread_cond_destroy(&readers[n].ready_cond);
   }
+  free(readers);
+  readers = NULL;
+  reader_count = 0;
+  d_mutex_unlock(&stop_lock);
+
+  free_read_buffer_pool();
 
   long now = get_current_time_millis();
   stats_process_duration = now - stats_process_start;
 
+  // Sets left partially read still hold their buffers and files
+  if (__atomic_load_n(&size_list_stopping, __ATOMIC_ACQUIRE)) {
+    return;
+  }
+
                                                              // LCOV_EXCL_START
   if (stats_read_buffers_allocated != 0) {
     printf("error: after round1 complete, buffers: %" PRIu64 "\n",
@@ -893,9 +1683,23 @@ void process_size_list(sqlite3 * dbh)
     exit(1);
   }
                                                              // LCOV_EXCL_STOP
+}
 
-  for (int n = 0; n < HASHER_THREADS; n++) {
-    free(hasher_info[n].queue);
-  }
 
+/** ***************************************************************************
+ * Public function, see header file.
+ *
+ */
+void stop_size_list()
+{
+  d_mutex_lock(&stop_lock, "stop_size_list");
+  __atomic_store_n(&size_list_stopping, 1, __ATOMIC_RELEASE);
+
+  // Wake up any reader waiting for parked entries to come back
+  for (int n = 0; n < reader_count; n++) {
+    d_mutex_lock(&readers[n].ready_lock, "stop_size_list");
+    d_cond_broadcast(&readers[n].ready_cond);
+    d_mutex_unlock(&readers[n].ready_lock);
+  }
+  d_mutex_unlock(&stop_lock);
 }
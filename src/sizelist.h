@@ -29,6 +29,8 @@ struct size_list {
   struct size_list * next;
   uint64_t size;
   int fully_read;
+  int reads_in_flight;
+  uint64_t parked;          // read list entries waiting on this set
   pthread_mutex_t lock;
 };
 
@@ -102,4 +104,35 @@ struct size_list * add_to_size_list(uint64_t size,
  */
 void process_size_list(sqlite3 * dbh);
 
+
+/** ***************************************************************************
+ * Hand the read list entries parked on this set (because its buffers were
+ * waiting for a hasher) back to the readers which own them. Called when
+ * the set comes back from a hasher or has been resolved otherwise.
+ *
+ * The caller must hold sizelist->lock.
+ *
+ * Parameters:
+ *    sizelist - The set.
+ *
+ * Return: none
+ *
+ */
+void release_parked_reads(struct size_list * sizelist);
+
+
+/** ***************************************************************************
+ * Make process_size_list() stop early: the readers stop reading, the sets
+ * already handed to hashers are finished and then process_size_list()
+ * returns with the remaining sets unprocessed.
+ *
+ * Can be called from any thread.
+ *
+ * Parameters: none
+ *
+ * Return: none
+ *
+ */
+void stop_size_list();
+
 #endif
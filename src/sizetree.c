@@ -17,6 +17,7 @@
   along with dupd.  If not, see <http://www.gnu.org/licenses/>.
 */
 
+#include <fcntl.h>
 #include <pthread.h>
 #include <stdint.h>
 #include <stdio.h>
@@ -25,321 +26,394 @@
 #include <strings.h>
 #include <unistd.h>
 
+#ifdef USE_IO_URING
+#include <linux/stat.h>
+#include <sys/sysmacros.h>
+#endif
+
 #include "dbops.h"
 #include "dirtree.h"
 #include "main.h"
 #include "paths.h"
 #include "scan.h"
+#include "sizeindex.h"
 #include "sizetree.h"
 #include "stats.h"
+#include "uring.h"
 #include "utils.h"
 
-struct size_node {
-  uint64_t size;
-  struct path_list_head * paths;
-  struct size_node * left;
-  struct size_node * right;
-  char * filename;
+// Files queued by add_queue() are passed to the workers in batches of
+// compact records. The full path is not copied, it can be rebuilt from
+// the dir_entry and the filename (kept in the batch name buffer).
+
+#define STAT_BATCH_LENGTH 64
+#define STAT_BATCH_NAMES (STAT_BATCH_LENGTH * 64)
+
+struct stat_record {
   struct direntry * dir_entry;
+  uint64_t size;
+  ino_t inode;
+  uint32_t name_pos;
 };
 
-static struct size_node * tip = NULL;
+struct stat_batch {
+  int count;
+  uint32_t names_used;
+  struct stat_batch * next_free;
+  struct stat_record records[STAT_BATCH_LENGTH];
+  char names[STAT_BATCH_NAMES];
+};
 
-struct stat_queue {
-  uint64_t block;
-  int end;
-  dev_t device;
-  ino_t inode;
-  uint64_t size;
-  struct direntry * dir_entry;
-  char filename[DUPD_FILENAME_MAX];
-  char path[DUPD_PATH_MAX];
-  struct stat_queue * next;
+struct stat_worker {
+  int thread_num;
+  pthread_t thread;
+  long batches;
+#ifdef USE_IO_URING
+  struct uring ring;
+  int ring_ok;
+  struct statx results[STAT_BATCH_LENGTH];
+#endif
 };
 
-#define QUEUE_COUNT 4
-static struct stat_queue queue[QUEUE_COUNT];
-#define STAT_QUEUE_LENGTH 50
-
-#define PRODUCER_DONE 42
-#define WORKER_NOT_STARTED 43
-#define WORKER_DONE 44
-#define WORKING 45
-#define WANT_QUEUE 46
-#define PRODUCER 47
-#define WORKER 48
-#define NOBODY 49
-
-static int current_producer_queue;
-static int current_worker_queue;
-static int last_owner[QUEUE_COUNT];
-static struct stat_queue * producer_next;
-static long queue_added[QUEUE_COUNT];
-static long queue_removed[QUEUE_COUNT];
+// Bounded MPMC queue of full batches waiting for a worker.
+static struct stat_batch ** batch_queue = NULL;
+static int batch_queue_size = 0;
+static int batch_queue_head = 0;
+static int batch_queue_count = 0;
+static int producers_done = 0;
+
+// Batch currently being filled by add_queue() and the recycled batches.
+static struct stat_batch * filling = NULL;
+static struct stat_batch * free_batches = NULL;
+static int batches_allocated = 0;
 
+static struct stat_worker * workers = NULL;
+static int worker_count = 0;
+static long queue_added = 0;
+static long queue_removed = 0;
+
+static pthread_mutex_t producer_lock = PTHREAD_MUTEX_INITIALIZER;
 static pthread_mutex_t queue_lock = PTHREAD_MUTEX_INITIALIZER;
-static pthread_cond_t queue_producer_cond = PTHREAD_COND_INITIALIZER;
-static pthread_cond_t queue_worker_cond = PTHREAD_COND_INITIALIZER;
-static pthread_t worker_thread;
-
-#define PRINT_INFO  if (log_level >= L_TRACE) {                         \
-    LOG(L_TRACE, "current_worker_queue=%s, current_producer_queue=%s\n", \
-        queue_state(current_worker_queue),                              \
-        queue_state(current_worker_queue));                             \
-  }
+static pthread_cond_t queue_not_empty = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t queue_not_full = PTHREAD_COND_INITIALIZER;
 
 
 /** ***************************************************************************
- * Return string description of a queue state.
+ * Get an empty batch, either a recycled one or a new allocation.
+ * Caller must hold queue_lock.
+ *
+ * Return: empty batch
  *
  */
-static char * queue_state(int s)
+static struct stat_batch * get_batch()
 {
-  switch (s) {
-  case PRODUCER_DONE:      return "PRODUCER_DONE";
-  case WORKER_NOT_STARTED: return "WORKER_NOT_STARTED";
-  case WORKER_DONE:        return "WORKER_DONE";
-  case WORKING:            return "WORKING";
-  case WANT_QUEUE:         return "WANT_QUEUE";
-  case 0: return "Q0";
-  case 1: return "Q1";
-  case 2: return "Q2";
-  case 3: return "Q3";
-  default:
-    printf("Bad queue state %d\n", s);
-    exit(1);
+  struct stat_batch * b = free_batches;
+
+  if (b != NULL) {
+    free_batches = b->next_free;
+  } else {
+    b = (struct stat_batch *)malloc(sizeof(struct stat_batch));
+    batches_allocated++;
   }
+
+  b->count = 0;
+  b->names_used = 0;
+  b->next_free = NULL;
+  return b;
 }
 
 
 /** ***************************************************************************
- * Allocate a new size tree leaf node to store the given size and path.
+ * Add a full batch to the queue, waiting for space if the queue is full.
  *
  * Parameters:
- *    size      - Size of this file.
- *    filename  - Name of the file (no path).
- *    dir_entry - Directory where filename lives.
+ *    b - The batch.
  *
- * Return: ptr to the node created
+ * Return: none
  *
  */
-static struct size_node * new_node(uint64_t size, char * filename,
-                                   struct direntry * dir_entry)
+static void push_batch(struct stat_batch * b)
 {
-  // Note: Not tracking size_node allocations in --trace-memory because
-  // all of them get freed after scan stage so these don't contribute to
-  // memory usage during read/hash stage.
-
-  struct size_node * n = (struct size_node *)malloc(sizeof(struct size_node));
-  n->left = NULL;
-  n->right = NULL;
-  n->size = size;
-  n->paths = NULL;
-  n->dir_entry = dir_entry;
-  int l = strlen(filename);
-  n->filename = (char *)malloc(l + 1);
-  strlcpy(n->filename, filename, l + 1);
+  d_mutex_lock(&queue_lock, "push_batch");
 
-  if (debug_size == size) {
-    LOG(L_PROGRESS, "new_node: size tree node created for size %" PRIu64
-        " by file [%s]\n", size, filename);
+  while (batch_queue_count == batch_queue_size) {
+    LOG(L_MORE_THREADS, "Batch queue full, WAIT\n");
+    d_cond_wait(&queue_not_full, &queue_lock);
   }
 
-  return n;
+  int tail = (batch_queue_head + batch_queue_count) % batch_queue_size;
+  batch_queue[tail] = b;
+  batch_queue_count++;
+  queue_added += b->count;
+
+  d_cond_signal(&queue_not_empty);
+  d_mutex_unlock(&queue_lock);
 }
 
 
 /** ***************************************************************************
- * Add the given size and path below the given node.
- * If no matching size node is found, create a new_node().
+ * Take the next batch off the queue, waiting for one if necessary.
+ *
+ * Return: batch or NULL if the scan is done and the queue is empty.
+ *
+ */
+static struct stat_batch * pop_batch()
+{
+  struct stat_batch * b = NULL;
+
+  d_mutex_lock(&queue_lock, "pop_batch");
+
+  while (batch_queue_count == 0 && !producers_done) {
+    d_cond_wait(&queue_not_empty, &queue_lock);
+  }
+
+  if (batch_queue_count > 0) {
+    b = batch_queue[batch_queue_head];
+    batch_queue_head = (batch_queue_head + 1) % batch_queue_size;
+    batch_queue_count--;
+    d_cond_signal(&queue_not_full);
+  }
+
+  d_mutex_unlock(&queue_lock);
+
+  return b;
+}
+
+
+/** ***************************************************************************
+ * Return a processed batch to the free list.
  *
  * Parameters:
- *    size - Size of this file.
- *    path - Path of this file.
+ *    b - The batch.
  *
  * Return: none
  *
  */
-static void add_below(struct size_node * node, ino_t inode,
-                      uint64_t size, char * filename,
-                      struct direntry * dir_entry)
+static void release_batch(struct stat_batch * b)
 {
-  struct size_node * p = node;
+  d_mutex_lock(&queue_lock, "release_batch");
+  queue_removed += b->count;
+  b->next_free = free_batches;
+  free_batches = b;
+  d_mutex_unlock(&queue_lock);
+}
 
-  s_files_in_sizetree++;
 
-  while (1) {
+#ifdef USE_IO_URING
+/** ***************************************************************************
+ * Process one batch using io_uring to stat the files.
+ *
+ * All the files in the batch which still need a stat() get a statx
+ * request (size and inode only) submitted at once and are added to
+ * the size index as the results complete. On high latency filesystems
+ * (NFS) this replaces a round trip per file with one per batch.
+ *
+ * If a statx fails (or the kernel doesn't support it) the file is
+ * handed to add_file() as-is, which retries with a regular stat() and
+ * reports any error. If submitting fails, the requests the kernel didn't
+ * take are dropped from the ring (so the next batch can't submit them
+ * with reused paths and results), the ones it did take are completed
+ * and all the files still waiting for a result go to add_file(). The
+ * worker then stops using io_uring.
+ *
+ * Parameters:
+ *    w     - The worker.
+ *    b     - The batch.
+ *    paths - Full paths of the files in the batch.
+ *
+ * Return: none
+ *
+ */
+static void process_batch_uring(struct stat_worker * w, struct stat_batch * b,
+                                char (*paths)[DUPD_PATH_MAX])
+{
+  struct io_uring_sqe * sqe;
+  struct io_uring_cqe * cqe;
+  struct stat_record * r;
+  char queued[STAT_BATCH_LENGTH];
+  int submitted = 0;
+  int failed = 0;
+
+  for (int i = 0; i < b->count; i++) {
+    r = &b->records[i];
+    queued[i] = 0;
+
+    if (r->size != SCAN_SIZE_UNKNOWN ||
+        (sqe = uring_get_sqe(&w->ring)) == NULL) {
+      add_file(NULL, r->inode, r->size, paths[i],
+               b->names + r->name_pos, r->dir_entry);
 
-    if (size == p->size) {
-      // The first file of this size is kept in the size_node itself,
-      // waiting to see if another file of the same size is found.
-      // If we reached a size_node which exists but paths is NULL that
-      // means we just found the second file of this size. So it's time
-      // to add both the previous and current to the path list.
+    } else {
+      sqe->opcode = IORING_OP_STATX;
+      sqe->fd = AT_FDCWD;
+      sqe->addr = (uint64_t)(uintptr_t)paths[i];
+      sqe->len = STATX_SIZE | STATX_INO;
+      sqe->statx_flags = AT_SYMLINK_NOFOLLOW;
+      sqe->off = (uint64_t)(uintptr_t)&w->results[i];
+      sqe->user_data = i;
+      queued[i] = 1;
+      submitted++;
+    }
+  }
 
-      if (p->paths == NULL) {
-        p->paths = insert_first_path(p->filename, p->dir_entry, size);
-        p->dir_entry = NULL;
-        free(p->filename);
-        p->filename = NULL;
-      }
+  // uring_submit() only returns once the kernel has taken every request,
+  // otherwise it fails and whatever is left is dropped here.
+  if (submitted > 0 && uring_submit(&w->ring, 0) < 0) {      // LCOV_EXCL_START
+    failed = 1;
+    uring_drop_queued(&w->ring);
+  }                                                          // LCOV_EXCL_STOP
 
-      insert_end_path(filename, dir_entry, inode, size, p->paths);
+  while (w->ring.inflight > 0) {
+    cqe = uring_peek_cqe(&w->ring);
+    if (cqe == NULL) {
+      if (uring_submit(&w->ring, 1) < 0) {                   // LCOV_EXCL_START
+        failed = 1;
+        break;
+      }                                                      // LCOV_EXCL_STOP
+      continue;
+    }
 
-      return;
+    int i = (int)cqe->user_data;
+    r = &b->records[i];
+    queued[i] = 0;
+
+    if (cqe->res == 0) {
+      r->size = w->results[i].stx_size;
+      r->inode = w->results[i].stx_ino;
     }
 
-    if (size > p->size) {
-      if (p->left == NULL) {
-        p->left = new_node(size, filename, dir_entry);
-        return;
-      } else {
-        p = p->left;
-      }
-    } else {
-      if (p->right == NULL) {
-        p->right = new_node(size, filename, dir_entry);
-        return;
-      } else {
-        p = p->right;
+    uring_cqe_seen(&w->ring);
+
+    if (cqe->res == 0 && r->size == 0) {
+      // Empty file, too small no matter what minimum_file_size is
+      LOG(L_TRACE, "SKIP (too small: 0): [%s]\n", paths[i]);
+      __atomic_fetch_add(&s_files_too_small, 1, __ATOMIC_RELAXED);
+      continue;
+    }
+
+    add_file(NULL, r->inode, r->size, paths[i],
+             b->names + r->name_pos, r->dir_entry);
+  }
+
+  if (failed) {                                              // LCOV_EXCL_START
+    LOG(L_PROGRESS, "Unable to submit statx requests, using stat()\n");
+    uring_free(&w->ring);
+    w->ring_ok = 0;
+
+    for (int i = 0; i < b->count; i++) {
+      if (queued[i]) {
+        r = &b->records[i];
+        add_file(NULL, r->inode, SCAN_SIZE_UNKNOWN, paths[i],
+                 b->names + r->name_pos, r->dir_entry);
       }
     }
+  }                                                          // LCOV_EXCL_STOP
+}
+#endif
+
+
+/** ***************************************************************************
+ * Stat (if needed) and add to the size index all the files in one batch.
+ *
+ * Parameters:
+ *    w     - The worker.
+ *    b     - The batch.
+ *    paths - Full paths of the files in the batch.
+ *
+ * Return: none
+ *
+ */
+static void process_batch(struct stat_worker * w, struct stat_batch * b,
+                          char (*paths)[DUPD_PATH_MAX])
+{
+  struct stat_record * r;
+
+#ifdef USE_IO_URING
+  if (w->ring_ok) {
+    process_batch_uring(w, b, paths);
+    return;
+  }
+#else
+  (void)w;
+#endif
+
+  for (int i = 0; i < b->count; i++) {
+    r = &b->records[i];
+    add_file(NULL, r->inode, r->size, paths[i],
+             b->names + r->name_pos, r->dir_entry);
   }
 }
 
 
 /** ***************************************************************************
- * Worker thread for inserting files to the sizetree if using threaded scan.
+ * Worker thread for inserting files to the size index if using threaded
+ * scan.
  *
- * The scan operation queues files via add_queue() into its queue and this
- * worker thread reads them from its queue to add them via add_file(). The
- * scanner and this worker exchange queues as they are done with them.
+ * The scan operation queues files via add_queue() and any number of these
+ * workers take batches of them off the queue, stat them if needed and add
+ * them to the size index. The size index is sharded by size so workers
+ * only contend when they happen to add files of sizes in the same shard.
  *
  * Parameters:
- *    arg  - Unused.
+ *    arg  - The stat_worker for this thread.
  *
  * Return: none
  *
  */
 static void * worker_main(void * arg)
 {
-  (void)arg;
-  int done = 0;
-  char * self = "                                        [sizetree] ";
-  struct stat_queue * worker_next;
-  int want_queue = 0;
-
+  struct stat_worker * w = (struct stat_worker *)arg;
+  struct stat_batch * b;
+  struct stat_record * r;
+  char self[80];
+  char (*paths)[DUPD_PATH_MAX];
+
+  snprintf(self, 80, "                                        [sizetree-%d] ",
+           w->thread_num);
   pthread_setspecific(thread_name, self);
   LOG(L_THREADS, "Thread created\n");
 
-  while (!done) {
-
-    // Before working through a queue, need to get one first.
-    pthread_mutex_lock(&queue_lock);
-
-    while (want_queue == current_producer_queue ||
-           last_owner[want_queue] == WORKER) {
-      LOG_MORE_THREADS {
-        LOG(L_MORE_THREADS, "Want Q%d, not available, WAIT\n", want_queue);
-        PRINT_INFO;
-      }
-      pthread_cond_signal(&queue_producer_cond);
-      pthread_cond_wait(&queue_worker_cond, &queue_lock);
-    }
-
-    current_worker_queue = want_queue;
-
-    if (last_owner[current_worker_queue] != PRODUCER) {      // LCOV_EXCL_START
-      printf("worker got Q%d but last_owner=%d\n",
-             current_worker_queue, last_owner[current_worker_queue]);
-      exit(1);
-    }                                                        // LCOV_EXCL_STOP
-
-    last_owner[current_worker_queue] = WORKER;
+  paths = malloc(STAT_BATCH_LENGTH * DUPD_PATH_MAX);
 
-    LOG_MORE_THREADS {
-      LOG(L_MORE_THREADS, "Took Q%d\n", current_worker_queue);
-      PRINT_INFO;
-    }
-
-    pthread_mutex_unlock(&queue_lock);
+#ifdef USE_IO_URING
+  w->ring_ok = 0;
+  if (use_uring) {
+    w->ring_ok = !uring_init(&w->ring, STAT_BATCH_LENGTH);
+  }
+#endif
 
-    // Work through the current queue to its end (or to the path marked end)
+  while ((b = pop_batch()) != NULL) {
 
-    LOG_MORE_THREADS {
-      LOG(L_MORE_THREADS, "Processing Q%d\n", current_worker_queue);
-      PRINT_INFO;
+    for (int i = 0; i < b->count; i++) {
+      r = &b->records[i];
+      build_path_from_string(b->names + r->name_pos, r->dir_entry, paths[i]);
     }
 
-    worker_next = &queue[current_worker_queue];
-
-    while (!done && worker_next != NULL) {
-      if (worker_next->end) {
-        LOG_THREADS {
-          LOG(L_THREADS, "Got END flag: DONE\n");
-          PRINT_INFO;
-        }
-        done = 1;
-
-      } else {
-        add_file(NULL, worker_next->inode,
-                 worker_next->size, worker_next->path,
-                 worker_next->filename, worker_next->dir_entry);
-        queue_removed[current_worker_queue]++;
-        worker_next = worker_next->next;
-      }
-    }
+    process_batch(w, b, paths);
 
-    LOG_MORE_THREADS {
-      LOG(L_MORE_THREADS, "Finished queue %d, removed from it %ld so far\n",
-          current_worker_queue, queue_removed[current_worker_queue]);
-      PRINT_INFO;
-    }
+    w->batches++;
+    release_batch(b);
 
     if (only_testing) {
       slow_down(10, 100);
       slow_down(100, 1000);
     }
+  }
 
-    if (!done) {
-      want_queue = (current_worker_queue + 1) % QUEUE_COUNT;
-
-      pthread_mutex_lock(&queue_lock);
-
-      if (queue_added[current_worker_queue] !=               // LCOV_EXCL_START
-          queue_removed[current_worker_queue]) {
-        printf("Q%d: added (%ld) != removed (%ld)\n",
-               current_worker_queue,
-               queue_added[current_worker_queue],
-               queue_removed[current_worker_queue]);
-        exit(1);
-      }                                                      // LCOV_EXCL_STOP
-
-      current_worker_queue = WANT_QUEUE;
-      pthread_cond_signal(&queue_producer_cond);
-      pthread_mutex_unlock(&queue_lock);
-    }
+#ifdef USE_IO_URING
+  if (w->ring_ok) {
+    uring_free(&w->ring);
+    w->ring_ok = 0;
   }
+#endif
 
-  LOG(L_THREADS, "Thread finished\n");
+  free(paths);
+  LOG(L_THREADS, "Thread finished, processed %ld batches\n", w->batches);
 
   return(NULL);
 }
 
 
-/** ***************************************************************************
- * Free one node and its children.
- *
- */
-static void free_node(struct size_node * node)
-{
-  if (node->left != NULL) { free_node(node->left); }
-  if (node->right != NULL) { free_node(node->right); }
-  if (node->filename != NULL) { free(node->filename); }
-  free(node);
-}
-
-
 /** ***************************************************************************
  * Public function, see header file.
  *
@@ -349,7 +423,7 @@ int add_file(sqlite3 * dbh,
              char * filename, struct direntry * dir_entry)
 {
   (void)dbh;                    /* not used */
-  static STRUCT_STAT new_stat_info;
+  STRUCT_STAT new_stat_info;
 
   LOG(L_FILES, "FILE: [%s]\n", path);
 
@@ -361,7 +435,7 @@ int add_file(sqlite3 * dbh,
     int rv = get_file_info(path, &new_stat_info);
     if (rv != 0) {
       LOG(L_PROGRESS, "SKIP (error) [%s]\n", path);
-      stats_files_error++;
+      __atomic_fetch_add(&stats_files_error, 1, __ATOMIC_RELAXED);
       return(-2);
     }
 
@@ -376,17 +450,11 @@ int add_file(sqlite3 * dbh,
 
   if (size < minimum_file_size) {
     LOG(L_TRACE, "SKIP (too small: %" PRIu64 "): [%s]\n", size, path);
-    s_files_too_small++;
-    return(-2);
-  }
-
-  if (tip == NULL) {
-    tip = new_node(size, filename, dir_entry);
-    s_files_in_sizetree = 1;
+    __atomic_fetch_add(&s_files_too_small, 1, __ATOMIC_RELAXED);
     return(-2);
   }
 
-  add_below(tip, inode, size, filename, dir_entry);
+  size_index_add(inode, size, filename, dir_entry);
 
   return(-2);
 }
@@ -401,65 +469,42 @@ int add_queue(sqlite3 * dbh,
               char * filename, struct direntry * dir_entry)
 {
   (void)dbh;                    /* not used */
+  struct stat_batch * full = NULL;
 
-  LOG(L_MORE_TRACE, "add_queue (%d): %s\n", current_producer_queue, path);
+  LOG(L_MORE_TRACE, "add_queue: %s\n", path);
 
   if (debug_size == size) {
-    LOG(L_PROGRESS, "add_queue (%d): %s\n", current_producer_queue, path);
+    LOG(L_PROGRESS, "add_queue: %s\n", path);
   }
 
-  // Just add it to the end of the queue producer currently owns.
-  producer_next->size = size;
-  producer_next->inode = inode;
-  strlcpy(producer_next->filename, filename, DUPD_FILENAME_MAX);
-  producer_next->dir_entry = dir_entry;
-  strlcpy(producer_next->path, path, DUPD_PATH_MAX);
-  producer_next = producer_next->next;
-  queue_added[current_producer_queue]++;
-
-  // Unless we've hit the end of this queue, that's all for now...
-  if (producer_next != NULL) {
-    return(-2);
+  int len = strlen(filename) + 1;
+
+  d_mutex_lock(&producer_lock, "add_queue");
+
+  struct stat_batch * b = filling;
+  struct stat_record * r = &b->records[b->count];
+  r->dir_entry = dir_entry;
+  r->size = size;
+  r->inode = inode;
+  r->name_pos = b->names_used;
+  memcpy(b->names + b->names_used, filename, len);
+  b->names_used += len;
+  b->count++;
+
+  // If this batch can't take another record (or its longest possible
+  // name), hand it to the workers and start a new one.
+  if (b->count == STAT_BATCH_LENGTH ||
+      b->names_used + DUPD_FILENAME_MAX > STAT_BATCH_NAMES) {
+    full = b;
+    d_mutex_lock(&queue_lock, "add_queue new batch");
+    filling = get_batch();
+    d_mutex_unlock(&queue_lock);
   }
 
-  if (only_testing) {
-    slow_down(10, 100);
-    slow_down(100, 1000);
-  }
+  d_mutex_unlock(&producer_lock);
 
-  // If we did reach the end of this queue, need to move to the next one.
-  LOG_MORE_THREADS {
-    LOG(L_MORE_THREADS,
-        "Finished filling Q%d\n", current_producer_queue);
-    PRINT_INFO;
-  }
-
-  int want = (current_producer_queue + 1) % QUEUE_COUNT;
-
-  pthread_mutex_lock(&queue_lock);
-
-  current_producer_queue = WANT_QUEUE;
-
-  while (want == current_worker_queue || last_owner[want] == PRODUCER) {
-    LOG_MORE_THREADS {
-      LOG(L_MORE_THREADS, "Want Q%d, not available, WAIT\n", want);
-      PRINT_INFO;
-    }
-    pthread_cond_signal(&queue_worker_cond);
-    pthread_cond_wait(&queue_producer_cond, &queue_lock);
-  }
-
-  current_producer_queue = want;
-  last_owner[current_producer_queue] = PRODUCER;
-
-  pthread_cond_signal(&queue_worker_cond);
-  pthread_mutex_unlock(&queue_lock);
-
-  producer_next = &queue[current_producer_queue];
-
-  LOG_MORE_THREADS {
-    LOG(L_MORE_THREADS, "Took Q%d\n", current_producer_queue);
-    PRINT_INFO;
+  if (full != NULL) {
+    push_batch(full);
   }
 
   return(-2);
@@ -472,43 +517,37 @@ int add_queue(sqlite3 * dbh,
  */
 void scan_done()
 {
-  pthread_mutex_lock(&queue_lock);
-
-  LOG_THREADS {
-    LOG(L_THREADS,
-        "scan_done: END in %s\n", queue_state(current_producer_queue));
-    PRINT_INFO;
+  d_mutex_lock(&producer_lock, "scan_done");
+  if (filling->count > 0) {
+    push_batch(filling);
+  } else {
+    d_mutex_lock(&queue_lock, "scan_done release");
+    filling->next_free = free_batches;
+    free_batches = filling;
+    d_mutex_unlock(&queue_lock);
   }
+  filling = NULL;
+  d_mutex_unlock(&producer_lock);
 
-  producer_next->end = 1;       // tells worker this will the last entry
-  current_producer_queue = PRODUCER_DONE;
-
-  pthread_cond_signal(&queue_worker_cond);
-  pthread_mutex_unlock(&queue_lock);
-
-  LOG(L_THREADS, "Waiting for sizetree worker thread to finish...\n");
+  d_mutex_lock(&queue_lock, "scan_done");
+  producers_done = 1;
+  pthread_cond_broadcast(&queue_not_empty);
+  d_mutex_unlock(&queue_lock);
 
-  d_join(worker_thread, NULL);
+  LOG(L_THREADS, "Waiting for %d sizetree worker threads to finish...\n",
+      worker_count);
 
-  // Verify counts for sanity checking...
-  uint32_t removed = 0;
-  uint32_t added = 0;
-  for (int i = 0; i < QUEUE_COUNT; i++) {
-    LOG(L_MORE_THREADS, "Q%d: added %ld, removed %ld\n",
-        i, queue_added[i], queue_removed[i]);
-    removed += queue_removed[i];
-    added += queue_added[i];
+  for (int i = 0; i < worker_count; i++) {
+    d_join(workers[i].thread, NULL);
   }
 
-  LOG(L_MORE_THREADS,
-      "Total added %" PRIu32 ", removed %" PRIu32 "\n", added, removed);
+  LOG(L_MORE_THREADS, "Total added %ld, removed %ld, batches %d\n",
+      queue_added, queue_removed, batches_allocated);
 
-                                                             // LCOV_EXCL_START
-  if (added != removed) {
-    printf("added (%" PRIu32 ") != removed (%" PRIu32 ")\n", added, removed);
+  if (queue_added != queue_removed) {                        // LCOV_EXCL_START
+    printf("added (%ld) != removed (%ld)\n", queue_added, queue_removed);
     exit(1);
   }                                                          // LCOV_EXCL_STOP
-
 }
 
 
@@ -518,37 +557,26 @@ void scan_done()
  */
 void init_sizetree()
 {
-  int i;
-  int n;
-  struct stat_queue * p;
+  init_size_index();
 
   if (threaded_sizetree) {
-    for (i = 0; i < QUEUE_COUNT; i++) {
-      queue_removed[i] = 0;
-      queue_added[i] = 0;
-      last_owner[i] = NOBODY;
-      p = &queue[i];
-      for (n = 1; n < STAT_QUEUE_LENGTH; n++) {
-        p->next = (struct stat_queue *)malloc(sizeof(struct stat_queue));
-        p->next->end = 0;
-        p = p->next;
-        p->next = NULL;
-      }
+    worker_count = stat_threads;
+    batch_queue_size = 4 * worker_count;
+    batch_queue = (struct stat_batch **)
+      malloc(batch_queue_size * sizeof(struct stat_batch *));
+    batch_queue_head = 0;
+    batch_queue_count = 0;
+    producers_done = 0;
+    queue_added = 0;
+    queue_removed = 0;
+    filling = get_batch();
+
+    workers = (struct stat_worker *)calloc(worker_count,
+                                           sizeof(struct stat_worker));
+    for (int i = 0; i < worker_count; i++) {
+      workers[i].thread_num = i;
+      d_create(&workers[i].thread, worker_main, &workers[i]);
     }
-
-    // Assign Q0 to producer initially.
-    current_producer_queue = 0;
-    producer_next = &queue[0];
-    last_owner[0] = PRODUCER;
-
-    // Worker can't start yet.
-    current_worker_queue = WORKER_NOT_STARTED;
-
-    if (pthread_create(&worker_thread, NULL, worker_main, NULL)) {
-                                                             // LCOV_EXCL_START
-      printf("error: unable to create sizetree worker thread!\n");
-      exit(1);
-    }                                                        // LCOV_EXCL_STOP
   }
 }
 
@@ -559,25 +587,28 @@ void init_sizetree()
  */
 void free_size_tree()
 {
-  struct stat_queue * p;
-  struct stat_queue * t;
-  int i;
+  struct stat_batch * b;
+
+  free_size_index();
 
-  if (tip != NULL) {
-    free_node(tip);
-    tip = NULL;
+  while (free_batches != NULL) {
+    b = free_batches;
+    free_batches = b->next_free;
+    free(b);
   }
 
-  for (i = 0; i < QUEUE_COUNT; i++) {
-    t = &queue[i];
-    if (t) {
-      t = t->next;
-      queue[i].next = NULL;
-      while (t != NULL) {
-        p = t;
-        t = t->next;
-        free(p);
-      }
-    }
+  if (filling != NULL) {
+    free(filling);
+    filling = NULL;
+  }
+
+  if (batch_queue != NULL) {
+    free(batch_queue);
+    batch_queue = NULL;
+  }
+
+  if (workers != NULL) {
+    free(workers);
+    workers = NULL;
   }
 }
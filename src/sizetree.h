@@ -26,7 +26,8 @@
 
 
 /** ***************************************************************************
- * Add the given path to the size tree. Also adds the path to the path list.
+ * Add the given path to the size index (see sizeindex.h). Also adds the
+ * path to the path list if it is not the first file of its size.
  *
  * Parameters:
  *    dbh       - sqlite3 database handle (not used, set to NULL).
@@ -89,7 +90,7 @@ void scan_done();
 
 
 /** ***************************************************************************
- * Walk through the size tree and free everything.
+ * Free the size index and the scan queues.
  *
  * Parameters: none
  *
@@ -71,6 +71,9 @@ int stats_one_block_hash_first = 0;
 int stats_size_list_done = 0;
 int stats_three_file_compare = 0;
 int stats_two_file_compare = 0;
+int stats_lane_hashed = 0;
+int stats_sample_sets = 0;
+int stats_sample_unique = 0;
 int stats_uniques_saved = 0;
 long stats_size_list_avg = 0;
 
@@ -85,6 +88,7 @@ int stats_hashlist_path_realloc = 0;
 int stats_hash_list_len_inc = 0;
 int scan_list_usage_max = 0;
 int scan_list_resizes = 0;
+int stats_dirs_reused = 0;
 uint64_t stats_read_buffers_allocated = 0;
 uint64_t stats_size_list_allocated = 0;
 uint64_t stats_size_hashtable_allocated = 0;
@@ -162,9 +166,19 @@ void report_stats()
     printf(" Duplicate files: %" PRIu32 "\n", s_files_completed_dups);
     printf(" Unique files: %" PRIu32 "\n", s_files_completed_unique);
     printf(" Unable to read: %" PRIu32 "\n", s_files_cant_read);
+    printf("Rounds compared instead of hashed: %d (2 files), %d (3 files)\n",
+           stats_two_file_compare, stats_three_file_compare);
+    printf("Buffers hashed in SIMD lanes: %d\n", stats_lane_hashed);
+    if (sample_round) {
+      printf("Sets sampled: %d (files found unique: %d)\n",
+             stats_sample_sets, stats_sample_unique);
+    }
     if (hardlink_is_unique) {
       printf(" Skipped hardlinks: %" PRIu32 "\n", s_files_hl_skip);
     }
+    if (incremental_scan) {
+      printf("Directories unchanged since last scan: %d\n", stats_dirs_reused);
+    }
   }
 
   if (files_accepted != s_files_in_sizetree - s_files_hl_skip) {
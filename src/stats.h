@@ -26,7 +26,7 @@
 #define ROUNDS 2
 #define ROUND1 0
 #define ROUND2 1
-#define MAX_HASHER_THREADS 2
+#define MAX_HASHER_THREADS 64
 
 extern pthread_mutex_t stats_lock;
 
@@ -73,6 +73,9 @@ extern int stats_single_block_count;
 extern int stats_size_list_done;
 extern int stats_three_file_compare;
 extern int stats_two_file_compare;
+extern int stats_lane_hashed;
+extern int stats_sample_sets;
+extern int stats_sample_unique;
 extern int stats_uniques_saved;
 extern long stats_size_list_avg;
 //extern uint32_t stats_files_count;
@@ -88,6 +91,7 @@ extern int stats_hashlist_path_realloc;
 extern int stats_hash_list_len_inc;
 extern int scan_list_usage_max;
 extern int scan_list_resizes;
+extern int stats_dirs_reused;
 extern uint64_t stats_read_buffers_allocated;
 extern int stats_flusher_active;
 extern uint32_t stats_fiemap_total_blocks;
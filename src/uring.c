@@ -0,0 +1,247 @@
+/*
+  Copyright 2021 Jyri J. Virkki <jyri@virkki.com>
+
+  This file is part of dupd.
+
+  dupd is free software: you can redistribute it and/or modify it
+  under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  dupd is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with dupd.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifdef USE_IO_URING
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include "main.h"
+#include "uring.h"
+#include "utils.h"
+
+#define load_acquire(p) __atomic_load_n(p, __ATOMIC_ACQUIRE)
+#define store_release(p, v) __atomic_store_n(p, v, __ATOMIC_RELEASE)
+
+
+/** ***************************************************************************
+ * Public function, see uring.h
+ *
+ */
+int uring_init(struct uring * ring, unsigned entries)
+{
+  struct io_uring_params p;
+
+  memset(ring, 0, sizeof(struct uring));
+  memset(&p, 0, sizeof(p));
+
+  ring->fd = syscall(__NR_io_uring_setup, entries, &p);
+  if (ring->fd < 0) {
+    LOG(L_INFO, "io_uring not available, using synchronous calls\n");
+    return -1;
+  }
+
+  ring->entries = p.sq_entries;
+  ring->sq_size = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+  ring->cq_size = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+
+  if (p.features & IORING_FEAT_SINGLE_MMAP) {
+    if (ring->cq_size > ring->sq_size) { ring->sq_size = ring->cq_size; }
+    ring->cq_size = ring->sq_size;
+  }
+
+  ring->sq_ptr = mmap(0, ring->sq_size, PROT_READ | PROT_WRITE,
+                      MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQ_RING);
+  if (ring->sq_ptr == MAP_FAILED) {                          // LCOV_EXCL_START
+    close(ring->fd);
+    return -1;
+  }                                                          // LCOV_EXCL_STOP
+
+  if (p.features & IORING_FEAT_SINGLE_MMAP) {
+    ring->cq_ptr = ring->sq_ptr;
+  } else {
+    ring->cq_ptr = mmap(0, ring->cq_size, PROT_READ | PROT_WRITE,
+                        MAP_SHARED | MAP_POPULATE, ring->fd,
+                        IORING_OFF_CQ_RING);
+    if (ring->cq_ptr == MAP_FAILED) {                        // LCOV_EXCL_START
+      munmap(ring->sq_ptr, ring->sq_size);
+      close(ring->fd);
+      return -1;
+    }                                                        // LCOV_EXCL_STOP
+  }
+
+  ring->sqes_size = p.sq_entries * sizeof(struct io_uring_sqe);
+  ring->sqes = mmap(0, ring->sqes_size, PROT_READ | PROT_WRITE,
+                    MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQES);
+  if (ring->sqes == MAP_FAILED) {                            // LCOV_EXCL_START
+    if (ring->cq_ptr != ring->sq_ptr) { munmap(ring->cq_ptr, ring->cq_size); }
+    munmap(ring->sq_ptr, ring->sq_size);
+    close(ring->fd);
+    return -1;
+  }                                                          // LCOV_EXCL_STOP
+
+  char * sq = (char *)ring->sq_ptr;
+  ring->sq_head = (unsigned *)(sq + p.sq_off.head);
+  ring->sq_tail = (unsigned *)(sq + p.sq_off.tail);
+  ring->sq_mask = (unsigned *)(sq + p.sq_off.ring_mask);
+  ring->sq_array = (unsigned *)(sq + p.sq_off.array);
+  ring->sq_local_tail = *ring->sq_tail;
+
+  char * cq = (char *)ring->cq_ptr;
+  ring->cq_head = (unsigned *)(cq + p.cq_off.head);
+  ring->cq_tail = (unsigned *)(cq + p.cq_off.tail);
+  ring->cq_mask = (unsigned *)(cq + p.cq_off.ring_mask);
+  ring->cqes = (struct io_uring_cqe *)(cq + p.cq_off.cqes);
+
+  LOG(L_THREADS, "io_uring ring set up with %u entries\n", ring->entries);
+
+  return 0;
+}
+
+
+/** ***************************************************************************
+ * Public function, see uring.h
+ *
+ */
+void uring_free(struct uring * ring)
+{
+  if (ring->fd < 0) {
+    return;
+  }
+
+  munmap(ring->sqes, ring->sqes_size);
+  if (ring->cq_ptr != ring->sq_ptr) { munmap(ring->cq_ptr, ring->cq_size); }
+  munmap(ring->sq_ptr, ring->sq_size);
+  close(ring->fd);
+  ring->fd = -1;
+}
+
+
+/** ***************************************************************************
+ * Public function, see uring.h
+ *
+ */
+struct io_uring_sqe * uring_get_sqe(struct uring * ring)
+{
+  unsigned head = load_acquire(ring->sq_head);
+
+  if (ring->sq_local_tail - head >= ring->entries) {
+    return NULL;
+  }
+
+  unsigned index = ring->sq_local_tail & *ring->sq_mask;
+  struct io_uring_sqe * sqe = &ring->sqes[index];
+  ring->sq_array[index] = index;
+  ring->sq_local_tail++;
+
+  memset(sqe, 0, sizeof(struct io_uring_sqe));
+  return sqe;
+}
+
+
+/** ***************************************************************************
+ * Public function, see uring.h
+ *
+ */
+int uring_submit(struct uring * ring, unsigned wait_nr)
+{
+  unsigned flags = wait_nr > 0 ? IORING_ENTER_GETEVENTS : 0;
+  unsigned to_submit;
+  int submitted = 0;
+  int rv;
+
+  store_release(ring->sq_tail, ring->sq_local_tail);
+
+  // The kernel may consume fewer entries than asked for, keep going until
+  // it has taken all of them (the wait only happens once they're all in).
+  while (1) {
+    to_submit = uring_sq_pending(ring);
+    if (to_submit == 0 && wait_nr == 0) {
+      return submitted;
+    }
+
+    rv = syscall(__NR_io_uring_enter, ring->fd, to_submit, wait_nr,
+                 flags, NULL, 0);
+    if (rv < 0 && errno == EINTR) {
+      continue;
+    }
+    if (rv < 0) {                                            // LCOV_EXCL_START
+      LOG(L_PROGRESS, "io_uring_enter failed\n");
+      return -1;
+    }                                                        // LCOV_EXCL_STOP
+
+    ring->inflight += rv;
+    submitted += rv;
+
+    if ((unsigned)rv == to_submit) {
+      return submitted;
+    }
+
+    if (rv == 0) {                                           // LCOV_EXCL_START
+      LOG(L_PROGRESS, "io_uring_enter made no progress (%u queued)\n",
+          to_submit);
+      return -1;
+    }                                                        // LCOV_EXCL_STOP
+  }
+}
+
+
+/** ***************************************************************************
+ * Public function, see uring.h
+ *
+ */
+unsigned uring_sq_pending(struct uring * ring)
+{
+  return ring->sq_local_tail - load_acquire(ring->sq_head);
+}
+
+
+/** ***************************************************************************
+ * Public function, see uring.h
+ *
+ */
+void uring_drop_queued(struct uring * ring)
+{
+  ring->sq_local_tail = load_acquire(ring->sq_head);
+  store_release(ring->sq_tail, ring->sq_local_tail);
+}
+
+
+/** ***************************************************************************
+ * Public function, see uring.h
+ *
+ */
+struct io_uring_cqe * uring_peek_cqe(struct uring * ring)
+{
+  unsigned head = *ring->cq_head;
+
+  if (head == load_acquire(ring->cq_tail)) {
+    return NULL;
+  }
+
+  return &ring->cqes[head & *ring->cq_mask];
+}
+
+
+/** ***************************************************************************
+ * Public function, see uring.h
+ *
+ */
+void uring_cqe_seen(struct uring * ring)
+{
+  store_release(ring->cq_head, *ring->cq_head + 1);
+  ring->inflight--;
+}
+
+#endif
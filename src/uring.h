@@ -0,0 +1,171 @@
+/*
+  Copyright 2021 Jyri J. Virkki <jyri@virkki.com>
+
+  This file is part of dupd.
+
+  dupd is free software: you can redistribute it and/or modify it
+  under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  dupd is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with dupd.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef _DUPD_URING_H
+#define _DUPD_URING_H
+
+#ifdef USE_IO_URING
+
+#include <linux/io_uring.h>
+#include <stddef.h>
+#include <stdint.h>
+
+
+/** ***************************************************************************
+ * Minimal io_uring ring, set up directly with the io_uring syscalls so
+ * there is no dependency on liburing.
+ *
+ * A ring is not thread safe, each thread using io_uring sets up its own.
+ *
+ */
+struct uring {
+  int fd;
+  unsigned entries;
+  unsigned inflight;
+
+  unsigned * sq_head;
+  unsigned * sq_tail;
+  unsigned * sq_mask;
+  unsigned * sq_array;
+  struct io_uring_sqe * sqes;
+  unsigned sq_local_tail;
+
+  unsigned * cq_head;
+  unsigned * cq_tail;
+  unsigned * cq_mask;
+  struct io_uring_cqe * cqes;
+
+  void * sq_ptr;
+  size_t sq_size;
+  void * cq_ptr;
+  size_t cq_size;
+  size_t sqes_size;
+};
+
+
+/** ***************************************************************************
+ * Set up an io_uring ring.
+ *
+ * Parameters:
+ *    ring    - The ring to initialize.
+ *    entries - Size of the submission queue.
+ *
+ * Return: 0 on success, -1 if io_uring is not available (in which case
+ *         callers should fall back to synchronous calls).
+ *
+ */
+int uring_init(struct uring * ring, unsigned entries);
+
+
+/** ***************************************************************************
+ * Tear down a ring set up with uring_init().
+ *
+ * Parameters:
+ *    ring - The ring.
+ *
+ * Return: none
+ *
+ */
+void uring_free(struct uring * ring);
+
+
+/** ***************************************************************************
+ * Get a free submission queue entry. The entry is cleared, caller fills
+ * it in. It will be submitted on the next uring_submit().
+ *
+ * Parameters:
+ *    ring - The ring.
+ *
+ * Return: sqe or NULL if the submission queue is full.
+ *
+ */
+struct io_uring_sqe * uring_get_sqe(struct uring * ring);
+
+
+/** ***************************************************************************
+ * Submit all queued entries and optionally wait for completions. If the
+ * kernel takes only some of the entries, the rest are submitted again
+ * until all have been taken.
+ *
+ * Parameters:
+ *    ring    - The ring.
+ *    wait_nr - Wait until at least this many completions are available.
+ *
+ * Return: number of entries submitted, or -1 on error (or if the kernel
+ *         stops taking entries). On error, entries not taken are still
+ *         queued, see uring_sq_pending() and uring_drop_queued().
+ *
+ */
+int uring_submit(struct uring * ring, unsigned wait_nr);
+
+
+/** ***************************************************************************
+ * Number of queued entries the kernel has not consumed yet.
+ *
+ * Parameters:
+ *    ring - The ring.
+ *
+ * Return: number of entries.
+ *
+ */
+unsigned uring_sq_pending(struct uring * ring);
+
+
+/** ***************************************************************************
+ * Take back the queued entries the kernel has not consumed yet, e.g.
+ * after uring_submit() failed. Entries already submitted are not
+ * affected.
+ *
+ * Parameters:
+ *    ring - The ring.
+ *
+ * Return: none
+ *
+ */
+void uring_drop_queued(struct uring * ring);
+
+
+/** ***************************************************************************
+ * Get the next completion, if any. Once done with it, the caller must
+ * call uring_cqe_seen().
+ *
+ * Parameters:
+ *    ring - The ring.
+ *
+ * Return: cqe or NULL if no completions are available.
+ *
+ */
+struct io_uring_cqe * uring_peek_cqe(struct uring * ring);
+
+
+/** ***************************************************************************
+ * Mark the completion returned by uring_peek_cqe() as consumed.
+ *
+ * Parameters:
+ *    ring - The ring.
+ *
+ * Return: none
+ *
+ */
+void uring_cqe_seen(struct uring * ring);
+
+
+#endif
+
+#endif
@@ -17,7 +17,13 @@
   along with dupd.  If not, see <http://www.gnu.org/licenses/>.
 */
 
+#ifdef USE_DIRECT_IO
+#define _GNU_SOURCE // for O_DIRECT
+#endif
+
+#include <fcntl.h>
 #include <inttypes.h>
+#include <pthread.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -28,6 +34,10 @@
 #include <sys/types.h>
 #include <unistd.h>
 
+#ifdef USE_SYSFS
+#include <sys/sysmacros.h>
+#endif
+
 #include "main.h"
 #include "stats.h"
 #include "utils.h"
@@ -44,6 +54,12 @@
 #define DUPD_PAGESIZE (uint64_t)sysconf(_SC_PAGESIZE)
 #endif
 
+// Buffers for --direct-io reads which are not aligned, see read_direct()
+#define ALIGNED_POOL_MAX 16
+static char * aligned_pool[ALIGNED_POOL_MAX];
+static int aligned_pool_count = 0;
+static pthread_mutex_t aligned_pool_lock = PTHREAD_MUTEX_INITIALIZER;
+
 
 /** ***************************************************************************
  * Public function, see header file.
@@ -189,8 +205,8 @@ int read_entry_bytes(struct path_list_entry * entry, uint64_t filesize,
                      char * path, char * output,
                      uint64_t bytes, uint64_t skip, uint64_t * bytes_read)
 {
+  struct path_read_state * rs = pb_read_state(entry);
   *bytes_read = 0;
-  int fd = 0;
 
   if (bytes == 0) {
     printf("error: requested zero bytes from [%s] (skip=%" PRIu64 ")\n",
@@ -198,74 +214,277 @@ int read_entry_bytes(struct path_list_entry * entry, uint64_t filesize,
     exit(1);
   }
 
-  if (entry->fd != 0) {
-    fd = entry->fd;
-  } else {
-    int file = open(path, O_RDONLY);
-    if (file < 0) {                                          // LCOV_EXCL_START
-      LOG(L_PROGRESS, "Error opening [%s]\n", path);
-      s_files_cant_read++;
-      return -1;
-    }                                                        // LCOV_EXCL_STOP
-    fd = file;
-    update_open_files(1);
-    entry->file_pos = 0;
+  int fd = open_entry_fd(entry, path);
+  if (fd < 0) {
+    return -1;
   }
 
-  if (skip > 0) {
-    if (skip != entry->file_pos) {
-      uint64_t pos = lseek(fd, skip, SEEK_SET);
-      if (pos != skip) {                                     // LCOV_EXCL_START
-        LOG(L_PROGRESS, "Error seeking [%s]\n", path);
-        exit(1);
-      }                                                      // LCOV_EXCL_STOP
-      entry->file_pos = pos;
+  ssize_t got;
+
+  if (rs->direct) {
+    got = read_direct(fd, output, bytes, skip);
+
+  } else {
+    if (skip > 0) {
+      if (skip != rs->file_pos) {
+        uint64_t pos = lseek(fd, skip, SEEK_SET);
+        if (pos != skip) {                                   // LCOV_EXCL_START
+          LOG(L_PROGRESS, "Error seeking [%s]\n", path);
+          exit(1);
+        }                                                    // LCOV_EXCL_STOP
+        rs->file_pos = pos;
+      }
     }
-  }
 
-  ssize_t got = read(fd, output, bytes);
+    got = read(fd, output, bytes);
+  }
 
   if (got >= 0) {
     *bytes_read = got;
-    stats_total_bytes_read += *bytes_read;
-    entry->file_pos += *bytes_read;
+    __atomic_fetch_add(&stats_total_bytes_read, *bytes_read, __ATOMIC_RELAXED);
+    rs->file_pos += *bytes_read;
   } else {
-    s_files_cant_read++;
-    close(fd);
-    entry->fd = 0;
-    entry->file_pos = 0;
-    update_open_files(-1);
-    return -1;
+    __atomic_fetch_add(&s_files_cant_read, 1, __ATOMIC_RELAXED);
   }
 
-  // If all remaining files can be kept open, just do that
-  int remaining = s_files_processed -
-    s_files_completed_dups - s_files_completed_unique;
-  if (remaining < max_open_files) {
-    entry->fd = fd;
-    return 0;
-  }
+  release_entry_fd(entry, fd, filesize, bytes, skip, got < 0);
 
-  // If this is not the first pass (didn't start at pos 0)
-  // and there are file descriptors left, keep it open
-  if (skip > 0 && current_open_files < max_open_files) {
-    entry->fd = fd;
-    return 0;
+  return got < 0 ? -1 : 0;
+}
+
+
+/** ***************************************************************************
+ * Public function, see header file.
+ *
+ */
+int open_entry_fd(struct path_list_entry * entry, char * path)
+{
+  struct path_read_state * rs = pb_read_state(entry);
+
+  if (rs->fd != 0) {
+    return rs->fd;
   }
 
-  // If file is large and there are file descriptors left,
-  // keep it open.
-  if (filesize > bytes && current_open_files < max_open_files) {
-    entry->fd = fd;
-    return 0;
+  int direct;
+  int fd = open_data_file(path, &direct);
+  if (fd < 0) {                                              // LCOV_EXCL_START
+    LOG(L_PROGRESS, "Error opening [%s]\n", path);
+    __atomic_fetch_add(&s_files_cant_read, 1, __ATOMIC_RELAXED);
+    return -1;
+  }                                                          // LCOV_EXCL_STOP
+
+  update_open_files(1);
+  rs->file_pos = 0;
+  rs->direct = direct;
+
+  return fd;
+}
+
+
+/** ***************************************************************************
+ * Public function, see header file.
+ *
+ */
+void release_entry_fd(struct path_list_entry * entry, int fd,
+                      uint64_t filesize, uint64_t bytes, uint64_t skip,
+                      int failed)
+{
+  struct path_read_state * rs = entry->rs;
+
+  if (!failed) {
+    // If all remaining files can be kept open, just do that
+    int remaining = s_files_processed -
+      s_files_completed_dups - s_files_completed_unique;
+    if (remaining < max_open_files) {
+      rs->fd = fd;
+      return;
+    }
+
+    // If this is not the first pass (didn't start at pos 0)
+    // and there are file descriptors left, keep it open
+    if (skip > 0 && current_open_files < max_open_files) {
+      rs->fd = fd;
+      return;
+    }
+
+    // If file is large and there are file descriptors left,
+    // keep it open.
+    if (filesize > bytes && current_open_files < max_open_files) {
+      rs->fd = fd;
+      return;
+    }
   }
 
   update_open_files(-1);
   close(fd);
-  entry->fd = 0;
-  entry->file_pos = 0;
+  rs->fd = 0;
+  rs->file_pos = 0;
+}
 
-  return 0;
+
+/** ***************************************************************************
+ * Public function, see header file.
+ *
+ */
+int open_data_file(const char * path, int * direct)
+{
+  *direct = 0;
+
+#ifdef USE_DIRECT_IO
+  if (direct_io) {
+    int fd = open(path, O_RDONLY | O_DIRECT);
+    if (fd >= 0) {
+      *direct = 1;
+      return fd;
+    }
+    // Not all filesystems support O_DIRECT (e.g. tmpfs), read those normally
+  }
+#endif
+
+  return open(path, O_RDONLY);
+}
+
+
+/** ***************************************************************************
+ * Public function, see header file.
+ *
+ */
+char * alloc_aligned(uint64_t size)
+{
+  void * buffer = NULL;
+
+  if (posix_memalign(&buffer, DIRECT_IO_ALIGN, size) != 0) { // LCOV_EXCL_START
+    printf("error: unable to allocate aligned buffer of %" PRIu64 "\n", size);
+    exit(1);
+  }                                                          // LCOV_EXCL_STOP
+
+  return (char *)buffer;
+}
+
+
+/** ***************************************************************************
+ * Public function, see header file.
+ *
+ */
+char * get_aligned_buffer()
+{
+  char * buffer = NULL;
+
+  d_mutex_lock(&aligned_pool_lock, "get_aligned_buffer");
+  if (aligned_pool_count > 0) {
+    aligned_pool_count--;
+    buffer = aligned_pool[aligned_pool_count];
+  }
+  d_mutex_unlock(&aligned_pool_lock);
+
+  if (buffer == NULL) {
+    buffer = alloc_aligned(DIRECT_IO_BUFSIZE);
+  }
+
+  return buffer;
+}
+
+
+/** ***************************************************************************
+ * Public function, see header file.
+ *
+ */
+void put_aligned_buffer(char * buffer)
+{
+  d_mutex_lock(&aligned_pool_lock, "put_aligned_buffer");
+  if (aligned_pool_count < ALIGNED_POOL_MAX) {
+    aligned_pool[aligned_pool_count] = buffer;
+    aligned_pool_count++;
+    buffer = NULL;
+  }
+  d_mutex_unlock(&aligned_pool_lock);
+
+  free(buffer);
+}
+
+
+/** ***************************************************************************
+ * Public function, see header file.
+ *
+ */
+ssize_t read_direct(int fd, char * output, uint64_t bytes, uint64_t pos)
+{
+  uint64_t done = 0;
+
+  if (((uintptr_t)output | pos | bytes) % DIRECT_IO_ALIGN == 0) {
+    return pread(fd, output, bytes, pos);
+  }
+
+  // Read the aligned range containing the wanted bytes, a piece at a time.
+  // At the end of the file the read returns short, which is fine.
+  char * buffer = get_aligned_buffer();
+
+  while (done < bytes) {
+    uint64_t at = pos + done;
+    uint64_t start = at - at % DIRECT_IO_ALIGN;
+    uint64_t offset = at - start;
+    uint64_t want = offset + bytes - done;
+    if (want > DIRECT_IO_BUFSIZE) {
+      want = DIRECT_IO_BUFSIZE;
+    } else if (want % DIRECT_IO_ALIGN) {
+      want += DIRECT_IO_ALIGN - want % DIRECT_IO_ALIGN;
+    }
+
+    ssize_t got = pread(fd, buffer, want, start);
+    if (got < 0) {
+      put_aligned_buffer(buffer);
+      return -1;
+    }
+    if ((uint64_t)got <= offset) {
+      break;
+    }
+
+    uint64_t n = got - offset;
+    if (n > bytes - done) {
+      n = bytes - done;
+    }
+    memcpy(output + done, buffer + offset, n);
+    done += n;
+
+    if ((uint64_t)got < want) {
+      break;
+    }
+  }
+
+  put_aligned_buffer(buffer);
+  return done;
+}
+
+
+/** ***************************************************************************
+ * Public function, see header file.
+ *
+ */
+void prefetch_range(int fd, uint64_t pos, uint64_t len)
+{
+#ifdef FADVISE
+  posix_fadvise(fd, pos, len, POSIX_FADV_WILLNEED);
+#else
+  (void)fd;
+  (void)pos;
+  (void)len;
+#endif
+}
+
+
+/** ***************************************************************************
+ * Public function, see header file.
+ *
+ */
+void drop_cached_range(int fd, uint64_t pos, uint64_t len)
+{
+#ifdef FADVISE
+  posix_fadvise(fd, pos, len, POSIX_FADV_DONTNEED);
+#else
+  (void)fd;
+  (void)pos;
+  (void)len;
+#endif
 }
 
 
@@ -294,6 +513,59 @@ uint64_t total_ram()
 }
 
 
+#ifdef USE_SYSFS
+/** ***************************************************************************
+ * Read the rotational flag from the given sysfs file.
+ *
+ * Return: 1 if rotational, 0 if not, -1 if file not readable.
+ *
+ */
+static int read_rotational(const char * path)
+{
+  int rotational = -1;
+  FILE * fp = fopen(path, "r");
+
+  if (fp != NULL) {
+    if (fscanf(fp, "%d", &rotational) != 1) {
+      rotational = -1;
+    }
+    fclose(fp);
+  }
+
+  return rotational;
+}
+#endif
+
+
+/** ***************************************************************************
+ * Public function, see header file.
+ *
+ */
+int device_is_rotational(dev_t dev)
+{
+#ifdef USE_SYSFS
+  char path[80];
+  unsigned int maj = major(dev);
+  unsigned int min = minor(dev);
+
+  // Whole disks have the queue directory, partitions find it in the parent.
+  snprintf(path, sizeof(path),
+           "/sys/dev/block/%u:%u/queue/rotational", maj, min);
+  int rotational = read_rotational(path);
+  if (rotational < 0) {
+    snprintf(path, sizeof(path),
+             "/sys/dev/block/%u:%u/../queue/rotational", maj, min);
+    rotational = read_rotational(path);
+  }
+
+  return rotational;
+#else
+  (void)dev;
+  return -1;
+#endif
+}
+
+
 /** ***************************************************************************
  * Public function, see header file.
  *
@@ -392,12 +664,7 @@ void dump_block_list(const char * prefix, struct block_list * bl)
 struct block_list * get_block_info_from_path(char * path, ino_t inode,
                                              uint64_t size, void * map)
 {
-  if (using_fiemap && map == NULL) {
-    printf("error: using_fiemap but no map [%s]\n", path);
-    exit(1);
-  }
-
-  if (!using_fiemap) {
+  if (!using_fiemap || map == NULL) {
     return block_list_inode_only(inode, size);
   }
 
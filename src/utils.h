@@ -64,6 +64,23 @@
 #define LSTAT lstat
 #endif
 
+#ifdef __linux__
+#define FADVISE 1
+#endif
+
+#ifdef __sun__
+#define FADVISE 1
+#endif
+
+#ifdef __FreeBSD__
+#define FADVISE 1
+#endif
+
+// With --direct-io, reads must be aligned (buffer, offset and length)
+// to the device block size. 4K covers all current devices.
+#define DIRECT_IO_ALIGN 4096
+#define DIRECT_IO_BUFSIZE (1024 * 1024)
+
 struct block_list_entry {
   uint64_t start_pos;
   uint64_t len;
@@ -206,6 +223,138 @@ int read_entry_bytes(struct path_list_entry * entry, uint64_t filesize,
                      uint64_t bytes, uint64_t skip, uint64_t * bytes_read);
 
 
+/** ***************************************************************************
+ * Return a file descriptor for reading a path entry, opening the file
+ * unless it was kept open from a previous read.
+ *
+ * Parameters:
+ *    entry - Path entry of file to read.
+ *    path  - Path to file to read.
+ *
+ * Return: fd or -1 if the file can't be opened.
+ *
+ */
+int open_entry_fd(struct path_list_entry * entry, char * path);
+
+
+/** ***************************************************************************
+ * After a read using a fd from open_entry_fd(), either keep the file open
+ * for the next read of this entry or close it, depending on how many files
+ * can be kept open.
+ *
+ * Parameters:
+ *    entry    - Path entry of file which was read.
+ *    fd       - The fd from open_entry_fd().
+ *    filesize - Size of this file.
+ *    bytes    - Number of bytes requested.
+ *    skip     - Offset the read started from.
+ *    failed   - True if the read failed, the file is always closed.
+ *
+ * Return: none
+ *
+ */
+void release_entry_fd(struct path_list_entry * entry, int fd,
+                      uint64_t filesize, uint64_t bytes, uint64_t skip,
+                      int failed);
+
+
+/** ***************************************************************************
+ * Open a file for reading its data. With --direct-io the file is opened
+ * with O_DIRECT if the platform and filesystem allow it.
+ *
+ * Parameters:
+ *    path   - Path to file to open.
+ *    direct - Set to true if the file was opened with O_DIRECT.
+ *
+ * Return: fd or -1 if the file can't be opened.
+ *
+ */
+int open_data_file(const char * path, int * direct);
+
+
+/** ***************************************************************************
+ * Get a DIRECT_IO_BUFSIZE buffer aligned to DIRECT_IO_ALIGN from the pool
+ * of such buffers. Return it with put_aligned_buffer() when done.
+ *
+ * Return: the buffer.
+ *
+ */
+char * get_aligned_buffer();
+
+
+/** ***************************************************************************
+ * Return a buffer from get_aligned_buffer() to the pool.
+ *
+ * Parameters:
+ *    buffer - The buffer.
+ *
+ * Return: none
+ *
+ */
+void put_aligned_buffer(char * buffer);
+
+
+/** ***************************************************************************
+ * Allocate a buffer of the given size aligned to DIRECT_IO_ALIGN.
+ * Release it with free().
+ *
+ * Parameters:
+ *    size - Size of buffer.
+ *
+ * Return: the buffer.
+ *
+ */
+char * alloc_aligned(uint64_t size);
+
+
+/** ***************************************************************************
+ * Read from a file opened with O_DIRECT. Any offset, length and buffer
+ * can be given. If they are all suitably aligned the data is read
+ * directly into output, otherwise the aligned range around it is read
+ * into a pooled buffer and copied out.
+ *
+ * Parameters:
+ *    fd     - The file.
+ *    output - Store the data here.
+ *    bytes  - Read this many bytes (fewer if the file ends first).
+ *    pos    - Read from this file offset.
+ *
+ * Return: number of bytes read, or -1 on error.
+ *
+ */
+ssize_t read_direct(int fd, char * output, uint64_t bytes, uint64_t pos);
+
+
+/** ***************************************************************************
+ * Tell the kernel a range of a file will be read soon, so it can start
+ * reading it into the page cache. Does nothing where not supported.
+ *
+ * Parameters:
+ *    fd  - The file.
+ *    pos - Start of range.
+ *    len - Length of range.
+ *
+ * Return: none
+ *
+ */
+void prefetch_range(int fd, uint64_t pos, uint64_t len);
+
+
+/** ***************************************************************************
+ * Tell the kernel a range of a file won't be needed again, so its pages
+ * can be dropped from the page cache. Does nothing where not supported.
+ *
+ * Parameters:
+ *    fd  - The file.
+ *    pos - Start of range.
+ *    len - Length of range.
+ *
+ * Return: none
+ *
+ */
+void drop_cached_range(int fd, uint64_t pos, uint64_t len);
+
+
 /** ***************************************************************************
  * Return number of available cores on system.
  *
@@ -224,6 +373,19 @@ int cpu_cores();
 uint64_t total_ram();
 
 
+/** ***************************************************************************
+ * Check whether the disk holding the given device is rotational (a hard
+ * drive) as opposed to an SSD. Only known on Linux (from sysfs).
+ *
+ * Parameters:
+ *    dev - The device (st_dev).
+ *
+ * Return: 1 if rotational, 0 if not, -1 if not known.
+ *
+ */
+int device_is_rotational(dev_t dev);
+
+
 /** ***************************************************************************
  * Dump memory region to stdout, for debugging.
  *
@@ -302,6 +464,25 @@ static inline void d_cond_signal(pthread_cond_t * cond)
 }
 
 
+/** ***************************************************************************
+ * Wrapper for pthread_cond_broadcast, exit on failure.
+ *
+ * Parameters:
+ *    cond - condition variable
+ *
+ * Return: none
+ *
+ */
+static inline void d_cond_broadcast(pthread_cond_t * cond)
+{
+  int rv = pthread_cond_broadcast(cond);
+  if (rv != 0) {                                             // LCOV_EXCL_START
+    printf("error: pthread_cond_broadcast == %d\n", rv);
+    exit(1);
+  }                                                          // LCOV_EXCL_STOP
+}
+
+
 /** ***************************************************************************
  * Wrapper for pthread_mutex_lock, exit on failure.
  *
@@ -407,7 +588,7 @@ void * fiemap_alloc();
  *    path  - path to query
  *    inode - inode of this file, used if fiemap not used or not available
  *    size  - size of the file
- *    map   - as allocated by fiemap_alloc
+ *    map   - as allocated by fiemap_alloc, or NULL to skip fiemap
  *
  * Return: block_list with one or more blocks, must be free'd by caller
  *
@@ -0,0 +1,773 @@
+/*
+  Copyright 2021 Jyri J. Virkki <jyri@virkki.com>
+
+  This file is part of dupd.
+
+  dupd is free software: you can redistribute it and/or modify it
+  under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  dupd is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with dupd.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <errno.h>
+#include <inttypes.h>
+#include <signal.h>
+#include <sqlite3.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+#ifdef USE_INOTIFY
+#include <poll.h>
+#include <sys/inotify.h>
+#endif
+
+#include "dbops.h"
+#include "dirread.h"
+#include "exclude.h"
+#include "hash.h"
+#include "main.h"
+#include "scan.h"
+#include "utils.h"
+#include "watch.h"
+
+#ifdef USE_INOTIFY
+
+#define WATCH_MASK (IN_CREATE | IN_CLOSE_WRITE | IN_DELETE | \
+                    IN_MOVED_FROM | IN_MOVED_TO | IN_ONLYDIR)
+
+// After an event, wait this long for more before updating duplicates,
+// but don't hold off updates longer than WATCH_MAX_DELAY_MS.
+#define WATCH_SETTLE_MS 200
+#define WATCH_MAX_DELAY_MS 2000
+
+struct watch_file {
+  char hash[HASH_MAX_BUFSIZE];
+  char * path;
+};
+
+static volatile sig_atomic_t watch_stop = 0;
+static int inotify_fd = -1;
+static char * * wd_paths = NULL;
+static int wd_paths_size = 0;
+static int watched_dirs = 0;
+static int need_rescan = 0;
+static struct dir_reader reader;
+
+// The paths and sizes of all the files being watched are kept in an
+// in-memory database, along with the sizes which need to be updated.
+static sqlite3 * state = NULL;
+static sqlite3_stmt * stmt_get_size = NULL;
+static sqlite3_stmt * stmt_add_file = NULL;
+static sqlite3_stmt * stmt_forget_file = NULL;
+static sqlite3_stmt * stmt_mark_dirty = NULL;
+static sqlite3_stmt * stmt_paths_of_size = NULL;
+
+
+/** ***************************************************************************
+ * Signal handler to stop watching.
+ *
+ */
+static void stop_watching(int sig)
+{
+  (void)sig;
+  watch_stop = 1;
+}
+
+
+/** ***************************************************************************
+ * Prepare a statement on the state db.
+ *
+ */
+static sqlite3_stmt * state_prepare(const char * sql)
+{
+  sqlite3_stmt * statement = NULL;
+
+  int rv = sqlite3_prepare_v2(state, sql, -1, &statement, NULL);
+  rvchk(rv, SQLITE_OK, "Can't prepare statement: %s\n", state);
+
+  return statement;
+}
+
+
+/** ***************************************************************************
+ * Run a statement with no parameters on the state db.
+ *
+ */
+static void state_exec(const char * sql)
+{
+  sqlite3_stmt * statement = state_prepare(sql);
+
+  int rv = sqlite3_step(statement);
+  rvchk(rv, SQLITE_DONE, "Can't step: %s\n", state);
+
+  sqlite3_finalize(statement);
+}
+
+
+/** ***************************************************************************
+ * Run a statement on the state db for all paths under a directory.
+ *
+ */
+static void state_exec_prefix(const char * sql, const char * prefix)
+{
+  sqlite3_stmt * statement = state_prepare(sql);
+
+  sqlite3_bind_int(statement, 1, strlen(prefix));
+  sqlite3_bind_text(statement, 2, prefix, -1, SQLITE_STATIC);
+  int rv = sqlite3_step(statement);
+  rvchk(rv, SQLITE_DONE, "Can't step: %s\n", state);
+
+  sqlite3_finalize(statement);
+}
+
+
+/** ***************************************************************************
+ * Set up the state db.
+ *
+ */
+static void open_state()
+{
+  int rv = sqlite3_open(":memory:", &state);
+  rvchk(rv, SQLITE_OK, "Can't open state database: %s\n", state);
+
+  state_exec("CREATE TABLE files (path TEXT PRIMARY KEY, size INTEGER)");
+  state_exec("CREATE INDEX files_size ON files (size)");
+  state_exec("CREATE TABLE dirty (size INTEGER PRIMARY KEY)");
+
+  stmt_get_size = state_prepare("SELECT size FROM files WHERE path=?");
+  stmt_add_file = state_prepare("INSERT INTO files (path, size) "
+                                "VALUES (?, ?)");
+  stmt_forget_file = state_prepare("DELETE FROM files WHERE path=?");
+  stmt_mark_dirty = state_prepare("INSERT OR IGNORE INTO dirty (size) "
+                                  "VALUES (?)");
+  stmt_paths_of_size = state_prepare("SELECT path FROM files WHERE size=?");
+}
+
+
+/** ***************************************************************************
+ * Close the state db.
+ *
+ */
+static void close_state()
+{
+  sqlite3_finalize(stmt_get_size);
+  sqlite3_finalize(stmt_add_file);
+  sqlite3_finalize(stmt_forget_file);
+  sqlite3_finalize(stmt_mark_dirty);
+  sqlite3_finalize(stmt_paths_of_size);
+  sqlite3_close(state);
+  state = NULL;
+}
+
+
+/** ***************************************************************************
+ * Flag the files of this size as needing to be checked again.
+ *
+ */
+static void mark_dirty(uint64_t size)
+{
+  sqlite3_bind_int64(stmt_mark_dirty, 1, (sqlite3_int64)size);
+  int rv = sqlite3_step(stmt_mark_dirty);
+  rvchk(rv, SQLITE_DONE, "Can't mark size: %s\n", state);
+  sqlite3_reset(stmt_mark_dirty);
+}
+
+
+/** ***************************************************************************
+ * Stop tracking a file (if it was being tracked).
+ *
+ * Parameters:
+ *    path - Path of the file.
+ *
+ * Return: none
+ *
+ */
+static void forget_file(const char * path)
+{
+  uint64_t size = 0;
+  int found = 0;
+  int rv;
+
+  sqlite3_bind_text(stmt_get_size, 1, path, -1, SQLITE_STATIC);
+  if (sqlite3_step(stmt_get_size) == SQLITE_ROW) {
+    size = (uint64_t)sqlite3_column_int64(stmt_get_size, 0);
+    found = 1;
+  }
+  sqlite3_reset(stmt_get_size);
+
+  if (!found) {
+    return;
+  }
+
+  mark_dirty(size);
+
+  sqlite3_bind_text(stmt_forget_file, 1, path, -1, SQLITE_STATIC);
+  rv = sqlite3_step(stmt_forget_file);
+  rvchk(rv, SQLITE_DONE, "Can't forget file: %s\n", state);
+  sqlite3_reset(stmt_forget_file);
+}
+
+
+/** ***************************************************************************
+ * Start tracking a file, or update it if already tracked.
+ *
+ * Parameters:
+ *    path - Path of the file.
+ *    info - Current stat info of the file.
+ *
+ * Return: none
+ *
+ */
+static void track_file(const char * path, STRUCT_STAT * info)
+{
+  uint64_t size = (uint64_t)info->st_size;
+  int rv;
+
+  forget_file(path);
+
+  if (!S_ISREG(info->st_mode) || size < minimum_file_size) {
+    return;
+  }
+
+  sqlite3_bind_text(stmt_add_file, 1, path, -1, SQLITE_STATIC);
+  sqlite3_bind_int64(stmt_add_file, 2, (sqlite3_int64)size);
+  rv = sqlite3_step(stmt_add_file);
+  rvchk(rv, SQLITE_DONE, "Can't add file: %s\n", state);
+  sqlite3_reset(stmt_add_file);
+
+  mark_dirty(size);
+}
+
+
+/** ***************************************************************************
+ * A file was created or changed.
+ *
+ */
+static void update_file(const char * path)
+{
+  STRUCT_STAT info;
+
+  if (get_file_info(path, &info)) {
+    forget_file(path);
+    return;
+  }
+
+  track_file(path, &info);
+}
+
+
+/** ***************************************************************************
+ * Build the path of an entry in a directory.
+ *
+ */
+static void entry_path(char * buf, const char * dir, const char * name)
+{
+  int len = strlen(dir);
+
+  if (len > 0 && dir[len - 1] == '/') {
+    snprintf(buf, DUPD_PATH_MAX, "%s%s", dir, name);
+  } else {
+    snprintf(buf, DUPD_PATH_MAX, "%s/%s", dir, name);
+  }
+}
+
+
+/** ***************************************************************************
+ * Returns true if this directory entry is not of interest.
+ *
+ */
+static int skip_entry(const char * name)
+{
+  if (name[0] == '.') {
+    if (!scan_hidden) { return 1; }
+    if (name[1] == 0) { return 1; }
+    if (name[1] == '.' && name[2] == 0) { return 1; }
+  }
+
+  // As in scan, names containing the path_separator can't be saved.
+  if (strchr(name, path_separator)) { return 1; }
+
+  return 0;
+}
+
+
+/** ***************************************************************************
+ * Add an inotify watch on a directory.
+ *
+ */
+static void watch_dir(const char * path)
+{
+  int wd = inotify_add_watch(inotify_fd, path, WATCH_MASK);
+  if (wd < 0) {
+    LOG(L_PROGRESS, "warning: unable to watch [%s]: %s\n",
+        path, strerror(errno));
+    return;
+  }
+
+  if (wd >= wd_paths_size) {
+    int old_size = wd_paths_size;
+    wd_paths_size = wd + K4;
+    wd_paths = (char * *)realloc(wd_paths, wd_paths_size * sizeof(char *));
+    memset(wd_paths + old_size, 0, (wd_paths_size - old_size) * sizeof(char *));
+  }
+
+  if (wd_paths[wd] == NULL) {
+    watched_dirs++;
+  } else {
+    free(wd_paths[wd]);
+  }
+  wd_paths[wd] = strdup(path);
+}
+
+
+/** ***************************************************************************
+ * Stop watching a directory.
+ *
+ */
+static void unwatch_dir(int wd)
+{
+  inotify_rm_watch(inotify_fd, wd);
+  free(wd_paths[wd]);
+  wd_paths[wd] = NULL;
+  watched_dirs--;
+}
+
+
+/** ***************************************************************************
+ * Watch a directory tree and track all the files in it.
+ *
+ * The watch on each directory is added before reading it so no files
+ * created in the meantime are missed.
+ *
+ * Parameters:
+ *    path - Top of the directory tree.
+ *
+ * Return: none
+ *
+ */
+static void add_tree(const char * path)
+{
+  STRUCT_STAT info;
+  char newpath[DUPD_PATH_MAX];
+  int capacity = 64;
+  int top = 0;
+  char * * stack = (char * *)malloc(capacity * sizeof(char *));
+
+  stack[top++] = strdup(path);
+
+  while (top > 0) {
+    char * dir = stack[--top];
+    watch_dir(dir);
+
+    if (dir_reader_open(&reader, dir) == 0) {
+      while (dir_reader_next(&reader)) {
+        if (skip_entry(reader.name)) {
+          continue;
+        }
+        entry_path(newpath, dir, reader.name);
+        if (have_excludes() && is_excluded(newpath, reader.name)) {
+          continue;
+        }
+        if (get_file_info(newpath, &info)) {
+          continue;
+        }
+        if (S_ISDIR(info.st_mode)) {
+          if (top == capacity) {
+            capacity *= 2;
+            stack = (char * *)realloc(stack, capacity * sizeof(char *));
+          }
+          stack[top++] = strdup(newpath);
+        } else {
+          track_file(newpath, &info);
+        }
+      }
+      dir_reader_close(&reader);
+    }
+
+    free(dir);
+  }
+
+  free(stack);
+}
+
+
+/** ***************************************************************************
+ * A directory tree was removed (or moved away).
+ *
+ * Parameters:
+ *    path - Top of the directory tree.
+ *
+ * Return: none
+ *
+ */
+static void forget_tree(const char * path)
+{
+  char prefix[DUPD_PATH_MAX + 1];
+  int len;
+
+  snprintf(prefix, DUPD_PATH_MAX + 1, "%s/", path);
+  len = strlen(prefix);
+
+  state_exec_prefix("INSERT OR IGNORE INTO dirty (size) SELECT DISTINCT size "
+                    "FROM files WHERE substr(path, 1, ?) = ?", prefix);
+  state_exec_prefix("DELETE FROM files WHERE substr(path, 1, ?) = ?", prefix);
+
+  for (int wd = 0; wd < wd_paths_size; wd++) {
+    if (wd_paths[wd] != NULL &&
+        (!strcmp(wd_paths[wd], path) || !strncmp(wd_paths[wd], prefix, len))) {
+      unwatch_dir(wd);
+    }
+  }
+}
+
+
+/** ***************************************************************************
+ * Start over from scratch, used if inotify events were lost.
+ *
+ */
+static void rescan_all()
+{
+  LOG(L_BASE, "Change events were lost, rescanning all paths\n");
+
+  state_exec("INSERT OR IGNORE INTO dirty (size) "
+             "SELECT DISTINCT size FROM files");
+  state_exec("DELETE FROM files");
+
+  for (int wd = 0; wd < wd_paths_size; wd++) {
+    if (wd_paths[wd] != NULL) {
+      unwatch_dir(wd);
+    }
+  }
+
+  for (int i = 0; start_path[i] != NULL; i++) {
+    add_tree(start_path[i]);
+  }
+
+  need_rescan = 0;
+}
+
+
+/** ***************************************************************************
+ * Update the state for one inotify event.
+ *
+ */
+static void handle_event(struct inotify_event * event)
+{
+  char path[DUPD_PATH_MAX];
+
+  if (event->mask & IN_Q_OVERFLOW) {
+    need_rescan = 1;
+    return;
+  }
+
+  if (event->wd < 0 || event->wd >= wd_paths_size ||
+      wd_paths[event->wd] == NULL) {
+    return;
+  }
+
+  if (event->mask & IN_IGNORED) {
+    free(wd_paths[event->wd]);
+    wd_paths[event->wd] = NULL;
+    watched_dirs--;
+    return;
+  }
+
+  if (event->len == 0 || skip_entry(event->name)) {
+    return;
+  }
+
+  entry_path(path, wd_paths[event->wd], event->name);
+  if (have_excludes() && is_excluded(path, event->name)) {
+    return;
+  }
+  LOG(L_FILES, "Event %x [%s]\n", event->mask, path);
+
+  if (event->mask & IN_ISDIR) {
+    if (event->mask & (IN_DELETE | IN_MOVED_FROM)) {
+      forget_tree(path);
+    }
+    if (event->mask & (IN_CREATE | IN_MOVED_TO)) {
+      add_tree(path);
+    }
+  } else {
+    if (event->mask & (IN_DELETE | IN_MOVED_FROM)) {
+      forget_file(path);
+    }
+    if (event->mask & (IN_CREATE | IN_CLOSE_WRITE | IN_MOVED_TO)) {
+      update_file(path);
+    }
+  }
+}
+
+
+/** ***************************************************************************
+ * Compare watch_file entries by hash, for qsort.
+ *
+ */
+static int watch_file_cmp(const void * a, const void * b)
+{
+  return memcmp(((struct watch_file *)a)->hash,
+                ((struct watch_file *)b)->hash, hash_bufsize);
+}
+
+
+/** ***************************************************************************
+ * Recompute the duplicate sets of the files of one size.
+ *
+ * Parameters:
+ *    dbh  - Database handle.
+ *    size - The file size.
+ *
+ * Return: number of duplicate sets of this size.
+ *
+ */
+static int update_size(sqlite3 * dbh, uint64_t size)
+{
+  struct watch_file * files = NULL;
+  int capacity = 0;
+  int count = 0;
+  int hashed = 0;
+  int sets = 0;
+  int cacheable = use_hash_cache && size > cache_min_size;
+
+  delete_duplicates_of_size(dbh, size);
+
+  sqlite3_bind_int64(stmt_paths_of_size, 1, (sqlite3_int64)size);
+  while (sqlite3_step(stmt_paths_of_size) == SQLITE_ROW) {
+    if (count == capacity) {
+      capacity = capacity == 0 ? 16 : capacity * 2;
+      files = (struct watch_file *)realloc(files,
+                                           capacity * sizeof(struct watch_file));
+    }
+    files[count].path =
+      strdup((char *)sqlite3_column_text(stmt_paths_of_size, 0));
+    count++;
+  }
+  sqlite3_reset(stmt_paths_of_size);
+
+  LOG(L_INFO, "Checking %d files of size %" PRIu64 "\n", count, size);
+
+  if (count < 2) {
+    hashed = count;
+    goto DONE;
+  }
+
+  for (int i = 0; i < count; i++) {
+    char * path = files[i].path;
+    STRUCT_STAT info;
+
+    // The file may have been removed or changed since its last event was
+    // read. Catch up with it now, its new size (if any) gets its own turn.
+    if (get_file_info(path, &info) || !S_ISREG(info.st_mode) ||
+        (uint64_t)info.st_size != size) {
+      LOG(L_INFO, "Changed since last seen, skipping [%s]\n", path);
+      update_file(path);
+      free(path);
+      continue;
+    }
+
+    if (!cacheable ||
+        cache_db_find_entry(path, files[i].hash) != CACHE_HASH_FOUND) {
+      if (hash_fn(path, files[i].hash, 0, 0, 0)) {
+        LOG(L_PROGRESS, "warning: unable to hash [%s]\n", path);
+        free(path);
+        continue;
+      }
+      if (cacheable) {
+        cache_db_add_entry(path, files[i].hash, hash_bufsize);
+      }
+    }
+
+    files[hashed++] = files[i];
+  }
+
+  qsort(files, hashed, sizeof(struct watch_file), watch_file_cmp);
+
+  int start = 0;
+  while (start < hashed) {
+    int end = start + 1;
+    int len = strlen(files[start].path) + 1;
+    while (end < hashed && !watch_file_cmp(&files[start], &files[end])) {
+      len += strlen(files[end].path) + 1;
+      end++;
+    }
+
+    if (end - start > 1) {
+      char * paths = (char *)malloc(len);
+      int pos = 0;
+      for (int i = start; i < end; i++) {
+        pos += sprintf(paths + pos, "%s%c", files[i].path, path_separator);
+      }
+      paths[pos - 1] = 0;
+      duplicate_to_db(dbh, end - start, size, paths);
+      free(paths);
+      sets++;
+    }
+
+    start = end;
+  }
+
+ DONE:
+  for (int i = 0; i < hashed; i++) {
+    free(files[i].path);
+  }
+  if (files != NULL) {
+    free(files);
+  }
+
+  return sets;
+}
+
+
+/** ***************************************************************************
+ * Recompute the duplicate sets of all the sizes affected by changes.
+ *
+ */
+static void process_dirty(sqlite3 * dbh)
+{
+  uint64_t * sizes = NULL;
+  int capacity = 0;
+  int count = 0;
+  int sets = 0;
+
+  if (need_rescan) {
+    rescan_all();
+  }
+
+  sqlite3_stmt * statement = state_prepare("SELECT size FROM dirty");
+  while (sqlite3_step(statement) == SQLITE_ROW) {
+    if (count == capacity) {
+      capacity = capacity == 0 ? 64 : capacity * 2;
+      sizes = (uint64_t *)realloc(sizes, capacity * sizeof(uint64_t));
+    }
+    sizes[count++] = (uint64_t)sqlite3_column_int64(statement, 0);
+  }
+  sqlite3_finalize(statement);
+  state_exec("DELETE FROM dirty");
+
+  begin_transaction(dbh);
+  for (int i = 0; i < count; i++) {
+    sets += update_size(dbh, sizes[i]);
+  }
+  commit_transaction(dbh);
+
+  LOG(L_BASE, "Updated %d file sizes, %d duplicate sets\n", count, sets);
+
+  if (sizes != NULL) {
+    free(sizes);
+  }
+}
+
+
+/** ***************************************************************************
+ * Public function, see watch.h
+ *
+ */
+int operation_watch()
+{
+  char buf[K64] __attribute__ ((aligned(__alignof__(struct inotify_event))));
+  struct pollfd pfd;
+  long pending_since = 0;
+
+  inotify_fd = inotify_init1(IN_CLOEXEC);
+  if (inotify_fd < 0) {                                      // LCOV_EXCL_START
+    printf("error: unable to initialize inotify: %s\n", strerror(errno));
+    return 1;
+  }                                                          // LCOV_EXCL_STOP
+
+  // Start watching before the scan so any changes made while the scan
+  // runs are queued and handled once it completes.
+
+  open_state();
+  dir_reader_init(&reader);
+  for (int i = 0; start_path[i] != NULL; i++) {
+    add_tree(start_path[i]);
+  }
+  state_exec("DELETE FROM dirty");
+
+  scan();
+
+  sqlite3 * dbh = open_database(db_path, 0);
+  open_cache_database(cache_db_path);
+
+  signal(SIGINT, &stop_watching);
+  signal(SIGTERM, &stop_watching);
+
+  LOG(L_BASE, "Watching %d directories for changes\n", watched_dirs);
+
+  pfd.fd = inotify_fd;
+  pfd.events = POLLIN;
+
+  while (!watch_stop) {
+    int rv = poll(&pfd, 1, pending_since ? WATCH_SETTLE_MS : 1000);
+    if (rv < 0 && errno != EINTR) {                          // LCOV_EXCL_START
+      perror("poll");
+      break;
+    }                                                        // LCOV_EXCL_STOP
+
+    if (rv > 0) {
+      ssize_t len = read(inotify_fd, buf, sizeof(buf));
+      for (char * p = buf; len > 0 && p < buf + len; ) {
+        struct inotify_event * event = (struct inotify_event *)p;
+        handle_event(event);
+        p += sizeof(struct inotify_event) + event->len;
+      }
+      if (pending_since == 0) {
+        pending_since = get_current_time_millis();
+      }
+    }
+
+    if (pending_since > 0 &&
+        (rv == 0 ||
+         get_current_time_millis() - pending_since > WATCH_MAX_DELAY_MS)) {
+      process_dirty(dbh);
+      pending_since = 0;
+    }
+  }
+
+  LOG(L_BASE, "Stopped watching\n");
+
+  close_database(dbh);
+  close_cache_database();
+  close_state();
+  dir_reader_free(&reader);
+
+  for (int wd = 0; wd < wd_paths_size; wd++) {
+    if (wd_paths[wd] != NULL) {
+      free(wd_paths[wd]);
+    }
+  }
+  free(wd_paths);
+  wd_paths = NULL;
+  wd_paths_size = 0;
+
+  close(inotify_fd);
+  inotify_fd = -1;
+
+  return 0;
+}
+
+#else
+
+/** ***************************************************************************
+ * Public function, see watch.h
+ *
+ */
+int operation_watch()
+{
+  printf("error: watch is not supported on this platform\n");
+  return 1;
+}
+
+#endif
@@ -0,0 +1,38 @@
+/*
+  Copyright 2021 Jyri J. Virkki <jyri@virkki.com>
+
+  This file is part of dupd.
+
+  dupd is free software: you can redistribute it and/or modify it
+  under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  dupd is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with dupd.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef _DUPD_WATCH_H
+#define _DUPD_WATCH_H
+
+
+/** ***************************************************************************
+ * Scan the start paths, then keep watching them for changes and keep the
+ * duplicates table (and hash cache) current as files are added, changed
+ * or removed. Only the files of the sizes affected by a change are
+ * hashed again. Runs until interrupted (SIGINT or SIGTERM).
+ *
+ * Parameters: none
+ *
+ * Return: 0 on clean exit, 1 if watching is not possible.
+ *
+ */
+int operation_watch();
+
+
+#endif